@@ -40,13 +40,13 @@ function renderRelays() {
     }
     
     container.innerHTML = relaysData.map(relay => `
-        <div class="relay-card ${relay.state ? 'active' : ''}" data-relay-id="${relay.id}">
+        <div class="relay-card ${relay.state ? 'active' : ''}" data-relay-id="${relay.id}"${relay.active === false ? ' style="opacity: 0.5;" title="Not exposed to Home Assistant"' : ''}>
             <div class="relay-header">
                 <span class="relay-name">${relay.name}</span>
                 <span class="relay-id">R${relay.id}</span>
             </div>
             <div class="relay-info">
-                <span>GPIO Pin: ${relay.pin}</span>
+                <span>${relay.pin !== undefined ? `GPIO Pin: ${relay.pin}` : `Output ${relay.id}`}</span>
                 <span class="relay-state ${relay.state ? 'on' : 'off'}">
                     ${relay.state ? 'ON' : 'OFF'}
                 </span>
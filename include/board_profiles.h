@@ -0,0 +1,144 @@
+#ifndef BOARD_PROFILES_H
+#define BOARD_PROFILES_H
+
+#include <stdint.h>
+
+/*
+ * Relay Board Profiles
+ *
+ * Each profile is a type with constexpr members only:
+ *   MODEL          - reported to Home Assistant
+ *   RELAY_COUNT    - number of channels
+ *   ACTIVE_LOW     - true if a LOW output energises the relay
+ *   BACKEND        - output backend (output_backends.h)
+ *   NAMES[]        - default relay names
+ *   DEFAULT_ON[]   - state applied by init() (before saved states are restored)
+ *
+ * plus the backend's wiring:
+ *   BACKEND_GPIO      PINS[]                   - GPIO per relay
+ *   BACKEND_MCP23017  SDA_PIN, SCL_PIN,
+ *                     I2C_FREQUENCY,
+ *                     MCP_BASE_ADDRESS         - 16 relays per chip
+ *   BACKEND_74HC595   SCK_PIN, MOSI_PIN,
+ *                     LATCH_PIN, OE_PIN (-1 = tied low),
+ *                     SPI_FREQUENCY            - 8 relays per register
+ *
+ * RelayControl is instantiated for one profile, selected per PlatformIO
+ * environment with -D RELAY_BOARD=<profile> (see platformio.ini).
+ * To add a board, copy a profile below and adjust it.
+ */
+
+enum OutputKind {
+    BACKEND_GPIO,      // Relay inputs wired to ESP32 GPIOs
+    BACKEND_MCP23017,  // MCP23017 I2C expanders
+    BACKEND_74HC595    // Chained 74HC595 shift registers on SPI
+};
+
+// "Relay 1" .. "Relay N", generated at compile time for large boards
+template <int N>
+struct RelayNames {
+    char text[N][12];
+
+    constexpr RelayNames() : text() {
+        for (int i = 0; i < N; i++) {
+            const char prefix[] = "Relay ";
+            int p = 0;
+            for (; prefix[p]; p++) {
+                text[i][p] = prefix[p];
+            }
+            char digits[4] = {};
+            int d = 0;
+            for (int n = i + 1; n > 0; n /= 10) {
+                digits[d++] = '0' + n % 10;
+            }
+            while (d > 0) {
+                text[i][p++] = digits[--d];
+            }
+        }
+    }
+
+    constexpr const char* operator[](int i) const { return text[i]; }
+};
+
+// Original 16-channel board, active-high inputs
+struct RelayBoard16 {
+    static constexpr const char* MODEL = "16-Channel Relay Controller";
+    static constexpr int RELAY_COUNT = 16;
+    static constexpr bool ACTIVE_LOW = false;
+    static constexpr OutputKind BACKEND = BACKEND_GPIO;
+    
+    static constexpr uint8_t PINS[RELAY_COUNT] = {
+        13, 12, 14, 27, 26, 25, 33, 32,
+        2, 4, 16, 17, 18, 19, 21, 22
+    };
+    
+    static constexpr const char* NAMES[RELAY_COUNT] = {
+        "Relay 1", "Relay 2", "Relay 3", "Relay 4",
+        "Relay 5", "Relay 6", "Relay 7", "Relay 8",
+        "Relay 9", "Relay 10", "Relay 11", "Relay 12",
+        "Relay 13", "Relay 14", "Relay 15", "Relay 16"
+    };
+    
+    static constexpr bool DEFAULT_ON[RELAY_COUNT] = {};  // All OFF
+};
+
+// Common opto-isolated 8-channel module (IN1..IN8 pulled low to switch)
+// Uses no strapping pins
+struct RelayBoard8Low {
+    static constexpr const char* MODEL = "8-Channel Relay Controller";
+    static constexpr int RELAY_COUNT = 8;
+    static constexpr bool ACTIVE_LOW = true;
+    static constexpr OutputKind BACKEND = BACKEND_GPIO;
+    
+    static constexpr uint8_t PINS[RELAY_COUNT] = {
+        16, 17, 18, 19, 21, 22, 23, 25
+    };
+    
+    static constexpr const char* NAMES[RELAY_COUNT] = {
+        "Relay 1", "Relay 2", "Relay 3", "Relay 4",
+        "Relay 5", "Relay 6", "Relay 7", "Relay 8"
+    };
+    
+    static constexpr bool DEFAULT_ON[RELAY_COUNT] = {};  // All OFF
+};
+
+// 64 relays on four MCP23017 (A2..A0 = 000..011), active-low relay inputs
+struct RelayBoard64Mcp {
+    static constexpr const char* MODEL = "64-Channel Relay Controller (MCP23017)";
+    static constexpr int RELAY_COUNT = 64;
+    static constexpr bool ACTIVE_LOW = true;
+    static constexpr OutputKind BACKEND = BACKEND_MCP23017;
+    
+    static constexpr int SDA_PIN = 21;
+    static constexpr int SCL_PIN = 22;
+    static constexpr uint32_t I2C_FREQUENCY = 400000;
+    static constexpr uint8_t MCP_BASE_ADDRESS = 0x20;
+    
+    static constexpr RelayNames<RELAY_COUNT> NAMES{};
+    static constexpr bool DEFAULT_ON[RELAY_COUNT] = {};  // All OFF
+};
+
+// 128 relays on sixteen chained 74HC595 (VSPI pins), active-high relay inputs
+struct RelayBoard128Shift {
+    static constexpr const char* MODEL = "128-Channel Relay Controller (74HC595)";
+    static constexpr int RELAY_COUNT = 128;
+    static constexpr bool ACTIVE_LOW = false;
+    static constexpr OutputKind BACKEND = BACKEND_74HC595;
+    
+    static constexpr int SCK_PIN = 18;
+    static constexpr int MOSI_PIN = 23;
+    static constexpr int LATCH_PIN = 5;
+    static constexpr int OE_PIN = 4;
+    static constexpr uint32_t SPI_FREQUENCY = 4000000;
+    
+    static constexpr RelayNames<RELAY_COUNT> NAMES{};
+    static constexpr bool DEFAULT_ON[RELAY_COUNT] = {};  // All OFF
+};
+
+#ifndef RELAY_BOARD
+#define RELAY_BOARD RelayBoard16
+#endif
+
+typedef RELAY_BOARD ActiveBoard;
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef COMMAND_TRACE_H
+#define COMMAND_TRACE_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+/*
+ * Command Latency Tracing
+ *
+ * Every relay command (MQTT, HTTP) and RF trigger gets a trace record with
+ * micros() timestamps at each stage:
+ *   received   - MQTT callback / HTTP handler / RF frame decoded
+ *   dispatched - command parsed and routed to a relay (or RF slot matched)
+ *   gpio       - relay output written (not for RF)
+ *   published  - confirming /state publish sent
+ *
+ * Records live in a fixed ring (COMMAND_TRACE_ENTRIES), nothing allocates.
+ * /api/debug/trace reports p50/p90/p99/max per source and stage, plus the
+ * most recent records.
+ *
+ * A command can carry a correlation id: {"state":"ON","cid":"abc"} on
+ * /set or "cid" in the /api/relay body. The id and stage timings are then
+ * published on <prefix><hostname>/relay<N>/trace, so a client can measure
+ * the full round trip. It goes on a sibling topic because the /state
+ * payload has to stay plain ON/OFF for Home Assistant. HTTP traces are
+ * queued and published by loop(), which owns the MQTT client.
+ */
+
+enum TraceSource {
+    TRACE_MQTT = 0,
+    TRACE_HTTP,
+    TRACE_RF,
+    TRACE_SOURCE_COUNT
+};
+
+enum TraceStage {
+    TRACE_RECEIVED = 0,
+    TRACE_DISPATCHED,
+    TRACE_GPIO,
+    TRACE_PUBLISHED,
+    TRACE_STAGE_COUNT
+};
+
+#define TRACE_ID_LEN 24  // Correlation id incl. terminator - longer ids are truncated
+
+struct CommandTrace {
+    uint32_t id;                          // 0 = slot never used
+    uint8_t source;                       // TraceSource
+    uint8_t target;                       // Relay index or RF slot
+    bool state;
+    std::atomic<bool> complete;           // Set once the publish stage is stamped
+    uint32_t stamps[TRACE_STAGE_COUNT];   // micros(), 0 = stage not reached
+    char correlationId[TRACE_ID_LEN];
+
+    // Microseconds from receive to a stage, or -1 if the stage wasn't reached
+    long offset(int stage) const {
+        return stamps[stage] ? (long)(stamps[stage] - stamps[TRACE_RECEIVED]) : -1;
+    }
+};
+
+class CommandTracer {
+private:
+    CommandTrace entries[COMMAND_TRACE_ENTRIES];
+    std::atomic<uint32_t> nextId;
+
+public:
+    CommandTracer();
+
+    // Claims the next ring slot; receivedMicros is the receive stamp
+    CommandTrace* begin(TraceSource source, int target, bool state, uint32_t receivedMicros,
+                        const char* correlationId = nullptr);
+
+    static void mark(CommandTrace* trace, TraceStage stage) {
+        if (trace) trace->stamps[stage] = micros();
+    }
+
+    // Stamps the publish stage and makes the record visible to readers
+    static void finish(CommandTrace* trace) {
+        if (!trace) return;
+        trace->stamps[TRACE_PUBLISHED] = micros();
+        trace->complete.store(true, std::memory_order_release);
+    }
+
+    static const char* sourceName(int source);
+    static const char* stageName(int stage);
+    void writeJson(Print& out, int recent) const;
+};
+
+extern CommandTracer commandTrace;
+
+#endif
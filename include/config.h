@@ -7,65 +7,155 @@
 #define AP_PASSWORD "12345678"
 
 // Relay Configuration
-#define NUM_RELAYS 16  // Change this to match your number of relays
-
-// Relay GPIO Pins (adjust these to match your hardware)
-static constexpr int RELAY_PINS[NUM_RELAYS] = {
-    13,  // Relay 1
-    12,  // Relay 2
-    14,  // Relay 3
-    27,  // Relay 4
-    26,  // Relay 5
-    25,  // Relay 6
-    33,  // Relay 7
-    32,  // Relay 8
-    2,   // Relay 9
-    4,   // Relay 10
-    16,  // Relay 11
-    17,  // Relay 12
-    18,  // Relay 13
-    19,  // Relay 14
-    21,  // Relay 15
-    22   // Relay 16
-};
-
-// Relay Names (customize as needed)
-static constexpr const char* RELAY_NAMES[NUM_RELAYS] = {
-    "Relay 1",
-    "Relay 2",
-    "Relay 3",
-    "Relay 4",
-    "Relay 5",
-    "Relay 6",
-    "Relay 7",
-    "Relay 8",
-    "Relay 9",
-    "Relay 10",
-    "Relay 11",
-    "Relay 12",
-    "Relay 13",
-    "Relay 14",
-    "Relay 15",
-    "Relay 16"
-};
+// Count, wiring, polarity and names come from the board profile selected with
+// -D RELAY_BOARD=... in platformio.ini (see board_profiles.h)
+#include "board_profiles.h"
+
+static constexpr int NUM_RELAYS = ActiveBoard::RELAY_COUNT;
+static constexpr const auto& RELAY_NAMES = ActiveBoard::NAMES;
 
 // MQTT Configuration
 #define MQTT_PORT 1883
 #define MQTT_TOPIC_PREFIX "homeassistant/switch/"
 #define MQTT_DISCOVERY_PREFIX "homeassistant"
+#define MQTT_PROBE_TIMEOUT 2  // Seconds per probe step (TCP connect / TLS handshake, CONNACK) - loop() waits on it
+
+// MQTT over TLS (mqtt_tls.h) - enabled from platformio.ini (env:esp32dev-tls).
+// The broker's CA certificate (PEM) goes in data/ as MQTT_TLS_CA_FILE, and
+// the MQTT port setting becomes the broker's TLS port (usually 8883)
+#ifndef MQTT_TLS
+#define MQTT_TLS 0
+#endif
+#define MQTT_TLS_CA_FILE "/mqtt_ca.pem"
+#define MQTT_TLS_SESSION_RTC 1              // 1 = the session also survives a software restart (RTC memory)
+#define MQTT_TLS_RTC_BYTES 2048             // Saved session incl. the broker certificate - larger stays in RAM only
+#define MQTT_TLS_HANDSHAKE_TIMEOUT_MS 10000 // TCP connect + handshake, and each write
+
+// Home Assistant discovery mode
+// false = one retained config per relay / RF code (classic, default)
+// true  = single device-based config listing all components in one message
+// Can be changed at runtime via POST /api/admin/discovery
+#define MQTT_DEVICE_DISCOVERY false
+#define MQTT_DEVICE_DISCOVERY_MAX_BYTES 32768  // Larger device documents (many relays) fall back to entity mode
+#define MQTT_STREAM_CHUNK 256                   // Socket write size for streamed JSON publishes (discovery)
+
+// Relay state topics
+// false = reconnects publish one retained message per relay (relay<N>/state)
+// true  = reconnects publish the whole bank as one retained message on
+//         <hostname>/state, e.g. {"relays":"1001"}; Home Assistant reads each
+//         relay through a value_template. relay<N>/state is still updated on
+//         every change for other clients.
+// Can be changed at runtime via POST /api/admin/discovery
+#define MQTT_AGGREGATE_STATE false
+
+// Group commands (group_commands.h)
+// Each device can join up to MQTT_GROUP_MAX groups (e.g. site, floor, zone)
+// and takes commands published once to <prefix><group>/set; acknowledgements
+// are aggregated and sent on <prefix><group>/ack after a random delay of up
+// to MQTT_GROUP_ACK_WINDOW_MS, so a large group doesn't answer all at once.
+// Configured at runtime via POST /api/admin/groups
+#define MQTT_GROUP_PREFIX "esp32-relay/group/"
+#define MQTT_GROUP_MAX 4
+#define MQTT_GROUP_NAME_LEN 24          // Incl. terminator
+#define MQTT_SCENE_MAX 8
+#define MQTT_SCENE_NAME_LEN 16          // Incl. terminator
+#define MQTT_SCENE_RELAYS 128           // Stored scene width - largest board
+#define MQTT_GROUP_ACK_WINDOW_MS 2000
+#define MQTT_GROUP_ACK_IDS 4            // Correlation ids listed per ack, further ones are only counted
+
+// Device info reported in Home Assistant discovery
+#define DEVICE_MANUFACTURER "ESP32"
+#define DEVICE_MODEL ActiveBoard::MODEL
+#define FIRMWARE_VERSION "1.2.0"
 
 // Web Server
 #define WEB_SERVER_PORT 80
+#define HTTP_BODY_MAX_BYTES 2048     // Larger POST bodies get 413 on their first chunk
+#define HTTP_BODY_SLOTS 4            // Bodies split across TCP segments assembled at once (503 when full)
+#define HTTP_BODY_TIMEOUT_MS 10000   // A slot idle this long can be taken by a new request (408 to its owner)
+
+// HTTP admission control (http_admission.h) - GETs are shed before POSTs
+#define HTTP_MAX_IN_FLIGHT 8            // Requests handled at once (lwIP has 10 sockets, MQTT needs one)
+#define HTTP_CONTROL_RESERVE_SLOTS 2    // The last slots only take POSTs (relay control, admin)
+#define HTTP_IN_FLIGHT_TIMEOUT_MS 30000 // A slot this old is reclaimed (disconnect never seen)
+#define HTTP_SHED_READ_HEAP 32768       // Free heap below which GETs get 503
+#define HTTP_SHED_CONTROL_HEAP 16384    // ... and POSTs
+#define HTTP_RATE_PER_SEC 5             // Token bucket per client IP
+#define HTTP_RATE_BURST 20
+#define HTTP_RATE_CONTROL_RESERVE 5     // GETs leave this many tokens for POSTs (429 below it)
+#define HTTP_RATE_CLIENTS 8             // Clients tracked; the one seen longest ago is replaced
+
+// UDP control protocol (udp_control.h) - off until a key is set with POST /api/admin/udp
+#define UDP_CONTROL 1                   // 0 = compile out
+#define UDP_CONTROL_PORT 4210
+#define UDP_CONTROL_CLIENTS 8           // Clients whose last reply is kept for retries; the one seen longest ago is replaced
 
 // mDNS hostname (will be accessible at http://esp32-relay.local)
 #define MDNS_HOSTNAME "esp32-relay"
 
 // WiFi Configuration Portal timeout (seconds)
 #define PORTAL_TIMEOUT 180
+#define WIFI_BOOT_CONNECT_TIMEOUT 20  // Seconds on the saved network at boot before the portal opens
+#define MDNS_RESTART_DEBOUNCE_MS 1000  // Reconnects / restart requests this close together restart mDNS once
+
+// WiFi / MQTT reconnection (reconnect_policy.h) - try changes in native/netsim first
+#define WIFI_CHECK_INTERVAL 5000        // Station checked this often once boot is done
+#define WIFI_RECONNECT_TIMEOUT 15000    // A reconnect attempt without an IP this long opens the AP
+#define WIFI_RECONNECT_INTERVAL 30000   // In AP mode without clients, the station retries this often
+#define MQTT_RETRY_INTERVAL 10000       // Broker connect attempts at most this often
 
 // RF Receiver Configuration
 #define RF_RECEIVER_PIN 15
 #define RF_TRIGGER_DURATION 2000  // 2 seconds in milliseconds
 
+// RF decoding (pulse_decoder.h, rf_receiver.h)
+#define RF_DECODER_RMT 1                // 0 = rc-switch edge interrupt instead of RMT captures
+#define RF_SEPARATION_LIMIT_US 4300     // Longer pulses are gaps between frames (as rc-switch)
+#define RF_PULSE_TOLERANCE 60           // Percent of the base pulse (as rc-switch)
+#define RF_MIN_PULSE_US 80              // Shorter pulses are glitches, merged into their neighbours
+#define RF_MAX_CHANGES 67               // Pulses per frame incl. gap - 32 bit codes
+#define RF_MAX_PROFILES 16              // rc-switch's 12 plus user profiles
+#define RF_RMT_CHANNEL 0
+#define RF_RMT_MEM_BLOCKS 4             // 64 items (128 pulses) each
+#define RF_RMT_IDLE_US 30000            // Capture ends after this long without an edge (> any sync gap)
+#define RF_RMT_RINGBUF_BYTES 4096
+#define RF_TRACE_MAX_PULSES (RF_RMT_MEM_BLOCKS * 128)
+
+// Extra timing profiles: { protocol, base us, {sync high, low}, {zero high, low}, {one high, low}, inverted }
+// #define RF_USER_PROFILES { { 100, 300, { 1, 12 }, { 1, 3 }, { 3, 1 }, false } }
+
+// OTA updates (POST /api/ota)
+#define OTA_HEALTH_TIMEOUT_MS 300000    // New firmware must reach WiFi (+ MQTT) within this or it is rolled back
+#define OTA_TRIAL_BOOTS 3               // Boots a new firmware gets to pass the health check (crash loops)
+
+// Relay switch counters and on-time (relay_stats.h, /api/relays/stats, /metrics)
+#define RELAY_STATS_CHECKPOINT_MS 3600000UL  // Written to NVS at most this often, and before a planned restart
+#define RELAY_STATS_SENSORS false            // true = a switch count sensor per relay in Home Assistant
+#define RELAY_STATS_PUBLISH_MS 300000UL      // Sensor updates, only for relays that switched or are on
+
+// Relay transition history (relay_history.h, /api/relays/history)
+#define RELAY_HISTORY_BYTES 4096            // RAM ring - 2-5 bytes per transition
+#define RELAY_HISTORY_SNAPSHOT 1            // 1 = kept across a planned restart in RELAY_HISTORY_FILE
+#define RELAY_HISTORY_FILE "/relay_history.bin"
+
+// Loop instrumentation (exposed on /metrics)
+#define METRICS_ENABLED 1               // 0 = compile out the loop timers
+#define LOOP_STALL_THRESHOLD_US 50000   // Loop iterations longer than this count as stalls
+
+// Deferred logging (drained to Serial by a background task, recent lines on /api/debug/log)
+#define LOG_LEVEL 3                 // 0 = off, 1 = error, 2 = warn, 3 = info, 4 = debug
+#define LOG_BUFFER_ENTRIES 128      // Ring size (~64 bytes per entry)
+#define LOG_DRAIN_INTERVAL_MS 20
+
+// Command latency trace ring (percentiles on /api/debug/trace)
+#define COMMAND_TRACE_ENTRIES 64    // ~56 bytes per entry
+#define HTTP_TRACE_QUEUE 4          // HTTP traces with a correlation id waiting for loop() to publish them
+
+// Per-subsystem allocation counts on /api/debug/memory
+// Enabled from platformio.ini together with the malloc wrap linker flags
+#ifndef ALLOC_TRACKING
+#define ALLOC_TRACKING 0
+#endif
+
 #endif
 
@@ -0,0 +1,28 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <Arduino.h>
+
+#ifndef NATIVE_BUILD
+#include <rom/crc.h>
+#endif
+
+// CRC-32 (IEEE, same as zlib.crc32) - the table-driven ROM routine on the
+// ESP32, bitwise on the host. Pass the previous result to continue a CRC
+// over data that arrives in pieces; start with 0.
+inline uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t length) {
+#ifndef NATIVE_BUILD
+    return crc32_le(crc, data, length);
+#else
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+#endif
+}
+
+#endif
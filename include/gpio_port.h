@@ -0,0 +1,47 @@
+#ifndef GPIO_PORT_H
+#define GPIO_PORT_H
+
+#include <Arduino.h>
+
+/*
+ * Masked GPIO output writes
+ *
+ * ESP32 outputs live in two 32-bit ports (GPIO 0-31 and 32-39). Each
+ * set/clear is a single write to the W1TS/W1TC register, so any number of
+ * pins on one port change in the same instruction. The native build
+ * falls back to digitalWrite() so the fakes still see every pin.
+ */
+
+#ifndef NATIVE_BUILD
+#include "soc/gpio_struct.h"
+#endif
+
+inline void gpioSetMask(uint8_t port, uint32_t mask) {
+#ifdef NATIVE_BUILD
+    for (uint8_t bit = 0; bit < 32; bit++) {
+        if (mask & ((uint32_t)1 << bit)) digitalWrite(port * 32 + bit, HIGH);
+    }
+#else
+    if (port == 0) {
+        GPIO.out_w1ts = mask;
+    } else {
+        GPIO.out1_w1ts.val = mask;
+    }
+#endif
+}
+
+inline void gpioClearMask(uint8_t port, uint32_t mask) {
+#ifdef NATIVE_BUILD
+    for (uint8_t bit = 0; bit < 32; bit++) {
+        if (mask & ((uint32_t)1 << bit)) digitalWrite(port * 32 + bit, LOW);
+    }
+#else
+    if (port == 0) {
+        GPIO.out_w1tc = mask;
+    } else {
+        GPIO.out1_w1tc.val = mask;
+    }
+#endif
+}
+
+#endif
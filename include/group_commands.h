@@ -0,0 +1,104 @@
+#ifndef GROUP_COMMANDS_H
+#define GROUP_COMMANDS_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "relay_mask.h"
+#include "command_trace.h"
+
+/*
+ * Group Commands
+ *
+ * A device can join up to MQTT_GROUP_MAX groups (site, floor, zone, ...).
+ * A command published once on <MQTT_GROUP_PREFIX><group>/set reaches every
+ * member through the broker, instead of one relay<N>/set per device:
+ *
+ *   {"relays":"10x1"}   - '1' on, '0' off, anything else unchanged; relays
+ *                         past the end of the pattern are unchanged
+ *   {"all":"OFF"}       - every active relay
+ *   {"scene":"night"}   - a pattern stored on the device under that name
+ *
+ * with an optional "cid" to correlate the acknowledgement. The pattern is
+ * relative to each device's own relay numbering, and a command is applied
+ * with a single RelayControl::setMask() call.
+ *
+ * Acknowledgements are not sent per command. The first command in a group
+ * starts a random delay of up to MQTT_GROUP_ACK_WINDOW_MS; everything that
+ * arrives for that group before it expires goes out as one message on
+ * <MQTT_GROUP_PREFIX><group>/ack:
+ *
+ *   {"device":"kitchen","cids":["a1"],"commands":1,"relays":"0000"}
+ *
+ * so a group of a hundred devices spreads its answers over the window
+ * instead of hitting the broker in the same millisecond.
+ */
+
+// Scenes are stored at a fixed width so the config record doesn't depend on the board
+typedef RelayMask<MQTT_SCENE_RELAYS> SceneMask;
+static_assert(NUM_RELAYS <= MQTT_SCENE_RELAYS, "Scene masks must cover every relay on the board");
+
+struct RelayScene {
+    char name[MQTT_SCENE_NAME_LEN];   // Empty = unused
+    SceneMask on;                     // Relays the scene switches on
+    SceneMask off;                    // Relays the scene switches off
+};
+
+// Group memberships and scenes - persisted in the config record
+struct GroupConfig {
+    char groups[MQTT_GROUP_MAX][MQTT_GROUP_NAME_LEN];  // Empty = unused
+    RelayScene scenes[MQTT_SCENE_MAX];
+
+    // Index of the group named by the first length characters of name, or -1
+    int findGroup(const char* name, size_t length) const;
+    const RelayScene* findScene(const char* name) const;
+    int groupCount() const;
+    int sceneCount() const;
+};
+
+// Group and scene names: letters, digits, '-' and '_' (safe in a topic level)
+bool isValidGroupName(const char* name, size_t maxLength);
+
+// Parses a "10x1" pattern; false if it is empty or longer than maxRelays
+bool parseRelayPattern(const char* pattern, int maxRelays, SceneMask& on, SceneMask& off);
+
+// Writes the pattern for the first count relays of a scene ('x' = unchanged)
+void formatRelayPattern(const RelayScene& scene, int count, char* out, size_t size);
+
+// Narrows a stored scene mask to the board's relay mask
+template <int N>
+RelayMask<N> relayMaskOf(const SceneMask& mask) {
+    RelayMask<N> m;
+    for (int w = 0; w < RelayMask<N>::WORDS; w++) {
+        m.words[w] = mask.words[w];
+    }
+    return m & RelayMask<N>::all();
+}
+
+// Acknowledgements waiting for their (jittered) send time, one per group
+class GroupAck {
+private:
+    struct Pending {
+        bool active;
+        uint32_t dueMillis;
+        uint16_t commands;
+        uint8_t idCount;
+        char ids[MQTT_GROUP_ACK_IDS][TRACE_ID_LEN];
+    };
+    Pending pending[MQTT_GROUP_MAX];
+
+public:
+    GroupAck();
+
+    // Records a command for the group; the first one of a window sets the send time
+    void add(int group, const char* correlationId, uint32_t now, uint32_t delayMillis);
+
+    // Group whose acknowledgement is due, or -1
+    int due(uint32_t now) const;
+
+    // Writes the ack body for the group (relays = current pattern) and clears it
+    size_t take(int group, const char* hostname, const char* relays, char* out, size_t size);
+
+    void clear();
+};
+
+#endif
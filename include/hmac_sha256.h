@@ -0,0 +1,57 @@
+#ifndef HMAC_SHA256_H
+#define HMAC_SHA256_H
+
+#include <Arduino.h>
+
+/*
+ * SHA-256 / HMAC-SHA256
+ *
+ * Plain C++ (FIPS 180-4, RFC 2104), so the UDP control frames are signed
+ * by the same code on the device and in the native/udpctl client. For
+ * messages this short the ESP32's SHA accelerator doesn't pay for its
+ * locking.
+ *
+ * HmacSha256 keeps the hash state after the key's inner and outer pad
+ * blocks, so a tag over a message that fits one block costs two block
+ * compressions instead of four. Nothing allocates.
+ */
+
+#define SHA256_BLOCK_BYTES 64
+#define SHA256_DIGEST_BYTES 32
+
+class Sha256 {
+private:
+    uint32_t state[8];
+    uint64_t length;            // Bytes hashed so far
+    uint8_t block[SHA256_BLOCK_BYTES];
+    size_t used;                // Bytes waiting in block
+
+    void compress(const uint8_t* data);
+
+public:
+    Sha256() { begin(); }
+
+    void begin();
+    void update(const uint8_t* data, size_t size);
+    void finish(uint8_t digest[SHA256_DIGEST_BYTES]);
+};
+
+class HmacSha256 {
+private:
+    Sha256 inner;               // After the key XOR ipad block
+    Sha256 outer;               // After the key XOR opad block
+
+public:
+    HmacSha256() {}
+
+    // Keys longer than a block are hashed first, as RFC 2104 says
+    void setKey(const uint8_t* key, size_t size);
+
+    // Tag over data; can be called any number of times per key
+    void compute(const uint8_t* data, size_t size, uint8_t tag[SHA256_DIGEST_BYTES]) const;
+
+    // Compares the first size bytes of a received tag without an early exit
+    static bool equal(const uint8_t* a, const uint8_t* b, size_t size);
+};
+
+#endif
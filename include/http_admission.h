@@ -0,0 +1,87 @@
+#ifndef HTTP_ADMISSION_H
+#define HTTP_ADMISSION_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/*
+ * HTTP Admission Control
+ *
+ * Every request is checked once its headers are in, before a handler runs
+ * or a body is read. Admitted requests hold an in-flight slot until they
+ * disconnect; the rest are answered right away (from canHandle(), so the
+ * response goes out before any body byte is parsed) and cost no handler
+ * time.
+ *
+ * - Per client (IPv4 address) token bucket: HTTP_RATE_PER_SEC, bursts of
+ *   HTTP_RATE_BURST; over it -> 429 with Retry-After
+ * - At most HTTP_MAX_IN_FLIGHT requests in flight, and a free heap floor;
+ *   over it -> 503 with Retry-After
+ *
+ * Reads (GET / HEAD: dashboards, API polling, static files) are shed
+ * first. Controls (POST: relay commands, admin changes) may use the last
+ * HTTP_CONTROL_RESERVE_SLOTS slots, the heap between the two floors, and
+ * the last HTTP_RATE_CONTROL_RESERVE tokens of their client's bucket - so
+ * a dashboard polling too fast still has its clicks go through.
+ *
+ * A slot whose disconnect never came is reclaimed after
+ * HTTP_IN_FLIGHT_TIMEOUT_MS. Only called from the async_tcp task, so no
+ * locking.
+ */
+
+enum RequestClass {
+    REQUEST_READ = 0,
+    REQUEST_CONTROL,
+    REQUEST_CLASS_COUNT
+};
+
+enum Admission {
+    ADMIT_OK = 0,
+    ADMIT_BUSY,             // In-flight limit
+    ADMIT_LOW_HEAP,
+    ADMIT_RATE_LIMITED,     // Client's bucket is empty
+    ADMISSION_COUNT
+};
+
+class HttpAdmission {
+private:
+    struct Slot {
+        const void* owner;      // nullptr = free
+        uint32_t admittedMillis;
+    };
+    struct Client {
+        uint32_t address;       // 0 = free
+        int32_t milliTokens;
+        uint32_t refillMillis;
+    };
+    Slot slots[HTTP_MAX_IN_FLIGHT];
+    Client clients[HTTP_RATE_CLIENTS];
+
+    Client& client(uint32_t address, uint32_t now);
+    int reclaim(uint32_t now);
+    Admission reject(RequestClass requestClass, Admission result, uint32_t wait, uint32_t& retryAfter);
+
+public:
+    uint32_t counts[REQUEST_CLASS_COUNT][ADMISSION_COUNT];
+    int peakInFlight;
+
+    HttpAdmission();
+
+    // Admits the request (taking a slot and a token), or says why not and
+    // how many seconds it should wait (retryAfter)
+    Admission admit(const void* owner, uint32_t address, RequestClass requestClass, uint32_t freeHeap,
+                    uint32_t& retryAfter);
+
+    // Frees the owner's slot, if it has one
+    void finish(const void* owner);
+
+    int inFlight() const;
+
+    static const char* className(int requestClass);
+    static const char* resultName(int result);
+    void writePrometheus(Print& out) const;
+};
+
+extern HttpAdmission httpAdmission;
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef LOG_BUFFER_H
+#define LOG_BUFFER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <type_traits>
+#include "config.h"
+
+/*
+ * Deferred Log Buffer
+ *
+ * LOGE/LOGW/LOGI/LOGD record the format string pointer and up to
+ * LOG_MAX_ARGS integer/string arguments in a lock-free RAM ring; a
+ * low-priority task formats them and writes them to Serial, so the caller
+ * never waits on the UART.
+ *
+ * - Levels above LOG_LEVEL (config.h) compile to nothing
+ * - Format strings must be literals (only the pointer is stored)
+ * - The first %s argument is copied (LOG_TEXT_LEN - 1 chars), any further
+ *   %s arguments must point to storage that outlives the entry
+ * - When the ring is full the oldest entries are overwritten and counted
+ *   as dropped
+ *
+ * The most recent entries are readable on /api/debug/log.
+ */
+
+#define LOG_LVL_NONE  0
+#define LOG_LVL_ERROR 1
+#define LOG_LVL_WARN  2
+#define LOG_LVL_INFO  3
+#define LOG_LVL_DEBUG 4
+
+#define LOG_MAX_ARGS 4
+#define LOG_TEXT_LEN 32
+#define LOG_LINE_LEN 160
+
+struct LogArg {
+    uintptr_t value;
+    bool text;
+
+    template <typename T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value, int>::type = 0>
+    LogArg(T v) : value((uintptr_t)v), text(false) {}
+    LogArg(const char* s) : value((uintptr_t)s), text(true) {}
+};
+
+struct LogEntry {
+    std::atomic<uint32_t> seq;  // Index + 1 once written, 0 while being written
+    uint32_t timestamp;         // millis()
+    const char* format;
+    uint8_t level;
+    uint8_t argCount;
+    int8_t textArg;             // Argument replaced by text (-1 = none)
+    uintptr_t args[LOG_MAX_ARGS];
+    char text[LOG_TEXT_LEN];
+};
+
+class LogBuffer {
+private:
+    LogEntry entries[LOG_BUFFER_ENTRIES];
+    std::atomic<uint32_t> head;      // Next index to write (all producers)
+    uint32_t readIndex;              // Next index to drain (drain task only)
+    std::atomic<uint32_t> dropped;
+
+    void commit(uint8_t level, const char* format, const LogArg* args, int argCount);
+    bool copyEntry(uint32_t index, LogEntry& out, bool& overwritten) const;
+    static void formatEntry(const LogEntry& entry, char* line, size_t size);
+
+public:
+    LogBuffer();
+    void begin();  // Starts the drain task (no-op on the native build)
+
+    template <typename... Args>
+    void write(uint8_t level, const char* format, Args... args) {
+        static_assert(sizeof...(Args) <= LOG_MAX_ARGS, "too many log arguments");
+        const LogArg list[] = {LogArg(args)..., LogArg(0)};
+        commit(level, format, list, sizeof...(Args));
+    }
+
+    // Writes pending entries to out, returns how many were written
+    size_t drain(Print& out, size_t maxEntries);
+
+    // Writes up to maxEntries of the most recent entries (timestamped) without consuming them
+    void writeRecent(Print& out, size_t maxEntries) const;
+
+    uint32_t droppedCount() const { return dropped.load(); }
+};
+
+extern LogBuffer logBuffer;
+
+// The dead snprintf() keeps compile-time format checking
+#define LOG_AT(level, ...) do { \
+        if (false) { snprintf(nullptr, 0, __VA_ARGS__); } \
+        logBuffer.write(level, __VA_ARGS__); \
+    } while (0)
+
+#if LOG_LEVEL >= LOG_LVL_ERROR
+#define LOGE(...) LOG_AT(LOG_LVL_ERROR, __VA_ARGS__)
+#else
+#define LOGE(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LVL_WARN
+#define LOGW(...) LOG_AT(LOG_LVL_WARN, __VA_ARGS__)
+#else
+#define LOGW(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LVL_INFO
+#define LOGI(...) LOG_AT(LOG_LVL_INFO, __VA_ARGS__)
+#else
+#define LOGI(...) do {} while (0)
+#endif
+
+#if LOG_LEVEL >= LOG_LVL_DEBUG
+#define LOGD(...) LOG_AT(LOG_LVL_DEBUG, __VA_ARGS__)
+#else
+#define LOGD(...) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef MEM_DEBUG_H
+#define MEM_DEBUG_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+#include "metrics.h"
+
+/*
+ * Memory Diagnostics
+ *
+ * - Heap: free, largest free block, minimum-ever free, fragmentation
+ * - Stack high-water marks of the loop, AsyncTCP, WiFi and event tasks
+ * - Allocation counts per subsystem (ALLOC_TRACKING builds only)
+ *
+ * Allocation tracking wraps malloc/calloc/realloc at link time
+ * (-Wl,--wrap=..., see platformio.ini). Allocations on the loop task are
+ * attributed to the loop subsystem currently running (SubsystemTimer),
+ * allocations on other tasks to that task. The hook is a task-handle
+ * compare and two atomic adds; remove the build flags to compile it out.
+ *
+ * Exposed on /api/debug/memory.
+ */
+
+enum AllocTag {
+    // SUBSYS_WIFI .. SUBSYS_RF map 1:1 onto the loop subsystems (activeSubsystem)
+    ALLOC_LOOP_OTHER = SUBSYS_COUNT,  // Loop task outside a timed subsystem (setup, discovery)
+    ALLOC_WEB,                        // async_tcp task (HTTP handlers)
+    ALLOC_EVENTS,                     // WiFi event callbacks
+    ALLOC_SYSTEM,                     // WiFi/lwIP and any other task
+    ALLOC_TAG_COUNT
+};
+
+class MemDebug {
+private:
+    // No constructor: the allocation hook can run before static init,
+    // so everything relies on zero-initialisation
+    std::atomic<uint32_t> allocs[ALLOC_TAG_COUNT];
+    std::atomic<uint32_t> allocBytes[ALLOC_TAG_COUNT];
+    std::atomic<uint32_t> failures;
+    std::atomic<uint32_t> lastFailureSize;
+    TaskHandle_t loopTask;
+    TaskHandle_t webTask;
+    TaskHandle_t eventTask;
+
+    int currentTag();
+
+public:
+    void begin();        // Call from setup() - records the loop task
+    void attachTasks();  // Call after server.begin() - looks up the other tasks
+
+    // Called from the allocation hook - must not allocate
+    void recordAlloc(size_t size, bool ok);
+
+    static const char* tagName(int tag);
+    void writeJson(Print& out);
+};
+
+extern MemDebug memDebug;
+
+#endif
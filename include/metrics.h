@@ -0,0 +1,126 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+/*
+ * Loop Instrumentation
+ *
+ * - Per-subsystem timing with the CPU cycle counter (a few cycles per sample)
+ * - Fixed-bucket latency histograms, no allocation after boot
+ * - Stall detector: when a loop() iteration exceeds LOOP_STALL_THRESHOLD_US,
+ *   the subsystem that took longest in that iteration is blamed
+ * - Event counters (MQTT publishes, reconnects, RF frames, NVS commits)
+ *
+ * Everything is exposed on /metrics in Prometheus text format.
+ * Set METRICS_ENABLED to 0 in config.h to compile the timers out.
+ */
+
+enum Subsystem {
+    SUBSYS_WIFI = 0,        // checkWiFiConnection()
+    SUBSYS_MQTT_RECONNECT,  // reconnectMQTT()
+    SUBSYS_MQTT_LOOP,       // mqttClient.loop() incl. command dispatch
+    SUBSYS_RF,              // checkRFSignal()
+    SUBSYS_COUNT
+};
+
+// Boot stages, in the order they normally complete. Relays and RF are up
+// from setup(); the network stages finish from loop() whenever WiFi allows.
+enum BootStage {
+    BOOT_RELAYS = 0,    // Saved relay states applied to the outputs
+    BOOT_RF,            // RF receiver listening
+    BOOT_WIFI,          // First IP address
+    BOOT_WEB,           // Web server listening (after the config portal closed)
+    BOOT_MDNS,          // mDNS responder announced
+    BOOT_MQTT,          // First broker connection
+    BOOT_STAGE_COUNT
+};
+
+// Upper bounds of the latency buckets in microseconds (+Inf is implicit)
+#define LATENCY_BUCKET_COUNT 12
+
+class LatencyHistogram {
+private:
+    uint32_t buckets[LATENCY_BUCKET_COUNT + 1];  // Last bucket = +Inf
+    uint64_t sumMicros;
+
+public:
+    static const uint32_t BOUNDS_US[LATENCY_BUCKET_COUNT];
+
+    LatencyHistogram();
+    void record(uint32_t value);
+    void writePrometheus(Print& out, const char* name, const char* labels) const;
+    uint32_t count() const;
+};
+
+class Metrics {
+private:
+    LatencyHistogram loopHistogram;
+    LatencyHistogram subsystemHistograms[SUBSYS_COUNT];
+    uint32_t iterationMicros[SUBSYS_COUNT];  // Time per subsystem in the current iteration
+    uint32_t loopStartCycles;
+    uint32_t subsystemStartCycles;
+    uint32_t cyclesPerMicro;
+    uint32_t stalls[SUBSYS_COUNT];
+    uint32_t bootStageMicros[BOOT_STAGE_COUNT];  // micros() when each stage first completed, 0 = not yet
+    uint32_t lastStallMicros;
+    uint32_t lastStallUptime;   // millis() when the last stall ended
+    int lastStallSubsystem;     // -1 = no stall yet
+
+public:
+    // Event counters - incremented from the loop, web and WiFi tasks
+    std::atomic<uint32_t> mqttPublishes;
+    std::atomic<uint32_t> mqttPublishFailures;
+    std::atomic<uint32_t> mqttReconnectAttempts;
+    std::atomic<uint32_t> mqttConnects;
+    std::atomic<uint32_t> mqttGroupCommands;
+    std::atomic<uint32_t> mqttGroupAcks;
+    std::atomic<uint32_t> rfFrames;
+    std::atomic<uint32_t> rfMatches;
+    std::atomic<uint32_t> nvsCommits;
+
+    Metrics();
+    void begin();
+
+    // Loop timing - called from loop() only
+    void beginLoop();
+    void endLoop();
+    void beginSubsystem(Subsystem subsystem);
+    void endSubsystem(Subsystem subsystem);
+
+    static const char* subsystemName(int subsystem);
+    
+    // Records the first completion only - safe to call on every reconnect
+    void markBootStage(BootStage stage);
+    static const char* bootStageName(int stage);
+    void writePrometheus(Print& out) const;
+};
+
+extern Metrics metrics;
+
+// Subsystem currently running on the loop task (-1 = none), read by the allocation hook
+extern volatile int activeSubsystem;
+
+// Times one subsystem call for the lifetime of the scope
+class SubsystemTimer {
+private:
+    Subsystem subsystem;
+
+public:
+    explicit SubsystemTimer(Subsystem s) : subsystem(s) {
+        activeSubsystem = s;
+#if METRICS_ENABLED
+        metrics.beginSubsystem(subsystem);
+#endif
+    }
+    ~SubsystemTimer() {
+#if METRICS_ENABLED
+        metrics.endSubsystem(subsystem);
+#endif
+        activeSubsystem = -1;
+    }
+};
+
+#endif
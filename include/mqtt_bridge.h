@@ -0,0 +1,75 @@
+#ifndef MQTT_BRIDGE_H
+#define MQTT_BRIDGE_H
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <ArduinoJson.h>
+#include "config.h"
+#include "settings.h"
+#include "relay_control.h"
+#include "rf_codes.h"
+#include "storage.h"
+#include "metrics.h"
+#include "command_trace.h"
+#include "group_commands.h"
+#include "relay_stats.h"
+
+// MQTT side of the controller: topics, command dispatch, state and discovery publishing
+class MqttBridge {
+private:
+    PubSubClient& client;
+    RelayControl& relays;
+    RFCodeStore& rfCodes;
+    Settings& settings;
+    Storage& storage;
+    bool discoveryPublished;  // Only publish once per boot unless manually triggered
+    int staleRelayCount;      // Relays above activeRelayCount whose discovery still needs removing
+    bool aggregateRetained;   // An aggregate state is retained on the broker from this session
+    GroupConfig groupConfig;  // Groups this device answers to, and its scenes
+    GroupAck groupAck;
+    uint32_t lastStatsPublish;
+    uint32_t publishedSwitches[NUM_RELAYS];  // Switch counts in the last stats publish
+    
+    bool publish(const char* topic, const char* payload, bool retained);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained);
+    bool publishJson(const char* topic, const JsonDocument& doc, bool retained);
+    void publishEntityDiscovery();
+    void publishRelayEntityConfig(int relayIndex);
+    void publishRelayStatsConfig(int relayIndex);
+    void clearRelayEntity(int relayIndex);
+    size_t deviceDiscoveryCapacity() const;
+    bool useDeviceDiscovery() const;
+    bool publishDeviceDiscovery();
+    void clearEntityDiscovery();
+    void clearDeviceDiscovery();
+    int parseCommandTopic(const char* topic) const;
+    int parseGroupTopic(const char* topic) const;
+    bool handleGroupCommand(int group, const byte* payload, unsigned int length);
+    void subscribeGroups(bool subscribe);
+    void publishRelayState(int relayIndex);
+    int formatRelayStates(char* out) const;
+    bool probe(const Settings& candidate, const char* clientId);
+    void clearRetainedTopics();
+    static void copyMqttSettings(Settings& to, const Settings& from);
+    
+public:
+    MqttBridge(PubSubClient& client, RelayControl& relays, RFCodeStore& rfCodes,
+               Settings& settings, Storage& storage);
+    bool connect(const char* clientId);
+    bool switchBroker(const Settings& candidate, const char* clientId);
+    bool handleMessage(const char* topic, const byte* payload, unsigned int length);
+    void publishState(int relayIndex);
+    void publishStates(const RelayControl::Mask& changed);
+    void publishAllStates();
+    void publishAggregateState();
+    void publishRFTrigger(int slot, bool on);
+    void publishTrace(const CommandTrace* trace);
+    void publishDiscovery();
+    void applyRelayCount(int newCount);
+    void setGroupConfig(const GroupConfig& config, bool save);
+    const GroupConfig& getGroupConfig() const { return groupConfig; }
+    void publishGroupAcks();
+    void publishRelayStats(bool force);
+};
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef MQTT_TLS_H
+#define MQTT_TLS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+#if MQTT_TLS
+
+#include <Client.h>
+#include <mbedtls/ctr_drbg.h>
+#include <mbedtls/entropy.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/x509_crt.h>
+
+/*
+ * MQTT over TLS
+ *
+ * A Client for PubSubClient that speaks TLS 1.2 (mbedTLS) and resumes the
+ * previous session when it reconnects. Only the first connection to a broker
+ * pays for the full handshake: certificate chain check and key exchange,
+ * seconds of CPU on an ESP32. The abbreviated handshake skips both.
+ *
+ * - The CA certificate (MQTT_TLS_CA_FILE) is parsed once at boot into a
+ *   config shared by all connections - the broker link and the switchover
+ *   probe
+ * - Each client caches its last session (a ticket, or a session ID if the
+ *   broker has no tickets) in RAM. The broker link also keeps it in RTC
+ *   memory (MQTT_TLS_SESSION_RTC), so a planned restart resumes as well
+ * - A session is only offered to the host and port it came from. If the
+ *   broker refuses it, the full handshake's new session replaces it
+ *
+ * Handshake counts and times (full / resumed) and the resumption hit rate
+ * are on /metrics and GET /api/mqtt. Only used from loop(), so no locking.
+ */
+
+enum TlsHandshakeKind {
+    TLS_HANDSHAKE_FULL = 0,
+    TLS_HANDSHAKE_RESUMED,
+    TLS_HANDSHAKE_KIND_COUNT
+};
+
+// Shared config: CA chain, RNG, session tickets - and the handshake stats
+class MqttTls {
+private:
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    mbedtls_x509_crt ca;
+    mbedtls_ssl_config conf;
+    bool ready;
+
+public:
+    uint32_t handshakes[TLS_HANDSHAKE_KIND_COUNT];
+    uint64_t handshakeMillis[TLS_HANDSHAKE_KIND_COUNT];
+    uint32_t offered;           // Handshakes that offered a cached session
+    uint32_t failures;          // TCP connects and handshakes that failed
+    uint32_t lastHandshakeMillis;
+    bool lastResumed;
+
+    MqttTls();
+
+    // Parses the PEM CA chain (needn't be NUL-terminated) and sets up the config
+    bool begin(const uint8_t* pem, size_t length);
+    bool isReady() const { return ready; }
+    const mbedtls_ssl_config* config() const { return &conf; }
+
+    void recordHandshake(bool resumed, bool offeredSession, uint32_t elapsed);
+
+    // Resumed / offered, 0 before the first offer
+    float hitRate() const;
+    void writePrometheus(Print& out) const;
+};
+
+extern MqttTls mqttTls;
+
+class TlsClient : public Client {
+private:
+    mbedtls_ssl_context ssl;
+    int fd;                     // -1 = closed
+    int peeked;                 // Byte read ahead by peek(), -1 = none
+    bool persistent;            // Session mirrored to RTC memory
+    bool haveSession;
+    mbedtls_ssl_session session;
+    char sessionHost[40];
+    uint16_t sessionPort;
+    uint32_t timeoutMs;         // Connect + handshake, and each write
+
+    bool waitSocket(bool forWrite, uint32_t deadline);
+    bool openSocket(const char* host, uint16_t port, uint32_t deadline);
+    bool handshake(uint32_t deadline, bool& resumed);
+    void keepSession(const char* host, uint16_t port);
+    void dropSession();
+    void restoreSession();
+    static int sendCallback(void* context, const unsigned char* data, size_t length);
+    static int recvCallback(void* context, unsigned char* data, size_t length);
+
+public:
+    explicit TlsClient(bool persistent = false);
+    ~TlsClient();
+
+    // MQTT_TLS_HANDSHAKE_TIMEOUT_MS unless set (the broker probe uses less)
+    void setHandshakeTimeout(uint32_t ms) { timeoutMs = ms; }
+
+    int connect(IPAddress ip, uint16_t port) override;
+    int connect(const char* host, uint16_t port) override;
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t* data, size_t length) override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* data, size_t length) override;
+    int peek() override;
+    void flush() override {}
+    void stop() override;
+    uint8_t connected() override;
+    operator bool() override { return connected(); }
+};
+
+#endif
+
+#endif
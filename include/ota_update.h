@@ -0,0 +1,81 @@
+#ifndef OTA_UPDATE_H
+#define OTA_UPDATE_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "storage.h"
+
+/*
+ * Over-the-Air Updates
+ *
+ * An upload is streamed chunk by chunk into the inactive app partition
+ * (firmware) or the LittleFS partition (filesystem) through the Update
+ * class, which flashes in 4 KB sectors - the image is never held in RAM.
+ * A CRC-32 of the image (zlib.crc32) is given with the upload, kept up to
+ * date on every chunk and compared before the image is committed; a
+ * mismatch, short upload or disconnect aborts and leaves the running
+ * firmware bootable.
+ *
+ * A new firmware boots on trial. It is accepted once it has WiFi and (if a
+ * broker is configured) MQTT. If that doesn't happen within
+ * OTA_HEALTH_TIMEOUT_MS, or the image keeps crashing before it gets there
+ * (OTA_TRIAL_BOOTS boots), the previous app partition is made the boot
+ * partition again and the device restarts into it. With a bootloader built
+ * with rollback support, the image is also marked valid / invalid for it.
+ *
+ * One upload at a time. Uploads run on the async_tcp task; the health check
+ * runs from loop().
+ */
+
+enum OtaTarget {
+    OTA_FIRMWARE = 0,
+    OTA_FILESYSTEM
+};
+
+class OtaUpdate {
+private:
+    Storage& storage;
+
+    // Upload in progress
+    const void* owner;          // Request streaming the image, nullptr = idle
+    OtaTarget target;
+    size_t total;
+    size_t received;
+    uint32_t crc;
+    uint32_t expectedCrc;
+    char lastError[64];
+
+    // Trial boot
+    bool onTrial;
+    uint32_t trialStartMillis;
+
+    bool fail(const char* message, const char* detail = "");
+    void rollBack();
+
+public:
+    uint32_t completed;
+    uint32_t failed;
+
+    explicit OtaUpdate(Storage& storage);
+
+    // Upload - each returns false on an error (getError()) and the upload is aborted
+    bool begin(const void* owner, OtaTarget target, size_t size, uint32_t expectedCrc);
+    bool write(const void* owner, const uint8_t* data, size_t len, size_t index);
+    bool end(const void* owner);
+    void abort(const void* owner);
+
+    bool isRunning() const { return owner != nullptr; }
+    bool isOwner(const void* request) const { return owner != nullptr && owner == request; }
+    OtaTarget getTarget() const { return target; }  // Of the current / last upload
+    const char* getError() const { return lastError; }
+
+    // Trial boot - checkBoot() from setup() after storage.load(), loop() every iteration
+    void checkBoot();
+    void loop(bool healthy);
+    bool isOnTrial() const { return onTrial; }
+
+    static const char* targetName(int target);
+    void writeJson(Print& out) const;
+};
+
+#endif
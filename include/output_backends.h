@@ -0,0 +1,267 @@
+#ifndef OUTPUT_BACKENDS_H
+#define OUTPUT_BACKENDS_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <SPI.h>
+#include "board_profiles.h"
+#include "relay_mask.h"
+#include "gpio_port.h"
+#include "log_buffer.h"
+
+/*
+ * Relay Output Backends
+ *
+ * RelayControl handles relay state and polarity; a backend only drives
+ * output levels (bit set = HIGH / latch 1). Every backend provides:
+ *
+ *   void begin(const Mask& levels)                     - set levels, then enable outputs
+ *   void apply(const Mask& levels, const Mask& changed) - batched update
+ *   void write(int index, bool level)                  - single output
+ *   static int pin(int index)                          - GPIO number, -1 if none
+ *
+ * Expander backends keep a shadow of the output latches and push all
+ * changes of one update in a single bus transaction per chip (MCP23017)
+ * or per chain (74HC595).
+ */
+
+// ---------------------------------------------------------------------------
+// Native GPIO - one W1TS/W1TC register write per port
+// ---------------------------------------------------------------------------
+template <typename Board>
+class GpioOutput {
+public:
+    static constexpr int COUNT = Board::RELAY_COUNT;
+    typedef RelayMask<COUNT> Mask;
+
+private:
+    struct PortBit {
+        uint8_t port;
+        uint32_t bit;
+    };
+
+    struct PortMasks {
+        uint32_t mask[2];
+    };
+
+    struct PinTable {
+        PortBit entries[COUNT];
+    };
+
+    static constexpr PortBit portBit(int i) {
+        return PortBit{(uint8_t)(Board::PINS[i] >> 5), (uint32_t)1 << (Board::PINS[i] & 31)};
+    }
+
+    static constexpr PinTable pinTable() {
+        PinTable t = {};
+        for (int i = 0; i < COUNT; i++) {
+            t.entries[i] = portBit(i);
+        }
+        return t;
+    }
+
+    // Port masks of the pins selected by relays
+    static constexpr PortMasks portMasks(const Mask& relays) {
+        PortMasks m = {{0, 0}};
+        for (int i = 0; i < COUNT; i++) {
+            if (relays.test(i)) {
+                m.mask[Board::PINS[i] >> 5] |= (uint32_t)1 << (Board::PINS[i] & 31);
+            }
+        }
+        return m;
+    }
+
+public:
+    static constexpr PinTable PIN_TABLE = pinTable();
+
+    void begin(const Mask& levels) {
+        // Levels first, so outputs come up in the right state
+        apply(levels, Mask::all());
+        for (int i = 0; i < COUNT; i++) {
+            pinMode(Board::PINS[i], OUTPUT);
+        }
+    }
+
+    void apply(const Mask& levels, const Mask& changed) {
+        PortMasks high = portMasks(levels & changed);
+        PortMasks low = portMasks(~levels & changed);
+        for (uint8_t port = 0; port < 2; port++) {
+            if (high.mask[port]) gpioSetMask(port, high.mask[port]);
+            if (low.mask[port]) gpioClearMask(port, low.mask[port]);
+        }
+    }
+
+    void write(int index, bool level) {
+        const PortBit& pb = PIN_TABLE.entries[index];
+        if (level) {
+            gpioSetMask(pb.port, pb.bit);
+        } else {
+            gpioClearMask(pb.port, pb.bit);
+        }
+    }
+
+    static int pin(int index) { return Board::PINS[index]; }
+};
+
+// ---------------------------------------------------------------------------
+// MCP23017 16-bit I2C expanders at MCP_BASE_ADDRESS + 0..7
+// Relays 1-16 on the first chip (GPA0-7, GPB0-7), 17-32 on the next, ...
+// ---------------------------------------------------------------------------
+template <typename Board>
+class Mcp23017Output {
+public:
+    static constexpr int COUNT = Board::RELAY_COUNT;
+    static constexpr int CHIPS = (COUNT + 15) / 16;
+    typedef RelayMask<COUNT> Mask;
+
+    static_assert(CHIPS <= 8, "MCP23017 has only 8 addresses");
+
+private:
+    // Register addresses with IOCON.BANK = 0 (power-on default)
+    static constexpr uint8_t REG_IODIRA = 0x00;
+    static constexpr uint8_t REG_OLATA = 0x14;
+
+    uint16_t latch[CHIPS];
+
+    // Register pair A/B in one transaction (sequential addressing)
+    bool writePair(int chip, uint8_t reg, uint16_t value) {
+        Wire.beginTransmission(Board::MCP_BASE_ADDRESS + chip);
+        Wire.write(reg);
+        Wire.write((uint8_t)(value & 0xFF));
+        Wire.write((uint8_t)(value >> 8));
+        uint8_t error = Wire.endTransmission();
+        if (error != 0) {
+            LOGE("[MCP23017] Write to 0x%02x failed (%u)", Board::MCP_BASE_ADDRESS + chip, error);
+            return false;
+        }
+        return true;
+    }
+
+public:
+    Mcp23017Output() : latch() {}
+
+    void begin(const Mask& levels) {
+        Wire.begin(Board::SDA_PIN, Board::SCL_PIN, Board::I2C_FREQUENCY);
+        for (int chip = 0; chip < CHIPS; chip++) {
+            latch[chip] = levels.halfAt(chip);
+            writePair(chip, REG_OLATA, latch[chip]);
+            writePair(chip, REG_IODIRA, 0x0000);  // All outputs
+        }
+    }
+
+    void apply(const Mask& levels, const Mask& changed) {
+        for (int chip = 0; chip < CHIPS; chip++) {
+            uint16_t mask = changed.halfAt(chip);
+            if (mask == 0) continue;
+            uint16_t value = (latch[chip] & ~mask) | (levels.halfAt(chip) & mask);
+            if (value != latch[chip]) {
+                latch[chip] = value;
+                writePair(chip, REG_OLATA, value);
+            }
+        }
+    }
+
+    void write(int index, bool level) {
+        int chip = index >> 4;
+        uint16_t bit = (uint16_t)1 << (index & 15);
+        uint16_t value = level ? (latch[chip] | bit) : (latch[chip] & ~bit);
+        if (value != latch[chip]) {
+            latch[chip] = value;
+            writePair(chip, REG_OLATA, value);
+        }
+    }
+
+    static int pin(int) { return -1; }
+};
+
+// ---------------------------------------------------------------------------
+// Chained 74HC595 shift registers on SPI (SCK -> SH_CP, MOSI -> DS)
+// Relays 1-8 on the first register in the chain (Q0-Q7), 9-16 on the next, ...
+// ---------------------------------------------------------------------------
+template <typename Board>
+class Shift595Output {
+public:
+    static constexpr int COUNT = Board::RELAY_COUNT;
+    static constexpr int CHIPS = (COUNT + 7) / 8;
+    typedef RelayMask<COUNT> Mask;
+
+private:
+    uint8_t frame[CHIPS];  // frame[0] = first register in the chain
+
+    // Whole chain in one SPI transaction, then latch
+    void flush() {
+        SPI.beginTransaction(SPISettings(Board::SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+        for (int chip = CHIPS - 1; chip >= 0; chip--) {  // Last register is shifted first
+            SPI.transfer(frame[chip]);
+        }
+        SPI.endTransaction();
+        digitalWrite(Board::LATCH_PIN, HIGH);  // ST_CP rising edge copies the shift register to the outputs
+        digitalWrite(Board::LATCH_PIN, LOW);
+    }
+
+public:
+    Shift595Output() : frame() {}
+
+    void begin(const Mask& levels) {
+        // Keep outputs disabled (/OE high) until the first frame is latched
+        if (Board::OE_PIN >= 0) {
+            digitalWrite(Board::OE_PIN, HIGH);
+            pinMode(Board::OE_PIN, OUTPUT);
+        }
+        digitalWrite(Board::LATCH_PIN, LOW);
+        pinMode(Board::LATCH_PIN, OUTPUT);
+        SPI.begin(Board::SCK_PIN, -1, Board::MOSI_PIN, -1);
+        
+        for (int chip = 0; chip < CHIPS; chip++) {
+            frame[chip] = levels.byteAt(chip);
+        }
+        flush();
+        
+        if (Board::OE_PIN >= 0) {
+            digitalWrite(Board::OE_PIN, LOW);
+        }
+    }
+
+    void apply(const Mask& levels, const Mask& changed) {
+        bool dirty = false;
+        for (int chip = 0; chip < CHIPS; chip++) {
+            uint8_t mask = changed.byteAt(chip);
+            if (mask == 0) continue;
+            uint8_t value = (frame[chip] & ~mask) | (levels.byteAt(chip) & mask);
+            if (value != frame[chip]) {
+                frame[chip] = value;
+                dirty = true;
+            }
+        }
+        if (dirty) {
+            flush();
+        }
+    }
+
+    void write(int index, bool level) {
+        int chip = index >> 3;
+        uint8_t bit = (uint8_t)1 << (index & 7);
+        uint8_t value = level ? (frame[chip] | bit) : (frame[chip] & ~bit);
+        if (value != frame[chip]) {
+            frame[chip] = value;
+            flush();
+        }
+    }
+
+    static int pin(int) { return -1; }
+};
+
+// Backend named by a profile's BACKEND
+template <typename Board, OutputKind Kind = Board::BACKEND>
+struct DefaultOutput;
+
+template <typename Board>
+struct DefaultOutput<Board, BACKEND_GPIO> { typedef GpioOutput<Board> type; };
+
+template <typename Board>
+struct DefaultOutput<Board, BACKEND_MCP23017> { typedef Mcp23017Output<Board> type; };
+
+template <typename Board>
+struct DefaultOutput<Board, BACKEND_74HC595> { typedef Shift595Output<Board> type; };
+
+#endif
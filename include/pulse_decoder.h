@@ -0,0 +1,97 @@
+#ifndef PULSE_DECODER_H
+#define PULSE_DECODER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/*
+ * Pulse-Trace RF Decoder
+ *
+ * Decodes OOK remotes from a stream of pulse durations (alternating levels,
+ * in microseconds) instead of timing every edge in an interrupt. Durations
+ * come from a capture buffer: the RMT peripheral on the ESP32
+ * (rf_receiver.h) or a recorded trace on the host (native/rfreplay).
+ *
+ * Framing follows rc-switch, so codes learned with either decoder match:
+ * a pulse longer than RF_SEPARATION_LIMIT_US is a gap between frames, a
+ * frame is decoded once a second gap of about the same length confirms the
+ * repeat, and that gap sets the timing base (gap / longest sync factor).
+ * Each profile then checks the data pulses against its zero / one patterns
+ * within RF_PULSE_TOLERANCE percent.
+ *
+ * Unlike the rc-switch ISR, pulses shorter than RF_MIN_PULSE_US are treated
+ * as glitches and merged into the pulse around them, so a noise spike in a
+ * gap or a data bit doesn't throw away the frame.
+ *
+ * Profiles 1-12 are the rc-switch protocols. Others can be added with
+ * addProfile() (RF_USER_PROFILES in config.h).
+ */
+
+struct PulseProfile {
+    uint16_t protocol;  // Reported protocol number (1-12 = rc-switch)
+    uint16_t baseUs;    // Nominal pulse length - the gap sets the real one when decoding
+    uint8_t sync[2];    // {high, low} in base pulses
+    uint8_t zero[2];
+    uint8_t one[2];
+    bool inverted;
+};
+
+class PulseDecoder {
+private:
+    PulseProfile profiles[RF_MAX_PROFILES];
+    int profileCount;
+    uint32_t minPulseUs;
+
+    // Frame being collected; timings[0] is the gap that started it
+    uint32_t timings[RF_MAX_CHANGES];
+    unsigned int changeCount;
+    unsigned int repeatCount;
+
+    // De-glitching holds back one pulse until the next one shows it is complete
+    uint32_t pending;
+    bool mergeNext;
+
+    unsigned long receivedValue;
+    unsigned int receivedBitlength;
+    unsigned int receivedDelay;
+    unsigned int receivedProtocol;
+
+    void processPulse(uint32_t duration);
+    bool decodeFrame(const PulseProfile& profile);
+
+public:
+    // Counters for the replay tool and diagnostics
+    uint32_t pulses;
+    uint32_t glitches;
+    uint32_t frames;
+
+    PulseDecoder();
+
+    static const PulseProfile BUILTIN_PROFILES[];
+    static const int BUILTIN_PROFILE_COUNT;
+
+    bool addProfile(const PulseProfile& profile);
+    void setMinPulse(uint32_t us) { minPulseUs = us; }  // 0 = no de-glitching (rc-switch behaviour)
+    int getProfileCount() const { return profileCount; }
+    const PulseProfile& getProfile(int index) const { return profiles[index]; }
+
+    // Feeds one pulse duration / a captured buffer of alternating levels
+    void feed(uint32_t durationUs);
+    void feed(const uint16_t* durations, size_t count);
+
+    // End of a capture: the held-back pulse is complete
+    void flush();
+
+    // Drops the frame in progress (the decoded result stays)
+    void reset();
+
+    // Same interface as RCSwitch - the newest frame overwrites an unread one
+    bool available() const { return receivedValue != 0; }
+    void resetAvailable() { receivedValue = 0; }
+    unsigned long getReceivedValue() const { return receivedValue; }
+    unsigned int getReceivedBitlength() const { return receivedBitlength; }
+    unsigned int getReceivedDelay() const { return receivedDelay; }
+    unsigned int getReceivedProtocol() const { return receivedProtocol; }
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef RECONNECT_POLICY_H
+#define RECONNECT_POLICY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/*
+ * Reconnect Policy
+ *
+ * The timing side of getting WiFi and MQTT back: when to check the station,
+ * when to give up on it and open the AP, when to retry from AP mode and when
+ * to try the broker again. It only decides - loop() passes in what it sees
+ * (station up, AP clients) and carries out the returned actions, so the
+ * same code runs on the device and in the native/netsim simulator.
+ *
+ * WiFi, checked every WIFI_CHECK_INTERVAL once boot is done:
+ * - Station down: WiFi.begin(), and if there is no IP within
+ *   WIFI_RECONNECT_TIMEOUT, open the AP (AP + STA)
+ * - In AP mode: retry every WIFI_RECONNECT_INTERVAL, but not while someone
+ *   is connected to the AP (a retry moves the radio to the network's
+ *   channel and drops them)
+ * - The station's IP (from wifiRecovery) ends a reconnect and AP mode
+ *
+ * MQTT: at most one connect attempt per MQTT_RETRY_INTERVAL, the first one
+ * right away. Only used from loop(), so no locking.
+ */
+
+enum ReconnectAction {
+    RECONNECT_NONE = 0,
+    RECONNECT_WIFI_BEGIN = 1 << 0,  // Station down: WiFi.begin()
+    RECONNECT_START_AP = 1 << 1,    // Reconnect timed out: open the AP, keep the station
+    RECONNECT_AP_RETRY = 1 << 2     // From AP mode: WiFi.mode(WIFI_AP_STA) + WiFi.begin()
+};
+
+struct ReconnectTiming {
+    uint32_t checkInterval = WIFI_CHECK_INTERVAL;
+    uint32_t reconnectTimeout = WIFI_RECONNECT_TIMEOUT;
+    uint32_t reconnectInterval = WIFI_RECONNECT_INTERVAL;
+    uint32_t mqttRetryInterval = MQTT_RETRY_INTERVAL;
+};
+
+class ReconnectPolicy {
+private:
+    ReconnectTiming timing;
+    uint32_t lastCheck;
+    bool reconnecting;
+    uint32_t reconnectStart;
+    bool apMode;
+    uint32_t lastApRetry;
+    uint32_t lastMqttAttempt;
+
+public:
+    explicit ReconnectPolicy(const ReconnectTiming& timing = ReconnectTiming());
+
+    // Boot-time bring-up is done (connected or not) - supervision starts
+    void begin(uint32_t now);
+
+    // From loop(); returns ReconnectAction bits. apClients only matters in AP mode
+    uint32_t checkWiFi(uint32_t now, bool stationConnected, int apClients);
+
+    // Station has an IP again; true if AP mode should be closed
+    bool stationConnected();
+
+    // Whether a broker connect attempt is due now (and if so, counts it as made)
+    bool mqttAttemptDue(uint32_t now);
+    // Next attempt after the full interval / right away
+    void mqttAttempted(uint32_t now) { lastMqttAttempt = now; }
+    void mqttRetryNow(uint32_t now) { lastMqttAttempt = now - timing.mqttRetryInterval; }
+
+    bool isApMode() const { return apMode; }
+    bool isReconnecting() const { return reconnecting; }
+    const ReconnectTiming& getTiming() const { return timing; }
+
+    // When checkWiFi() / mqttAttemptDue() can next do something - the
+    // simulator skips ahead to these instead of running every loop()
+    uint32_t nextWiFiCheck() const { return lastCheck + timing.checkInterval; }
+    uint32_t nextMqttAttempt() const { return lastMqttAttempt + timing.mqttRetryInterval; }
+};
+
+extern ReconnectPolicy reconnectPolicy;
+
+#endif
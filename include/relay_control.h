@@ -2,25 +2,169 @@
 #define RELAY_CONTROL_H
 
 #include <Arduino.h>
+#include <mutex>
 #include "config.h"
+#include "board_profiles.h"
+#include "relay_mask.h"
+#include "output_backends.h"
+#include "log_buffer.h"
+
+/*
+ * Relay Control
+ *
+ * Templated over a board profile (board_profiles.h) and its output backend
+ * (output_backends.h). Relay state is a RelayMask; the polarity inversion
+ * is folded in at compile time and the backend only sees output levels.
+ * setMask()/allOn()/allOff() switch any set of relays in one backend
+ * update - one register write per GPIO port, one bus transaction per
+ * expander. set<I>() checks the index at compile time.
+ *
+ * An optional change hook sees every relay that actually switched, with
+ * the source the caller passed, on the task that switched it (counters in
+ * relay_stats.h, transition log in relay_history.h).
+ *
+ * Relays are switched from loop(), async_tcp and the UDP task. One mutex
+ * covers the state, the backend write and the change hook, so a switch and
+ * its hook call are never interleaved with another task's; the hook must
+ * not switch relays itself.
+ */
+
+// What switched a relay - passed through to the change hook
+enum RelaySource {
+    RELAY_SOURCE_OTHER = 0,
+    RELAY_SOURCE_MQTT,
+    RELAY_SOURCE_HTTP,
+    RELAY_SOURCE_RF,
+    RELAY_SOURCE_SCHEDULE,
+    RELAY_SOURCE_BOOT,      // Saved states restored at boot
+    RELAY_SOURCE_GROUP,     // MQTT group command
+    RELAY_SOURCE_UDP,       // UDP control protocol
+    RELAY_SOURCE_COUNT
+};
+
+template <typename Board, typename Output = typename DefaultOutput<Board>::type>
+class BoardRelayControl {
+public:
+    static constexpr int COUNT = Board::RELAY_COUNT;
+    typedef RelayMask<COUNT> Mask;
+
+    static constexpr Mask ALL_MASK = Mask::all();
+
+    // changed = relays that switched, states = all relays after the change
+    typedef void (*ChangeHook)(const Mask& changed, const Mask& states, RelaySource source);
 
-class RelayControl {
 private:
-    bool relayStates[NUM_RELAYS];
-    
+    static constexpr Mask defaultMask() {
+        Mask m;
+        for (int i = 0; i < COUNT; i++) {
+            m.set(i, Board::DEFAULT_ON[i]);
+        }
+        return m;
+    }
+
+    Output output;
+    Mask states;  // Bit i = relay i logically ON
+    ChangeHook changeHook;
+    mutable std::mutex lock;
+
+    // Relay states -> output levels
+    static Mask levelsOf(const Mask& relays) {
+        return Board::ACTIVE_LOW ? ~relays : relays;
+    }
+
+    // Lock held
+    void setStateLocked(int relayIndex, bool state, RelaySource source) {
+        bool changed = states.test(relayIndex) != state;
+        states.set(relayIndex, state);
+        output.write(relayIndex, state != Board::ACTIVE_LOW);
+        LOGI("Relay %d set to %s", relayIndex + 1, state ? "ON" : "OFF");
+        if (changed && changeHook) {
+            Mask m;
+            m.set(relayIndex);
+            changeHook(m, states, source);
+        }
+    }
+
 public:
-    RelayControl();
-    void init();
-    void setState(int relayIndex, bool state);
-    bool getState(int relayIndex);
-    void toggleRelay(int relayIndex);
-    void allOn();
-    void allOff();
-};
+    static constexpr Mask DEFAULT_MASK = defaultMask();
 
-#endif
+    BoardRelayControl() : changeHook(nullptr) {}
+
+    void init() {
+        states = DEFAULT_MASK;
+        output.begin(levelsOf(states));
+        Serial.println("Relays initialized");
+    }
+
+    void setState(int relayIndex, bool state, RelaySource source = RELAY_SOURCE_OTHER) {
+        if (relayIndex < 0 || relayIndex >= COUNT) return;
+        std::lock_guard<std::mutex> guard(lock);
+        setStateLocked(relayIndex, state, source);
+    }
+
+    // Compile-time index: no bounds check
+    template <int I>
+    void set(bool state, RelaySource source = RELAY_SOURCE_OTHER) {
+        static_assert(I >= 0 && I < COUNT, "relay index out of range");
+        std::lock_guard<std::mutex> guard(lock);
+        bool changed = states.test(I) != state;
+        states.set(I, state);
+        output.write(I, state != Board::ACTIVE_LOW);
+        if (changed && changeHook) {
+            Mask m;
+            m.set(I);
+            changeHook(m, states, source);
+        }
+    }
+
+    bool getState(int relayIndex) const {
+        if (relayIndex < 0 || relayIndex >= COUNT) return false;
+        std::lock_guard<std::mutex> guard(lock);
+        return states.test(relayIndex);
+    }
+
+    void toggleRelay(int relayIndex) {
+        if (relayIndex >= 0 && relayIndex < COUNT) {
+            std::lock_guard<std::mutex> guard(lock);
+            setStateLocked(relayIndex, !states.test(relayIndex), RELAY_SOURCE_OTHER);
+        }
+    }
 
+    // Sets every relay in changeMask to its bit in newStates, in one backend
+    // update. Returns the relays that actually switched.
+    Mask setMask(const Mask& newStates, const Mask& changeMask, RelaySource source = RELAY_SOURCE_OTHER) {
+        std::lock_guard<std::mutex> guard(lock);
+        Mask previous = states;
+        states = (states & ~changeMask) | (newStates & changeMask);
+        output.apply(levelsOf(states), changeMask);
+        if (changeHook && states != previous) {
+            changeHook(states ^ previous, states, source);
+        }
+        return states ^ previous;
+    }
 
+    void allOn() {
+        setMask(ALL_MASK, ALL_MASK);
+        LOGI("All relays ON");
+    }
 
+    void allOff() {
+        setMask(Mask(), ALL_MASK);
+        LOGI("All relays OFF");
+    }
 
+    // A copy - the mask spans several words another task may be writing
+    Mask getMask() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return states;
+    }
 
+    void setChangeHook(ChangeHook hook) { changeHook = hook; }
+
+    // GPIO driving the relay, -1 on expander boards
+    static int pin(int relayIndex) { return Output::pin(relayIndex); }
+};
+
+typedef BoardRelayControl<ActiveBoard> RelayControl;
+
+#endif
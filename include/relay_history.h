@@ -0,0 +1,141 @@
+#ifndef RELAY_HISTORY_H
+#define RELAY_HISTORY_H
+
+#include <Arduino.h>
+#include <mutex>
+#include "config.h"
+#include "relay_control.h"
+
+/*
+ * Relay History
+ *
+ * The last few thousand relay transitions - when, which relay, on or off
+ * and what switched it - kept in a fixed RELAY_HISTORY_BYTES ring in RAM,
+ * for answering "who turned the pump on at 3am" without a log server.
+ *
+ * Entries are delta encoded: a varint of (milliseconds since the previous
+ * entry << 3 | source) and one byte of (state << 7 | relay index): 3 bytes
+ * for a change within 2 s of the previous one, 4 within 4 minutes, 5 within
+ * 9 hours, and 2 per relay for a bank switched by one group command - 4 KB
+ * holds 1000-2000 transitions. Once full, the oldest entries are dropped.
+ *
+ * Times are on the history clock: milliseconds of uptime, continued across
+ * a planned restart when the ring was snapshotted (RELAY_HISTORY_SNAPSHOT)
+ * and restored at the next boot - the downtime itself isn't counted. The
+ * /api/relays/history response carries "now" on the same clock.
+ *
+ * record() runs on the task that switched the relay (loop, async_tcp or
+ * the UDP task) and queries from a web handler; both take a mutex, held
+ * for one change on the writer side and one matching entry on the reader
+ * side.
+ */
+
+static_assert(NUM_RELAYS <= 128, "History entries store the relay index in 7 bits");
+static_assert(RELAY_SOURCE_COUNT <= 8, "History entries store the source in 3 bits");
+
+// JSON name of a source ("mqtt", "http", ...)
+const char* relaySourceName(uint8_t source);
+
+struct RelayHistoryEntry {
+    uint64_t time;      // History clock, ms
+    uint8_t relay;      // 0-based
+    uint8_t source;     // RelaySource
+    bool state;
+};
+
+// Snapshot header - followed by the used ring bytes, oldest entry first
+struct RelayHistorySnapshot {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t relayCount;    // NUM_RELAYS of the firmware that wrote it
+    uint32_t used;
+    uint32_t count;
+    uint64_t headTime;      // Oldest entry
+    uint64_t tailTime;      // Newest entry
+    uint64_t savedTime;     // History clock when written - the next boot carries on from here
+};
+
+class RelayHistory {
+public:
+    // Read position of a streaming query - survives entries being dropped under it
+    struct Cursor {
+        uint32_t seq;       // Next entry
+        uint32_t offset;
+        uint64_t time;      // Time of the entry before seq
+        bool started;
+    };
+
+private:
+    uint8_t ring[RELAY_HISTORY_BYTES];
+    uint32_t head;          // Offset of the oldest entry
+    uint32_t used;
+    uint32_t firstSeq;      // Sequence number of the oldest entry
+    uint32_t nextSeq;
+    uint64_t headTime;
+    uint64_t tailTime;
+    uint64_t clockOffset;   // Added to uptime - history carried over a restart
+    uint64_t uptimeHigh;    // millis() wraps, extended to 64 bits
+    uint32_t lastMillis;
+    uint32_t dropped;
+    mutable std::mutex lock;
+
+    uint64_t clockLocked(uint32_t now);
+    void append(uint64_t time, uint8_t relay, bool state, uint8_t source);
+    void dropOldest();
+    uint8_t byteAt(uint32_t offset) const { return ring[offset % RELAY_HISTORY_BYTES]; }
+    // Decodes the entry at offset; returns its length
+    uint32_t decode(uint32_t offset, uint64_t& delta, uint8_t& source, uint8_t& relayState) const;
+
+public:
+    RelayHistory();
+
+    // Change hook - one entry per relay that switched
+    void record(const RelayControl::Mask& changed, const RelayControl::Mask& states, RelaySource source,
+                uint32_t now);
+
+    // History clock at uptime now
+    uint64_t clock(uint32_t now);
+
+    // Next entry at or after cursor matching the filter (relay -1 = any) up to
+    // until; false when there are no more. Entries dropped since the last call
+    // are skipped.
+    Cursor begin() const;
+    bool next(Cursor& cursor, uint64_t since, uint64_t until, int relay, RelayHistoryEntry& entry) const;
+
+    uint32_t getCount() const;
+    uint32_t getUsedBytes() const;
+    uint32_t getDropped() const { return dropped; }
+
+    // Planned restart: header + ring bytes, written to and read back from LittleFS
+    size_t snapshotSize() const;
+    size_t writeSnapshot(Print& out, uint32_t now);
+    // Puts the saved entries in front of the ones recorded since boot; false if it isn't ours
+    bool restoreSnapshot(const uint8_t* data, size_t length);
+};
+
+// Streams matching entries as JSON for a chunked response:
+//   {"now":..,"count":..,"dropped":..,"entries":[{"t":..,"relay":1,"state":1,"source":"mqtt"},..]}
+class RelayHistoryQuery {
+private:
+    const RelayHistory& history;
+    RelayHistory::Cursor cursor;
+    uint64_t now;
+    uint64_t since;
+    uint64_t until;
+    int relay;
+    uint8_t stage;
+    bool first;
+    char line[96];          // Text not yet handed out - a chunk can end mid-entry
+    uint8_t lineLength;
+    uint8_t linePosition;
+
+public:
+    RelayHistoryQuery(const RelayHistory& history, uint64_t now, uint64_t since, uint64_t until, int relay);
+
+    // Next part of the response; 0 once it is complete
+    size_t read(uint8_t* buffer, size_t maxLength);
+};
+
+extern RelayHistory relayHistory;
+
+#endif
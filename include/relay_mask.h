@@ -0,0 +1,128 @@
+#ifndef RELAY_MASK_H
+#define RELAY_MASK_H
+
+#include <stdint.h>
+
+/*
+ * Fixed-size relay bitmask
+ *
+ * One bit per relay (bit i = relay i + 1), stored in 32-bit words so any
+ * board size works - 16 native GPIOs or 128 expander channels. All
+ * operations are constexpr so board-wide masks are computed at compile time.
+ */
+template <int N>
+struct RelayMask {
+    static constexpr int BITS = N;
+    static constexpr int WORDS = (N + 31) / 32;
+    static constexpr int BYTES = (N + 7) / 8;
+
+    uint32_t words[WORDS];
+
+    constexpr RelayMask() : words() {}
+
+    // Low 64 relays from an integer (e.g. a JSON or MQTT bitmask)
+    constexpr explicit RelayMask(uint64_t low) : words() {
+        for (int w = 0; w < WORDS && w < 2; w++) {
+            words[w] = (uint32_t)(low >> (32 * w));
+        }
+        trim();
+    }
+
+    static constexpr RelayMask all() {
+        RelayMask m;
+        for (int w = 0; w < WORDS; w++) {
+            m.words[w] = 0xFFFFFFFFUL;
+        }
+        m.trim();
+        return m;
+    }
+
+    constexpr bool test(int i) const {
+        return (words[i >> 5] >> (i & 31)) & 1;
+    }
+
+    constexpr void set(int i, bool on = true) {
+        if (on) {
+            words[i >> 5] |= (uint32_t)1 << (i & 31);
+        } else {
+            words[i >> 5] &= ~((uint32_t)1 << (i & 31));
+        }
+    }
+
+    constexpr bool any() const {
+        for (int w = 0; w < WORDS; w++) {
+            if (words[w]) return true;
+        }
+        return false;
+    }
+
+    constexpr int count() const {
+        int n = 0;
+        for (int w = 0; w < WORDS; w++) {
+            for (uint32_t v = words[w]; v; v &= v - 1) n++;
+        }
+        return n;
+    }
+
+    // 8 / 16 relay slices, as written to expander registers
+    constexpr uint8_t byteAt(int b) const {
+        return (uint8_t)(words[b >> 2] >> ((b & 3) * 8));
+    }
+
+    constexpr uint16_t halfAt(int h) const {
+        return (uint16_t)(words[h >> 1] >> ((h & 1) * 16));
+    }
+
+    constexpr void setByte(int b, uint8_t value) {
+        int shift = (b & 3) * 8;
+        words[b >> 2] = (words[b >> 2] & ~((uint32_t)0xFF << shift)) | ((uint32_t)value << shift);
+    }
+
+    constexpr uint64_t low64() const {
+        return WORDS > 1 ? ((uint64_t)words[1] << 32) | words[0] : words[0];
+    }
+
+    constexpr RelayMask operator&(const RelayMask& o) const {
+        RelayMask m;
+        for (int w = 0; w < WORDS; w++) m.words[w] = words[w] & o.words[w];
+        return m;
+    }
+
+    constexpr RelayMask operator|(const RelayMask& o) const {
+        RelayMask m;
+        for (int w = 0; w < WORDS; w++) m.words[w] = words[w] | o.words[w];
+        return m;
+    }
+
+    constexpr RelayMask operator^(const RelayMask& o) const {
+        RelayMask m;
+        for (int w = 0; w < WORDS; w++) m.words[w] = words[w] ^ o.words[w];
+        return m;
+    }
+
+    constexpr RelayMask operator~() const {
+        RelayMask m;
+        for (int w = 0; w < WORDS; w++) m.words[w] = ~words[w];
+        m.trim();
+        return m;
+    }
+
+    constexpr bool operator==(const RelayMask& o) const {
+        for (int w = 0; w < WORDS; w++) {
+            if (words[w] != o.words[w]) return false;
+        }
+        return true;
+    }
+
+    constexpr bool operator!=(const RelayMask& o) const { return !(*this == o); }
+
+private:
+    // Keep bits above N clear
+    constexpr void trim() {
+        if (N % 32) {
+            words[WORDS - 1] &= ((uint32_t)1 << (N % 32)) - 1;
+        }
+    }
+};
+
+#endif
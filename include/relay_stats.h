@@ -0,0 +1,85 @@
+#ifndef RELAY_STATS_H
+#define RELAY_STATS_H
+
+#include <Arduino.h>
+#include <mutex>
+#include "config.h"
+#include "relay_control.h"
+
+/*
+ * Relay Statistics
+ *
+ * Per relay: switch count, cumulative on-time and the uptime of the last
+ * change - for contact wear planning and for spotting automations that
+ * chatter. Duty cycle is on-time over the time the counters have run.
+ *
+ * Counting is done in RAM from the RelayControl change hook, so a toggle
+ * costs a few increments and no flash write. Totals are checkpointed to NVS
+ * (the "relay_stats" blob) every RELAY_STATS_CHECKPOINT_MS and before a
+ * planned restart; an unplanned reset loses at most one interval.
+ *
+ * Running on-periods and the tracked time are folded into the totals at
+ * every checkpoint, so no millis() difference ever spans the 49 day wrap.
+ * record() runs on the task that switched the relay (loop, async_tcp or
+ * the UDP task), everything else from loop() or a web handler. On-times
+ * are 64-bit and record() is a read-modify-write, so every access takes
+ * the mutex; the *Locked helpers expect it held.
+ */
+
+// NVS layout - a blob written for a different relay count is ignored
+struct RelayStatsRecord {
+    uint16_t count;                     // NUM_RELAYS of the firmware that wrote it
+    uint16_t reserved;
+    uint32_t trackedSeconds;            // Time the counters have been running
+    uint32_t switches[NUM_RELAYS];
+    uint32_t onSeconds[NUM_RELAYS];
+};
+
+class RelayStats {
+private:
+    uint32_t switches[NUM_RELAYS];
+    uint64_t onMillis[NUM_RELAYS];          // Completed (or folded) on-periods
+    uint32_t onSinceMillis[NUM_RELAYS];     // Start of the running on-period
+    uint32_t lastChangeMillis[NUM_RELAYS];  // 0 = no change since boot or reset
+    RelayControl::Mask onMask;              // Relays in a running on-period
+    uint64_t trackedMillis;                 // Counter run time up to foldMillis
+    uint32_t foldMillis;
+    uint32_t lastCheckpointMillis;
+    mutable std::mutex lock;
+
+    void fold(uint32_t now);
+    uint32_t onSecondsLocked(int relayIndex, uint32_t now) const;
+    uint32_t trackedSecondsLocked(uint32_t now) const;
+    float dutyCycleLocked(int relayIndex, uint32_t now) const;
+
+public:
+    RelayStats();
+
+    // Boot: totals from NVS (Storage::load), then the relays that are on
+    void restore(const RelayStatsRecord& saved);
+    void begin(const RelayControl::Mask& states, uint32_t now);
+
+    // Change hook - changed = relays that switched, states = all relays after it
+    void record(const RelayControl::Mask& changed, const RelayControl::Mask& states, uint32_t now);
+
+    // Checkpoint - snapshot() folds the running periods and restarts the interval
+    bool checkpointDue(uint32_t now) const;
+    void snapshot(RelayStatsRecord& out, uint32_t now);
+
+    // Zeroes every counter and forgets the last changes (e.g. after the relays were replaced)
+    void reset(uint32_t now);
+
+    uint32_t getSwitches(int relayIndex) const;
+    uint32_t getOnSeconds(int relayIndex, uint32_t now) const;
+    uint32_t getTrackedSeconds(uint32_t now) const;
+    float getDutyCycle(int relayIndex, uint32_t now) const;
+    uint32_t getLastChange(int relayIndex) const;
+
+    // First count relays
+    void writeJson(Print& out, int count, uint32_t now) const;
+    void writePrometheus(Print& out, int count, uint32_t now) const;
+};
+
+extern RelayStats relayStats;
+
+#endif
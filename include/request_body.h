@@ -0,0 +1,78 @@
+#ifndef REQUEST_BODY_H
+#define REQUEST_BODY_H
+
+#include <Arduino.h>
+#include "config.h"
+
+/*
+ * Request Body Assembly
+ *
+ * ESPAsyncWebServer hands POST bodies to the handler in chunks, one per TCP
+ * segment, with the chunk's offset (index) and the Content-Length (total).
+ * Chunks are copied into a fixed slot until the body is complete, so the
+ * handler parses the whole body exactly once.
+ *
+ * - HTTP_BODY_SLOTS bodies can be assembled at the same time; the slots are
+ *   allocated once, nothing is allocated per request
+ * - A Content-Length over HTTP_BODY_MAX_BYTES is rejected on the first chunk,
+ *   before anything is copied
+ * - A slot belongs to its request until released (on disconnect), or until
+ *   no chunk came for HTTP_BODY_TIMEOUT_MS and another request needs it.
+ *   The evicted request's next chunk gets BODY_EVICTED, so its handler can
+ *   answer it (408) instead of leaving the client waiting
+ * - A chunk out of order or past Content-Length frees the slot and gets
+ *   BODY_OUT_OF_ORDER (400); the rest of that body is BODY_IGNORED
+ *
+ * Bodies that arrive in one chunk don't need a slot and are parsed in place.
+ * Only called from the async_tcp task, so no locking.
+ */
+
+enum BodyStatus {
+    BODY_COMPLETE = 0,  // Whole body available
+    BODY_PARTIAL,       // More chunks to come
+    BODY_TOO_LARGE,     // Content-Length over HTTP_BODY_MAX_BYTES
+    BODY_BUSY,          // All slots in use
+    BODY_IGNORED,       // Chunk of a body that was already rejected
+    BODY_EVICTED,       // First chunk since the slot was taken by another request
+    BODY_OUT_OF_ORDER   // Chunk not at the expected offset, or past Content-Length - body dropped
+};
+
+class RequestBodyPool {
+private:
+    struct Slot {
+        const void* owner;      // nullptr = free
+        size_t total;
+        size_t received;
+        uint32_t lastChunkMillis;
+        char data[HTTP_BODY_MAX_BYTES + 1];  // +1 keeps the body terminated
+    };
+    Slot slots[HTTP_BODY_SLOTS];
+    const void* evicted[HTTP_BODY_SLOTS];  // Owners that lost their slot and haven't been told yet
+    int nextEvicted;
+
+    int find(const void* owner) const;
+    int acquire(const void* owner, size_t total);
+
+public:
+    // Rejections, for /metrics
+    uint32_t tooLarge;
+    uint32_t busy;
+    uint32_t timedOut;
+    uint32_t outOfOrder;
+
+    RequestBodyPool();
+
+    // Adds one chunk. On BODY_COMPLETE, body / length point at the whole
+    // body - into the slot, or straight at data if it came in one chunk.
+    BodyStatus append(const void* owner, const uint8_t* data, size_t len, size_t index, size_t total,
+                      char*& body, size_t& length);
+
+    // Frees the owner's slot, if it has one, and forgets an eviction
+    void release(const void* owner);
+
+    int slotsInUse() const;
+};
+
+extern RequestBodyPool requestBodies;
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef RF_CODES_H
+#define RF_CODES_H
+
+#include <Arduino.h>
+
+// RF Receiver settings - Multiple codes support
+#define MAX_RF_CODES 10
+
+struct RFCode {
+    char name[32];              // User-defined name
+    unsigned long code;         // RF code value
+    unsigned int bitLength;     // Bit length
+    unsigned int protocol;      // Protocol
+    bool active;                // Is this slot in use
+    unsigned long lastTrigger;  // Last trigger timestamp
+};
+
+class RFCodeStore {
+private:
+    RFCode codes[MAX_RF_CODES];
+    int codeCount;
+    
+public:
+    RFCodeStore();
+    void clear();
+    int add(const char* name, unsigned long code, unsigned int bitLength, unsigned int protocol);
+    bool remove(int slot);
+    int match(unsigned long code, unsigned int bitLength, unsigned int protocol) const;
+    RFCode& get(int slot) { return codes[slot]; }
+    int count() const { return codeCount; }
+    
+    // Raw table access for persistence (stored as a single blob)
+    RFCode* table() { return codes; }
+    size_t tableSize() const { return sizeof(codes); }
+    void setCount(int count) { codeCount = count; }
+};
+
+#endif
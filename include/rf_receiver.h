@@ -0,0 +1,65 @@
+#ifndef RF_RECEIVER_H
+#define RF_RECEIVER_H
+
+#include <Arduino.h>
+#include "config.h"
+#include "pulse_decoder.h"
+
+#ifndef NATIVE_BUILD
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#endif
+
+/*
+ * RMT-Captured RF Receiver
+ *
+ * The RMT peripheral timestamps the receiver's edges in hardware (1 us
+ * ticks) and hands over a whole capture once the line has been idle for
+ * RF_RMT_IDLE_US - no per-edge interrupt. Captures are decoded from loop()
+ * by PulseDecoder.
+ *
+ * The idle threshold is longer than any protocol's sync gap, so the repeats
+ * of one button press (and their gaps) arrive in one capture. A capture
+ * longer than the RMT memory (RF_RMT_MEM_BLOCKS x 64 items) is cut off,
+ * which still leaves several repeats to decode.
+ *
+ * Same interface as RCSwitch (available / getReceived* / resetAvailable).
+ * The most recent capture is kept for GET /api/rf/trace, in the text format
+ * native/rfreplay reads.
+ */
+
+class RmtRFReceiver {
+private:
+    PulseDecoder decoder;
+#ifndef NATIVE_BUILD
+    RingbufHandle_t ringbuf;
+#endif
+    bool started;
+
+    // Most recent capture with enough pulses to be a frame
+    uint16_t lastCapture[RF_TRACE_MAX_PULSES];
+    size_t lastCaptureLength;
+    uint32_t lastCaptureMillis;
+
+    void poll();
+
+public:
+    RmtRFReceiver();
+    bool begin(int pin);
+
+    PulseDecoder& getDecoder() { return decoder; }
+
+    // Decodes one capture of alternating-level durations (also the test / replay entry point)
+    void feedCapture(const uint16_t* durations, size_t count);
+
+    bool available() { poll(); return decoder.available(); }
+    void resetAvailable() { decoder.resetAvailable(); }
+    unsigned long getReceivedValue() const { return decoder.getReceivedValue(); }
+    unsigned int getReceivedBitlength() const { return decoder.getReceivedBitlength(); }
+    unsigned int getReceivedDelay() const { return decoder.getReceivedDelay(); }
+    unsigned int getReceivedProtocol() const { return decoder.getReceivedProtocol(); }
+
+    void writeTrace(Print& out) const;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Runtime settings - loaded from preferences, override the defaults in main.cpp
+struct Settings {
+    char mqtt_server[40];
+    char mqtt_port[6];
+    char mqtt_user[40];
+    char mqtt_password[40];
+    char mqtt_hostname[40];   // Configurable MQTT hostname for topics
+    int activeRelayCount;     // Relays exposed to Home Assistant
+    bool deviceDiscovery;     // true = single device-based discovery message
+    int lastDiscoveryMode;    // Mode last published (-1 = unknown, 0 = entity, 1 = device)
+    bool aggregateState;      // true = whole relay bank on one <hostname>/state topic
+};
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <mutex>
+#include "settings.h"
+#include "relay_control.h"
+#include "rf_codes.h"
+#include "group_commands.h"
+#include "udp_control.h"
+
+// All persistent data lives in a single preferences namespace
+#define PREFS_NAMESPACE "relay-states"
+
+/*
+ * Configuration Record
+ *
+ * Settings and RF codes are stored together as one versioned, CRC-32
+ * protected blob, so boot needs a single namespace open and a couple of
+ * blob reads instead of one lookup per key, and an update can never leave
+ * e.g. the MQTT server and port from two different saves.
+ *
+ * The record is double-buffered in two keys ("cfg_a" / "cfg_b"). Each save
+ * goes to the slot not holding the live copy with the next sequence number;
+ * at boot the valid copy with the highest sequence wins. A save interrupted
+ * by a reset leaves the previous copy intact.
+ *
+ * Schema changes append fields and bump CONFIG_RECORD_VERSION. Older
+ * records are accepted and the fields they don't cover keep their defaults.
+ * A newer record (firmware downgraded) is accepted too: the fields this
+ * version knows are kept, the ones it doesn't are lost on its next save.
+ * Firmware without a record migrates the individual keys written by
+ * earlier versions once, then removes them.
+ *
+ * Relay states are not part of the record: they change on every command
+ * and stay in their own small "relay_mask" blob. The relay counters
+ * (relay_stats.h) have their own "relay_stats" blob for the same reason.
+ *
+ * Saves come from loop() and from web handlers on async_tcp. A mutex
+ * serializes every change to the live record and every NVS write; load()
+ * runs in setup(), before the other tasks start.
+ */
+
+#define CONFIG_RECORD_MAGIC   0x52434647  // Rejects blobs that aren't a record at all
+#define CONFIG_RECORD_VERSION 4
+
+struct ConfigRecord {
+    // Header
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;            // sizeof(ConfigRecord) of the firmware that wrote it
+    uint32_t sequence;          // Incremented on every save, newest copy wins
+    uint32_t crc;               // CRC-32 of bytes [payload, length)
+
+    // Version 1
+    uint8_t mqttConfigured;     // 0 = use the compiled-in MQTT defaults
+    uint8_t deviceDiscovery;
+    int8_t lastDiscoveryMode;
+    uint8_t aggregateState;     // Was reserved (always 0) before - older records read as off
+    int32_t activeRelayCount;
+    char mqtt_server[40];
+    char mqtt_port[6];
+    char mqtt_user[40];
+    char mqtt_password[40];
+    char mqtt_hostname[40];
+    int32_t rfCount;
+    RFCode rfCodes[MAX_RF_CODES];
+
+    // Version 2
+    uint8_t otaTrial;           // Running firmware was just updated and hasn't passed its health check
+    uint8_t otaTrialBoots;      // Boots started on trial so far
+    uint8_t reserved2[2];
+
+    // Version 3
+    GroupConfig groupConfig;    // Group memberships and scenes, empty in older records
+
+    // Version 4
+    uint8_t udpKeySet;          // 0 = UDP control protocol off
+    uint8_t reserved4[3];
+    uint8_t udpKey[UDP_KEY_BYTES];
+};
+
+class Storage {
+private:
+    Preferences& preferences;
+    ConfigRecord record;        // Live copy, every save rewrites it as a whole
+    int liveSlot;               // Slot holding the live copy (-1 = none yet)
+    mutable std::mutex lock;
+
+    bool readRecord(int slot, ConfigRecord& out);
+    bool readNewerRecord(int slot, size_t length, ConfigRecord& out);
+    void writeRecord();
+    void migrateLegacyKeys();
+    void applySettings(Settings& settings) const;
+
+public:
+    explicit Storage(Preferences& prefs);
+
+    // Boot restore: settings, RF codes and relay states from one namespace open
+    void load(Settings& settings, RelayControl& relays, RFCodeStore& rfCodes);
+
+    void saveMqttSettings(const Settings& settings, bool savePassword);
+    void saveActiveRelayCount(int count);
+    void saveDiscoveryMode(bool deviceDiscovery, bool aggregateState);
+    void saveLastDiscoveryMode(int mode);
+    void saveRelayStates(RelayControl& relays);
+    void saveRelayStats();
+    void saveRFCodes(RFCodeStore& rfCodes);
+
+    bool isOtaTrial() const;
+    int getOtaTrialBoots() const;
+    void saveOtaTrial(bool trial, int boots);
+
+    void loadGroupConfig(GroupConfig& config) const;
+    void saveGroupConfig(const GroupConfig& config);
+
+    // UDP control key; false if none is set
+    bool loadUdpKey(uint8_t key[UDP_KEY_BYTES]) const;
+    // nullptr = protocol off
+    void saveUdpKey(const uint8_t* key);
+};
+
+#endif
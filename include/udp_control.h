@@ -0,0 +1,203 @@
+#ifndef UDP_CONTROL_H
+#define UDP_CONTROL_H
+
+#include <Arduino.h>
+#include <mutex>
+#include "config.h"
+#include "relay_mask.h"
+#include "hmac_sha256.h"
+
+/*
+ * UDP Control Protocol
+ *
+ * Fixed-size binary frames for LAN clients (PLCs, scripts) that need relays
+ * switched in a millisecond or two: one datagram each way - no TCP connect,
+ * no JSON, no broker hop. Listens on UDP_CONTROL_PORT once a shared key is
+ * set with POST /api/admin/udp.
+ *
+ * Request, 64 bytes (integers little-endian, masks bit i = relay i + 1):
+ *    0  'R' 'C', version (UDP_VERSION), op (UdpOp)
+ *    4  u16 client id, u8 scene index (SCENE), reserved
+ *    8  u32 sequence number
+ *   12  u32 session - the device's, from its last reply (0 = none yet)
+ *   16  16 bytes select - relays to switch (SET)
+ *   32  16 bytes value - their new states
+ *   48  first 16 bytes of HMAC-SHA256(key, bytes 0-47)
+ *
+ * Reply, 48 bytes:
+ *    0  'R' 'C', version, status (UdpStatus)
+ *    4  u16 client id, u8 active relay count, reserved
+ *    8  u32 sequence number of the request
+ *   12  u32 session - the device's current one
+ *   16  16 bytes state - every relay after the command
+ *   32  first 16 bytes of HMAC-SHA256(key, bytes 0-31)
+ *
+ * GET only reads the state. SET switches the selected relays in one
+ * RelayControl::setMask(); a selected relay above activeRelayCount refuses
+ * the whole command. SCENE applies a scene from /api/admin/groups by its
+ * index in the GET response.
+ *
+ * Retries: the last sequence number and reply are kept per client id
+ * (UDP_CONTROL_CLIENTS of them). The same number again gets the same reply
+ * without running the command, an older one gets UDP_STATUS_STALE and the
+ * current state - a retried or reordered SET is applied once. Clients count
+ * up from any start, wrapping. The source address isn't part of it, as the
+ * tag doesn't cover it: a frame resent from another host is still the same
+ * client's, so every client needs its own id.
+ *
+ * Replays: the table alone only covers clients it still holds, so every
+ * frame also carries the device's session number, inside the tag. It is
+ * drawn from esp_random() on the first frame after boot or a key change
+ * (the radio is up by then), and drawn again whenever a client is evicted
+ * from the table. A frame from another session - captured before a
+ * restart or an eviction, or a client's first - runs nothing and records
+ * nothing: it gets UDP_STATUS_SESSION with the state and the current
+ * session, and the client sends its command again with a new sequence
+ * number. Commands are absolute (no toggle), so that resend is safe.
+ *
+ * Frames with the wrong size, magic, version or tag get no reply at all.
+ * handle() works on the caller's buffers and allocates nothing. It runs on
+ * the AsyncUDP task and setKey() on loop(), so both take a mutex.
+ */
+
+#define UDP_MAGIC_0 'R'
+#define UDP_MAGIC_1 'C'
+#define UDP_VERSION 2
+#define UDP_MASK_BYTES 16
+#define UDP_TAG_BYTES 16
+#define UDP_REQUEST_BYTES 64
+#define UDP_REPLY_BYTES 48
+#define UDP_KEY_BYTES 32
+
+typedef RelayMask<UDP_MASK_BYTES * 8> UdpMask;
+static_assert(NUM_RELAYS <= UdpMask::BITS, "UDP frames must cover every relay on the board");
+
+enum UdpOp {
+    UDP_OP_GET = 0,
+    UDP_OP_SET,
+    UDP_OP_SCENE,
+    UDP_OP_COUNT
+};
+
+enum UdpStatus {
+    UDP_STATUS_OK = 0,
+    UDP_STATUS_STALE,       // Sequence number older than the client's last - nothing done
+    UDP_STATUS_BAD_OP,
+    UDP_STATUS_BAD_RELAY,   // Selected relay isn't active
+    UDP_STATUS_BAD_SCENE,   // No scene at that index
+    UDP_STATUS_SESSION,     // Not the device's current session - nothing done, resend in the reply's
+    UDP_STATUS_COUNT
+};
+
+// What happened to a received frame (counted, on /metrics)
+enum UdpResult {
+    UDP_RESULT_OK = 0,      // Command ran
+    UDP_RESULT_REFUSED,     // ... but was refused (bad op, relay or scene)
+    UDP_RESULT_RETRY,       // Repeat of the last sequence number - reply resent
+    UDP_RESULT_STALE,
+    UDP_RESULT_SESSION,     // Other session (replayed, or the client's first) - answered, not run
+    UDP_RESULT_MALFORMED,   // Dropped: size, magic or version
+    UDP_RESULT_BAD_TAG,     // Dropped: wrong key or altered
+    UDP_RESULT_DISABLED,    // Dropped: no key set
+    UDP_RESULT_COUNT
+};
+
+struct UdpCommand {
+    uint16_t client;
+    uint32_t sequence;
+    uint32_t session;
+    uint8_t op;             // UdpOp
+    uint8_t scene;
+    UdpMask select;
+    UdpMask value;
+};
+
+struct UdpReply {
+    uint16_t client;
+    uint32_t sequence;
+    uint32_t session;
+    uint8_t status;         // UdpStatus
+    uint8_t relayCount;
+    UdpMask state;
+};
+
+// Frames and commands so far, for /api/admin/udp and /metrics
+struct UdpCounters {
+    uint32_t frames[UDP_RESULT_COUNT];
+    uint32_t commands[UDP_OP_COUNT];    // Run, by op
+};
+
+// Widens a board mask to the wire width
+template <int N>
+UdpMask udpMaskOf(const RelayMask<N>& mask) {
+    UdpMask m;
+    for (int w = 0; w < RelayMask<N>::WORDS; w++) {
+        m.words[w] = mask.words[w];
+    }
+    return m;
+}
+
+// Frame encoding, shared with the native/udpctl client
+void udpEncodeRequest(const HmacSha256& key, const UdpCommand& command, uint8_t frame[UDP_REQUEST_BYTES]);
+void udpEncodeReply(const HmacSha256& key, const UdpReply& reply, uint8_t frame[UDP_REPLY_BYTES]);
+// false if the size, magic, version or tag is wrong
+bool udpDecodeRequest(const HmacSha256& key, const uint8_t* frame, size_t size, UdpCommand& command);
+bool udpDecodeReply(const HmacSha256& key, const uint8_t* frame, size_t size, UdpReply& reply);
+
+// 2 * UDP_KEY_BYTES hex digits, e.g. from `openssl rand -hex 32`
+bool udpParseKey(const char* hex, uint8_t key[UDP_KEY_BYTES]);
+
+// Runs a verified command: status, state after it and active relay count
+// go in reply. Called for GET too (and for the state sent with STALE and
+// SESSION).
+typedef void (*UdpCommandHandler)(const UdpCommand& command, UdpReply& reply);
+
+class UdpControl {
+private:
+    struct Client {
+        uint16_t id;            // Who the sequence number belongs to
+        bool used;
+        uint32_t sequence;      // Last one run
+        uint32_t seenMillis;
+        uint8_t reply[UDP_REPLY_BYTES];  // Sent for it - resent on a retry
+    };
+    HmacSha256 key;
+    bool enabled;
+    uint32_t session;               // 0 = not drawn yet
+    UdpCommandHandler handler;
+    Client clients[UDP_CONTROL_CLIENTS];
+    mutable std::mutex lock;
+
+    uint32_t counts[UDP_RESULT_COUNT];
+    uint32_t ops[UDP_OP_COUNT];     // Commands run, by op
+
+    Client* findClient(uint16_t id);
+    Client& addClient(uint16_t id, uint32_t now);
+    void newSession();
+    size_t answerState(const UdpCommand& command, UdpReply& result, uint8_t status, uint8_t reply[UDP_REPLY_BYTES]);
+
+public:
+    UdpControl();
+
+    void setHandler(UdpCommandHandler commandHandler) { handler = commandHandler; }
+
+    // nullptr = disabled. A new key forgets every client's sequence number and
+    // starts a new session
+    void setKey(const uint8_t* keyBytes, size_t size);
+    bool isEnabled() const { return enabled; }
+
+    // Reply length (UDP_REPLY_BYTES), or 0 to send nothing
+    size_t handle(const uint8_t* frame, size_t size, uint32_t now, uint8_t reply[UDP_REPLY_BYTES]);
+
+    int clientCount() const;
+    // Copies of the counters, taken under the lock
+    UdpCounters getCounters() const;
+    static const char* opName(int op);
+    static const char* statusName(int status);
+    static const char* resultName(int result);
+    void writePrometheus(Print& out) const;
+};
+
+extern UdpControl udpControl;
+
+#endif
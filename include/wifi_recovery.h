@@ -0,0 +1,81 @@
+#ifndef WIFI_RECOVERY_H
+#define WIFI_RECOVERY_H
+
+#include <Arduino.h>
+#include <atomic>
+#include "config.h"
+
+/*
+ * WiFi Recovery
+ *
+ * The WiFi event task and web handlers only post events here - a flag and
+ * a timestamp, nothing that waits. loop() polls the worker, which turns
+ * them into actions: leave AP mode once the station is back, and
+ * (re)start mDNS. Reconnects and manual restart requests arriving within
+ * MDNS_RESTART_DEBOUNCE_MS of each other become one mDNS restart, done
+ * without the settle delays the event handler used to sleep through.
+ *
+ * It also times outages: from the first disconnect after a working
+ * connection to the next IP address. Repeated disconnect events while the
+ * station retries don't restart the clock. Exposed on /metrics.
+ */
+
+enum RecoveryAction {
+    RECOVERY_NONE = 0,
+    RECOVERY_LEAVE_AP = 1 << 0,     // Station is connected - AP mode can go
+    RECOVERY_MDNS = 1 << 1          // (Re)start the mDNS responder
+};
+
+class WiFiRecovery {
+private:
+    enum Event {
+        EVENT_CONNECTED = 1 << 0,
+        EVENT_DISCONNECTED = 1 << 1,
+        EVENT_MDNS_RESTART = 1 << 2
+    };
+
+    // Posted from any task
+    std::atomic<uint32_t> events;
+    std::atomic<uint32_t> connectMillis;        // Last connect event
+    std::atomic<uint32_t> disconnectMillis;     // First disconnect not yet taken by poll()
+
+    // Worker state - loop() only, read by /metrics
+    bool connected;
+    uint32_t outageStartMillis;
+    bool mdnsRunning;
+    bool mdnsScheduled;
+    uint32_t mdnsDueMillis;
+
+    void scheduleMdns(uint32_t now, bool debounce);
+    void onConnected(uint32_t now);
+    void onDisconnected(uint32_t now);
+
+public:
+    uint32_t outages;
+    uint32_t recoveries;
+    uint32_t lastRecoveryMillis;
+    uint32_t maxRecoveryMillis;
+    uint64_t totalRecoveryMillis;
+    uint32_t mdnsRestarts;
+
+    WiFiRecovery();
+
+    // Event side - safe from the WiFi event task and web handlers
+    void postConnected(uint32_t now);
+    void postDisconnected(uint32_t now);
+    void requestMdnsRestart();
+
+    // Worker - from loop(); returns RecoveryAction bits to carry out now
+    uint32_t poll(uint32_t now);
+    void mdnsStarted(bool running);
+
+    bool isConnected() const { return connected; }
+    bool isMdnsRunning() const { return mdnsRunning; }
+    bool isMdnsScheduled() const { return mdnsScheduled; }
+
+    void writePrometheus(Print& out, uint32_t now) const;
+};
+
+extern WiFiRecovery wifiRecovery;
+
+#endif
@@ -0,0 +1,450 @@
+/*
+ * Host-side hot-path microbenchmarks
+ *
+ * Build and run with:
+ *   pio run -e native && .pio/build/native/program [filter]
+ *
+ * Each benchmark reports wall time, heap allocations, bytes written to
+ * MQTT / NVS and I2C/SPI bus transactions per operation. The Arduino,
+ * Preferences, PubSubClient, WiFi, RCSwitch, Wire, SPI and Update layers
+ * are the fakes from native/fakes, so numbers reflect the controller logic
+ * itself rather than the radio, flash or bus.
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <RCSwitch.h>
+#include <Wire.h>
+#include <SPI.h>
+#include <Update.h>
+#include <chrono>
+#include <functional>
+#include <new>
+#include "config.h"
+#include "relay_control.h"
+#include "rf_codes.h"
+#include "settings.h"
+#include "storage.h"
+#include "mqtt_bridge.h"
+#include "ota_update.h"
+#include "crc32.h"
+#include "relay_stats.h"
+#include "relay_history.h"
+#include "udp_control.h"
+
+// ---------------------------------------------------------------------------
+// Allocation counting
+// ---------------------------------------------------------------------------
+static unsigned long allocCount = 0;
+static unsigned long allocBytes = 0;
+static bool countAllocs = false;
+
+#if defined(__GLIBC__)
+// Hook malloc itself so ArduinoJson and libc allocations are counted too
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t n, size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+
+extern "C" void* malloc(size_t size) {
+    if (countAllocs) { allocCount++; allocBytes += size; }
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t n, size_t size) {
+    if (countAllocs) { allocCount++; allocBytes += n * size; }
+    return __libc_calloc(n, size);
+}
+
+extern "C" void* realloc(void* ptr, size_t size) {
+    if (countAllocs) { allocCount++; allocBytes += size; }
+    return __libc_realloc(ptr, size);
+}
+#else
+void* operator new(size_t size) {
+    if (countAllocs) { allocCount++; allocBytes += size; }
+    void* p = malloc(size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+#endif
+
+// ---------------------------------------------------------------------------
+// System under test
+// ---------------------------------------------------------------------------
+static Settings settings = {
+    "127.0.0.1",
+    "1883",
+    "bench",
+    "bench",
+    "esp32-relay",
+    NUM_RELAYS,
+    false,
+    0,
+    false
+};
+
+static RelayControl relayControl;
+static RFCodeStore rfCodes;
+static Preferences preferences;
+static Storage storage(preferences);
+static PubSubClient mqttClient;
+static RCSwitch rfReceiver;
+static MqttBridge mqttBridge(mqttClient, relayControl, rfCodes, settings, storage);
+static OtaUpdate otaUpdate(storage);
+
+// 1 MB firmware image for the OTA path: ESP image magic byte, then noise
+static std::vector<uint8_t> otaImage(1024 * 1024);
+static uint32_t otaImageCrc;
+
+// Expander boards, driven through the fake Wire / SPI buses
+static BoardRelayControl<RelayBoard64Mcp> mcpRelays;
+static BoardRelayControl<RelayBoard128Shift> shiftRelays;
+
+// UDP control: the firmware's handler minus the scene lookup and deferred publish
+static void udpHandler(const UdpCommand& command, UdpReply& reply) {
+    if (command.op == UDP_OP_SET) {
+        relayControl.setMask(relayMaskOf<RelayControl::Mask::BITS>(command.value),
+                             relayMaskOf<RelayControl::Mask::BITS>(command.select), RELAY_SOURCE_UDP);
+    }
+    reply.state = udpMaskOf(relayControl.getMask());
+    reply.relayCount = NUM_RELAYS;
+}
+
+// Signed SET frames with increasing sequence numbers, relay 3 on / off in turn
+static std::vector<uint8_t> udpFrames;
+static const unsigned long UDP_FRAMES = 50000;
+
+static void setupUdp() {
+    static const uint8_t key[UDP_KEY_BYTES] = {1, 2, 3, 4, 5, 6, 7, 8};
+    HmacSha256 hmac;
+    hmac.setKey(key, sizeof(key));
+    udpControl.setKey(key, sizeof(key));
+    udpControl.setHandler(udpHandler);
+
+    // The session, as a client learns it: a first frame answered with UDP_STATUS_SESSION
+    UdpCommand hello = UdpCommand();
+    hello.client = 1;
+    uint8_t frame[UDP_REQUEST_BYTES];
+    uint8_t answer[UDP_REPLY_BYTES];
+    UdpReply reply;
+    udpEncodeRequest(hmac, hello, frame);
+    udpControl.handle(frame, sizeof(frame), millis(), answer);
+    udpDecodeReply(hmac, answer, sizeof(answer), reply);
+
+    // Replays: client 2 switches relay 5 on, then off. Its frames sent again - from
+    // whatever host, the device doesn't look - must not switch it back on
+    uint8_t on[UDP_REQUEST_BYTES];
+    uint8_t off[UDP_REQUEST_BYTES];
+    UdpCommand command = UdpCommand();
+    command.client = 2;
+    command.session = reply.session;
+    command.op = UDP_OP_SET;
+    command.select.set(4);
+    command.sequence = 1;
+    command.value.set(4, true);
+    udpEncodeRequest(hmac, command, on);
+    command.sequence = 2;
+    command.value.set(4, false);
+    udpEncodeRequest(hmac, command, off);
+    udpControl.handle(on, sizeof(on), millis(), answer);
+    udpControl.handle(off, sizeof(off), millis(), answer);
+    UdpReply replayed;
+    udpControl.handle(on, sizeof(on), millis(), answer);
+    bool stale = udpDecodeReply(hmac, answer, sizeof(answer), replayed) && replayed.status == UDP_STATUS_STALE;
+    udpControl.handle(off, sizeof(off), millis(), answer);
+    if (!stale || relayControl.getState(4)) {
+        fprintf(stderr, "Replayed UDP frame was run again\n");
+        exit(1);
+    }
+
+    udpFrames.resize(UDP_FRAMES * UDP_REQUEST_BYTES);
+    for (unsigned long i = 0; i < UDP_FRAMES; i++) {
+        UdpCommand command = UdpCommand();
+        command.client = 1;
+        command.sequence = i + 1;
+        command.session = reply.session;
+        command.op = UDP_OP_SET;
+        command.select.set(2);
+        command.value.set(2, i & 1);
+        udpEncodeRequest(hmac, command, &udpFrames[i * UDP_REQUEST_BYTES]);
+    }
+}
+
+static void setupSystem() {
+    fake::reset();
+    fake::resetNvs(true);
+    fake::resetMqtt();
+    fake::resetI2c();
+    fake::resetSpi();
+    for (int chip = 0; chip < 4; chip++) {
+        fake::addI2cDevice(RelayBoard64Mcp::MCP_BASE_ADDRESS + chip);
+    }
+
+    relayControl.init();
+    relayControl.setChangeHook([](const RelayControl::Mask& changed, const RelayControl::Mask& states,
+                                  RelaySource source) {
+        relayHistory.record(changed, states, source, millis());
+        if (source != RELAY_SOURCE_BOOT) {
+            relayStats.record(changed, states, millis());
+        }
+    });
+    mcpRelays.init();
+    shiftRelays.init();
+    rfCodes.clear();
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Remote Button %d", i + 1);
+        rfCodes.add(name, 5592400UL + i * 3, 24, 1);
+    }
+    strcpy(settings.mqtt_server, "192.168.1.10");
+    storage.saveMqttSettings(settings, true);
+    storage.saveRFCodes(rfCodes);
+    storage.saveRelayStates(relayControl);
+
+    mqttClient.setBufferSize(1024);
+    mqttClient.setCallback([](char* topic, uint8_t* payload, unsigned int length) {
+        if (mqttBridge.handleMessage(topic, payload, length)) {
+            storage.saveRelayStates(relayControl);
+        }
+    });
+    mqttClient.connect("bench");
+
+    fake::resetOta();
+    for (size_t i = 0; i < otaImage.size(); i++) {
+        otaImage[i] = (uint8_t)(i * 2654435761u >> 24);
+    }
+    otaImage[0] = 0xE9;
+    otaImageCrc = crc32Update(0, otaImage.data(), otaImage.size());
+
+    GroupConfig groups = GroupConfig();
+    strcpy(groups.groups[0], "site");
+    strcpy(groups.groups[1], "floor-2");
+    strcpy(groups.scenes[0].name, "night");
+    parseRelayPattern("0101xxxx0000xxxx", NUM_RELAYS, groups.scenes[0].on, groups.scenes[0].off);
+    mqttBridge.setGroupConfig(groups, false);
+
+    setupUdp();
+}
+
+// Streams the image like the web server hands it over: one chunk per TCP segment
+static void streamOtaImage(const void* request) {
+    const size_t CHUNK = 1436;
+    bool ok = otaUpdate.begin(request, OTA_FIRMWARE, otaImage.size(), otaImageCrc);
+    for (size_t index = 0; ok && index < otaImage.size(); index += CHUNK) {
+        ok = otaUpdate.write(request, otaImage.data() + index, std::min(CHUNK, otaImage.size() - index), index);
+    }
+    if (!ok || !otaUpdate.end(request) || fake::appPartition.data != otaImage) {
+        fprintf(stderr, "OTA image did not reach the fake partition intact: %s\n", otaUpdate.getError());
+        exit(1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Harness
+// ---------------------------------------------------------------------------
+struct Benchmark {
+    const char* name;
+    unsigned long iterations;
+    std::function<void(unsigned long)> run;
+};
+
+static void runBenchmark(const Benchmark& bench) {
+    // Warm up (first-use allocations, branch predictors)
+    for (unsigned long i = 0; i < 8; i++) {
+        bench.run(i);
+    }
+
+    fake::mqtt = fake::MqttStats();
+    fake::nvs = fake::NvsStats();
+    fake::i2c = fake::I2cStats();
+    fake::spi = fake::SpiStats();
+    allocCount = 0;
+    allocBytes = 0;
+
+    countAllocs = true;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < bench.iterations; i++) {
+        bench.run(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    countAllocs = false;
+
+    double n = (double)bench.iterations;
+    double nsPerOp = std::chrono::duration<double, std::nano>(end - start).count() / n;
+
+    printf("%-24s %9lu %12.1f %10.2f %12.1f %8.2f %10.1f %8.2f %10.1f %9.2f %8.2f\n",
+           bench.name, bench.iterations, nsPerOp,
+           allocCount / n, allocBytes / n,
+           fake::mqtt.publishes / n, fake::mqtt.bytesOut / n,
+           fake::nvs.commits / n, fake::nvs.bytesWritten / n, fake::nvs.reads / n,
+           (fake::i2c.transactions + fake::spi.transactions) / n);
+}
+
+int main(int argc, char** argv) {
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+
+    setupSystem();
+
+    static const char* setTopic = "homeassistant/switch/esp32-relay/relay7/set";
+
+    Benchmark benchmarks[] = {
+        {"mqtt_dispatch", 20000, [](unsigned long i) {
+            const char* payload = (i & 1) ? "ON" : "OFF";
+            mqttBridge.handleMessage(setTopic, (const byte*)payload, strlen(payload));
+        }},
+        {"mqtt_dispatch_saved", 5000, [](unsigned long i) {
+            mqttClient.inject(setTopic, (i & 1) ? "ON" : "OFF");
+        }},
+        {"mqtt_dispatch_traced", 20000, [](unsigned long i) {
+            const char* payload = (i & 1) ? "{\"state\":\"ON\",\"cid\":\"b1\"}" : "{\"state\":\"OFF\",\"cid\":\"b1\"}";
+            mqttBridge.handleMessage(setTopic, (const byte*)payload, strlen(payload));
+        }},
+        {"mqtt_dispatch_unknown", 20000, [](unsigned long) {
+            static const char* topic = "homeassistant/switch/other-device/relay7/set";
+            mqttBridge.handleMessage(topic, (const byte*)"ON", 2);
+        }},
+        {"group_all_toggle", 5000, [](unsigned long i) {
+            // Every relay flips - one backend update, a publish per relay, acks left pending
+            static const char* topic = "esp32-relay/group/floor-2/set";
+            const char* payload = (i & 1) ? "{\"all\":\"ON\",\"cid\":\"g1\"}" : "{\"all\":\"OFF\",\"cid\":\"g1\"}";
+            mqttBridge.handleMessage(topic, (const byte*)payload, strlen(payload));
+        }},
+        {"group_scene", 20000, [](unsigned long i) {
+            // Alternates between a scene and all on, so the scene's relays always switch
+            static const char* topic = "esp32-relay/group/site/set";
+            const char* payload = (i & 1) ? "{\"scene\":\"night\"}" : "{\"all\":\"ON\"}";
+            mqttBridge.handleMessage(topic, (const byte*)payload, strlen(payload));
+        }},
+        {"group_ack", 20000, [](unsigned long) {
+            static const char* topic = "esp32-relay/group/site/set";
+            static const char* payload = "{\"relays\":\"x\",\"cid\":\"a7\"}";
+            mqttBridge.handleMessage(topic, (const byte*)payload, strlen(payload));
+            fake::advanceMillis(MQTT_GROUP_ACK_WINDOW_MS);
+            mqttBridge.publishGroupAcks();
+        }},
+        {"publish_state", 50000, [](unsigned long i) {
+            mqttBridge.publishState(i % NUM_RELAYS);
+        }},
+        {"publish_all_states", 5000, [](unsigned long) {
+            mqttBridge.publishAllStates();
+        }},
+        {"publish_all_states_agg", 5000, [](unsigned long) {
+            settings.aggregateState = true;
+            mqttBridge.publishAllStates();
+            settings.aggregateState = false;
+        }},
+        {"discovery_entity", 500, [](unsigned long) {
+            settings.deviceDiscovery = false;
+            mqttBridge.publishDiscovery();
+        }},
+        {"discovery_device", 500, [](unsigned long) {
+            settings.deviceDiscovery = true;
+            mqttBridge.publishDiscovery();
+        }},
+        {"discovery_device_agg", 500, [](unsigned long) {
+            settings.deviceDiscovery = true;
+            settings.aggregateState = true;
+            mqttBridge.publishDiscovery();
+            settings.aggregateState = false;
+        }},
+        {"rf_match_hit", 200000, [](unsigned long i) {
+            volatile int slot = rfCodes.match(5592400UL + (i % MAX_RF_CODES) * 3, 24, 1);
+            (void)slot;
+        }},
+        {"rf_match_miss", 200000, [](unsigned long i) {
+            volatile int slot = rfCodes.match(1000UL + i, 24, 1);
+            (void)slot;
+        }},
+        {"rf_receive", 100000, [](unsigned long i) {
+            rfReceiver.inject(5592400UL + (i % MAX_RF_CODES) * 3, 24, 1);
+            if (rfReceiver.available()) {
+                volatile int slot = rfCodes.match(rfReceiver.getReceivedValue(),
+                                                  rfReceiver.getReceivedBitlength(),
+                                                  rfReceiver.getReceivedProtocol());
+                (void)slot;
+                rfReceiver.resetAvailable();
+            }
+        }},
+        {"relay_set_gpio", 100000, [](unsigned long i) {
+            relayControl.setState(i % NUM_RELAYS, (i & 1) != 0);
+        }},
+        {"relay_set_mcp23017", 100000, [](unsigned long i) {
+            mcpRelays.setState(i % RelayBoard64Mcp::RELAY_COUNT, (i / RelayBoard64Mcp::RELAY_COUNT) & 1);
+        }},
+        {"relay_mask_mcp23017", 50000, [](unsigned long i) {
+            // All 64 relays flip - one transaction per chip
+            mcpRelays.setMask((i & 1) ? mcpRelays.ALL_MASK : decltype(mcpRelays)::Mask(), mcpRelays.ALL_MASK);
+        }},
+        {"relay_set_74hc595", 100000, [](unsigned long i) {
+            shiftRelays.setState(i % RelayBoard128Shift::RELAY_COUNT, (i / RelayBoard128Shift::RELAY_COUNT) & 1);
+        }},
+        {"relay_mask_74hc595", 50000, [](unsigned long i) {
+            // All 128 relays flip - one transaction for the whole chain
+            shiftRelays.setMask((i & 1) ? shiftRelays.ALL_MASK : decltype(shiftRelays)::Mask(), shiftRelays.ALL_MASK);
+        }},
+        {"udp_set", UDP_FRAMES - 8, [](unsigned long i) {
+            // Verify, run, sign the reply - the warm-up takes the first 8 frames
+            static unsigned long next = 0;
+            uint8_t reply[UDP_REPLY_BYTES];
+            udpControl.handle(&udpFrames[next++ * UDP_REQUEST_BYTES], UDP_REQUEST_BYTES, millis(), reply);
+        }},
+        {"udp_retry", 100000, [](unsigned long) {
+            // Repeat of the last frame: tag check, then the cached reply
+            uint8_t reply[UDP_REPLY_BYTES];
+            udpControl.handle(&udpFrames[(UDP_FRAMES - 1) * UDP_REQUEST_BYTES], UDP_REQUEST_BYTES, millis(), reply);
+        }},
+        {"udp_bad_tag", 100000, [](unsigned long) {
+            uint8_t frame[UDP_REQUEST_BYTES];
+            uint8_t reply[UDP_REPLY_BYTES];
+            memcpy(frame, &udpFrames[0], UDP_REQUEST_BYTES);
+            frame[UDP_REQUEST_BYTES - 1] ^= 1;
+            udpControl.handle(frame, UDP_REQUEST_BYTES, millis(), reply);
+        }},
+        {"save_relay_states", 5000, [](unsigned long i) {
+            relayControl.setState(i % NUM_RELAYS, (i & 1) != 0);
+            storage.saveRelayStates(relayControl);
+        }},
+        {"save_relay_stats", 5000, [](unsigned long) {
+            storage.saveRelayStats();
+        }},
+        {"history_query", 200, [](unsigned long) {
+            // Whole ring (full after the benchmarks above) as JSON, in 1 KB chunks
+            static uint8_t chunk[1024];
+            RelayHistoryQuery query(relayHistory, relayHistory.clock(millis()), 0, UINT64_MAX, -1);
+            while (query.read(chunk, sizeof(chunk)) > 0) {
+            }
+        }},
+        {"save_rf_codes", 5000, [](unsigned long) {
+            storage.saveRFCodes(rfCodes);
+        }},
+        {"boot_restore", 5000, [](unsigned long) {
+            // Settings, RF codes and relay states, as setup() does
+            storage.load(settings, relayControl, rfCodes);
+        }},
+        {"ota_stream_1mb", 20, [](unsigned long i) {
+            streamOtaImage(&i);
+        }},
+    };
+
+    printf("%-24s %9s %12s %10s %12s %8s %10s %8s %10s %9s %8s\n",
+           "benchmark", "iters", "ns/op", "allocs/op", "alloc B/op",
+           "pub/op", "mqtt B/op", "nvs/op", "nvs B/op", "nvs rd/op", "bus/op");
+
+    for (const Benchmark& bench : benchmarks) {
+        if (filter && strstr(bench.name, filter) == nullptr) {
+            continue;
+        }
+        runBenchmark(bench);
+    }
+
+    return 0;
+}
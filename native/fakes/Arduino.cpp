@@ -0,0 +1,133 @@
+#include "Arduino.h"
+#include <chrono>
+#include <random>
+#include <thread>
+
+HardwareSerial Serial;
+EspClass ESP;
+
+namespace fake {
+    GpioStats gpio;
+    unsigned long serialBytes = 0;
+    bool serialEcho = false;
+    unsigned long restarts = 0;
+    bool realTime = false;
+
+    static unsigned long long clockMicros = 0;
+
+    void setMillis(unsigned long ms) {
+        clockMicros = (unsigned long long)ms * 1000ULL;
+    }
+
+    void advanceMillis(unsigned long ms) {
+        clockMicros += (unsigned long long)ms * 1000ULL;
+    }
+
+    void reset() {
+        memset(&gpio, 0, sizeof(gpio));
+        serialBytes = 0;
+        restarts = 0;
+        clockMicros = 0;
+    }
+}
+
+static unsigned long long wallMicros() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long millis() {
+    return (unsigned long)((fake::realTime ? wallMicros() : fake::clockMicros) / 1000ULL);
+}
+
+unsigned long micros() {
+    return (unsigned long)(fake::realTime ? wallMicros() : fake::clockMicros);
+}
+
+void delay(unsigned long ms) {
+    if (fake::realTime) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    } else {
+        fake::advanceMillis(ms);
+    }
+}
+
+void delayMicroseconds(unsigned int us) {
+    if (fake::realTime) {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    } else {
+        fake::clockMicros += us;
+    }
+}
+
+void yield() {
+}
+
+long random(long howbig) {
+    return howbig > 0 ? rand() % howbig : 0;
+}
+
+long random(long howsmall, long howbig) {
+    return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+uint32_t esp_random() {
+    static std::random_device device;
+    return device();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    if (pin < FAKE_GPIO_COUNT) {
+        fake::gpio.mode[pin] = mode;
+    }
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+    if (pin < FAKE_GPIO_COUNT) {
+        fake::gpio.level[pin] = val ? HIGH : LOW;
+        fake::gpio.writes++;
+    }
+}
+
+int digitalRead(uint8_t pin) {
+    return pin < FAKE_GPIO_COUNT ? fake::gpio.level[pin] : LOW;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+    fake::serialBytes += size;
+    if (fake::serialEcho) {
+        fwrite(buffer, 1, size, stdout);
+    }
+    return size;
+}
+
+uint32_t EspClass::getCycleCount() {
+    // 240 MHz core clock, derived from the virtual clock
+    return (uint32_t)(micros() * 240UL);
+}
+
+void EspClass::restart() {
+    fake::restarts++;
+}
+
+struct FakeTask {
+    const char* name;
+};
+
+static FakeTask loopTask = {"loopTask"};
+
+TaskHandle_t xTaskGetCurrentTaskHandle() {
+    return &loopTask;
+}
+
+TaskHandle_t xTaskGetHandle(const char* name) {
+    return strcmp(name, loopTask.name) == 0 ? &loopTask : nullptr;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    return task ? 4096 : 0;
+}
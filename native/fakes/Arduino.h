@@ -0,0 +1,364 @@
+#ifndef FAKE_ARDUINO_H
+#define FAKE_ARDUINO_H
+
+/*
+ * Host-side stand-in for the Arduino core (native environment only)
+ *
+ * Provides just enough of the Arduino API for the controller logic to build
+ * and run on a PC: String, Serial, millis()/delay() on a virtual clock and
+ * GPIO calls that record pin levels instead of touching hardware.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <math.h>
+#include <string>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT        0x01
+#define OUTPUT       0x03
+#define INPUT_PULLUP 0x05
+
+#define DEC 10
+#define HEX 16
+
+#define digitalPinToInterrupt(p) (p)
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+using std::min;
+using std::max;
+
+// ---------------------------------------------------------------------------
+// Time (virtual clock - delay() advances it instead of sleeping, unless
+// fake::realTime is set)
+// ---------------------------------------------------------------------------
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+// Deterministic on the host (rand()), hardware RNG on the device
+long random(long howbig);
+long random(long howsmall, long howbig);
+// esp_system.h - unpredictable on the host too (std::random_device)
+uint32_t esp_random();
+
+// ---------------------------------------------------------------------------
+// GPIO
+// ---------------------------------------------------------------------------
+#define FAKE_GPIO_COUNT 40
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+// ---------------------------------------------------------------------------
+// String
+// ---------------------------------------------------------------------------
+class String {
+private:
+    std::string buffer;
+
+public:
+    String() {}
+    String(const char* cstr) : buffer(cstr ? cstr : "") {}
+    String(const std::string& str) : buffer(str) {}
+    String(const String& other) = default;
+    String(String&& other) = default;
+    explicit String(char c) : buffer(1, c) {}
+    explicit String(unsigned char value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(int value, unsigned char base = DEC) { fromSigned(value, base); }
+    explicit String(unsigned int value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(long value, unsigned char base = DEC) { fromSigned(value, base); }
+    explicit String(unsigned long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(long long value, unsigned char base = DEC) { fromSigned(value, base); }
+    explicit String(unsigned long long value, unsigned char base = DEC) { fromUnsigned(value, base); }
+    explicit String(float value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+    explicit String(double value, unsigned char decimals = 2) { fromDouble(value, decimals); }
+
+    String& operator=(const String& other) = default;
+    String& operator=(String&& other) = default;
+    String& operator=(const char* cstr) { buffer = cstr ? cstr : ""; return *this; }
+
+    const char* c_str() const { return buffer.c_str(); }
+    unsigned int length() const { return buffer.length(); }
+    bool isEmpty() const { return buffer.empty(); }
+    bool reserve(unsigned int size) { buffer.reserve(size); return true; }
+
+    bool concat(const String& str) { buffer += str.buffer; return true; }
+    bool concat(const char* cstr) { if (cstr) buffer += cstr; return true; }
+    bool concat(const char* cstr, unsigned int len) { if (cstr) buffer.append(cstr, len); return true; }
+    bool concat(char c) { buffer += c; return true; }
+    bool concat(int value) { return concat(String(value)); }
+    bool concat(unsigned int value) { return concat(String(value)); }
+    bool concat(long value) { return concat(String(value)); }
+    bool concat(unsigned long value) { return concat(String(value)); }
+
+    String& operator+=(const String& str) { concat(str); return *this; }
+    String& operator+=(const char* cstr) { concat(cstr); return *this; }
+    String& operator+=(char c) { concat(c); return *this; }
+    String& operator+=(int value) { concat(value); return *this; }
+    String& operator+=(unsigned int value) { concat(value); return *this; }
+    String& operator+=(long value) { concat(value); return *this; }
+    String& operator+=(unsigned long value) { concat(value); return *this; }
+
+    bool equals(const String& other) const { return buffer == other.buffer; }
+    bool equals(const char* cstr) const { return buffer == (cstr ? cstr : ""); }
+    bool operator==(const String& other) const { return equals(other); }
+    bool operator==(const char* cstr) const { return equals(cstr); }
+    bool operator!=(const String& other) const { return !equals(other); }
+    bool operator!=(const char* cstr) const { return !equals(cstr); }
+    bool operator<(const String& other) const { return buffer < other.buffer; }
+
+    char charAt(unsigned int index) const { return index < buffer.length() ? buffer[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    char& operator[](unsigned int index) { return buffer[index]; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        size_t pos = buffer.find(c, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    int indexOf(const char* str, unsigned int from = 0) const {
+        size_t pos = buffer.find(str, from);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    int indexOf(const String& str, unsigned int from = 0) const { return indexOf(str.c_str(), from); }
+    int lastIndexOf(char c) const {
+        size_t pos = buffer.rfind(c);
+        return pos == std::string::npos ? -1 : (int)pos;
+    }
+    bool startsWith(const String& prefix) const { return buffer.compare(0, prefix.buffer.length(), prefix.buffer) == 0; }
+    bool endsWith(const String& suffix) const {
+        return buffer.length() >= suffix.buffer.length() &&
+               buffer.compare(buffer.length() - suffix.buffer.length(), suffix.buffer.length(), suffix.buffer) == 0;
+    }
+    String substring(unsigned int from) const { return from < buffer.length() ? String(buffer.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) std::swap(from, to);
+        if (from >= buffer.length()) return String();
+        return String(buffer.substr(from, to - from));
+    }
+
+    void replace(const String& find, const String& replacement) {
+        if (find.buffer.empty()) return;
+        size_t pos = 0;
+        while ((pos = buffer.find(find.buffer, pos)) != std::string::npos) {
+            buffer.replace(pos, find.buffer.length(), replacement.buffer);
+            pos += replacement.buffer.length();
+        }
+    }
+    void toLowerCase() { for (auto& c : buffer) c = (char)tolower((unsigned char)c); }
+    void toUpperCase() { for (auto& c : buffer) c = (char)toupper((unsigned char)c); }
+    void trim() {
+        size_t start = buffer.find_first_not_of(" \t\r\n");
+        size_t end = buffer.find_last_not_of(" \t\r\n");
+        buffer = (start == std::string::npos) ? std::string() : buffer.substr(start, end - start + 1);
+    }
+    void toCharArray(char* buf, unsigned int bufsize, unsigned int index = 0) const {
+        if (!buf || bufsize == 0) return;
+        size_t n = 0;
+        if (index < buffer.length()) {
+            n = std::min<size_t>(bufsize - 1, buffer.length() - index);
+            memcpy(buf, buffer.data() + index, n);
+        }
+        buf[n] = '\0';
+    }
+    long toInt() const { return atol(buffer.c_str()); }
+    float toFloat() const { return (float)atof(buffer.c_str()); }
+
+private:
+    void fromUnsigned(unsigned long long value, unsigned char base) {
+        char buf[66];
+        char* p = buf + sizeof(buf) - 1;
+        *p = '\0';
+        if (base < 2) base = 10;
+        do {
+            unsigned digit = (unsigned)(value % base);
+            *--p = (char)(digit < 10 ? '0' + digit : 'a' + digit - 10);
+            value /= base;
+        } while (value);
+        buffer = p;
+    }
+    void fromSigned(long long value, unsigned char base) {
+        if (value < 0 && base == DEC) {
+            fromUnsigned((unsigned long long)(-value), base);
+            buffer.insert(buffer.begin(), '-');
+        } else {
+            fromUnsigned((unsigned long long)value, base);
+        }
+    }
+    void fromDouble(double value, unsigned char decimals) {
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.*f", decimals, value);
+        buffer = buf;
+    }
+};
+
+inline String operator+(const String& lhs, const String& rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, const char* rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const char* lhs, const String& rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, char rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, int rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, unsigned int rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, long rhs) { String s(lhs); s += rhs; return s; }
+inline String operator+(const String& lhs, unsigned long rhs) { String s(lhs); s += rhs; return s; }
+inline bool operator==(const char* lhs, const String& rhs) { return rhs.equals(lhs); }
+inline bool operator!=(const char* lhs, const String& rhs) { return !rhs.equals(lhs); }
+
+// ---------------------------------------------------------------------------
+// Print / Serial
+// ---------------------------------------------------------------------------
+class Print;
+
+class Printable {
+public:
+    virtual ~Printable() {}
+    virtual size_t printTo(Print& p) const = 0;
+};
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t write(const char* str) { return str ? write((const uint8_t*)str, strlen(str)) : 0; }
+
+    size_t print(const char* str) { return write(str); }
+    size_t print(const String& str) { return write(str.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(int value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(unsigned int value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(long value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(unsigned long value, int base = DEC) { return print(String(value, (unsigned char)base)); }
+    size_t print(double value, int digits = 2) { return print(String(value, (unsigned char)digits)); }
+    size_t print(const Printable& value) { return value.printTo(*this); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T& value) { size_t n = print(value); return n + println(); }
+    template <typename T> size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[512];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if (len < 0) return 0;
+        return write((const uint8_t*)buf, std::min<size_t>((size_t)len, sizeof(buf) - 1));
+    }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+    void begin(unsigned long baud) { (void)baud; }
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+    void flush() {}
+};
+
+extern HardwareSerial Serial;
+
+// ---------------------------------------------------------------------------
+// IPAddress / Client (used by the WiFi and PubSubClient fakes)
+// ---------------------------------------------------------------------------
+class IPAddress : public Printable {
+private:
+    uint8_t octets[4];
+
+public:
+    IPAddress() : octets{0, 0, 0, 0} {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : octets{a, b, c, d} {}
+    uint8_t operator[](int index) const { return octets[index]; }
+    operator uint32_t() const {
+        uint32_t address;
+        memcpy(&address, octets, sizeof(address));
+        return address;
+    }
+    String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", octets[0], octets[1], octets[2], octets[3]);
+        return String(buf);
+    }
+    size_t printTo(Print& p) const override { return p.print(toString()); }
+};
+
+class Client : public Stream {
+public:
+    virtual int connect(const char* host, uint16_t port) = 0;
+    virtual uint8_t connected() = 0;
+    virtual void stop() = 0;
+};
+
+// ---------------------------------------------------------------------------
+// ESP
+// ---------------------------------------------------------------------------
+class EspClass {
+public:
+    uint64_t getEfuseMac() { return 0x0000A1B2C3D4E5F6ULL; }
+    uint32_t getHeapSize() { return 300000; }
+    uint32_t getFreeHeap() { return 200000; }
+    uint32_t getMinFreeHeap() { return 180000; }
+    uint32_t getMaxAllocHeap() { return 110000; }
+    uint32_t getCpuFreqMHz() { return 240; }
+    uint32_t getCycleCount();
+    void restart();
+};
+
+extern EspClass ESP;
+
+// FreeRTOS task API - the host has a single "loopTask"
+typedef struct FakeTask* TaskHandle_t;
+typedef unsigned int UBaseType_t;
+
+TaskHandle_t xTaskGetCurrentTaskHandle();
+TaskHandle_t xTaskGetHandle(const char* name);
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+
+// ---------------------------------------------------------------------------
+// Test hooks - inspect and drive the fake hardware
+// ---------------------------------------------------------------------------
+namespace fake {
+    struct GpioStats {
+        uint8_t mode[FAKE_GPIO_COUNT];
+        uint8_t level[FAKE_GPIO_COUNT];
+        unsigned long writes;
+    };
+
+    extern GpioStats gpio;
+    extern unsigned long serialBytes;  // Bytes written to Serial
+    extern bool serialEcho;            // Echo Serial output to stdout
+    extern unsigned long restarts;     // ESP.restart() calls
+    extern bool realTime;              // millis()/delay() follow the wall clock (host firmware)
+
+    void setMillis(unsigned long ms);
+    void advanceMillis(unsigned long ms);
+    void reset();
+}
+
+#endif
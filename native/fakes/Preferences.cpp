@@ -0,0 +1,97 @@
+#include "Preferences.h"
+
+namespace fake {
+    NvsStats nvs;
+    static std::map<std::string, std::map<std::string, std::vector<uint8_t>>> flash;
+
+    void resetNvs(bool eraseFlash) {
+        nvs = NvsStats();
+        if (eraseFlash) {
+            flash.clear();
+        }
+    }
+}
+
+bool Preferences::begin(const char* name, bool readOnlyMode) {
+    ns = &fake::flash[name];
+    readOnly = readOnlyMode;
+    fake::nvs.opens++;
+    return true;
+}
+
+void Preferences::end() {
+    ns = nullptr;
+}
+
+bool Preferences::clear() {
+    if (!ns || readOnly) return false;
+    ns->clear();
+    fake::nvs.commits++;
+    return true;
+}
+
+bool Preferences::remove(const char* key) {
+    if (!ns || readOnly) return false;
+    fake::nvs.commits++;
+    return ns->erase(key) > 0;
+}
+
+bool Preferences::putRaw(const char* key, const void* value, size_t len) {
+    if (!ns || readOnly || !key) return false;
+    const uint8_t* bytes = (const uint8_t*)value;
+    (*ns)[key].assign(bytes, bytes + len);
+    fake::nvs.commits++;
+    fake::nvs.bytesWritten += len;
+    return true;
+}
+
+const std::vector<uint8_t>* Preferences::getRaw(const char* key) const {
+    if (!ns || !key) return nullptr;
+    fake::nvs.reads++;
+    auto it = ns->find(key);
+    return it == ns->end() ? nullptr : &it->second;
+}
+
+size_t Preferences::putString(const char* key, const char* value) {
+    size_t len = strlen(value) + 1;  // Stored with terminator, like NVS strings
+    return putRaw(key, value, len) ? len - 1 : 0;
+}
+
+bool Preferences::getBool(const char* key, bool defaultValue) const {
+    const std::vector<uint8_t>* raw = getRaw(key);
+    return raw && raw->size() == sizeof(bool) ? (*raw)[0] != 0 : defaultValue;
+}
+
+int32_t Preferences::getInt(const char* key, int32_t defaultValue) const {
+    const std::vector<uint8_t>* raw = getRaw(key);
+    if (!raw || raw->size() != sizeof(int32_t)) return defaultValue;
+    int32_t value;
+    memcpy(&value, raw->data(), sizeof(value));
+    return value;
+}
+
+uint32_t Preferences::getUInt(const char* key, uint32_t defaultValue) const {
+    const std::vector<uint8_t>* raw = getRaw(key);
+    if (!raw || raw->size() != sizeof(uint32_t)) return defaultValue;
+    uint32_t value;
+    memcpy(&value, raw->data(), sizeof(value));
+    return value;
+}
+
+String Preferences::getString(const char* key, const String& defaultValue) const {
+    const std::vector<uint8_t>* raw = getRaw(key);
+    if (!raw || raw->empty()) return defaultValue;
+    return String((const char*)raw->data());
+}
+
+size_t Preferences::getBytesLength(const char* key) const {
+    const std::vector<uint8_t>* raw = getRaw(key);
+    return raw ? raw->size() : 0;
+}
+
+size_t Preferences::getBytes(const char* key, void* buf, size_t maxLen) const {
+    const std::vector<uint8_t>* raw = getRaw(key);
+    if (!raw || raw->size() > maxLen) return 0;
+    memcpy(buf, raw->data(), raw->size());
+    return raw->size();
+}
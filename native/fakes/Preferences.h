@@ -0,0 +1,61 @@
+#ifndef FAKE_PREFERENCES_H
+#define FAKE_PREFERENCES_H
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * In-memory Preferences (NVS) stand-in for the native environment
+ *
+ * Values survive end()/begin() like real flash. Every put counts as one
+ * NVS commit, matching the Arduino-ESP32 implementation.
+ */
+class Preferences {
+private:
+    std::map<std::string, std::vector<uint8_t>>* ns;
+    bool readOnly;
+
+    bool putRaw(const char* key, const void* value, size_t len);
+    const std::vector<uint8_t>* getRaw(const char* key) const;
+
+public:
+    Preferences() : ns(nullptr), readOnly(false) {}
+    bool begin(const char* name, bool readOnly = false);
+    void end();
+
+    bool clear();
+    bool remove(const char* key);
+    bool isKey(const char* key) const { return getRaw(key) != nullptr; }
+
+    size_t putBool(const char* key, bool value) { return putRaw(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putInt(const char* key, int32_t value) { return putRaw(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putUInt(const char* key, uint32_t value) { return putRaw(key, &value, sizeof(value)) ? sizeof(value) : 0; }
+    size_t putULong(const char* key, uint32_t value) { return putUInt(key, value); }
+    size_t putString(const char* key, const char* value);
+    size_t putString(const char* key, const String& value) { return putString(key, value.c_str()); }
+    size_t putBytes(const char* key, const void* value, size_t len) { return putRaw(key, value, len) ? len : 0; }
+
+    bool getBool(const char* key, bool defaultValue = false) const;
+    int32_t getInt(const char* key, int32_t defaultValue = 0) const;
+    uint32_t getUInt(const char* key, uint32_t defaultValue = 0) const;
+    uint32_t getULong(const char* key, uint32_t defaultValue = 0) const { return getUInt(key, defaultValue); }
+    String getString(const char* key, const String& defaultValue = String()) const;
+    size_t getBytesLength(const char* key) const;
+    size_t getBytes(const char* key, void* buf, size_t maxLen) const;
+};
+
+namespace fake {
+    struct NvsStats {
+        unsigned long opens;         // begin() calls
+        unsigned long reads;         // get*() lookups
+        unsigned long commits;       // put*() calls (each one commits)
+        unsigned long bytesWritten;  // Value bytes written
+    };
+
+    extern NvsStats nvs;
+    void resetNvs(bool eraseFlash);
+}
+
+#endif
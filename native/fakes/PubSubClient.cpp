@@ -0,0 +1,193 @@
+#include "PubSubClient.h"
+
+namespace fake {
+    MqttStats mqtt;
+    bool mqttRecord = false;
+    bool mqttRefuseConnect = false;
+    std::string mqttRefuseServer;
+    std::vector<MqttMessage> mqttLog;
+    std::vector<std::string> mqttSubscriptions;
+
+    void resetMqtt() {
+        mqtt = MqttStats();
+        mqttLog.clear();
+        mqttSubscriptions.clear();
+        mqttRefuseConnect = false;
+        mqttRefuseServer.clear();
+    }
+}
+
+PubSubClient::PubSubClient()
+    : client(nullptr), bufferSize(MQTT_MAX_PACKET_SIZE), isConnected(false), connState(MQTT_DISCONNECTED),
+      port(0), keepAliveSeconds(MQTT_KEEPALIVE), socketTimeoutSeconds(MQTT_SOCKET_TIMEOUT), socketFd(-1), lastOutbound(0),
+      streamLength(0), streamWritten(0), streamRetained(false) {
+}
+
+PubSubClient::PubSubClient(Client& c)
+    : client(&c), bufferSize(MQTT_MAX_PACKET_SIZE), isConnected(false), connState(MQTT_DISCONNECTED),
+      port(0), keepAliveSeconds(MQTT_KEEPALIVE), socketTimeoutSeconds(MQTT_SOCKET_TIMEOUT), socketFd(-1), lastOutbound(0),
+      streamLength(0), streamWritten(0), streamRetained(false) {
+}
+
+PubSubClient& PubSubClient::setServer(const char* domain, uint16_t port) {
+    this->port = port;
+    server = domain ? domain : "";
+    return *this;
+}
+
+PubSubClient& PubSubClient::setServer(IPAddress ip, uint16_t port) {
+    (void)ip;
+    (void)port;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+    this->callback = callback;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setClient(Client& c) {
+    client = &c;
+    return *this;
+}
+
+bool PubSubClient::setBufferSize(uint16_t size) {
+    if (size == 0) return false;
+    bufferSize = size;
+    return true;
+}
+
+bool PubSubClient::connect(const char* id) {
+    return connect(id, nullptr, nullptr, nullptr, 0, false, nullptr);
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass) {
+    return connect(id, user, pass, nullptr, 0, false, nullptr);
+}
+
+bool PubSubClient::connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    return connect(id, nullptr, nullptr, willTopic, willQos, willRetain, willMessage);
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass,
+                           const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    (void)id; (void)user; (void)pass; (void)willTopic; (void)willQos; (void)willRetain; (void)willMessage;
+    fake::mqtt.connects++;
+    if (fake::mqttRefuseConnect || (!fake::mqttRefuseServer.empty() && server == fake::mqttRefuseServer)) {
+        isConnected = false;
+        connState = MQTT_CONNECT_FAILED;
+        return false;
+    }
+    isConnected = true;
+    connState = MQTT_CONNECTED;
+    return true;
+}
+
+void PubSubClient::disconnect() {
+    isConnected = false;
+    connState = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, false);
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload, bool retained) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength) {
+    return publish(topic, payload, plength, false);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retained) {
+    size_t topicLength = strlen(topic);
+    if (!isConnected || bufferSize < MQTT_MAX_HEADER_SIZE + 2 + topicLength + plength) {
+        fake::mqtt.failedPublishes++;
+        return false;
+    }
+    
+    // Fixed header (1 byte + remaining-length varint) + topic length + topic + payload
+    size_t remaining = 2 + topicLength + plength;
+    size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+    fake::mqtt.publishes++;
+    fake::mqtt.bytesOut += 1 + lengthBytes + remaining;
+    
+    if (fake::mqttRecord) {
+        fake::mqttLog.push_back({topic, std::string((const char*)payload, plength), retained});
+    }
+    return true;
+}
+
+bool PubSubClient::beginPublish(const char* topic, unsigned int plength, bool retained) {
+    if (!isConnected) {
+        fake::mqtt.failedPublishes++;
+        return false;
+    }
+    streamTopic = topic;
+    streamPayload.clear();
+    streamLength = plength;
+    streamWritten = 0;
+    streamRetained = retained;
+    return true;
+}
+
+size_t PubSubClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+    streamWritten += size;
+    if (fake::mqttRecord) {
+        streamPayload.append((const char*)buffer, size);
+    }
+    return size;
+}
+
+// Counted like publish() once the announced length has been written
+int PubSubClient::endPublish() {
+    if (streamWritten != streamLength) {
+        fake::mqtt.failedPublishes++;
+        return 0;
+    }
+    size_t remaining = 2 + streamTopic.size() + streamLength;
+    size_t lengthBytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : remaining < 2097152 ? 3 : 4;
+    fake::mqtt.publishes++;
+    fake::mqtt.bytesOut += 1 + lengthBytes + remaining;
+    
+    if (fake::mqttRecord) {
+        fake::mqttLog.push_back({streamTopic, streamPayload, streamRetained});
+    }
+    return 1;
+}
+
+bool PubSubClient::subscribe(const char* topic, uint8_t qos) {
+    (void)qos;
+    if (!isConnected) return false;
+    fake::mqtt.subscribes++;
+    fake::mqttSubscriptions.push_back(topic);
+    return true;
+}
+
+bool PubSubClient::unsubscribe(const char* topic) {
+    if (!isConnected) return false;
+    fake::mqtt.unsubscribes++;
+    for (auto it = fake::mqttSubscriptions.begin(); it != fake::mqttSubscriptions.end(); ++it) {
+        if (*it == topic) {
+            fake::mqttSubscriptions.erase(it);
+            break;
+        }
+    }
+    return true;
+}
+
+bool PubSubClient::loop() {
+    return isConnected;
+}
+
+void PubSubClient::inject(const char* topic, const char* payload) {
+    if (!callback) return;
+    std::string topicCopy(topic);
+    std::string payloadCopy(payload);
+    callback(&topicCopy[0], (uint8_t*)&payloadCopy[0], payloadCopy.length());
+}
@@ -0,0 +1,126 @@
+#ifndef FAKE_PUBSUBCLIENT_H
+#define FAKE_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * PubSubClient stand-in for the native environment
+ *
+ * Keeps the real client's buffer-size rule (publish fails when the packet
+ * doesn't fit - a streamed beginPublish() doesn't use the buffer) and
+ * records every publish so tests and benchmarks can check what went out on
+ * the wire.
+ *
+ * native/posix/PubSubClient.cpp implements the same class over a real TCP
+ * socket for the load-test firmware (env:native-loadtest).
+ */
+
+#define MQTT_MAX_PACKET_SIZE 256
+#define MQTT_MAX_HEADER_SIZE 5
+
+#ifndef MQTT_KEEPALIVE
+#define MQTT_KEEPALIVE 15
+#endif
+
+#ifndef MQTT_SOCKET_TIMEOUT
+#define MQTT_SOCKET_TIMEOUT 15
+#endif
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+#define MQTT_CALLBACK_SIGNATURE std::function<void(char*, uint8_t*, unsigned int)> callback
+
+class PubSubClient : public Print {
+private:
+    Client* client;
+    MQTT_CALLBACK_SIGNATURE;
+    uint16_t bufferSize;
+    bool isConnected;
+    int connState;
+    std::string server;
+    uint16_t port;
+    uint16_t keepAliveSeconds;
+    uint16_t socketTimeoutSeconds;
+    int socketFd;                 // Socket build only
+    std::string rxBuffer;         // Socket build only - bytes of a partly received packet
+    unsigned long lastOutbound;   // Socket build only - millis() of the last packet sent
+    std::string streamTopic;      // beginPublish() ... endPublish() in progress
+    std::string streamPayload;    // Kept only with fake::mqttRecord
+    size_t streamLength;
+    size_t streamWritten;
+    bool streamRetained;
+
+public:
+    PubSubClient();
+    explicit PubSubClient(Client& client);
+
+    PubSubClient& setServer(const char* domain, uint16_t port);
+    PubSubClient& setServer(IPAddress ip, uint16_t port);
+    PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE);
+    PubSubClient& setClient(Client& client);
+    PubSubClient& setKeepAlive(uint16_t keepAlive) { keepAliveSeconds = keepAlive; return *this; }
+    PubSubClient& setSocketTimeout(uint16_t timeout) { socketTimeoutSeconds = timeout; return *this; }
+    bool setBufferSize(uint16_t size);
+    uint16_t getBufferSize() { return bufferSize; }
+
+    bool connect(const char* id);
+    bool connect(const char* id, const char* user, const char* pass);
+    bool connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+    bool connect(const char* id, const char* user, const char* pass,
+                 const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage);
+    void disconnect();
+
+    bool publish(const char* topic, const char* payload);
+    bool publish(const char* topic, const char* payload, bool retained);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int plength);
+    bool publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retained);
+    // Streamed publish: header, then plength bytes of write(), then endPublish() - no buffer needed
+    bool beginPublish(const char* topic, unsigned int plength, bool retained);
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int endPublish();
+
+    bool subscribe(const char* topic, uint8_t qos = 0);
+    bool unsubscribe(const char* topic);
+    bool loop();
+    bool connected() { return isConnected; }
+    int state() { return connState; }
+
+    // Test hook: deliver a message as if it came from the broker
+    void inject(const char* topic, const char* payload);
+};
+
+namespace fake {
+    struct MqttMessage {
+        std::string topic;
+        std::string payload;
+        bool retained;
+    };
+
+    struct MqttStats {
+        unsigned long connects;
+        unsigned long publishes;
+        unsigned long failedPublishes;  // Rejected (buffer too small / not connected)
+        unsigned long bytesOut;         // MQTT PUBLISH packet bytes
+        unsigned long subscribes;
+        unsigned long unsubscribes;
+    };
+
+    extern MqttStats mqtt;
+    extern bool mqttRecord;                      // Keep a copy of every message
+    extern bool mqttRefuseConnect;               // Make connect() fail
+    extern std::string mqttRefuseServer;         // Make connect() fail for this server only
+    extern std::vector<MqttMessage> mqttLog;     // Recorded messages
+    extern std::vector<std::string> mqttSubscriptions;
+    void resetMqtt();
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef FAKE_RCSWITCH_H
+#define FAKE_RCSWITCH_H
+
+#include <Arduino.h>
+
+// rc-switch stand-in for the native environment - frames are injected by the test/benchmark
+class RCSwitch {
+private:
+    unsigned long receivedValue;
+    unsigned int receivedBitlength;
+    unsigned int receivedProtocol;
+    int interrupt;
+
+public:
+    RCSwitch() : receivedValue(0), receivedBitlength(0), receivedProtocol(0), interrupt(-1) {}
+    void enableReceive(int irq) { interrupt = irq; }
+    void disableReceive() { interrupt = -1; }
+    bool available() { return receivedValue != 0; }
+    void resetAvailable() { receivedValue = 0; }
+    unsigned long getReceivedValue() { return receivedValue; }
+    unsigned int getReceivedBitlength() { return receivedBitlength; }
+    unsigned int getReceivedDelay() { return 350; }
+    unsigned int getReceivedProtocol() { return receivedProtocol; }
+
+    // Test hook: pretend a frame was decoded by the ISR
+    void inject(unsigned long value, unsigned int bitLength, unsigned int protocol) {
+        receivedValue = value;
+        receivedBitlength = bitLength;
+        receivedProtocol = protocol;
+    }
+};
+
+#endif
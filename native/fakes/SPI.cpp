@@ -0,0 +1,43 @@
+#include "SPI.h"
+
+SPIClass SPI;
+
+namespace fake {
+    SpiStats spi;
+    std::vector<uint8_t> spiLastFrame;
+    static std::vector<uint8_t> currentFrame;
+
+    void resetSpi() {
+        spi = SpiStats();
+        spiLastFrame.clear();
+        currentFrame.clear();
+    }
+}
+
+void SPIClass::begin(int8_t sck, int8_t miso, int8_t mosi, int8_t ss) {
+    fake::spi.begins++;
+}
+
+void SPIClass::beginTransaction(SPISettings settings) {
+    inTransaction = true;
+    fake::currentFrame.clear();
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    fake::currentFrame.push_back(data);
+    fake::spi.bytes++;
+    return 0;
+}
+
+void SPIClass::writeBytes(const uint8_t* data, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+        transfer(data[i]);
+    }
+}
+
+void SPIClass::endTransaction() {
+    if (!inTransaction) return;
+    inTransaction = false;
+    fake::spi.transactions++;
+    fake::spiLastFrame = fake::currentFrame;
+}
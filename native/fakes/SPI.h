@@ -0,0 +1,50 @@
+#ifndef FAKE_SPI_H
+#define FAKE_SPI_H
+
+#include <Arduino.h>
+#include <vector>
+
+/*
+ * Host-side stand-in for the Arduino SPI library
+ *
+ * Every beginTransaction()/endTransaction() pair counts as one bus
+ * transaction; the bytes of the last one are kept for inspection.
+ */
+
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0
+
+class SPISettings {
+public:
+    SPISettings(uint32_t clock = 1000000, uint8_t bitOrder = MSBFIRST, uint8_t dataMode = SPI_MODE0) {}
+};
+
+class SPIClass {
+private:
+    bool inTransaction;
+
+public:
+    SPIClass() : inTransaction(false) {}
+    void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1);
+    void beginTransaction(SPISettings settings);
+    uint8_t transfer(uint8_t data);
+    void writeBytes(const uint8_t* data, uint32_t size);
+    void endTransaction();
+};
+
+extern SPIClass SPI;
+
+namespace fake {
+    struct SpiStats {
+        unsigned long begins;
+        unsigned long transactions;
+        unsigned long bytes;
+    };
+
+    extern SpiStats spi;
+    extern std::vector<uint8_t> spiLastFrame;  // Bytes of the last transaction, in send order
+    void resetSpi();
+}
+
+#endif
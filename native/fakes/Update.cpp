@@ -0,0 +1,104 @@
+#include "Update.h"
+
+UpdateClass Update;
+
+namespace fake {
+    FlashPartition appPartition = {{}, 0x140000, false};
+    FlashPartition fsPartition = {{}, 0x160000, false};
+    OtaStats ota;
+
+    void resetOta() {
+        ota = OtaStats();
+        appPartition.data.clear();
+        appPartition.valid = false;
+        fsPartition.data.clear();
+        fsPartition.valid = false;
+        Update.abort();
+    }
+}
+
+static const size_t SECTOR_SIZE = 4096;
+
+static fake::FlashPartition& partitionFor(int command) {
+    return command == U_SPIFFS ? fake::fsPartition : fake::appPartition;
+}
+
+bool UpdateClass::begin(size_t size, int cmd, int ledPin, uint8_t ledOn, const char* label) {
+    if (running) {
+        error = UPDATE_ERROR_BAD_ARGUMENT;
+        return false;
+    }
+    if (cmd != U_FLASH && cmd != U_SPIFFS) {
+        error = UPDATE_ERROR_NO_PARTITION;
+        return false;
+    }
+    fake::FlashPartition& partition = partitionFor(cmd);
+    if (size == UPDATE_SIZE_UNKNOWN) {
+        size = partition.capacity;
+    }
+    if (size == 0 || size > partition.capacity) {
+        error = UPDATE_ERROR_SIZE;
+        return false;
+    }
+
+    command = cmd;
+    expected = size;
+    written = 0;
+    error = UPDATE_ERROR_OK;
+    running = true;
+    partition.data.clear();
+    partition.valid = false;
+    return true;
+}
+
+size_t UpdateClass::write(uint8_t* data, size_t len) {
+    if (!running || hasError()) return 0;
+    if (len > remaining()) {
+        error = UPDATE_ERROR_SIZE;
+        return 0;
+    }
+    if (command == U_FLASH && written == 0 && len > 0 && data[0] != 0xE9) {
+        error = UPDATE_ERROR_MAGIC_BYTE;
+        return 0;
+    }
+
+    fake::FlashPartition& partition = partitionFor(command);
+    // A sector is erased when the first byte lands in it
+    fake::ota.sectorErases += (written + len + SECTOR_SIZE - 1) / SECTOR_SIZE - (written + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    partition.data.insert(partition.data.end(), data, data + len);
+    written += len;
+    fake::ota.bytesWritten += len;
+    return len;
+}
+
+bool UpdateClass::end(bool evenIfRemaining) {
+    if (!running || hasError()) return false;
+    if (written < expected && !evenIfRemaining) {
+        error = UPDATE_ERROR_ABORT;
+        running = false;
+        return false;
+    }
+    partitionFor(command).valid = true;
+    running = false;
+    return true;
+}
+
+void UpdateClass::abort() {
+    if (running) {
+        error = UPDATE_ERROR_ABORT;
+    }
+    running = false;
+}
+
+const char* UpdateClass::errorString() const {
+    switch (error) {
+        case UPDATE_ERROR_OK: return "No Error";
+        case UPDATE_ERROR_WRITE: return "Flash Write Failed";
+        case UPDATE_ERROR_SIZE: return "Not Enough Space";
+        case UPDATE_ERROR_MAGIC_BYTE: return "Wrong Magic Byte";
+        case UPDATE_ERROR_NO_PARTITION: return "Partition Could Not be Found";
+        case UPDATE_ERROR_BAD_ARGUMENT: return "Bad Argument";
+        case UPDATE_ERROR_ABORT: return "Aborted";
+        default: return "UNKNOWN";
+    }
+}
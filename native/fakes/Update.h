@@ -0,0 +1,76 @@
+#ifndef FAKE_UPDATE_H
+#define FAKE_UPDATE_H
+
+#include <Arduino.h>
+#include <vector>
+
+/*
+ * In-memory Update (OTA flash writer) stand-in for the native environment
+ *
+ * Writes go to a fake partition per target, sized like the default ESP32
+ * partition table (two 1.25 MB app slots, 1.375 MB filesystem). Checks the
+ * same things the real class does: the size fits, a firmware image starts
+ * with the ESP image magic byte, and end() sees every announced byte.
+ * Data is flashed in 4 KB sectors like the real class, so the stats count
+ * sector erases.
+ */
+
+#define UPDATE_SIZE_UNKNOWN 0xFFFFFFFF
+#define U_FLASH   0
+#define U_SPIFFS  100
+
+#define UPDATE_ERROR_OK         0
+#define UPDATE_ERROR_WRITE      1
+#define UPDATE_ERROR_SIZE       4
+#define UPDATE_ERROR_MAGIC_BYTE 6
+#define UPDATE_ERROR_NO_PARTITION 10
+#define UPDATE_ERROR_BAD_ARGUMENT 11
+#define UPDATE_ERROR_ABORT      12
+
+class UpdateClass {
+private:
+    int command;
+    size_t expected;
+    size_t written;
+    uint8_t error;
+    bool running;
+
+public:
+    UpdateClass() : command(U_FLASH), expected(0), written(0), error(UPDATE_ERROR_OK), running(false) {}
+
+    bool begin(size_t size = UPDATE_SIZE_UNKNOWN, int command = U_FLASH, int ledPin = -1, uint8_t ledOn = LOW,
+               const char* label = NULL);
+    size_t write(uint8_t* data, size_t len);
+    bool end(bool evenIfRemaining = false);
+    void abort();
+
+    bool isRunning() const { return running; }
+    bool hasError() const { return error != UPDATE_ERROR_OK; }
+    uint8_t getError() const { return error; }
+    const char* errorString() const;
+    size_t size() const { return expected; }
+    size_t progress() const { return written; }
+    size_t remaining() const { return expected - written; }
+};
+
+extern UpdateClass Update;
+
+namespace fake {
+    struct FlashPartition {
+        std::vector<uint8_t> data;  // Bytes written by the last update
+        size_t capacity;
+        bool valid;                 // Last update to this partition ended successfully
+    };
+
+    struct OtaStats {
+        unsigned long sectorErases;
+        unsigned long bytesWritten;
+    };
+
+    extern FlashPartition appPartition;
+    extern FlashPartition fsPartition;
+    extern OtaStats ota;
+    void resetOta();
+}
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FAKE_WIFI_H
+#define FAKE_WIFI_H
+
+#include <Arduino.h>
+
+// WiFi stand-in for the native environment - state is driven by the test/benchmark
+
+typedef enum {
+    WL_IDLE_STATUS     = 0,
+    WL_NO_SSID_AVAIL   = 1,
+    WL_SCAN_COMPLETED  = 2,
+    WL_CONNECTED       = 3,
+    WL_CONNECT_FAILED  = 4,
+    WL_CONNECTION_LOST = 5,
+    WL_DISCONNECTED    = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF    = 0,
+    WIFI_STA    = 1,
+    WIFI_AP     = 2,
+    WIFI_AP_STA = 3
+} wifi_mode_t;
+
+class WiFiClass {
+public:
+    wl_status_t status() { return currentStatus; }
+    bool mode(wifi_mode_t m) { currentMode = m; return true; }
+    wifi_mode_t getMode() { return currentMode; }
+    wl_status_t begin() { beginCalls++; return currentStatus; }
+    wl_status_t begin(const char* ssid, const char* passphrase = nullptr) {
+        (void)ssid;
+        (void)passphrase;
+        return begin();
+    }
+    bool disconnect() { currentStatus = WL_DISCONNECTED; return true; }
+    bool softAP(const char* ssid, const char* passphrase = nullptr) {
+        (void)ssid;
+        (void)passphrase;
+        softAPActive = true;
+        return true;
+    }
+    uint8_t softAPgetStationNum() { return apStations; }
+    IPAddress softAPIP() { return IPAddress(192, 168, 4, 1); }
+    IPAddress localIP() { return currentStatus == WL_CONNECTED ? IPAddress(192, 168, 1, 50) : IPAddress(); }
+    String SSID() { return String("native-ssid"); }
+    int8_t RSSI() { return -55; }
+
+    // Test hooks
+    wl_status_t currentStatus = WL_CONNECTED;
+    wifi_mode_t currentMode = WIFI_STA;
+    uint8_t apStations = 0;
+    bool softAPActive = false;
+    unsigned long beginCalls = 0;
+};
+
+extern WiFiClass WiFi;
+
+class WiFiClient : public Client {
+public:
+    int connect(const char* host, uint16_t port) override { (void)host; (void)port; return 1; }
+    int setTimeout(uint32_t seconds) { (void)seconds; return 0; }  // arduino-esp32: connect and socket timeout
+    uint8_t connected() override { return 1; }
+    void stop() override {}
+    size_t write(uint8_t c) override { (void)c; return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { (void)buffer; return size; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "Wire.h"
+
+TwoWire Wire;
+
+namespace fake {
+    I2cStats i2c;
+    std::map<uint8_t, std::vector<uint8_t>> i2cDevices;
+
+    void addI2cDevice(uint8_t address) {
+        i2cDevices[address] = std::vector<uint8_t>(256, 0);
+    }
+
+    void resetI2c() {
+        i2c = I2cStats();
+        i2cDevices.clear();
+    }
+}
+
+bool TwoWire::begin(int sda, int scl, uint32_t frequency) {
+    fake::i2c.begins++;
+    return true;
+}
+
+void TwoWire::beginTransmission(uint8_t addr) {
+    address = addr;
+    pending.clear();
+    transmitting = true;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (!transmitting) return 0;
+    pending.push_back(data);
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        write(data[i]);
+    }
+    return length;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+    transmitting = false;
+    fake::i2c.transactions++;
+    fake::i2c.bytes += pending.size() + 1;  // Plus the address byte
+    
+    auto device = fake::i2cDevices.find(address);
+    if (device == fake::i2cDevices.end()) {
+        fake::i2c.errors++;
+        return 2;  // NACK on address
+    }
+    if (!pending.empty()) {
+        uint8_t reg = pending[0];
+        for (size_t i = 1; i < pending.size(); i++) {
+            device->second[(uint8_t)(reg + i - 1)] = pending[i];
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,48 @@
+#ifndef FAKE_WIRE_H
+#define FAKE_WIRE_H
+
+#include <Arduino.h>
+#include <map>
+#include <vector>
+
+/*
+ * Host-side stand-in for the Arduino Wire (I2C) library
+ *
+ * Every beginTransmission()/endTransmission() pair counts as one bus
+ * transaction. Writes are decoded as <register><data...> with sequential
+ * register addressing (MCP23017 style), so tests can read back the
+ * register image of each device.
+ */
+
+class TwoWire {
+private:
+    uint8_t address;
+    std::vector<uint8_t> pending;
+    bool transmitting;
+
+public:
+    TwoWire() : address(0), transmitting(false) {}
+    bool begin(int sda = -1, int scl = -1, uint32_t frequency = 0);
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t* data, size_t length);
+    uint8_t endTransmission(bool sendStop = true);
+};
+
+extern TwoWire Wire;
+
+namespace fake {
+    struct I2cStats {
+        unsigned long begins;
+        unsigned long transactions;
+        unsigned long bytes;
+        unsigned long errors;  // NACKs from absent devices
+    };
+
+    extern I2cStats i2c;
+    extern std::map<uint8_t, std::vector<uint8_t>> i2cDevices;  // Address -> 256-byte register image
+    void addI2cDevice(uint8_t address);  // Devices not added NACK
+    void resetI2c();
+}
+
+#endif
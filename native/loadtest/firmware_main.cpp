@@ -0,0 +1,438 @@
+/*
+ * Host-native firmware for load testing
+ *
+ * Runs the controller logic (relays, storage, MQTT bridge, RF matching) on
+ * Linux against a real MQTT broker, with the same loop structure and
+ * handlers as src/main.cpp. Hardware stays faked: GPIO, NVS and the RF
+ * receiver come from native/fakes; MQTT goes over a real socket
+ * (native/posix/PubSubClient.cpp).
+ *
+ * Build and run with:
+ *   pio run -e native-loadtest
+ *   .pio/build/native-loadtest/program --broker 127.0.0.1 --port 1883 --http-port 8080
+ *
+ * The ESP32 web server runs on its own task; here a minimal HTTP/1.0
+ * server is polled from loop() and only serves what the load test needs:
+ *   GET  /api/relays   relay states (same shape as the firmware)
+ *   POST /api/relay    {"relay": N, "state": true} (same handler logic)
+ *   GET  /api/debug/trace  command latency trace (same as the firmware)
+ *   POST /sim/rf       {"code": N, "bits": 24, "protocol": 1} - as if the
+ *                      RF receiver had decoded a frame
+ *   GET  /metrics      Prometheus loop / subsystem metrics
+ *
+ * native/loadtest/loadtest.py drives it; see README "Load Testing".
+ */
+
+#include <Arduino.h>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <RCSwitch.h>
+#include <WiFi.h>
+#include <ArduinoJson.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include "config.h"
+#include "relay_control.h"
+#include "rf_codes.h"
+#include "settings.h"
+#include "storage.h"
+#include "mqtt_bridge.h"
+#include "metrics.h"
+#include "relay_stats.h"
+#include "relay_history.h"
+#include "command_trace.h"
+#include "reconnect_policy.h"
+#include "log_buffer.h"
+
+Settings settings = {
+    "127.0.0.1",       // mqtt_server
+    "1883",            // mqtt_port
+    "",                // mqtt_user
+    "",                // mqtt_password
+    "esp32-relay",     // mqtt_hostname
+    NUM_RELAYS,        // activeRelayCount
+    MQTT_DEVICE_DISCOVERY,
+    -1,
+    MQTT_AGGREGATE_STATE
+};
+
+WiFiClient espClient;
+PubSubClient mqttClient(espClient);
+RelayControl relayControl;
+RFCodeStore rfCodes;
+Preferences preferences;
+Storage storage(preferences);
+MqttBridge mqttBridge(mqttClient, relayControl, rfCodes, settings, storage);
+RCSwitch rfReceiver;
+
+// MQTT retries every second instead of MQTT_RETRY_INTERVAL so test runs start quickly
+static ReconnectTiming loadtestTiming() {
+    ReconnectTiming timing;
+    timing.mqttRetryInterval = 1000;
+    return timing;
+}
+ReconnectPolicy mqttRetry(loadtestTiming());
+
+static int httpPort = 8080;
+static int listenFd = -1;
+static volatile sig_atomic_t stopRequested = 0;
+
+// ---------------------------------------------------------------------------
+// Firmware logic - mirrors src/main.cpp
+// ---------------------------------------------------------------------------
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+    if (mqttBridge.handleMessage(topic, payload, length)) {
+        storage.saveRelayStates(relayControl);  // Save state to persistent storage
+        mqttBridge.publishAllStates();
+    }
+}
+
+void reconnectMQTT() {
+    if (!mqttRetry.mqttAttemptDue(millis())) {
+        return;
+    }
+
+    LOGI("[MQTT] Connecting to %s", settings.mqtt_server);
+    metrics.mqttReconnectAttempts++;
+
+    String clientId = String(DEVICE_NAME) + "-loadtest-" + String((unsigned long)getpid(), HEX);
+
+    if (!mqttBridge.connect(clientId.c_str())) {
+        LOGW("[MQTT] Connection failed, rc=%d", mqttClient.state());
+    }
+}
+
+void publishRFTriggerState(int slot, CommandTrace* trace) {
+    if (!mqttClient.connected()) return;
+
+    mqttBridge.publishRFTrigger(slot, true);
+    CommandTracer::finish(trace);
+
+    // Same blocking wait as the device - commands are still serviced through loop()
+    unsigned long start = millis();
+    while (millis() - start < RF_TRIGGER_DURATION) {
+        mqttClient.loop();
+        yield();
+        delay(10);
+    }
+
+    mqttBridge.publishRFTrigger(slot, false);
+}
+
+void checkRFSignal() {
+    if (rfReceiver.available()) {
+        uint32_t received = micros();
+        unsigned long receivedCode = rfReceiver.getReceivedValue();
+
+        if (receivedCode != 0) {
+            metrics.rfFrames++;
+            int slot = rfCodes.match(receivedCode, rfReceiver.getReceivedBitlength(), rfReceiver.getReceivedProtocol());
+            if (slot >= 0) {
+                metrics.rfMatches++;
+                CommandTrace* trace = commandTrace.begin(TRACE_RF, slot, true, received);
+                CommandTracer::mark(trace, TRACE_DISPATCHED);
+                rfCodes.get(slot).lastTrigger = millis();
+                publishRFTriggerState(slot, trace);
+            }
+        }
+
+        rfReceiver.resetAvailable();
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Minimal HTTP server
+// ---------------------------------------------------------------------------
+class StringPrint : public Print {
+public:
+    std::string text;
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+    size_t write(const uint8_t* buffer, size_t size) override { text.append((const char*)buffer, size); return size; }
+};
+
+static bool startsWith(const std::string& text, const char* prefix) {
+    return text.compare(0, strlen(prefix), prefix) == 0;
+}
+
+static void sendResponse(int fd, int status, const char* contentType, const std::string& body) {
+    const char* reason = status == 200 ? "OK" : status == 400 ? "Bad Request" : "Not Found";
+    char header[160];
+    int headerLength = snprintf(header, sizeof(header),
+                                "HTTP/1.0 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+                                status, reason, contentType, (unsigned)body.size());
+    send(fd, header, headerLength, MSG_NOSIGNAL);
+    send(fd, body.data(), body.size(), MSG_NOSIGNAL);
+}
+
+static void handleRelayPost(int fd, const std::string& body) {
+    uint32_t received = micros();
+    StaticJsonDocument<256> doc;
+    if (deserializeJson(doc, body.c_str())) {
+        sendResponse(fd, 400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        return;
+    }
+
+    int relayId = doc["relay"];
+    bool state = doc["state"];
+    if (relayId < 1 || relayId > NUM_RELAYS) {
+        sendResponse(fd, 400, "application/json", "{\"error\":\"Invalid relay ID\"}");
+        return;
+    }
+
+    CommandTrace* trace = commandTrace.begin(TRACE_HTTP, relayId - 1, state, received, doc["cid"].as<const char*>());
+    CommandTracer::mark(trace, TRACE_DISPATCHED);
+    relayControl.setState(relayId - 1, state, RELAY_SOURCE_HTTP);
+    CommandTracer::mark(trace, TRACE_GPIO);
+    mqttBridge.publishState(relayId - 1);
+    CommandTracer::finish(trace);
+    mqttBridge.publishTrace(trace);
+    storage.saveRelayStates(relayControl);
+
+    char response[64];
+    snprintf(response, sizeof(response), "{\"success\":true,\"relay\":%d,\"state\":%s}", relayId, state ? "true" : "false");
+    sendResponse(fd, 200, "application/json", response);
+}
+
+static void handleRelaysGet(int fd) {
+    DynamicJsonDocument doc(JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(NUM_RELAYS) + NUM_RELAYS * JSON_OBJECT_SIZE(4));
+    doc["active_relays"] = settings.activeRelayCount;
+    JsonArray relays = doc["relays"].to<JsonArray>();
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        JsonObject relay = relays.createNestedObject();
+        relay["id"] = i + 1;
+        relay["name"] = RELAY_NAMES[i];
+        relay["state"] = relayControl.getState(i);
+        relay["active"] = i < settings.activeRelayCount;
+    }
+
+    String output;
+    serializeJson(doc, output);
+    sendResponse(fd, 200, "application/json", output.c_str());
+}
+
+static void handleRFPost(int fd, const std::string& body) {
+    StaticJsonDocument<128> doc;
+    if (deserializeJson(doc, body.c_str()) || !doc["code"].is<unsigned long>()) {
+        sendResponse(fd, 400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        return;
+    }
+
+    // A newer frame overwrites one that hasn't been handled yet, like rc-switch
+    rfReceiver.inject(doc["code"].as<unsigned long>(), doc["bits"] | 24, doc["protocol"] | 1);
+    sendResponse(fd, 200, "application/json", "{\"success\":true}");
+}
+
+static bool setupHttpServer() {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenFd < 0) return false;
+
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(httpPort);
+    if (bind(listenFd, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    fcntl(listenFd, F_SETFL, O_NONBLOCK);
+    return true;
+}
+
+// Serves at most one request per call, like one AsyncTCP callback per loop
+static void handleHttpClient() {
+    int fd = accept(listenFd, nullptr, nullptr);
+    if (fd < 0) return;
+
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    // Read headers, then Content-Length bytes of body
+    std::string request;
+    size_t headerEnd = std::string::npos;
+    size_t contentLength = 0;
+    char chunk[1024];
+    while (true) {
+        if (headerEnd == std::string::npos) {
+            headerEnd = request.find("\r\n\r\n");
+            if (headerEnd != std::string::npos) {
+                size_t field = request.find("Content-Length:");
+                if (field == std::string::npos) field = request.find("content-length:");
+                if (field != std::string::npos && field < headerEnd) {
+                    contentLength = strtoul(request.c_str() + field + 15, nullptr, 10);
+                }
+            }
+        }
+        if (headerEnd != std::string::npos && request.size() >= headerEnd + 4 + contentLength) break;
+        if (request.size() > 8192) break;
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if (n <= 0) break;
+        request.append(chunk, n);
+    }
+
+    if (headerEnd == std::string::npos) {
+        close(fd);
+        return;
+    }
+
+    std::string body = request.substr(headerEnd + 4, contentLength);
+    if (startsWith(request, "POST /api/relay ")) {
+        handleRelayPost(fd, body);
+    } else if (startsWith(request, "GET /api/relays ")) {
+        handleRelaysGet(fd);
+    } else if (startsWith(request, "GET /api/debug/trace")) {
+        size_t query = request.find("recent=");
+        int recent = query != std::string::npos && query < request.find(' ', 4) ? atoi(request.c_str() + query + 7) : 10;
+        StringPrint out;
+        commandTrace.writeJson(out, recent);
+        sendResponse(fd, 200, "application/json", out.text);
+    } else if (startsWith(request, "POST /sim/rf ")) {
+        handleRFPost(fd, body);
+    } else if (startsWith(request, "GET /metrics ")) {
+        StringPrint out;
+        metrics.writePrometheus(out);
+        sendResponse(fd, 200, "text/plain; version=0.0.4", out.text);
+    } else {
+        sendResponse(fd, 404, "application/json", "{\"error\":\"Not found\"}");
+    }
+    close(fd);
+}
+
+// ---------------------------------------------------------------------------
+// setup() / loop()
+// ---------------------------------------------------------------------------
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [--broker HOST] [--port N] [--user U] [--password P]\n"
+            "          [--hostname NAME] [--http-port N] [--rf-codes N]\n",
+            program);
+}
+
+static bool parseArgs(int argc, char** argv, int& rfCodeCount) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!value) {
+            usage(argv[0]);
+            return false;
+        }
+        if (strcmp(arg, "--broker") == 0) {
+            snprintf(settings.mqtt_server, sizeof(settings.mqtt_server), "%s", value);
+        } else if (strcmp(arg, "--port") == 0) {
+            snprintf(settings.mqtt_port, sizeof(settings.mqtt_port), "%s", value);
+        } else if (strcmp(arg, "--user") == 0) {
+            snprintf(settings.mqtt_user, sizeof(settings.mqtt_user), "%s", value);
+        } else if (strcmp(arg, "--password") == 0) {
+            snprintf(settings.mqtt_password, sizeof(settings.mqtt_password), "%s", value);
+        } else if (strcmp(arg, "--hostname") == 0) {
+            snprintf(settings.mqtt_hostname, sizeof(settings.mqtt_hostname), "%s", value);
+        } else if (strcmp(arg, "--http-port") == 0) {
+            httpPort = atoi(value);
+        } else if (strcmp(arg, "--rf-codes") == 0) {
+            rfCodeCount = constrain(atoi(value), 0, MAX_RF_CODES);
+        } else {
+            usage(argv[0]);
+            return false;
+        }
+        i++;
+    }
+    return true;
+}
+
+static void setup(int rfCodeCount) {
+    fake::realTime = true;
+    fake::serialEcho = true;
+
+    metrics.begin();
+    relayControl.init();
+    relayControl.setChangeHook([](const RelayControl::Mask& changed, const RelayControl::Mask& states,
+                                  RelaySource source) {
+        relayHistory.record(changed, states, source, millis());
+        if (source != RELAY_SOURCE_BOOT) {
+            relayStats.record(changed, states, millis());
+        }
+    });
+    storage.load(settings, relayControl, rfCodes);  // Fresh fake NVS - keeps the command-line MQTT settings
+    relayStats.begin(relayControl.getMask(), millis());
+
+    // Codes the load test fires: RF_BASE_CODE + 3 * slot, 24 bit, protocol 1
+    rfCodes.clear();
+    for (int i = 0; i < rfCodeCount; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "Load Test %d", i + 1);
+        rfCodes.add(name, 5592400UL + i * 3, 24, 1);
+    }
+
+    mqttClient.setServer(settings.mqtt_server, atoi(settings.mqtt_port));
+    mqttClient.setCallback(mqttCallback);
+    mqttClient.setBufferSize(1024);
+    reconnectMQTT();
+
+    Serial.printf("[LoadTest] MQTT %s:%s as %s, HTTP on 127.0.0.1:%d\n",
+                  settings.mqtt_server, settings.mqtt_port, settings.mqtt_hostname, httpPort);
+}
+
+static void loop() {
+    metrics.beginLoop();
+
+    if (!mqttClient.connected()) {
+        SubsystemTimer timer(SUBSYS_MQTT_RECONNECT);
+        reconnectMQTT();
+    }
+    {
+        SubsystemTimer timer(SUBSYS_MQTT_LOOP);
+        mqttClient.loop();
+    }
+    {
+        SubsystemTimer timer(SUBSYS_RF);
+        checkRFSignal();
+    }
+    handleHttpClient();
+    // No drain task on the host - the log goes to stdout from here
+    logBuffer.drain(Serial, LOG_BUFFER_ENTRIES);
+
+    metrics.endLoop();
+
+    // The device loop spins; give the broker and load generator the CPU instead
+    delayMicroseconds(50);
+}
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+int main(int argc, char** argv) {
+    int rfCodeCount = 4;
+    if (!parseArgs(argc, argv, rfCodeCount)) {
+        return 2;
+    }
+
+    // Host firmware keeps its own fresh NVS and starts with every relay off
+    fake::resetNvs(true);
+
+    if (!setupHttpServer()) {
+        fprintf(stderr, "[LoadTest] Cannot listen on port %d\n", httpPort);
+        return 1;
+    }
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    setup(rfCodeCount);
+    while (!stopRequested) {
+        loop();
+    }
+
+    // A clean disconnect doesn't fire the will - mark the controller offline like a lost device
+    String availTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    mqttClient.publish(availTopic.c_str(), "offline", true);
+    mqttClient.disconnect();
+    close(listenFd);
+    return 0;
+}
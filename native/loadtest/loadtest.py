@@ -0,0 +1,447 @@
+#!/usr/bin/env python3
+"""
+Load test for the relay controller
+
+Fires storms of MQTT relay commands, batches of HTTP relay requests and
+simulated RF frames at the controller and measures how fast state comes
+back on MQTT. Runs against a local broker and the host-native firmware
+(env:native-loadtest), or against a running device when --firmware is
+omitted.
+
+Usage:
+    pio run -e native-loadtest
+    python3 native/loadtest/loadtest.py --start-broker \\
+        --firmware .pio/build/native-loadtest/program --output results.json
+
+Requires paho-mqtt (pip install paho-mqtt) and, for --start-broker,
+mosquitto on PATH.
+
+Latency is measured from command publish / request send to the matching
+retained state message. Each relay is toggled, so the expected payload of
+every command is known. Per relay, commands are matched in order. A
+command without a state by the end of the settle time counts as dropped.
+A state that completes a command older than one already completed from the
+same sender (the MQTT publisher, or one HTTP worker) counts as reordered.
+RF frames are matched to the rf_<slot>/state ON message.
+
+The results are a single JSON document (schema 1), meant to be stored per
+release and compared.
+"""
+
+import argparse
+import collections
+import concurrent.futures
+import datetime
+import json
+import os
+import shutil
+import socket
+import subprocess
+import sys
+import threading
+import time
+import urllib.error
+import urllib.request
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.exit("paho-mqtt is required: pip install paho-mqtt")
+
+TOPIC_PREFIX = "homeassistant/switch/"
+RF_BASE_CODE = 5592400  # Codes learned by the host firmware: RF_BASE_CODE + 3 * slot
+SCHEMA_VERSION = 1
+
+
+def percentile(values, pct):
+    """Nearest-rank percentile, None for an empty list."""
+    if not values:
+        return None
+    ordered = sorted(values)
+    rank = max(1, int(round(pct / 100.0 * len(ordered))))
+    return ordered[min(rank, len(ordered)) - 1]
+
+
+def summarize(latencies):
+    ms = [value * 1000.0 for value in latencies]
+    rounded = lambda value: round(value, 3) if value is not None else None
+    return {
+        "p50": rounded(percentile(ms, 50)),
+        "p90": rounded(percentile(ms, 90)),
+        "p99": rounded(percentile(ms, 99)),
+        "max": rounded(max(ms) if ms else None),
+        "mean": rounded(sum(ms) / len(ms) if ms else None),
+    }
+
+
+class StateTracker:
+    """Matches relay / RF state messages to the commands that caused them."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.condition = threading.Condition(self.lock)
+        self.current = {}                                # relay -> last seen "ON"/"OFF"
+        self.intended = {}                               # relay -> value of the last command
+        self.pending = collections.defaultdict(collections.deque)
+        self.rf_pending = collections.defaultdict(collections.deque)
+        self.sequence = 0
+        self.reset_counters()
+
+    def reset_counters(self):
+        with self.lock:
+            self.latencies = []
+            self.sent = 0
+            self.reordered = 0
+            self.last_completed = {}                     # sender -> newest completed sequence
+            self.pending.clear()
+            self.rf_pending.clear()
+
+    def sync(self, states):
+        """Start toggling from the controller's actual relay states."""
+        with self.lock:
+            self.current.update(states)
+            self.intended.clear()
+
+    def next_value(self, relay):
+        with self.lock:
+            last = self.intended.get(relay, self.current.get(relay, "OFF"))
+            return "OFF" if last == "ON" else "ON"
+
+    def expect(self, relay, value, sent_at, sender=0):
+        with self.lock:
+            self.intended[relay] = value
+            self.pending[relay].append((self.sequence, sender, value, sent_at))
+            self.sequence += 1
+            self.sent += 1
+
+    def expect_rf(self, slot, sent_at):
+        with self.lock:
+            self.rf_pending[slot].append((self.sequence, 0, "ON", sent_at))
+            self.sequence += 1
+            self.sent += 1
+
+    def on_state(self, queue, value, received_at):
+        # Repeats of the previous value (publishAllStates) never match the head
+        if queue and queue[0][2] == value:
+            sequence, sender, _, sent_at = queue.popleft()
+            self.latencies.append(received_at - sent_at)
+            newest = self.last_completed.get(sender, -1)
+            if sequence < newest:
+                self.reordered += 1
+            self.last_completed[sender] = max(newest, sequence)
+            self.condition.notify_all()
+
+    def on_message(self, topic, payload, received_at):
+        # homeassistant/switch/<host>/relay<N>/state or .../rf_<slot>/state
+        entity = topic.rsplit("/", 2)[-2]
+        with self.lock:
+            if entity.startswith("relay"):
+                relay = int(entity[5:]) - 1
+                self.current[relay] = payload
+                self.on_state(self.pending[relay], payload, received_at)
+            elif entity.startswith("rf_"):
+                self.on_state(self.rf_pending[int(entity[3:])], payload, received_at)
+
+    def outstanding(self):
+        return sum(len(q) for q in self.pending.values()) + sum(len(q) for q in self.rf_pending.values())
+
+    def wait_idle(self, timeout):
+        deadline = time.monotonic() + timeout
+        with self.lock:
+            while self.outstanding() > 0:
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    break
+                self.condition.wait(remaining)
+
+    def result(self, duration):
+        with self.lock:
+            completed = len(self.latencies)
+            return {
+                "sent": self.sent,
+                "completed": completed,
+                "dropped": self.outstanding(),
+                "reordered": self.reordered,
+                "duration_s": round(duration, 3),
+                "throughput_per_s": round(completed / duration, 1) if duration > 0 else None,
+                "latency_ms": summarize(self.latencies),
+            }
+
+
+class LoadTest:
+    def __init__(self, args):
+        self.args = args
+        self.broker_host, _, port = args.broker.partition(":")
+        self.broker_port = int(port or 1883)
+        self.base = TOPIC_PREFIX + args.hostname
+        self.tracker = StateTracker()
+        self.online = threading.Event()
+        self.processes = []
+
+        self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, client_id="relay-loadtest-%d" % os.getpid())
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+
+    # -- MQTT -------------------------------------------------------------
+
+    def on_connect(self, client, userdata, flags, reason_code, properties):
+        client.subscribe(self.base + "/+/state")
+        client.subscribe(self.base + "/availability")
+
+    def on_message(self, client, userdata, message):
+        received_at = time.perf_counter()
+        payload = message.payload.decode(errors="replace")
+        if message.topic.endswith("/availability"):
+            if payload == "online":
+                self.online.set()
+            return
+        self.tracker.on_message(message.topic, payload, received_at)
+
+    # -- Processes ----------------------------------------------------------
+
+    def start_broker(self):
+        binary = shutil.which("mosquitto")
+        if not binary:
+            sys.exit("--start-broker needs mosquitto on PATH")
+        self.processes.append(subprocess.Popen([binary, "-p", str(self.broker_port)],
+                                               stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL))
+        wait_for_port(self.broker_host, self.broker_port, 10)
+
+    def start_firmware(self):
+        http_port = self.args.http.rsplit(":", 1)[-1].rstrip("/")
+        command = [self.args.firmware,
+                   "--broker", self.broker_host, "--port", str(self.broker_port),
+                   "--hostname", self.args.hostname, "--http-port", http_port,
+                   "--rf-codes", str(self.args.rf_slots)]
+        log = open(self.args.firmware_log, "w") if self.args.firmware_log else subprocess.DEVNULL
+        self.processes.append(subprocess.Popen(command, stdout=log, stderr=subprocess.STDOUT))
+
+    def stop(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+        for process in reversed(self.processes):
+            process.terminate()
+            try:
+                process.wait(5)
+            except subprocess.TimeoutExpired:
+                process.kill()
+
+    # -- Scenarios ------------------------------------------------------------
+
+    def run_mqtt(self):
+        """Open-loop command storm at a fixed rate, round-robin over the relays."""
+        self.tracker.reset_counters()
+        interval = 1.0 / self.args.mqtt_rate
+        start = time.perf_counter()
+        for i in range(self.args.mqtt_commands):
+            relay = i % self.args.relays
+            target = start + i * interval
+            delay = target - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+            value = self.tracker.next_value(relay)
+            self.tracker.expect(relay, value, time.perf_counter())
+            self.client.publish("%s/relay%d/set" % (self.base, relay + 1), value)
+        self.tracker.wait_idle(self.args.settle)
+        return self.tracker.result(time.perf_counter() - start)
+
+    def run_http(self):
+        """Concurrent POST /api/relay; each worker owns its own relays so values stay ordered."""
+        self.tracker.reset_counters()
+        workers = min(self.args.http_concurrency, self.args.relays)
+        response_times = []
+        errors = [0]
+        shed = [0]
+        lock = threading.Lock()
+
+        def worker(index):
+            relays = list(range(index, self.args.relays, workers))
+            for n in range(index, self.args.http_requests, workers):
+                relay = relays[(n // workers) % len(relays)]
+                value = self.tracker.next_value(relay)
+                body = json.dumps({"relay": relay + 1, "state": value == "ON"}).encode()
+                request = urllib.request.Request(self.args.http + "/api/relay", data=body,
+                                                 headers={"Content-Type": "application/json"})
+                sent_at = time.perf_counter()
+                self.tracker.expect(relay, value, sent_at, sender=index)
+                try:
+                    with urllib.request.urlopen(request, timeout=10) as response:
+                        response.read()
+                    with lock:
+                        response_times.append(time.perf_counter() - sent_at)
+                except urllib.error.HTTPError as error:
+                    # 429 / 503: turned away by the device's admission control
+                    with lock:
+                        if error.code in (429, 503):
+                            shed[0] += 1
+                        else:
+                            errors[0] += 1
+                except Exception:
+                    with lock:
+                        errors[0] += 1
+
+        start = time.perf_counter()
+        with concurrent.futures.ThreadPoolExecutor(workers) as pool:
+            list(pool.map(worker, range(workers)))
+        self.tracker.wait_idle(self.args.settle)
+        result = self.tracker.result(time.perf_counter() - start)
+        result["errors"] = errors[0]
+        result["shed"] = shed[0]
+        result["response_ms"] = summarize(response_times)
+        return result
+
+    def run_rf(self):
+        """Simulated RF frames through the host firmware's /sim/rf hook."""
+        self.tracker.reset_counters()
+        start = time.perf_counter()
+        for i in range(self.args.rf_frames):
+            slot = i % self.args.rf_slots
+            body = json.dumps({"code": RF_BASE_CODE + 3 * slot, "bits": 24, "protocol": 1}).encode()
+            request = urllib.request.Request(self.args.http + "/sim/rf", data=body,
+                                             headers={"Content-Type": "application/json"})
+            self.tracker.expect_rf(slot, time.perf_counter())
+            with urllib.request.urlopen(request, timeout=10) as response:
+                response.read()
+            time.sleep(self.args.rf_interval)
+        self.tracker.wait_idle(self.args.settle)
+        return self.tracker.result(time.perf_counter() - start)
+
+    def sync_states(self):
+        """Read relay states over HTTP - retained MQTT states may be left over from an earlier run."""
+        deadline = time.monotonic() + self.args.startup_timeout
+        while True:
+            try:
+                with urllib.request.urlopen(self.args.http + "/api/relays", timeout=10) as response:
+                    relays = json.load(response)["relays"]
+                break
+            except OSError:
+                if time.monotonic() > deadline:
+                    raise
+                time.sleep(0.2)
+        self.tracker.sync({relay["id"] - 1: "ON" if relay["state"] else "OFF" for relay in relays})
+
+    def fetch_metrics(self):
+        """Counters from /metrics, summed over labels."""
+        try:
+            with urllib.request.urlopen(self.args.http + "/metrics", timeout=5) as response:
+                text = response.read().decode()
+        except Exception:
+            return None
+        counters = {}
+        for line in text.splitlines():
+            if line.startswith("#") or not line.strip():
+                continue
+            name, _, value = line.rpartition(" ")
+            name = name.split("{", 1)[0]
+            if name.endswith("_total"):
+                counters[name] = counters.get(name, 0) + float(value)
+        return counters
+
+    def fetch_trace(self):
+        """Per-stage latency percentiles from /api/debug/trace (firmware side of the round trip)."""
+        try:
+            with urllib.request.urlopen(self.args.http + "/api/debug/trace?recent=0", timeout=5) as response:
+                return json.load(response)["sources"]
+        except Exception:
+            return None
+
+    def run(self):
+        if self.args.start_broker:
+            self.start_broker()
+        if self.args.firmware:
+            self.start_firmware()
+
+        self.client.connect(self.broker_host, self.broker_port)
+        self.client.loop_start()
+        if not self.online.wait(self.args.startup_timeout):
+            raise RuntimeError("controller did not come online on %s/availability" % self.base)
+        self.sync_states()
+
+        scenarios = {}
+        if self.args.mqtt_commands > 0:
+            scenarios["mqtt"] = self.run_mqtt()
+        if self.args.http_requests > 0:
+            scenarios["http"] = self.run_http()
+        if self.args.rf_frames > 0:
+            scenarios["rf"] = self.run_rf()
+
+        return {
+            "schema": SCHEMA_VERSION,
+            "label": self.args.label,
+            "timestamp": datetime.datetime.now(datetime.timezone.utc).isoformat(timespec="seconds"),
+            "git_commit": git_commit(),
+            "config": {
+                "broker": "%s:%d" % (self.broker_host, self.broker_port),
+                "hostname": self.args.hostname,
+                "relays": self.args.relays,
+                "mqtt_commands": self.args.mqtt_commands,
+                "mqtt_rate": self.args.mqtt_rate,
+                "http_requests": self.args.http_requests,
+                "http_concurrency": self.args.http_concurrency,
+                "rf_frames": self.args.rf_frames,
+                "rf_interval_s": self.args.rf_interval,
+                "firmware": "host" if self.args.firmware else "external",
+            },
+            "scenarios": scenarios,
+            "firmware_metrics": self.fetch_metrics(),
+            "firmware_trace": self.fetch_trace(),
+        }
+
+
+def wait_for_port(host, port, timeout):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection((host, port), timeout=0.5):
+                return
+        except OSError:
+            time.sleep(0.1)
+    raise RuntimeError("nothing listening on %s:%d" % (host, port))
+
+
+def git_commit():
+    try:
+        return subprocess.check_output(["git", "rev-parse", "--short", "HEAD"],
+                                       stderr=subprocess.DEVNULL, text=True).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Relay controller load test")
+    parser.add_argument("--broker", default="127.0.0.1:1883", help="MQTT broker host:port")
+    parser.add_argument("--start-broker", action="store_true", help="start mosquitto on the broker port")
+    parser.add_argument("--firmware", help="host firmware binary to start (omit to test a running device)")
+    parser.add_argument("--firmware-log", help="write the host firmware's output here")
+    parser.add_argument("--http", default="http://127.0.0.1:8080", help="controller base URL")
+    parser.add_argument("--hostname", default="esp32-relay", help="MQTT hostname of the controller")
+    parser.add_argument("--relays", type=int, default=16, help="relays to exercise")
+    parser.add_argument("--mqtt-commands", type=int, default=2000)
+    parser.add_argument("--mqtt-rate", type=float, default=200.0, help="MQTT commands per second")
+    parser.add_argument("--http-requests", type=int, default=500)
+    parser.add_argument("--http-concurrency", type=int, default=4)
+    parser.add_argument("--rf-frames", type=int, default=4)
+    parser.add_argument("--rf-slots", type=int, default=4, help="RF codes learned by the host firmware")
+    parser.add_argument("--rf-interval", type=float, default=0.5, help="seconds between RF frames")
+    parser.add_argument("--settle", type=float, default=10.0, help="seconds to wait for outstanding states")
+    parser.add_argument("--startup-timeout", type=float, default=15.0)
+    parser.add_argument("--label", default=None, help="free-form tag stored in the results (e.g. release)")
+    parser.add_argument("--output", help="write JSON results here instead of stdout")
+    args = parser.parse_args()
+
+    test = LoadTest(args)
+    try:
+        results = test.run()
+    finally:
+        test.stop()
+
+    text = json.dumps(results, indent=2)
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write(text + "\n")
+    else:
+        print(text)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,574 @@
+/*
+ * WiFi / broker outage simulator
+ *
+ * Runs ReconnectPolicy, the timing the firmware's loop() uses to get WiFi
+ * and MQTT back, against a simulated access point, station and broker on a
+ * virtual clock. The clock jumps from one event to the next (a policy
+ * deadline, an association finishing, a scripted outage) instead of
+ * stepping through every loop(), so thousands of outages run per second.
+ *
+ * Build and run with:
+ *   pio run -e native-netsim
+ *   .pio/build/native-netsim/program --scenarios 20000 --client 0.3
+ *   .pio/build/native-netsim/program --reconnect-interval-ms 10000 --no-auto-reconnect
+ *   .pio/build/native-netsim/program --script outage.txt --scenarios 1 --trace
+ *
+ * Random scenarios: an AP outage (log-uniform length) and/or a broker
+ * outage overlapping it, and with --client a phone joining the setup AP
+ * some time after it opens. Script format, one event per line, seconds
+ * from the start ('#' starts a comment):
+ *   10 ap down
+ *   95 ap up
+ *   40 broker down
+ *   300 broker up
+ *   60 client join          someone on the setup AP (ignored if it isn't open)
+ *   200 client leave
+ *
+ * Device model: after WiFi.begin() the station associates within
+ * --assoc-ms if the AP is up at the end of that window. With auto-reconnect
+ * (the Arduino core default) a failed attempt starts the next one; without
+ * it the station waits for the next WiFi.begin(). A lost AP is noticed
+ * after --beacon-loss-ms, or when it comes back. A broker outage drops
+ * MQTT after --mqtt-detect-ms; connect attempts block loop() for
+ * --mqtt-connect-ms (--mqtt-fail-ms when the broker is down). loop() runs
+ * at least every 10 ms. Not modelled: DHCP, radio channel changes, mDNS.
+ *
+ * Reported per scenario, as distributions:
+ *   wifi after AP back     AP is back -> station has an IP
+ *   mqtt after available   AP and broker both back -> MQTT connected
+ *   offline                first outage -> MQTT connected
+ *   AP mode                time the setup AP was open
+ *   AP mode after AP back  ... while the network was already back
+ */
+
+#include <Arduino.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "reconnect_policy.h"
+
+static const uint32_t LOOP_MS = 10;
+static const uint32_t START_MS = 1000;
+static const uint32_t NEVER = UINT32_MAX;
+static const uint32_t HORIZON_MS = 24UL * 3600 * 1000;  // After the last event - later counts as not recovered
+
+enum EventType { AP_DOWN, AP_UP, BROKER_DOWN, BROKER_UP, CLIENT_JOIN, CLIENT_LEAVE };
+
+static const char* const EVENT_NAMES[] = {"ap down", "ap up", "broker down", "broker up", "client join",
+                                          "client leave"};
+
+struct Event {
+    uint32_t time;
+    EventType type;
+};
+
+struct Options {
+    unsigned long scenarios = 10000;
+    uint32_t seed = 1;
+    double apProbability = 0.8;         // Random scenarios: chance of an AP outage
+    double apMinS = 1, apMaxS = 1800;
+    double brokerProbability = 0.4;     // ... and of a broker outage (at least one of the two)
+    double brokerMinS = 1, brokerMaxS = 600;
+    double clientProbability = 0;       // ... and of someone joining the setup AP
+    uint32_t assocMinMs = 1500, assocMaxMs = 4000;
+    uint32_t beaconLossMs = 6000;
+    bool autoReconnect = true;
+    uint32_t mqttDetectMs = 0;
+    uint32_t mqttConnectMs = 100;
+    uint32_t mqttFailMs = 0;
+    bool trace = false;
+    ReconnectTiming timing;
+};
+
+struct Outcome {
+    bool recovered = false;
+    bool apOutage = false;
+    uint32_t wifiAfterApBack = 0;
+    uint32_t mqttAfterAvailable = 0;
+    uint32_t offline = 0;
+    uint32_t apMode = 0;
+    uint32_t apModeAfterApBack = 0;
+    uint32_t apOpened = 0;
+    uint32_t wifiBegins = 0;
+    uint32_t mqttAttempts = 0;
+};
+
+// ---------------------------------------------------------------------------
+// One scenario
+// ---------------------------------------------------------------------------
+class Simulation {
+private:
+    const Options& options;
+    std::mt19937& rng;
+    std::vector<Event> events;          // Pending, unordered - a handful at most
+    ReconnectPolicy policy;
+    uint32_t now;
+
+    // World
+    bool apUp = true;
+    bool brokerUp = true;
+    int apClients = 0;
+    uint32_t apBackAt = 0;              // Last AP_UP (0 = AP never went down)
+    uint32_t brokerBackAt = 0;
+    uint32_t firstOutageAt = NEVER;
+
+    // Station
+    bool connected = true;
+    bool associating = false;
+    uint32_t associatedAt = NEVER;
+    uint32_t lostAt = NEVER;            // Beacon loss pending
+    uint32_t wifiBackAt = 0;
+
+    // MQTT
+    bool mqttConnected = true;
+    uint32_t mqttLostAt = NEVER;
+    uint32_t mqttBackAt = 0;
+
+    // Setup AP
+    bool apOpen = false;
+    uint32_t apOpenedAt = 0;
+    uint32_t clientDelay;               // Random client: joins this long after the AP opens (0 = none)
+    uint32_t clientStay;
+
+    Outcome outcome;
+
+    uint32_t randomMs(uint32_t low, uint32_t high) {
+        return std::uniform_int_distribution<uint32_t>(low, max(low, high))(rng);
+    }
+
+    void log(const char* format, ...) {
+        if (!options.trace) return;
+        va_list args;
+        va_start(args, format);
+        printf("%10.3f  ", (now - START_MS) / 1e3);
+        vprintf(format, args);
+        printf("\n");
+        va_end(args);
+    }
+
+    void startAssociation(const char* why) {
+        associating = true;
+        associatedAt = now + randomMs(options.assocMinMs, options.assocMaxMs);
+        log("station: %s, associating until %.3f", why, (associatedAt - START_MS) / 1e3);
+    }
+
+    void closeAp() {
+        apOpen = false;
+        outcome.apMode += now - apOpenedAt;
+        if (apBackAt) {
+            outcome.apModeAfterApBack += now - max(apOpenedAt, apBackAt);
+        }
+        apClients = 0;
+        events.erase(std::remove_if(events.begin(), events.end(),
+                                    [](const Event& e) { return e.type == CLIENT_JOIN || e.type == CLIENT_LEAVE; }),
+                     events.end());
+        log("AP mode closed");
+    }
+
+    void apply(const Event& event) {
+        switch (event.type) {
+            case AP_DOWN:
+                apUp = false;
+                firstOutageAt = min(firstOutageAt, now);
+                outcome.apOutage = true;
+                if (connected && lostAt == NEVER) {
+                    lostAt = now + options.beaconLossMs;
+                }
+                break;
+            case AP_UP:
+                apUp = true;
+                apBackAt = now;
+                // The restarted AP doesn't know the station - it is dropped right away
+                if (lostAt != NEVER) lostAt = now;
+                break;
+            case BROKER_DOWN:
+                brokerUp = false;
+                firstOutageAt = min(firstOutageAt, now);
+                if (mqttConnected && mqttLostAt == NEVER) {
+                    mqttLostAt = now + options.mqttDetectMs;
+                }
+                break;
+            case BROKER_UP:
+                brokerUp = true;
+                brokerBackAt = now;
+                break;
+            case CLIENT_JOIN:
+                if (!policy.isApMode()) {
+                    log("client: no setup AP to join");
+                    return;
+                }
+                apClients++;
+                break;
+            case CLIENT_LEAVE:
+                apClients = max(0, apClients - 1);
+                break;
+        }
+        log("%s", EVENT_NAMES[event.type]);
+    }
+
+    // The world and the station, up to now
+    void advanceWorld() {
+        for (size_t i = 0; i < events.size();) {
+            if (events[i].time <= now) {
+                Event event = events[i];
+                events.erase(events.begin() + i);
+                apply(event);
+                i = 0;  // Applying may remove events
+            } else {
+                i++;
+            }
+        }
+        if (lostAt <= now) {
+            lostAt = NEVER;
+            connected = false;
+            if (mqttConnected) {
+                mqttConnected = false;
+                mqttLostAt = NEVER;
+                log("mqtt: disconnected (WiFi)");
+            }
+            log("station: disconnected");
+            if (options.autoReconnect) startAssociation("auto-reconnect");
+        }
+        if (associating && associatedAt <= now) {
+            if (apUp) {
+                associating = false;
+                connected = true;
+                wifiBackAt = now;
+                log("station: got IP");
+            } else if (options.autoReconnect) {
+                startAssociation("no AP, auto-reconnect");
+            } else {
+                associating = false;
+                log("station: no AP, attempt failed");
+            }
+        }
+        if (mqttLostAt <= now) {
+            mqttLostAt = NEVER;
+            if (mqttConnected) {
+                mqttConnected = false;
+                log("mqtt: disconnected (broker)");
+            }
+        }
+    }
+
+    // What loop() does - checkWiFiConnection(), processWiFiRecovery(), reconnectMQTT()
+    void runLoop() {
+        uint32_t actions = policy.checkWiFi(now, connected, policy.isApMode() ? apClients : 0);
+        if (actions & (RECONNECT_WIFI_BEGIN | RECONNECT_AP_RETRY)) {
+            outcome.wifiBegins++;
+            startAssociation(actions & RECONNECT_AP_RETRY ? "retry from AP mode" : "WiFi.begin()");
+        }
+        // A retry from AP mode that times out "opens" it again - only the first one counts
+        if ((actions & RECONNECT_START_AP) && !apOpen) {
+            apOpen = true;
+            outcome.apOpened++;
+            apOpenedAt = now;
+            log("AP mode opened");
+            if (clientDelay) {
+                uint32_t joinAt = now + clientDelay;
+                events.push_back({joinAt, CLIENT_JOIN});
+                events.push_back({joinAt + clientStay, CLIENT_LEAVE});
+                clientDelay = 0;
+            }
+        }
+
+        // The IP event arrives via wifiRecovery in the same iteration
+        if (connected && (policy.isReconnecting() || policy.isApMode())) {
+            if (policy.stationConnected() && apOpen) closeAp();
+        }
+
+        if (connected && !mqttConnected && policy.mqttAttemptDue(now)) {
+            outcome.mqttAttempts++;
+            if (brokerUp) {
+                now += options.mqttConnectMs;
+                mqttConnected = true;
+                mqttBackAt = now;
+                log("mqtt: connected");
+            } else {
+                now += options.mqttFailMs;
+                log("mqtt: connect failed");
+            }
+        }
+    }
+
+    bool settled() const {
+        return events.empty() && connected && mqttConnected && !policy.isApMode() && lostAt == NEVER &&
+               mqttLostAt == NEVER;
+    }
+
+    uint32_t nextWake() const {
+        uint32_t next = policy.nextWiFiCheck();
+        for (const Event& event : events) next = min(next, event.time);
+        if (associating) next = min(next, associatedAt);
+        next = min(next, min(lostAt, mqttLostAt));
+        if (connected && !mqttConnected) next = min(next, policy.nextMqttAttempt());
+        return max(next, now + LOOP_MS);
+    }
+
+public:
+    Simulation(const Options& options, std::mt19937& rng, const std::vector<Event>& script, uint32_t clientDelay,
+               uint32_t clientStay)
+        : options(options), rng(rng), events(script), policy(options.timing), now(START_MS),
+          clientDelay(clientDelay), clientStay(clientStay) {
+        for (Event& event : events) event.time += START_MS;
+    }
+
+    Outcome run() {
+        // Booted and online: the state finishWiFiBoot() and a first MQTT connect leave
+        policy.begin(now);
+        policy.mqttAttempted(now);
+
+        uint32_t lastEvent = START_MS;
+        for (const Event& event : events) lastEvent = max(lastEvent, event.time);
+        uint32_t horizon = lastEvent + HORIZON_MS;
+
+        while (now < horizon) {
+            advanceWorld();
+            runLoop();
+            if (settled() && now >= lastEvent) {
+                outcome.recovered = true;
+                break;
+            }
+            now = nextWake();
+        }
+
+        if (apOpen) closeAp();
+        if (outcome.recovered) {
+            uint32_t available = max(apBackAt, brokerBackAt);
+            outcome.wifiAfterApBack = apBackAt ? wifiBackAt - apBackAt : 0;
+            outcome.mqttAfterAvailable = mqttBackAt >= available ? mqttBackAt - available : 0;
+            outcome.offline = firstOutageAt != NEVER && mqttBackAt > firstOutageAt ? mqttBackAt - firstOutageAt : 0;
+        }
+        return outcome;
+    }
+};
+
+// ---------------------------------------------------------------------------
+// Scenarios
+// ---------------------------------------------------------------------------
+static uint32_t logUniformMs(std::mt19937& rng, double minS, double maxS) {
+    std::uniform_real_distribution<double> u(log(max(minS, 0.001)), log(max(minS, maxS)));
+    return (uint32_t)(exp(u(rng)) * 1000);
+}
+
+static std::vector<Event> randomScenario(const Options& options, std::mt19937& rng) {
+    std::uniform_real_distribution<double> chance(0, 1);
+    bool ap = chance(rng) < options.apProbability;
+    bool broker = chance(rng) < options.brokerProbability;
+    if (!ap && !broker) {
+        ap = options.apProbability > 0 || options.brokerProbability <= 0;
+        broker = !ap;
+    }
+
+    // Somewhere in the first minute - the phase against the 5 s check matters
+    std::vector<Event> events;
+    uint32_t apStart = std::uniform_int_distribution<uint32_t>(0, 60000)(rng);
+    uint32_t apLength = ap ? logUniformMs(rng, options.apMinS, options.apMaxS) : 0;
+    if (ap) {
+        events.push_back({apStart, AP_DOWN});
+        events.push_back({apStart + apLength, AP_UP});
+    }
+    if (broker) {
+        // Anywhere from a minute before the AP outage to a minute after it
+        uint32_t start = std::uniform_int_distribution<uint32_t>(0, 120000 + apLength)(rng);
+        events.push_back({start, BROKER_DOWN});
+        events.push_back({start + logUniformMs(rng, options.brokerMinS, options.brokerMaxS), BROKER_UP});
+    }
+    return events;
+}
+
+static bool loadScript(const char* path, std::vector<Event>& events) {
+    std::ifstream in(path);
+    if (!in) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    std::string line;
+    int number = 0;
+    while (std::getline(in, line)) {
+        number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream fields(line);
+        double seconds;
+        std::string what, how;
+        if (!(fields >> seconds)) continue;
+        fields >> what >> how;
+        std::string name = what + " " + how;
+        int type = -1;
+        for (int i = 0; i <= CLIENT_LEAVE; i++) {
+            if (name == EVENT_NAMES[i]) type = i;
+        }
+        if (type < 0 || seconds < 0) {
+            fprintf(stderr, "%s:%d: expected '<seconds> ap|broker down|up' or '<seconds> client join|leave'\n",
+                    path, number);
+            return false;
+        }
+        events.push_back({(uint32_t)(seconds * 1000), (EventType)type});
+    }
+    return true;
+}
+
+// ---------------------------------------------------------------------------
+// Report
+// ---------------------------------------------------------------------------
+static void printDistribution(const char* label, std::vector<uint32_t>& values) {
+    if (values.empty()) {
+        printf("%-24s %8u\n", label, 0u);
+        return;
+    }
+    std::sort(values.begin(), values.end());
+    double sum = 0;
+    for (uint32_t v : values) sum += v;
+    auto percentile = [&](double p) { return values[min(values.size() - 1, (size_t)(p * values.size()))] / 1e3; };
+    printf("%-24s %8zu %9.1f %9.1f %9.1f %9.1f %9.1f\n", label, values.size(), sum / values.size() / 1e3,
+           percentile(0.5), percentile(0.9), percentile(0.99), values.back() / 1e3);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  --scenarios N            outages to simulate (10000)\n"
+            "  --seed N                 random seed (1)\n"
+            "  --script FILE            scripted events instead of random outages\n"
+            "  --trace                  print every event (use with few scenarios)\n"
+            "  --ap P                   chance of an AP outage (0.8)\n"
+            "  --ap-min-s S, --ap-max-s S            its length, log-uniform (1, 1800)\n"
+            "  --broker P               chance of a broker outage (0.4)\n"
+            "  --broker-min-s S, --broker-max-s S    its length (1, 600)\n"
+            "  --client P               chance someone joins the setup AP (0)\n"
+            "  --assoc-min-ms MS, --assoc-max-ms MS  station association time (1500, 4000)\n"
+            "  --beacon-loss-ms MS      time to notice a lost AP (6000)\n"
+            "  --no-auto-reconnect      station only retries on WiFi.begin()\n"
+            "  --mqtt-detect-ms MS      time to notice a lost broker (0)\n"
+            "  --mqtt-connect-ms MS     loop() blocked by a connect (100)\n"
+            "  --mqtt-fail-ms MS        ... by a failed one (0)\n"
+            "  --check-ms MS            WIFI_CHECK_INTERVAL (%u)\n"
+            "  --reconnect-timeout-ms MS   WIFI_RECONNECT_TIMEOUT (%u)\n"
+            "  --reconnect-interval-ms MS  WIFI_RECONNECT_INTERVAL (%u)\n"
+            "  --mqtt-retry-ms MS       MQTT_RETRY_INTERVAL (%u)\n",
+            program, (unsigned)WIFI_CHECK_INTERVAL, (unsigned)WIFI_RECONNECT_TIMEOUT,
+            (unsigned)WIFI_RECONNECT_INTERVAL, (unsigned)MQTT_RETRY_INTERVAL);
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    const char* scriptPath = nullptr;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool hasValue = true;
+        if (strcmp(arg, "--trace") == 0) {
+            options.trace = true;
+            hasValue = false;
+        } else if (strcmp(arg, "--no-auto-reconnect") == 0) {
+            options.autoReconnect = false;
+            hasValue = false;
+        } else if (!value) {
+            usage(argv[0]);
+            return 2;
+        } else if (strcmp(arg, "--scenarios") == 0) {
+            options.scenarios = max(1UL, strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--seed") == 0) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--script") == 0) {
+            scriptPath = value;
+        } else if (strcmp(arg, "--ap") == 0) {
+            options.apProbability = atof(value);
+        } else if (strcmp(arg, "--ap-min-s") == 0) {
+            options.apMinS = atof(value);
+        } else if (strcmp(arg, "--ap-max-s") == 0) {
+            options.apMaxS = atof(value);
+        } else if (strcmp(arg, "--broker") == 0) {
+            options.brokerProbability = atof(value);
+        } else if (strcmp(arg, "--broker-min-s") == 0) {
+            options.brokerMinS = atof(value);
+        } else if (strcmp(arg, "--broker-max-s") == 0) {
+            options.brokerMaxS = atof(value);
+        } else if (strcmp(arg, "--client") == 0) {
+            options.clientProbability = atof(value);
+        } else if (strcmp(arg, "--assoc-min-ms") == 0) {
+            options.assocMinMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--assoc-max-ms") == 0) {
+            options.assocMaxMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--beacon-loss-ms") == 0) {
+            options.beaconLossMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--mqtt-detect-ms") == 0) {
+            options.mqttDetectMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--mqtt-connect-ms") == 0) {
+            options.mqttConnectMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--mqtt-fail-ms") == 0) {
+            options.mqttFailMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--check-ms") == 0) {
+            options.timing.checkInterval = max(1UL, strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--reconnect-timeout-ms") == 0) {
+            options.timing.reconnectTimeout = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--reconnect-interval-ms") == 0) {
+            options.timing.reconnectInterval = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--mqtt-retry-ms") == 0) {
+            options.timing.mqttRetryInterval = strtoul(value, nullptr, 10);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        if (hasValue) i++;
+    }
+
+    std::vector<Event> script;
+    if (scriptPath && !loadScript(scriptPath, script)) {
+        return 1;
+    }
+
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::vector<uint32_t> wifi, mqtt, offline, apMode, apModeAfterBack;
+    unsigned long unrecovered = 0, apOpened = 0, wifiBegins = 0, mqttAttempts = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long n = 0; n < options.scenarios; n++) {
+        std::vector<Event> events = scriptPath ? script : randomScenario(options, rng);
+        uint32_t clientDelay = 0, clientStay = 0;
+        if (!scriptPath && chance(rng) < options.clientProbability) {
+            clientDelay = std::uniform_int_distribution<uint32_t>(10000, 60000)(rng);
+            clientStay = std::uniform_int_distribution<uint32_t>(60000, 600000)(rng);
+        }
+        if (options.trace) printf("--- scenario %lu\n", n + 1);
+
+        Simulation simulation(options, rng, events, clientDelay, clientStay);
+        Outcome outcome = simulation.run();
+        apOpened += outcome.apOpened;
+        wifiBegins += outcome.wifiBegins;
+        mqttAttempts += outcome.mqttAttempts;
+        if (!outcome.recovered) {
+            unrecovered++;
+            continue;
+        }
+        if (outcome.apOutage) {
+            wifi.push_back(outcome.wifiAfterApBack);
+            apModeAfterBack.push_back(outcome.apModeAfterApBack);
+        }
+        mqtt.push_back(outcome.mqttAfterAvailable);
+        offline.push_back(outcome.offline);
+        apMode.push_back(outcome.apMode);
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const ReconnectTiming& timing = options.timing;
+    printf("%lu scenarios (%s) in %.2f s - %.0f scenarios/s\n", options.scenarios,
+           scriptPath ? scriptPath : "random", elapsed, options.scenarios / max(elapsed, 1e-9));
+    printf("check %u ms, reconnect timeout %u ms, reconnect interval %u ms, mqtt retry %u ms, auto-reconnect %s\n",
+           (unsigned)timing.checkInterval, (unsigned)timing.reconnectTimeout, (unsigned)timing.reconnectInterval,
+           (unsigned)timing.mqttRetryInterval, options.autoReconnect ? "on" : "off");
+    printf("%-24s %8s %9s %9s %9s %9s %9s\n", "seconds", "n", "mean", "p50", "p90", "p99", "max");
+    printDistribution("wifi after AP back", wifi);
+    printDistribution("mqtt after available", mqtt);
+    printDistribution("offline", offline);
+    printDistribution("AP mode", apMode);
+    printDistribution("AP mode after AP back", apModeAfterBack);
+    printf("AP opened %lu times, %lu WiFi.begin(), %lu MQTT attempts, %lu not recovered within %u h\n",
+           apOpened, wifiBegins, mqttAttempts, unrecovered, (unsigned)(HORIZON_MS / 3600000));
+    return 0;
+}
@@ -0,0 +1,409 @@
+#include "PubSubClient.h"
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * PubSubClient over a real TCP socket (env:native-loadtest only)
+ *
+ * Same class as the fake in native/fakes, but speaking MQTT 3.1.1 to a
+ * broker so the host firmware can be load-tested against mosquitto.
+ * Behaviour follows the Arduino library where it matters for timing:
+ * - QoS 0 publish / subscribe only
+ * - loop() handles at most one inbound packet per call
+ * - publish() fails if the packet doesn't fit in the buffer
+ * - PINGREQ after keepAlive seconds without outbound traffic
+ */
+
+namespace fake {
+    MqttStats mqtt;
+    bool mqttRecord = false;
+    bool mqttRefuseConnect = false;
+    std::string mqttRefuseServer;
+    std::vector<MqttMessage> mqttLog;
+    std::vector<std::string> mqttSubscriptions;
+
+    void resetMqtt() {
+        mqtt = MqttStats();
+        mqttLog.clear();
+        mqttSubscriptions.clear();
+        mqttRefuseConnect = false;
+        mqttRefuseServer.clear();
+    }
+}
+
+#define MQTT_CONNECT     0x10
+#define MQTT_CONNACK     0x20
+#define MQTT_PUBLISH     0x30
+#define MQTT_SUBSCRIBE   0x82
+#define MQTT_UNSUBSCRIBE 0xA2
+#define MQTT_PINGREQ     0xC0
+#define MQTT_DISCONNECT  0xE0
+
+static void appendString(std::string& out, const char* s) {
+    size_t length = strlen(s);
+    out += (char)(length >> 8);
+    out += (char)(length & 0xFF);
+    out.append(s, length);
+}
+
+// Fixed header: type + remaining-length varint
+static std::string header(uint8_t type, size_t remaining) {
+    std::string packet(1, (char)type);
+    do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) digit |= 0x80;
+        packet += (char)digit;
+    } while (remaining > 0);
+    return packet;
+}
+
+static std::string frame(uint8_t type, const std::string& body) {
+    return header(type, body.size()) + body;
+}
+
+PubSubClient::PubSubClient()
+    : client(nullptr), bufferSize(MQTT_MAX_PACKET_SIZE), isConnected(false), connState(MQTT_DISCONNECTED),
+      port(0), keepAliveSeconds(MQTT_KEEPALIVE), socketTimeoutSeconds(MQTT_SOCKET_TIMEOUT), socketFd(-1), lastOutbound(0),
+      streamLength(0), streamWritten(0), streamRetained(false) {
+}
+
+PubSubClient::PubSubClient(Client& c)
+    : client(&c), bufferSize(MQTT_MAX_PACKET_SIZE), isConnected(false), connState(MQTT_DISCONNECTED),
+      port(0), keepAliveSeconds(MQTT_KEEPALIVE), socketTimeoutSeconds(MQTT_SOCKET_TIMEOUT), socketFd(-1), lastOutbound(0),
+      streamLength(0), streamWritten(0), streamRetained(false) {
+}
+
+PubSubClient& PubSubClient::setServer(const char* domain, uint16_t port) {
+    this->port = port;
+    server = domain ? domain : "";
+    return *this;
+}
+
+PubSubClient& PubSubClient::setServer(IPAddress ip, uint16_t port) {
+    this->port = port;
+    server = ip.toString().c_str();
+    return *this;
+}
+
+PubSubClient& PubSubClient::setCallback(MQTT_CALLBACK_SIGNATURE) {
+    this->callback = callback;
+    return *this;
+}
+
+PubSubClient& PubSubClient::setClient(Client& c) {
+    client = &c;
+    return *this;
+}
+
+bool PubSubClient::setBufferSize(uint16_t size) {
+    if (size == 0) return false;
+    bufferSize = size;
+    return true;
+}
+
+bool PubSubClient::connect(const char* id) {
+    return connect(id, nullptr, nullptr, nullptr, 0, false, nullptr);
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass) {
+    return connect(id, user, pass, nullptr, 0, false, nullptr);
+}
+
+bool PubSubClient::connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    return connect(id, nullptr, nullptr, willTopic, willQos, willRetain, willMessage);
+}
+
+bool PubSubClient::connect(const char* id, const char* user, const char* pass,
+                           const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+    if (isConnected) disconnect();
+    fake::mqtt.connects++;
+    connState = MQTT_CONNECT_FAILED;
+
+    char portText[8];
+    snprintf(portText, sizeof(portText), "%u", (unsigned)port);
+    struct addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* result = nullptr;
+    if (getaddrinfo(server.c_str(), portText, &hints, &result) != 0) {
+        return false;
+    }
+
+    for (struct addrinfo* ai = result; ai != nullptr && socketFd < 0; ai = ai->ai_next) {
+        socketFd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (socketFd < 0) continue;
+        if (::connect(socketFd, ai->ai_addr, ai->ai_addrlen) != 0) {
+            close(socketFd);
+            socketFd = -1;
+        }
+    }
+    freeaddrinfo(result);
+    if (socketFd < 0) {
+        connState = MQTT_CONNECTION_TIMEOUT;
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct timeval timeout = {(time_t)socketTimeoutSeconds, 0};
+    setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(socketFd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    uint8_t flags = 0x02;  // Clean session
+    if (willTopic) flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+    if (user) flags |= 0x80;
+    if (user && pass) flags |= 0x40;
+
+    std::string body;
+    appendString(body, "MQTT");
+    body += (char)4;  // Protocol level 3.1.1
+    body += (char)flags;
+    body += (char)(keepAliveSeconds >> 8);
+    body += (char)(keepAliveSeconds & 0xFF);
+    appendString(body, id);
+    if (willTopic) {
+        appendString(body, willTopic);
+        appendString(body, willMessage ? willMessage : "");
+    }
+    if (user) appendString(body, user);
+    if (user && pass) appendString(body, pass);
+
+    std::string packet = frame(MQTT_CONNECT, body);
+    uint8_t connack[4];
+    size_t received = 0;
+    if (send(socketFd, packet.data(), packet.size(), MSG_NOSIGNAL) == (ssize_t)packet.size()) {
+        while (received < sizeof(connack)) {
+            ssize_t n = recv(socketFd, connack + received, sizeof(connack) - received, 0);
+            if (n <= 0) break;
+            received += n;
+        }
+    }
+
+    if (received < sizeof(connack) || connack[0] != MQTT_CONNACK || connack[3] != 0) {
+        connState = received == sizeof(connack) ? connack[3] : MQTT_CONNECTION_TIMEOUT;
+        close(socketFd);
+        socketFd = -1;
+        return false;
+    }
+
+    isConnected = true;
+    connState = MQTT_CONNECTED;
+    rxBuffer.clear();
+    lastOutbound = millis();
+    return true;
+}
+
+void PubSubClient::disconnect() {
+    if (socketFd >= 0) {
+        static const char packet[] = {(char)MQTT_DISCONNECT, 0};
+        send(socketFd, packet, sizeof(packet), MSG_NOSIGNAL);
+        close(socketFd);
+        socketFd = -1;
+    }
+    isConnected = false;
+    connState = MQTT_DISCONNECTED;
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, false);
+}
+
+bool PubSubClient::publish(const char* topic, const char* payload, bool retained) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength) {
+    return publish(topic, payload, plength, false);
+}
+
+bool PubSubClient::publish(const char* topic, const uint8_t* payload, unsigned int plength, bool retained) {
+    size_t topicLength = strlen(topic);
+    if (!isConnected || bufferSize < MQTT_MAX_HEADER_SIZE + 2 + topicLength + plength) {
+        fake::mqtt.failedPublishes++;
+        return false;
+    }
+
+    std::string body;
+    appendString(body, topic);
+    body.append((const char*)payload, plength);
+    std::string packet = frame(MQTT_PUBLISH | (retained ? 1 : 0), body);
+    if (send(socketFd, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        fake::mqtt.failedPublishes++;
+        disconnect();
+        connState = MQTT_CONNECTION_LOST;
+        return false;
+    }
+
+    lastOutbound = millis();
+    fake::mqtt.publishes++;
+    fake::mqtt.bytesOut += packet.size();
+    if (fake::mqttRecord) {
+        fake::mqttLog.push_back({topic, std::string((const char*)payload, plength), retained});
+    }
+    return true;
+}
+
+// Header and topic now, the payload as it is written - like the Arduino library
+bool PubSubClient::beginPublish(const char* topic, unsigned int plength, bool retained) {
+    if (!isConnected) {
+        fake::mqtt.failedPublishes++;
+        return false;
+    }
+    std::string body;
+    appendString(body, topic);
+    std::string packet = header(MQTT_PUBLISH | (retained ? 1 : 0), body.size() + plength) + body;
+    streamTopic = topic;
+    streamPayload.clear();
+    streamLength = plength;
+    streamWritten = 0;
+    streamRetained = retained;
+    if (send(socketFd, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        fake::mqtt.failedPublishes++;
+        disconnect();
+        connState = MQTT_CONNECTION_LOST;
+        return false;
+    }
+    lastOutbound = millis();
+    fake::mqtt.bytesOut += packet.size();
+    return true;
+}
+
+size_t PubSubClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t PubSubClient::write(const uint8_t* buffer, size_t size) {
+    if (!isConnected || send(socketFd, buffer, size, MSG_NOSIGNAL) != (ssize_t)size) {
+        disconnect();
+        connState = MQTT_CONNECTION_LOST;
+        return 0;
+    }
+    lastOutbound = millis();
+    streamWritten += size;
+    if (fake::mqttRecord) {
+        streamPayload.append((const char*)buffer, size);
+    }
+    return size;
+}
+
+int PubSubClient::endPublish() {
+    if (!isConnected || streamWritten != streamLength) {
+        fake::mqtt.failedPublishes++;
+        return 0;
+    }
+    fake::mqtt.publishes++;
+    fake::mqtt.bytesOut += streamLength;
+    if (fake::mqttRecord) {
+        fake::mqttLog.push_back({streamTopic, streamPayload, streamRetained});
+    }
+    return 1;
+}
+
+bool PubSubClient::subscribe(const char* topic, uint8_t qos) {
+    if (!isConnected) return false;
+    static uint16_t packetId = 0;
+    packetId++;
+
+    std::string body;
+    body += (char)(packetId >> 8);
+    body += (char)(packetId & 0xFF);
+    appendString(body, topic);
+    body += (char)qos;
+    std::string packet = frame(MQTT_SUBSCRIBE, body);
+    if (send(socketFd, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        return false;
+    }
+
+    lastOutbound = millis();
+    fake::mqtt.subscribes++;
+    fake::mqttSubscriptions.push_back(topic);
+    return true;
+}
+
+bool PubSubClient::unsubscribe(const char* topic) {
+    if (!isConnected) return false;
+    static uint16_t packetId = 0x8000;
+    packetId++;
+
+    std::string body;
+    body += (char)(packetId >> 8);
+    body += (char)(packetId & 0xFF);
+    appendString(body, topic);
+    std::string packet = frame(MQTT_UNSUBSCRIBE, body);
+    if (send(socketFd, packet.data(), packet.size(), MSG_NOSIGNAL) != (ssize_t)packet.size()) {
+        return false;
+    }
+
+    lastOutbound = millis();
+    fake::mqtt.unsubscribes++;
+    for (auto it = fake::mqttSubscriptions.begin(); it != fake::mqttSubscriptions.end(); ++it) {
+        if (*it == topic) {
+            fake::mqttSubscriptions.erase(it);
+            break;
+        }
+    }
+    return true;
+}
+
+bool PubSubClient::loop() {
+    if (!isConnected) return false;
+
+    if (millis() - lastOutbound > keepAliveSeconds * 1000UL) {
+        static const char ping[] = {(char)MQTT_PINGREQ, 0};
+        send(socketFd, ping, sizeof(ping), MSG_NOSIGNAL);
+        lastOutbound = millis();
+    }
+
+    char chunk[1024];
+    ssize_t n = recv(socketFd, chunk, sizeof(chunk), MSG_DONTWAIT);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) {
+        close(socketFd);
+        socketFd = -1;
+        isConnected = false;
+        connState = MQTT_CONNECTION_LOST;
+        return false;
+    }
+    if (n > 0) {
+        rxBuffer.append(chunk, n);
+    }
+
+    // Decode the remaining length; wait for more bytes if the packet is incomplete
+    size_t remaining = 0;
+    size_t headerLength = 1;
+    int shift = 0;
+    while (true) {
+        if (rxBuffer.size() <= headerLength) return true;
+        uint8_t digit = rxBuffer[headerLength++];
+        remaining |= (size_t)(digit & 0x7F) << shift;
+        shift += 7;
+        if (!(digit & 0x80)) break;
+    }
+    if (rxBuffer.size() < headerLength + remaining) return true;
+
+    uint8_t type = rxBuffer[0];
+    std::string body = rxBuffer.substr(headerLength, remaining);
+    rxBuffer.erase(0, headerLength + remaining);
+
+    if ((type & 0xF0) == MQTT_PUBLISH && body.size() >= 2 && callback) {
+        size_t topicLength = ((uint8_t)body[0] << 8) | (uint8_t)body[1];
+        size_t payloadStart = 2 + topicLength + (((type >> 1) & 0x03) ? 2 : 0);
+        if (payloadStart <= body.size()) {
+            std::string topic = body.substr(2, topicLength);
+            callback(&topic[0], (uint8_t*)&body[payloadStart], body.size() - payloadStart);
+        }
+    }
+    return true;
+}
+
+void PubSubClient::inject(const char* topic, const char* payload) {
+    if (!callback) return;
+    std::string topicCopy(topic);
+    std::string payloadCopy(payload);
+    callback(&topicCopy[0], (uint8_t*)&payloadCopy[0], payloadCopy.length());
+}
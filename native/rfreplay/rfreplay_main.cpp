@@ -0,0 +1,390 @@
+/*
+ * RF pulse-trace replay
+ *
+ * Feeds pulse traces through PulseDecoder, the decoder the firmware runs on
+ * RMT captures, and reports decode throughput and accuracy.
+ *
+ * Build and run with:
+ *   pio run -e native-rfreplay
+ *   .pio/build/native-rfreplay/program capture.txt [more.txt ...]
+ *   .pio/build/native-rfreplay/program --synth --presses 2000 --jitter 60 --glitch 0.02 --noise-ms 100
+ *
+ * Trace format (what GET /api/rf/trace returns): pulse durations in us,
+ * alternating levels, separated by whitespace. Lines starting with '#' are
+ * comments, except two markers that make accuracy measurable:
+ *   # press <code> <bits> <protocol>   the following pulses are one button
+ *                                      press (several repeats) of this code
+ *   # noise                            the following pulses are not a frame
+ * Traces without markers just list what was decoded.
+ *
+ * --synth generates a marked trace: presses of random codes on random
+ * rc-switch protocols, with edge jitter, glitches split into pulses and
+ * receiver noise between presses. --write saves it for later replays.
+ * A press counts as detected when its code and bit length are decoded;
+ * the protocol number isn't compared because several rc-switch protocols
+ * have the same shape (11 and 12 differ only in pulse length) and the
+ * first matching one is reported - on the device as well. Protocols that
+ * don't decode to their own code even when clean aren't generated:
+ * 4 has a sync gap shorter than the separation limit, and 9 is read as a
+ * bit-shifted protocol 8 frame. Both behave the same under rc-switch.
+ * Every run is done twice, with de-glitching and without it (which is
+ * what the rc-switch interrupt does), to show what the filter buys.
+ */
+
+#include <Arduino.h>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include "pulse_decoder.h"
+
+struct Segment {
+    bool press;             // false = noise
+    unsigned long code;
+    unsigned int bits;
+    unsigned int protocol;
+    std::vector<uint16_t> pulses;
+};
+
+struct Result {
+    unsigned long presses = 0;
+    unsigned long detected = 0;      // Presses whose code was decoded at least once
+    unsigned long wrong = 0;         // Decodes in a press with another code
+    unsigned long falsePositives = 0;  // Decodes in noise
+    unsigned long unmarked = 0;      // Decodes in traces without markers
+    unsigned long pulses = 0;
+    unsigned long glitches = 0;
+    double nsPerPulse = 0;
+};
+
+// ---------------------------------------------------------------------------
+// Trace files
+// ---------------------------------------------------------------------------
+static bool loadTrace(const char* path, std::vector<Segment>& segments) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+
+    Segment current = {false, 0, 0, 0, {}};
+    bool marked = false;
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') {
+            unsigned long code;
+            unsigned int bits, protocol;
+            if (sscanf(line, "# press %lu %u %u", &code, &bits, &protocol) == 3) {
+                segments.push_back(current);
+                current = {true, code, bits, protocol, {}};
+                marked = true;
+            } else if (strncmp(line, "# noise", 7) == 0) {
+                segments.push_back(current);
+                current = {false, 0, 0, 0, {}};
+                marked = true;
+            }
+            continue;
+        }
+        for (char* token = strtok(line, " \t\r\n"); token; token = strtok(nullptr, " \t\r\n")) {
+            current.pulses.push_back((uint16_t)min(strtoul(token, nullptr, 10), 65535UL));
+        }
+    }
+    segments.push_back(current);
+    fclose(file);
+
+    // An unmarked trace is one segment whose decodes are listed, not scored
+    if (!marked) {
+        segments.back().protocol = UINT32_MAX;
+    }
+    return true;
+}
+
+static void writeTrace(const char* path, const std::vector<Segment>& segments) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        fprintf(stderr, "cannot write %s\n", path);
+        return;
+    }
+    fprintf(file, "# Synthesized RF trace - pulse durations in us, alternating levels\n");
+    for (const Segment& segment : segments) {
+        if (segment.pulses.empty()) continue;
+        if (segment.press) {
+            fprintf(file, "# press %lu %u %u\n", segment.code, segment.bits, segment.protocol);
+        } else {
+            fprintf(file, "# noise\n");
+        }
+        for (size_t i = 0; i < segment.pulses.size(); i++) {
+            fprintf(file, "%u%c", segment.pulses[i], (i % 16 == 15 || i + 1 == segment.pulses.size()) ? '\n' : ' ');
+        }
+    }
+    fclose(file);
+}
+
+// ---------------------------------------------------------------------------
+// Synthesis
+// ---------------------------------------------------------------------------
+struct SynthOptions {
+    unsigned long presses = 1000;
+    unsigned int repeats = 4;       // Frames per press (remotes send 4-10)
+    int protocol = 0;               // 0 = random built-in protocol
+    unsigned int bits = 24;
+    double jitter = 40;             // +/- us per pulse (receiver edge jitter)
+    double glitch = 0.01;           // Probability that a pulse is split by a spike
+    unsigned int noiseMs = 50;      // Receiver noise between presses
+    unsigned int seed = 1;
+};
+
+// Nominal durations of one press, in rc-switch send order: data bits, then the sync pair, per repeat
+static std::vector<uint32_t> pressTimings(const PulseProfile& profile, unsigned long code,
+                                          unsigned int bits, unsigned int repeats) {
+    std::vector<uint32_t> timings;
+    for (unsigned int repeat = 0; repeat < repeats; repeat++) {
+        for (int bit = bits - 1; bit >= 0; bit--) {
+            const uint8_t* pattern = (code >> bit) & 1 ? profile.one : profile.zero;
+            timings.push_back(profile.baseUs * pattern[0]);
+            timings.push_back(profile.baseUs * pattern[1]);
+        }
+        timings.push_back(profile.baseUs * profile.sync[0]);
+        timings.push_back(profile.baseUs * profile.sync[1]);
+    }
+    return timings;
+}
+
+// Whether a clean press of the profile decodes to its own code
+static bool selfDecodes(const PulseProfile& profile, unsigned int bits) {
+    const unsigned long code = 0xA5A5A5A5UL & ((1UL << bits) - 1);
+    PulseDecoder decoder;
+    decoder.feed(20000);
+    for (uint32_t duration : pressTimings(profile, code, bits, 4)) {
+        decoder.feed(duration);
+    }
+    decoder.flush();
+    return decoder.available() && decoder.getReceivedValue() == code && decoder.getReceivedBitlength() == bits;
+}
+
+static std::vector<Segment> synthesize(const SynthOptions& options) {
+    std::mt19937 rng(options.seed);
+    std::uniform_real_distribution<double> jitter(-options.jitter, options.jitter);
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::uniform_int_distribution<int> spike(10, RF_MIN_PULSE_US - 10);
+    std::uniform_int_distribution<int> noisePulse(100, 1500);
+
+    std::vector<Segment> segments;
+    auto push = [&](Segment& segment, double us) {
+        uint32_t duration = (uint32_t)max(1.0, us + jitter(rng));
+        if (duration > 3 * RF_MIN_PULSE_US && chance(rng) < options.glitch) {
+            // Spike of the other level somewhere inside the pulse
+            uint32_t width = spike(rng);
+            uint32_t before = std::uniform_int_distribution<uint32_t>(RF_MIN_PULSE_US, duration - width - RF_MIN_PULSE_US)(rng);
+            segment.pulses.push_back(before);
+            segment.pulses.push_back(width);
+            segment.pulses.push_back(duration - width - before);
+        } else {
+            segment.pulses.push_back(min(duration, 65535u));
+        }
+    };
+
+    std::vector<int> decodable;
+    for (int i = 0; i < PulseDecoder::BUILTIN_PROFILE_COUNT; i++) {
+        if (selfDecodes(PulseDecoder::BUILTIN_PROFILES[i], options.bits)) {
+            decodable.push_back(i);
+        }
+    }
+
+    for (unsigned long press = 0; press < options.presses; press++) {
+        int index = options.protocol > 0 ? options.protocol - 1
+                                         : decodable[std::uniform_int_distribution<size_t>(0, decodable.size() - 1)(rng)];
+        const PulseProfile& profile = PulseDecoder::BUILTIN_PROFILES[index];
+        unsigned long code = std::uniform_int_distribution<unsigned long>(1, (1UL << options.bits) - 1)(rng);
+
+        Segment segment = {true, code, options.bits, profile.protocol, {}};
+        for (uint32_t duration : pressTimings(profile, code, options.bits, options.repeats)) {
+            push(segment, duration);
+        }
+        segments.push_back(segment);
+
+        Segment noise = {false, 0, 0, 0, {}};
+        for (uint32_t elapsed = 0; elapsed < options.noiseMs * 1000;) {
+            uint32_t duration = noisePulse(rng);
+            noise.pulses.push_back(duration);
+            elapsed += duration;
+        }
+        // Silence before the next press
+        noise.pulses.push_back(20000);
+        segments.push_back(noise);
+    }
+    return segments;
+}
+
+// ---------------------------------------------------------------------------
+// Replay
+// ---------------------------------------------------------------------------
+static Result replay(const std::vector<Segment>& segments, uint32_t minPulseUs, bool listDecodes) {
+    Result result;
+    PulseDecoder decoder;
+    decoder.setMinPulse(minPulseUs);
+
+    auto start = std::chrono::steady_clock::now();
+    for (const Segment& segment : segments) {
+        bool scored = segment.protocol != UINT32_MAX;
+        bool detected = false;
+        if (segment.press) result.presses++;
+
+        for (size_t i = 0; i <= segment.pulses.size(); i++) {
+            // The decoder holds one pulse back; flushing at the segment end
+            // credits a press's last gap to the press, not the noise after it
+            if (i < segment.pulses.size()) {
+                decoder.feed(segment.pulses[i]);
+            } else {
+                decoder.flush();
+            }
+            if (!decoder.available()) continue;
+
+            unsigned long value = decoder.getReceivedValue();
+            unsigned int bits = decoder.getReceivedBitlength();
+            unsigned int protocol = decoder.getReceivedProtocol();
+            decoder.resetAvailable();
+
+            if (!scored) {
+                result.unmarked++;
+                if (listDecodes) {
+                    printf("  decoded %lu / %u bit / protocol %u (pulse %u us)\n",
+                           value, bits, protocol, decoder.getReceivedDelay());
+                }
+            } else if (!segment.press) {
+                result.falsePositives++;
+            } else if (value == segment.code && bits == segment.bits) {
+                detected = true;
+            } else {
+                result.wrong++;
+            }
+        }
+        if (detected) result.detected++;
+    }
+    decoder.flush();
+    auto end = std::chrono::steady_clock::now();
+
+    result.pulses = decoder.pulses;
+    result.glitches = decoder.glitches;
+    result.nsPerPulse = result.pulses ? std::chrono::duration<double, std::nano>(end - start).count() / result.pulses : 0;
+    return result;
+}
+
+static void printResult(const char* label, const Result& result) {
+    printf("%-22s %9lu %9.1f %10.2f %8lu %9lu %8.2f%% %7lu %7lu\n",
+           label, result.pulses, result.nsPerPulse,
+           result.nsPerPulse > 0 ? 1e3 / result.nsPerPulse : 0.0,
+           result.glitches, result.presses,
+           result.presses ? 100.0 * result.detected / result.presses : 0.0,
+           result.wrong, result.falsePositives);
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [options] [trace.txt ...]\n"
+            "  --synth              generate a trace instead of reading files\n"
+            "  --presses N          button presses to generate (1000)\n"
+            "  --repeats N          frames per press (4)\n"
+            "  --protocol P         only protocol P (default: random 1-%d)\n"
+            "  --bits N             code length (24)\n"
+            "  --jitter US          +/- edge jitter per pulse (40)\n"
+            "  --glitch P           probability a pulse is split by a spike (0.01)\n"
+            "  --noise-ms MS        receiver noise between presses (50)\n"
+            "  --seed N             random seed (1)\n"
+            "  --write FILE         save the generated trace\n"
+            "  --iterations N       replay N times for steadier timing (1)\n",
+            program, PulseDecoder::BUILTIN_PROFILE_COUNT);
+}
+
+int main(int argc, char** argv) {
+    SynthOptions options;
+    bool synth = false;
+    const char* writePath = nullptr;
+    int iterations = 1;
+    std::vector<const char*> files;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool hasValue = true;
+        if (strcmp(arg, "--synth") == 0) {
+            synth = true;
+            hasValue = false;
+        } else if (!value && strncmp(arg, "--", 2) == 0) {
+            usage(argv[0]);
+            return 2;
+        } else if (strcmp(arg, "--presses") == 0) {
+            options.presses = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--repeats") == 0) {
+            options.repeats = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--protocol") == 0) {
+            options.protocol = constrain(atoi(value), 0, PulseDecoder::BUILTIN_PROFILE_COUNT);
+        } else if (strcmp(arg, "--bits") == 0) {
+            options.bits = constrain(atoi(value), 4, 32);
+        } else if (strcmp(arg, "--jitter") == 0) {
+            options.jitter = atof(value);
+        } else if (strcmp(arg, "--glitch") == 0) {
+            options.glitch = atof(value);
+        } else if (strcmp(arg, "--noise-ms") == 0) {
+            options.noiseMs = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--seed") == 0) {
+            options.seed = strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--write") == 0) {
+            writePath = value;
+        } else if (strcmp(arg, "--iterations") == 0) {
+            iterations = max(1, atoi(value));
+        } else if (strncmp(arg, "--", 2) == 0) {
+            usage(argv[0]);
+            return 2;
+        } else {
+            files.push_back(arg);
+            hasValue = false;
+        }
+        if (hasValue) i++;
+    }
+    if (!synth && files.empty()) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<std::pair<std::string, std::vector<Segment>>> traces;
+    if (synth) {
+        char label[32];
+        snprintf(label, sizeof(label), "synth (seed %u)", options.seed);
+        traces.push_back({label, synthesize(options)});
+        if (writePath) {
+            writeTrace(writePath, traces.back().second);
+        }
+    }
+    for (const char* path : files) {
+        std::vector<Segment> segments;
+        if (!loadTrace(path, segments)) return 1;
+        traces.push_back({path, segments});
+    }
+
+    printf("%-22s %9s %9s %10s %8s %9s %9s %7s %7s\n",
+           "trace", "pulses", "ns/pulse", "Mpulse/s", "glitch", "presses", "detected", "wrong", "false");
+
+    for (const auto& trace : traces) {
+        // Listed once; the timed runs stay quiet
+        bool unmarked = trace.second.size() == 1 && trace.second[0].protocol == UINT32_MAX;
+        if (unmarked) {
+            printf("%s:\n", trace.first.c_str());
+            replay(trace.second, RF_MIN_PULSE_US, true);
+        }
+
+        for (uint32_t minPulse : {(uint32_t)RF_MIN_PULSE_US, 0u}) {
+            Result result;
+            for (int i = 0; i < iterations; i++) {
+                Result run = replay(trace.second, minPulse, false);
+                if (i == 0 || run.nsPerPulse < result.nsPerPulse) result = run;
+            }
+            std::string label = trace.first.substr(0, 14) + (minPulse ? " deglitch" : " raw");
+            printResult(label.c_str(), result);
+            if (unmarked) {
+                printf("%-22s %lu frames decoded\n", "", result.unmarked);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,40 @@
+#!/bin/sh
+# Test CA and broker certificate for env:esp32dev-tls against a local mosquitto.
+#
+#   native/tls/make_certs.sh 192.168.1.10      # the broker's address as the device sees it
+#   mosquitto -c native/tls/mosquitto.conf
+#   pio run -e esp32dev-tls -t uploadfs && pio run -e esp32dev-tls -t upload
+#
+# The broker name goes in the certificate's CN and subjectAltName - mbedTLS
+# checks the MQTT server setting against the CN, so use the same string there.
+# Keys and certificates land in native/tls/certs/, the CA also in
+# data/mqtt_ca.pem (MQTT_TLS_CA_FILE) for the filesystem image.
+set -e
+
+if [ -z "$1" ]; then
+    echo "usage: $0 <broker host or IP>" >&2
+    exit 2
+fi
+HOST="$1"
+DIR="$(cd "$(dirname "$0")" && pwd)"
+OUT="$DIR/certs"
+mkdir -p "$OUT"
+
+case "$HOST" in
+    *[!0-9.]*) SAN="DNS:$HOST" ;;
+    *) SAN="IP:$HOST" ;;
+esac
+
+# EC keys: a P-256 handshake is several times cheaper than RSA-2048 on the ESP32
+openssl ecparam -name prime256v1 -genkey -noout -out "$OUT/ca.key"
+openssl req -x509 -new -key "$OUT/ca.key" -sha256 -days 3650 -subj "/CN=esp32-relay test CA" -out "$OUT/ca.pem"
+
+openssl ecparam -name prime256v1 -genkey -noout -out "$OUT/server.key"
+openssl req -new -key "$OUT/server.key" -subj "/CN=$HOST" -out "$OUT/server.csr"
+printf "subjectAltName=%s\n" "$SAN" > "$OUT/server.ext"
+openssl x509 -req -in "$OUT/server.csr" -CA "$OUT/ca.pem" -CAkey "$OUT/ca.key" -CAcreateserial \
+    -sha256 -days 825 -extfile "$OUT/server.ext" -out "$OUT/server.pem"
+rm -f "$OUT/server.csr" "$OUT/server.ext"
+
+cp "$OUT/ca.pem" "$DIR/../../data/mqtt_ca.pem"
+echo "CA: $OUT/ca.pem (copied to data/mqtt_ca.pem), broker: $OUT/server.pem for $HOST"
@@ -0,0 +1,374 @@
+/*
+ * UDP control client and benchmark
+ *
+ * Talks the binary protocol from udp_control.h to a device (or to the
+ * stand-in from `serve`), using the same frame and HMAC code as the
+ * firmware. Linux / POSIX sockets.
+ *
+ * Build and run with:
+ *   pio run -e native-udpctl
+ *   udpctl --host 192.168.1.50 --key $KEY get
+ *   udpctl --host 192.168.1.50 --key $KEY set 1=on 3=off
+ *   udpctl --host 192.168.1.50 --key $KEY scene 0
+ *   udpctl --host 192.168.1.50 --key $KEY bench --count 2000 --relay 1
+ *   udpctl --key $KEY serve            stand-in device on this machine
+ * where udpctl is .pio/build/native-udpctl/program and KEY is the 64 hex
+ * digit key given to POST /api/admin/udp.
+ *
+ * A command that gets no reply within --timeout-ms is sent again, the
+ * same frame with the same sequence number, up to --retries times; the
+ * device runs it once and answers each copy. Sequence numbers start from
+ * the wall clock in milliseconds, so consecutive runs with the same
+ * --client id keep counting up. Two clients on one machine at the same
+ * time need different ids, and bench uses one number per command - it
+ * runs ahead of the clock, so give it its own --client id.
+ *
+ * The first command of a run doesn't know the device's session yet: it is
+ * answered with status "session" and the current one, and sent again in
+ * it with the next sequence number (one extra round trip per run). The
+ * same happens when the device restarts or starts a new session mid-bench.
+ *
+ * bench sends --count commands one at a time (the next once the previous
+ * one is answered), switching --relay on and off - or GETs with --get -
+ * and reports round trip percentiles, retries and lost commands.
+ */
+
+#include <Arduino.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "udp_control.h"
+
+using std::max;
+using std::min;
+
+struct Options {
+    const char* host = "esp32-relay.local";
+    uint16_t port = UDP_CONTROL_PORT;
+    uint16_t client = 1;
+    int timeoutMs = 100;
+    int retries = 3;
+    unsigned long count = 1000;
+    int relay = 1;
+    bool benchGet = false;
+    int relayCount = NUM_RELAYS;    // serve
+};
+
+static HmacSha256 key;
+
+static uint64_t nowMicros() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static uint32_t firstSequence() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static int openSocket(const Options& options, sockaddr_in& device) {
+    addrinfo hints = addrinfo();
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(options.host, nullptr, &hints, &found) != 0 || found == nullptr) {
+        fprintf(stderr, "cannot resolve %s\n", options.host);
+        return -1;
+    }
+    device = *(sockaddr_in*)found->ai_addr;
+    device.sin_port = htons(options.port);
+    freeaddrinfo(found);
+
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr*)&device, sizeof(device)) != 0) {
+        perror("socket");
+        return -1;
+    }
+    return fd;
+}
+
+struct Exchange {
+    bool answered;
+    int retries;
+    uint32_t micros;        // First send -> matching reply
+    UdpReply reply;
+};
+
+// Sends the command until a reply with its sequence number arrives
+static Exchange exchange(int fd, const Options& options, const UdpCommand& command) {
+    uint8_t frame[UDP_REQUEST_BYTES];
+    udpEncodeRequest(key, command, frame);
+
+    Exchange result = Exchange();
+    uint64_t start = nowMicros();
+    for (int attempt = 0; attempt <= options.retries && !result.answered; attempt++) {
+        result.retries = attempt;
+        if (send(fd, frame, sizeof(frame), 0) < 0) {
+            perror("send");
+            continue;
+        }
+        uint64_t deadline = nowMicros() + (uint64_t)options.timeoutMs * 1000;
+        for (uint64_t now = nowMicros(); now < deadline; now = nowMicros()) {
+            pollfd p = {fd, POLLIN, 0};
+            if (poll(&p, 1, (int)((deadline - now + 999) / 1000)) <= 0) break;
+            uint8_t buffer[128];
+            ssize_t length = recv(fd, buffer, sizeof(buffer), 0);
+            // Late answers to earlier commands (or to earlier copies) are skipped
+            if (length > 0 && udpDecodeReply(key, buffer, length, result.reply) &&
+                result.reply.client == command.client && result.reply.sequence == command.sequence) {
+                result.answered = true;
+                result.micros = (uint32_t)(nowMicros() - start);
+                break;
+            }
+        }
+    }
+    return result;
+}
+
+// exchange() in the device's session: a SESSION answer updates command.session,
+// and the command goes again with the next sequence number
+static Exchange exchangeInSession(int fd, const Options& options, UdpCommand& command, unsigned long& sessions) {
+    Exchange result = exchange(fd, options, command);
+    if (result.answered && result.reply.status == UDP_STATUS_SESSION) {
+        sessions++;
+        command.session = result.reply.session;
+        command.sequence++;
+        result = exchange(fd, options, command);
+    }
+    return result;
+}
+
+static void printReply(const UdpReply& reply) {
+    printf("status %s, %d relays:", UdpControl::statusName(reply.status), reply.relayCount);
+    for (int i = 0; i < reply.relayCount; i++) {
+        printf("%s%d=%s", i % 16 ? " " : "\n  ", i + 1, reply.state.test(i) ? "on" : "off");
+    }
+    printf("\n");
+}
+
+static int runCommand(const Options& options, UdpCommand& command) {
+    sockaddr_in device;
+    int fd = openSocket(options, device);
+    if (fd < 0) return 1;
+    unsigned long sessions = 0;
+    Exchange result = exchangeInSession(fd, options, command, sessions);
+    close(fd);
+    if (!result.answered) {
+        fprintf(stderr, "no reply from %s:%u (wrong key, or protocol disabled?)\n", options.host, options.port);
+        return 1;
+    }
+    printf("%.2f ms, %d retries - ", result.micros / 1e3, result.retries);
+    printReply(result.reply);
+    if (result.reply.status == UDP_STATUS_STALE) {
+        fprintf(stderr, "the device has seen a newer sequence number from client %u - try another --client\n",
+                options.client);
+    }
+    return result.reply.status == UDP_STATUS_OK ? 0 : 1;
+}
+
+static int runBench(const Options& options, UdpCommand command) {
+    sockaddr_in device;
+    int fd = openSocket(options, device);
+    if (fd < 0) return 1;
+
+    command.op = options.benchGet ? UDP_OP_GET : UDP_OP_SET;
+    command.select.set(options.relay - 1);
+    std::vector<uint32_t> rtt;
+    unsigned long retries = 0, lost = 0, refused = 0, sessions = 0;
+    uint64_t start = nowMicros();
+    for (unsigned long n = 0; n < options.count; n++) {
+        command.sequence++;
+        command.value.set(options.relay - 1, n & 1);
+        Exchange result = exchangeInSession(fd, options, command, sessions);
+        retries += result.retries;
+        if (!result.answered) {
+            lost++;
+            continue;
+        }
+        if (result.reply.status != UDP_STATUS_OK) refused++;
+        rtt.push_back(result.micros);
+    }
+    double elapsed = (nowMicros() - start) / 1e6;
+    close(fd);
+
+    printf("%lu %s commands to %s:%u in %.2f s - %.0f commands/s\n", options.count,
+           options.benchGet ? "GET" : "SET", options.host, options.port, elapsed, options.count / elapsed);
+    printf("answered %zu, lost %lu, retries %lu, refused %lu, new sessions %lu\n", rtt.size(), lost, retries, refused,
+           sessions);
+    if (rtt.empty()) return 1;
+    std::sort(rtt.begin(), rtt.end());
+    double sum = 0;
+    for (uint32_t v : rtt) sum += v;
+    auto percentile = [&](double p) { return rtt[min(rtt.size() - 1, (size_t)(p * rtt.size()))] / 1e3; };
+    printf("round trip ms   mean %.3f  p50 %.3f  p90 %.3f  p99 %.3f  max %.3f\n", sum / rtt.size() / 1e3,
+           percentile(0.5), percentile(0.9), percentile(0.99), rtt.back() / 1e3);
+    return lost ? 1 : 0;
+}
+
+// Stand-in device: UdpControl over a real socket with relays in memory
+static UdpMask serveRelays;
+static int serveRelayCount;
+
+static void serveHandler(const UdpCommand& command, UdpReply& reply) {
+    UdpMask active;
+    for (int i = 0; i < serveRelayCount; i++) {
+        active.set(i);
+    }
+    if (command.op == UDP_OP_SET) {
+        if ((command.select & ~active).any()) {
+            reply.status = UDP_STATUS_BAD_RELAY;
+        } else {
+            serveRelays = (serveRelays & ~command.select) | (command.value & command.select);
+        }
+    } else if (command.op == UDP_OP_SCENE) {
+        reply.status = UDP_STATUS_BAD_SCENE;  // No scenes here
+    }
+    reply.state = serveRelays;
+    reply.relayCount = serveRelayCount;
+}
+
+static int runServe(const Options& options, const uint8_t* keyBytes) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in address = sockaddr_in();
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(options.port);
+    if (fd < 0 || bind(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        perror("bind");
+        return 1;
+    }
+    serveRelayCount = options.relayCount;
+    udpControl.setKey(keyBytes, UDP_KEY_BYTES);
+    udpControl.setHandler(serveHandler);
+    printf("serving %d relays on UDP port %u\n", serveRelayCount, options.port);
+
+    for (;;) {
+        uint8_t frame[128];
+        uint8_t reply[UDP_REPLY_BYTES];
+        sockaddr_in peer;
+        socklen_t peerLength = sizeof(peer);
+        ssize_t length = recvfrom(fd, frame, sizeof(frame), 0, (sockaddr*)&peer, &peerLength);
+        if (length < 0) continue;
+        size_t replyLength = udpControl.handle(frame, length, millis(), reply);
+        if (replyLength) {
+            sendto(fd, reply, replyLength, 0, (sockaddr*)&peer, peerLength);
+        }
+    }
+}
+
+static void usage(const char* program) {
+    fprintf(stderr,
+            "usage: %s [options] get | set <relay>=on|off ... | scene <index> | bench | serve\n"
+            "  --host HOST          device address (esp32-relay.local)\n"
+            "  --port N             UDP port (%u)\n"
+            "  --key HEX            shared key, 64 hex digits (required)\n"
+            "  --client N           client id, 0-65535 (1)\n"
+            "  --timeout-ms MS      wait per attempt (100)\n"
+            "  --retries N          resends without a reply (3)\n"
+            "  bench: --count N (1000), --relay N (1), --get (GETs instead of SETs)\n"
+            "  serve: --relays N    relays of the stand-in device (%d)\n",
+            program, (unsigned)UDP_CONTROL_PORT, NUM_RELAYS);
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    uint8_t keyBytes[UDP_KEY_BYTES];
+    bool haveKey = false;
+    std::vector<const char*> words;     // Command and its arguments
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strncmp(arg, "--", 2) != 0) {
+            words.push_back(arg);
+            continue;
+        }
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        bool hasValue = true;
+        if (strcmp(arg, "--get") == 0) {
+            options.benchGet = true;
+            hasValue = false;
+        } else if (!value) {
+            usage(argv[0]);
+            return 2;
+        } else if (strcmp(arg, "--host") == 0) {
+            options.host = value;
+        } else if (strcmp(arg, "--port") == 0) {
+            options.port = (uint16_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--key") == 0) {
+            haveKey = udpParseKey(value, keyBytes);
+        } else if (strcmp(arg, "--client") == 0) {
+            options.client = (uint16_t)strtoul(value, nullptr, 10);
+        } else if (strcmp(arg, "--timeout-ms") == 0) {
+            options.timeoutMs = max(1, atoi(value));
+        } else if (strcmp(arg, "--retries") == 0) {
+            options.retries = max(0, atoi(value));
+        } else if (strcmp(arg, "--count") == 0) {
+            options.count = max(1UL, strtoul(value, nullptr, 10));
+        } else if (strcmp(arg, "--relay") == 0) {
+            options.relay = atoi(value);
+        } else if (strcmp(arg, "--relays") == 0) {
+            options.relayCount = atoi(value);
+        } else {
+            usage(argv[0]);
+            return 2;
+        }
+        if (hasValue) i++;
+    }
+    if (words.empty() || !haveKey) {
+        if (!haveKey) fprintf(stderr, "--key needs 64 hex digits\n");
+        usage(argv[0]);
+        return 2;
+    }
+    if (options.relay < 1 || options.relay > UdpMask::BITS || options.relayCount < 1 ||
+        options.relayCount > UdpMask::BITS) {
+        fprintf(stderr, "relays are numbered 1-%d\n", UdpMask::BITS);
+        return 2;
+    }
+    key.setKey(keyBytes, sizeof(keyBytes));
+
+    const char* verb = words[0];
+    UdpCommand command = UdpCommand();
+    command.client = options.client;
+    command.sequence = firstSequence();
+
+    if (strcmp(verb, "get") == 0) {
+        command.op = UDP_OP_GET;
+        return runCommand(options, command);
+    }
+    if (strcmp(verb, "set") == 0) {
+        command.op = UDP_OP_SET;
+        for (size_t w = 1; w < words.size(); w++) {
+            int relay = 0;
+            char state[4] = "";
+            if (sscanf(words[w], "%d=%3s", &relay, state) != 2 || relay < 1 || relay > UdpMask::BITS ||
+                (strcmp(state, "on") != 0 && strcmp(state, "off") != 0)) {
+                fprintf(stderr, "expected <relay>=on|off, got '%s'\n", words[w]);
+                return 2;
+            }
+            command.select.set(relay - 1);
+            command.value.set(relay - 1, strcmp(state, "on") == 0);
+        }
+        if (!command.select.any()) {
+            usage(argv[0]);
+            return 2;
+        }
+        return runCommand(options, command);
+    }
+    if (strcmp(verb, "scene") == 0 && words.size() == 2) {
+        command.op = UDP_OP_SCENE;
+        command.scene = (uint8_t)atoi(words[1]);
+        return runCommand(options, command);
+    }
+    if (strcmp(verb, "bench") == 0) {
+        return runBench(options, command);
+    }
+    if (strcmp(verb, "serve") == 0) {
+        return runServe(options, keyBytes);
+    }
+    usage(argv[0]);
+    return 2;
+}
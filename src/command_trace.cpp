@@ -0,0 +1,119 @@
+#include "command_trace.h"
+#include <algorithm>
+
+CommandTracer commandTrace;
+
+CommandTracer::CommandTracer() : nextId(0) {
+    for (CommandTrace& entry : entries) {
+        entry.id = 0;
+        entry.complete.store(false);
+    }
+}
+
+// Called from the loop task (MQTT, RF) and the web task (HTTP) - each caller owns its slot
+CommandTrace* CommandTracer::begin(TraceSource source, int target, bool state, uint32_t receivedMicros,
+                                   const char* correlationId) {
+    uint32_t id = nextId.fetch_add(1, std::memory_order_relaxed) + 1;
+    CommandTrace& entry = entries[id % COMMAND_TRACE_ENTRIES];
+    
+    entry.complete.store(false, std::memory_order_relaxed);
+    entry.id = id;
+    entry.source = source;
+    entry.target = target;
+    entry.state = state;
+    memset(entry.stamps, 0, sizeof(entry.stamps));
+    entry.stamps[TRACE_RECEIVED] = receivedMicros;
+    
+    // Only characters that need no escaping in JSON and topics
+    int length = 0;
+    for (const char* c = correlationId; c && *c && length < TRACE_ID_LEN - 1; c++) {
+        if (isalnum((unsigned char)*c) || *c == '-' || *c == '_' || *c == '.' || *c == ':') {
+            entry.correlationId[length++] = *c;
+        }
+    }
+    entry.correlationId[length] = '\0';
+    return &entry;
+}
+
+const char* CommandTracer::sourceName(int source) {
+    switch (source) {
+        case TRACE_MQTT: return "mqtt";
+        case TRACE_HTTP: return "http";
+        case TRACE_RF:   return "rf";
+        default:         return "unknown";
+    }
+}
+
+const char* CommandTracer::stageName(int stage) {
+    switch (stage) {
+        case TRACE_RECEIVED:   return "received";
+        case TRACE_DISPATCHED: return "dispatch";
+        case TRACE_GPIO:       return "gpio";
+        case TRACE_PUBLISHED:  return "publish";
+        default:               return "unknown";
+    }
+}
+
+/*
+ * Percentiles are computed on demand from the ring. Records still being
+ * written are skipped; a record overwritten while this runs can skew one
+ * sample, which is fine for diagnostics.
+ */
+void CommandTracer::writeJson(Print& out, int recent) const {
+    uint32_t samples[COMMAND_TRACE_ENTRIES];
+    
+    out.printf("{\"capacity\":%u,\"recorded\":%u,\"sources\":{",
+               (unsigned)COMMAND_TRACE_ENTRIES, (unsigned)nextId.load());
+    
+    for (int source = 0; source < TRACE_SOURCE_COUNT; source++) {
+        out.printf("%s\"%s\":{", source ? "," : "", sourceName(source));
+        bool firstStage = true;
+    
+        for (int stage = TRACE_DISPATCHED; stage < TRACE_STAGE_COUNT; stage++) {
+            int count = 0;
+            for (const CommandTrace& entry : entries) {
+                if (!entry.complete.load(std::memory_order_acquire) || entry.source != source) continue;
+                long offset = entry.offset(stage);
+                if (offset >= 0) {
+                    samples[count++] = (uint32_t)offset;
+                }
+            }
+            if (count == 0) continue;
+    
+            std::sort(samples, samples + count);
+            // Nearest rank
+            auto rank = [&](int pct) { return samples[max(0, (count * pct + 99) / 100 - 1)]; };
+            out.printf("%s\"%s_us\":{\"count\":%d,\"p50\":%u,\"p90\":%u,\"p99\":%u,\"max\":%u}",
+                       firstStage ? "" : ",", stageName(stage), count,
+                       (unsigned)rank(50), (unsigned)rank(90), (unsigned)rank(99), (unsigned)samples[count - 1]);
+            firstStage = false;
+        }
+        out.print("}");
+    }
+    
+    // Newest first
+    out.print("},\"recent\":[");
+    uint32_t newest = nextId.load();
+    bool first = true;
+    for (uint32_t id = newest; id > 0 && newest - id < COMMAND_TRACE_ENTRIES && recent > 0; id--) {
+        const CommandTrace& entry = entries[id % COMMAND_TRACE_ENTRIES];
+        if (entry.id != id || !entry.complete.load(std::memory_order_acquire)) continue;
+    
+        out.printf("%s{\"id\":%u,\"source\":\"%s\",\"target\":%u,\"state\":%s",
+                   first ? "" : ",", (unsigned)entry.id, sourceName(entry.source),
+                   (unsigned)entry.target, entry.state ? "true" : "false");
+        if (entry.correlationId[0]) {
+            out.printf(",\"cid\":\"%s\"", entry.correlationId);
+        }
+        for (int stage = TRACE_DISPATCHED; stage < TRACE_STAGE_COUNT; stage++) {
+            long offset = entry.offset(stage);
+            if (offset >= 0) {
+                out.printf(",\"%s_us\":%ld", stageName(stage), offset);
+            }
+        }
+        out.print("}");
+        first = false;
+        recent--;
+    }
+    out.print("]}");
+}
@@ -0,0 +1,118 @@
+#include "group_commands.h"
+
+int GroupConfig::findGroup(const char* name, size_t length) const {
+    for (int i = 0; i < MQTT_GROUP_MAX; i++) {
+        if (groups[i][0] && strlen(groups[i]) == length && strncmp(groups[i], name, length) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const RelayScene* GroupConfig::findScene(const char* name) const {
+    for (const RelayScene& scene : scenes) {
+        if (scene.name[0] && strcmp(scene.name, name) == 0) {
+            return &scene;
+        }
+    }
+    return nullptr;
+}
+
+int GroupConfig::groupCount() const {
+    int count = 0;
+    for (int i = 0; i < MQTT_GROUP_MAX; i++) {
+        if (groups[i][0]) count++;
+    }
+    return count;
+}
+
+int GroupConfig::sceneCount() const {
+    int count = 0;
+    for (const RelayScene& scene : scenes) {
+        if (scene.name[0]) count++;
+    }
+    return count;
+}
+
+bool isValidGroupName(const char* name, size_t maxLength) {
+    size_t length = strlen(name);
+    if (length == 0 || length >= maxLength) return false;
+    for (size_t i = 0; i < length; i++) {
+        char c = name[i];
+        if (!isalnum((unsigned char)c) && c != '-' && c != '_') return false;
+    }
+    return true;
+}
+
+bool parseRelayPattern(const char* pattern, int maxRelays, SceneMask& on, SceneMask& off) {
+    on = SceneMask();
+    off = SceneMask();
+    int length = strlen(pattern);
+    if (length == 0 || length > maxRelays) return false;
+    
+    for (int i = 0; i < length; i++) {
+        if (pattern[i] == '1') {
+            on.set(i);
+        } else if (pattern[i] == '0') {
+            off.set(i);
+        }
+    }
+    return true;
+}
+
+void formatRelayPattern(const RelayScene& scene, int count, char* out, size_t size) {
+    int length = min(count, (int)size - 1);
+    for (int i = 0; i < length; i++) {
+        out[i] = scene.on.test(i) ? '1' : scene.off.test(i) ? '0' : 'x';
+    }
+    out[length] = '\0';
+}
+
+GroupAck::GroupAck() {
+    clear();
+}
+
+void GroupAck::add(int group, const char* correlationId, uint32_t now, uint32_t delayMillis) {
+    Pending& ack = pending[group];
+    if (!ack.active) {
+        ack.active = true;
+        ack.dueMillis = now + delayMillis;
+        ack.commands = 0;
+        ack.idCount = 0;
+    }
+    if (ack.commands < UINT16_MAX) {
+        ack.commands++;
+    }
+    if (correlationId[0] && ack.idCount < MQTT_GROUP_ACK_IDS) {
+        snprintf(ack.ids[ack.idCount++], TRACE_ID_LEN, "%s", correlationId);
+    }
+}
+
+int GroupAck::due(uint32_t now) const {
+    for (int i = 0; i < MQTT_GROUP_MAX; i++) {
+        if (pending[i].active && (int32_t)(now - pending[i].dueMillis) >= 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+size_t GroupAck::take(int group, const char* hostname, const char* relays, char* out, size_t size) {
+    Pending& ack = pending[group];
+    size_t length = snprintf(out, size, "{\"device\":\"%s\",\"cids\":[", hostname);
+    for (int i = 0; i < ack.idCount && length < size; i++) {
+        length += snprintf(out + length, size - length, "%s\"%s\"", i ? "," : "", ack.ids[i]);
+    }
+    if (length < size) {
+        length += snprintf(out + length, size - length, "],\"commands\":%u,\"relays\":\"%s\"}",
+                           (unsigned)ack.commands, relays);
+    }
+    ack.active = false;
+    return min(length, size - 1);
+}
+
+void GroupAck::clear() {
+    for (Pending& ack : pending) {
+        ack.active = false;
+    }
+}
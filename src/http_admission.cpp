@@ -0,0 +1,146 @@
+#include "http_admission.h"
+
+HttpAdmission httpAdmission;
+
+static const int32_t MILLI_TOKENS_MAX = HTTP_RATE_BURST * 1000;
+
+HttpAdmission::HttpAdmission() : peakInFlight(0) {
+    for (Slot& slot : slots) {
+        slot.owner = nullptr;
+    }
+    for (Client& c : clients) {
+        c.address = 0;
+    }
+    memset(counts, 0, sizeof(counts));
+}
+
+HttpAdmission::Client& HttpAdmission::client(uint32_t address, uint32_t now) {
+    // Known client, else a free entry, else the one seen longest ago
+    Client* found = nullptr;
+    uint32_t oldest = 0;
+    for (Client& c : clients) {
+        if (c.address == address) {
+            found = &c;
+            break;
+        }
+        uint32_t age = c.address ? now - c.refillMillis : UINT32_MAX;
+        if (!found || age > oldest) {
+            found = &c;
+            oldest = age;
+        }
+    }
+    if (found->address != address) {
+        found->address = address;
+        found->milliTokens = MILLI_TOKENS_MAX;
+        found->refillMillis = now;
+        return *found;
+    }
+    
+    // HTTP_RATE_PER_SEC tokens per second = that many milli-tokens per ms
+    uint32_t elapsed = now - found->refillMillis;
+    found->refillMillis = now;
+    if (elapsed >= (uint32_t)MILLI_TOKENS_MAX / HTTP_RATE_PER_SEC) {
+        found->milliTokens = MILLI_TOKENS_MAX;
+    } else {
+        found->milliTokens = min(found->milliTokens + (int32_t)(elapsed * HTTP_RATE_PER_SEC), MILLI_TOKENS_MAX);
+    }
+    return *found;
+}
+
+int HttpAdmission::reclaim(uint32_t now) {
+    int used = 0;
+    for (Slot& slot : slots) {
+        if (slot.owner && now - slot.admittedMillis > HTTP_IN_FLIGHT_TIMEOUT_MS) {
+            slot.owner = nullptr;
+        }
+        if (slot.owner) used++;
+    }
+    return used;
+}
+
+Admission HttpAdmission::reject(RequestClass requestClass, Admission result, uint32_t wait, uint32_t& retryAfter) {
+    counts[requestClass][result]++;
+    retryAfter = wait;
+    return result;
+}
+
+Admission HttpAdmission::admit(const void* owner, uint32_t address, RequestClass requestClass, uint32_t freeHeap,
+                               uint32_t& retryAfter) {
+    uint32_t now = millis();
+    bool control = requestClass == REQUEST_CONTROL;
+    
+    // Reads leave the last tokens of the bucket to controls
+    Client& c = client(address, now);
+    int32_t needed = (control ? 1 : HTTP_RATE_CONTROL_RESERVE + 1) * 1000;
+    if (c.milliTokens < needed) {
+        uint32_t wait = (needed - c.milliTokens + HTTP_RATE_PER_SEC * 1000 - 1) / (HTTP_RATE_PER_SEC * 1000);
+        return reject(requestClass, ADMIT_RATE_LIMITED, max(wait, (uint32_t)1), retryAfter);
+    }
+    
+    if (freeHeap < (control ? HTTP_SHED_CONTROL_HEAP : HTTP_SHED_READ_HEAP)) {
+        return reject(requestClass, ADMIT_LOW_HEAP, 1, retryAfter);
+    }
+    
+    int used = reclaim(now);
+    if (used >= (control ? HTTP_MAX_IN_FLIGHT : HTTP_MAX_IN_FLIGHT - HTTP_CONTROL_RESERVE_SLOTS)) {
+        return reject(requestClass, ADMIT_BUSY, 1, retryAfter);
+    }
+    
+    for (Slot& slot : slots) {
+        if (!slot.owner) {
+            slot.owner = owner;
+            slot.admittedMillis = now;
+            break;
+        }
+    }
+    c.milliTokens -= 1000;
+    counts[requestClass][ADMIT_OK]++;
+    peakInFlight = max(peakInFlight, used + 1);
+    return ADMIT_OK;
+}
+
+void HttpAdmission::finish(const void* owner) {
+    for (Slot& slot : slots) {
+        if (slot.owner == owner) {
+            slot.owner = nullptr;
+            return;
+        }
+    }
+}
+
+int HttpAdmission::inFlight() const {
+    int used = 0;
+    for (const Slot& slot : slots) {
+        if (slot.owner) used++;
+    }
+    return used;
+}
+
+const char* HttpAdmission::className(int requestClass) {
+    return requestClass == REQUEST_CONTROL ? "control" : "read";
+}
+
+const char* HttpAdmission::resultName(int result) {
+    switch (result) {
+        case ADMIT_OK:           return "accepted";
+        case ADMIT_BUSY:         return "busy";
+        case ADMIT_LOW_HEAP:     return "low_heap";
+        case ADMIT_RATE_LIMITED: return "rate_limited";
+        default:                 return "unknown";
+    }
+}
+
+void HttpAdmission::writePrometheus(Print& out) const {
+    out.print("# HELP relay_http_requests_total Requests by class, accepted or shed (and why)\n");
+    out.print("# TYPE relay_http_requests_total counter\n");
+    for (int c = 0; c < REQUEST_CLASS_COUNT; c++) {
+        for (int r = 0; r < ADMISSION_COUNT; r++) {
+            out.printf("relay_http_requests_total{class=\"%s\",result=\"%s\"} %u\n", className(c), resultName(r),
+                       (unsigned)counts[c][r]);
+        }
+    }
+    out.print("# TYPE relay_http_in_flight gauge\n");
+    out.printf("relay_http_in_flight %d\n", inFlight());
+    out.print("# TYPE relay_http_in_flight_peak gauge\n");
+    out.printf("relay_http_in_flight_peak %d\n", peakInFlight);
+}
@@ -0,0 +1,139 @@
+#include "log_buffer.h"
+
+LogBuffer logBuffer;
+
+static const char LEVEL_CHARS[] = {'-', 'E', 'W', 'I', 'D'};
+
+LogBuffer::LogBuffer() : head(0), readIndex(0), dropped(0) {
+    for (int i = 0; i < LOG_BUFFER_ENTRIES; i++) {
+        entries[i].seq.store(0);
+    }
+}
+
+#ifndef NATIVE_BUILD
+static void logDrainTask(void* param) {
+    LogBuffer* buffer = (LogBuffer*)param;
+    for (;;) {
+        while (buffer->drain(Serial, 16) > 0) {
+            taskYIELD();
+        }
+        vTaskDelay(pdMS_TO_TICKS(LOG_DRAIN_INTERVAL_MS));
+    }
+}
+#endif
+
+void LogBuffer::begin() {
+#ifndef NATIVE_BUILD
+    // Lowest priority above idle, on the protocol core so loop() (core 1) never waits on it
+    xTaskCreatePinnedToCore(logDrainTask, "log_drain", 3072, this, tskIDLE_PRIORITY + 1, nullptr, 0);
+#endif
+}
+
+// Producers: any task. Reserve an index, fill the slot, then publish it via seq
+void LogBuffer::commit(uint8_t level, const char* format, const LogArg* args, int argCount) {
+    uint32_t index = head.fetch_add(1, std::memory_order_relaxed);
+    LogEntry& entry = entries[index % LOG_BUFFER_ENTRIES];
+    
+    entry.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    
+    entry.timestamp = millis();
+    entry.format = format;
+    entry.level = level;
+    entry.argCount = argCount;
+    entry.textArg = -1;
+    for (int i = 0; i < argCount; i++) {
+        entry.args[i] = args[i].value;
+        if (args[i].text && entry.textArg < 0) {
+            const char* s = (const char*)args[i].value;
+            strncpy(entry.text, s ? s : "(null)", LOG_TEXT_LEN - 1);
+            entry.text[LOG_TEXT_LEN - 1] = '\0';
+            entry.textArg = i;
+        }
+    }
+    
+    entry.seq.store(index + 1, std::memory_order_release);
+}
+
+// Seqlock read: copy the slot, then check nobody rewrote it meanwhile.
+// Returns false if the entry is not readable; overwritten tells why.
+bool LogBuffer::copyEntry(uint32_t index, LogEntry& out, bool& overwritten) const {
+    const LogEntry& entry = entries[index % LOG_BUFFER_ENTRIES];
+    uint32_t before = entry.seq.load(std::memory_order_acquire);
+    if (before != index + 1) {
+        // 0 = being written; older sequence = not written yet
+        overwritten = before != 0 && (int32_t)(before - (index + 1)) > 0;
+        return false;
+    }
+    
+    out.timestamp = entry.timestamp;
+    out.format = entry.format;
+    out.level = entry.level;
+    out.argCount = entry.argCount;
+    out.textArg = entry.textArg;
+    memcpy(out.args, entry.args, sizeof(out.args));
+    memcpy(out.text, entry.text, sizeof(out.text));
+    
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != before) {
+        overwritten = true;
+        return false;
+    }
+    return true;
+}
+
+void LogBuffer::formatEntry(const LogEntry& entry, char* line, size_t size) {
+    uintptr_t a[LOG_MAX_ARGS];
+    memcpy(a, entry.args, sizeof(a));
+    if (entry.textArg >= 0) {
+        a[entry.textArg] = (uintptr_t)entry.text;
+    }
+    // Unused trailing arguments are ignored by snprintf
+    snprintf(line, size, entry.format, a[0], a[1], a[2], a[3]);
+}
+
+size_t LogBuffer::drain(Print& out, size_t maxEntries) {
+    size_t written = 0;
+    uint32_t end = head.load(std::memory_order_acquire);
+    char line[LOG_LINE_LEN];
+    
+    while (readIndex != end && written < maxEntries) {
+        // Producers lapped us - skip to the oldest entry still in the ring
+        if (end - readIndex > LOG_BUFFER_ENTRIES) {
+            dropped += end - readIndex - LOG_BUFFER_ENTRIES;
+            readIndex = end - LOG_BUFFER_ENTRIES;
+        }
+        
+        LogEntry entry;
+        bool overwritten = false;
+        if (!copyEntry(readIndex, entry, overwritten)) {
+            if (!overwritten) break;  // Still being written - try again next round
+            dropped++;
+            readIndex++;
+            continue;
+        }
+        
+        formatEntry(entry, line, sizeof(line));
+        out.println(line);
+        readIndex++;
+        written++;
+    }
+    return written;
+}
+
+void LogBuffer::writeRecent(Print& out, size_t maxEntries) const {
+    uint32_t end = head.load(std::memory_order_acquire);
+    uint32_t available = end < LOG_BUFFER_ENTRIES ? end : LOG_BUFFER_ENTRIES;
+    if (maxEntries > available) maxEntries = available;
+    
+    char line[LOG_LINE_LEN];
+    for (uint32_t index = end - maxEntries; index != end; index++) {
+        LogEntry entry;
+        bool overwritten = false;
+        if (!copyEntry(index, entry, overwritten)) continue;
+        
+        formatEntry(entry, line, sizeof(line));
+        out.printf("%10lu %c %s\n", (unsigned long)entry.timestamp,
+                   LEVEL_CHARS[entry.level < sizeof(LEVEL_CHARS) ? entry.level : 0], line);
+    }
+}
@@ -8,200 +8,356 @@
 #include <LittleFS.h>
 #include <Preferences.h>
 #include <RCSwitch.h>
+#include <memory>
+#include <mutex>
 #include "config.h"
 #include "relay_control.h"
+#include "settings.h"
+#include "rf_codes.h"
+#include "storage.h"
+#include "mqtt_bridge.h"
+#include "metrics.h"
+#include "mem_debug.h"
+#include "log_buffer.h"
+#include "command_trace.h"
+#include "rf_receiver.h"
+#include "request_body.h"
+#include "ota_update.h"
+#include "relay_stats.h"
+#include "relay_history.h"
+#include "wifi_recovery.h"
+#include "http_admission.h"
+#include "reconnect_policy.h"
+#include "mqtt_tls.h"
+#include "udp_control.h"
+#if UDP_CONTROL
+#include <AsyncUDP.h>
+#endif
 
 // Global objects
+#if MQTT_TLS
+TlsClient espClient(true);  // Session kept in RTC memory - resumes after a restart too
+#else
 WiFiClient espClient;
+#endif
 PubSubClient mqttClient(espClient);
 AsyncWebServer server(WEB_SERVER_PORT);
 RelayControl relayControl;
 Preferences preferences;
+#if RF_DECODER_RMT
+RmtRFReceiver rfReceiver;
+#else
 RCSwitch rfReceiver = RCSwitch();
+#endif
 
-// MQTT settings (hardcoded defaults)
-char mqtt_server[40] = "192.168.68.100";
-char mqtt_port[6] = "1883";
-char mqtt_user[40] = "solacemqtt";
-char mqtt_password[40] = "solacepass";
-char mqtt_hostname[40] = "esp32-relay";  // Configurable MQTT hostname for topics
+// Runtime settings (hardcoded defaults, overridden from preferences)
+Settings settings = {
+    "192.168.68.100",  // mqtt_server
+    "1883",            // mqtt_port
+    "solacemqtt",      // mqtt_user
+    "solacepass",      // mqtt_password
+    "esp32-relay",     // mqtt_hostname
+    NUM_RELAYS,        // activeRelayCount - default to all relays on the board
+    MQTT_DEVICE_DISCOVERY,
+    -1,                // lastDiscoveryMode
+    MQTT_AGGREGATE_STATE
+};
+
+RFCodeStore rfCodes;
+Storage storage(preferences);
+MqttBridge mqttBridge(mqttClient, relayControl, rfCodes, settings, storage);
+OtaUpdate otaUpdate(storage);
 
 // Admin settings
 const char* ADMIN_PASSWORD = "Solacepass@123";
-int activeRelayCount = 16;  // Default to all 16 relays
 
-// RF Receiver settings - Multiple codes support
-#define MAX_RF_CODES 10
-
-struct RFCode {
-    char name[32];              // User-defined name
-    unsigned long code;         // RF code value
-    unsigned int bitLength;     // Bit length
-    unsigned int protocol;      // Protocol
-    bool active;                // Is this slot in use
-    unsigned long lastTrigger;  // Last trigger timestamp
-};
-
-RFCode rfCodes[MAX_RF_CODES];
-int rfCodeCount = 0;
+// RF learning state
 bool rfLearningMode = false;
 int rfLearningSlot = -1;        // Which slot we're learning for
 char pendingRFName[32] = "";    // Name for code being learned
 
 // MQTT Discovery management
-bool discoveryPublished = false;  // Only publish once per boot unless manually triggered
-unsigned long lastMQTTAttempt = 0;
-const unsigned long MQTT_RETRY_INTERVAL = 10000;  // Try reconnecting every 10 seconds (was 5)
+bool discoveryPending = false;    // Republish discovery from loop() (set by API handlers)
+volatile int pendingRelayCount = 0;  // New active relay count from the admin API (0 = none)
+
+// Group memberships / scenes from the admin API, applied (and resubscribed) by loop()
+GroupConfig pendingGroupConfig;
+volatile bool groupConfigPending = false;
+
+#if UDP_CONTROL
+AsyncUDP udpServer;
+// Relays switched by UDP commands - the UDP task only switches them, loop() publishes and saves
+RelayControl::Mask udpChanged;
+std::mutex udpChangedLock;
+// Key from the admin API, saved and applied by loop()
+uint8_t pendingUdpKey[UDP_KEY_BYTES];
+volatile int udpKeyPending = 0;  // 1 = pendingUdpKey, -1 = protocol off
+#endif
 
-// WiFi reconnection management
-unsigned long lastWiFiCheck = 0;
-unsigned long lastReconnectAttempt = 0;
-const unsigned long WIFI_CHECK_INTERVAL = 5000;      // Check WiFi every 5 seconds (faster detection)
-const unsigned long RECONNECT_INTERVAL = 30000;      // Try to reconnect every 30 seconds (more frequent)
-const unsigned long RECONNECT_TIMEOUT = 15000;       // 15 second timeout for reconnection (faster AP mode)
-bool apModeActive = false;
+// HTTP commands with a correlation id - their trace is published by loop(), which owns the MQTT client
+struct PendingTrace {
+    CommandTrace* trace;
+    uint32_t id;  // The trace's id when queued - skipped if the ring slot was reused since
+};
+PendingTrace pendingTraces[HTTP_TRACE_QUEUE];
+int pendingTraceCount = 0;
+std::mutex pendingTraceLock;
+
+// MQTT settings switchover requested from the admin API, applied by loop()
+enum MqttSwitchStatus { MQTT_SWITCH_IDLE, MQTT_SWITCH_PENDING, MQTT_SWITCH_APPLIED, MQTT_SWITCH_ROLLED_BACK };
+Settings pendingMqttSettings;
+volatile MqttSwitchStatus mqttSwitchStatus = MQTT_SWITCH_IDLE;
+
+// WiFi reconnection management - timing lives in reconnectPolicy
 bool wifiConnected = false;
-bool wifiReconnecting = false;
-unsigned long reconnectStartTime = 0;
-bool mdnsInitialized = false;  // Track if mDNS has been set up in setup()
+
+// OTA follow-up, done from loop() so the upload response gets out first
+volatile uint32_t otaRestartAt = 0;       // millis() of a completed firmware upload (0 = none)
+volatile bool filesystemUnmounted = false;  // LittleFS released for a filesystem upload
 WiFiEventId_t wifiConnectHandler;
 WiFiEventId_t wifiDisconnectHandler;
 
+// Boot-time WiFi bring-up - runs from loop() so relays and RF are live meanwhile.
+// The config portal owns port 80 while it is open, so the web server starts after it.
+enum WiFiBootState { WIFI_BOOT_CONNECTING, WIFI_BOOT_PORTAL, WIFI_BOOT_DONE };
+WiFiBootState wifiBootState = WIFI_BOOT_CONNECTING;
+unsigned long wifiBootStart = 0;
+WiFiManager wifiManager;
+WiFiManagerParameter custom_mqtt_server("server", "MQTT Server IP", "", 40);
+WiFiManagerParameter custom_mqtt_port("port", "MQTT Port", "", 6);
+WiFiManagerParameter custom_mqtt_user("user", "MQTT Username", "", 40);
+WiFiManagerParameter custom_mqtt_password("password", "MQTT Password", "", 40);
 // Function declarations
 void checkWiFiConnection();
 void startAPMode();
 void setupWiFi();
+void startConfigPortal();
+void processWiFiBoot();
+void finishWiFiBoot();
 void setupWiFiEvents();
 void onWiFiConnect(WiFiEvent_t event, WiFiEventInfo_t info);
 void onWiFiDisconnect(WiFiEvent_t event, WiFiEventInfo_t info);
+void processWiFiRecovery();
 void setupMQTT();
 void setupWebServer();
+bool receiveJsonBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total,
+                     JsonDocument& doc);
 void setupMDNS();
 void mqttCallback(char* topic, byte* payload, unsigned int length);
+void onRelayChange(const RelayControl::Mask& changed, const RelayControl::Mask& states, RelaySource source);
+void saveRelayHistory();
+void restoreRelayHistory();
 void reconnectMQTT();
-void publishDiscovery();
-void publishState(int relayIndex);
+void loadMqttCa();
 void saveConfigCallback();
-void saveRelayStates();
-void restoreRelayStates();
 void setupRFReceiver();
 void checkRFSignal();
-void publishRFTriggerState(int slot);
-void saveRFCodes();
-void restoreRFCodes();
-int addRFCode(const char* name, unsigned long code, unsigned int bitLength, unsigned int protocol);
-void deleteRFCode(int slot);
+void publishRFTriggerState(int slot, CommandTrace* trace = nullptr);
+void setupUdpControl();
+void processUdpControl();
+void queueTrace(CommandTrace* trace);
+void processPendingTraces();
 bool shouldSaveConfig = false;
 
+// Arduino core hook: don't confirm a freshly updated image at startup - OtaUpdate
+// does that once the firmware is back on the network
+bool verifyRollbackLater() {
+    return true;
+}
+
 void setup() {
     Serial.begin(115200);
     Serial.println("\n\n=== ESP32 Relay Controller ===");
     
+    logBuffer.begin();
+    
+    metrics.begin();
+    memDebug.begin();
+    
+    // Local control first: nothing below waits for the network
     // Initialize relay control
     relayControl.init();
     
-    // Restore saved relay states and RF codes
-    restoreRelayStates();
-    restoreRFCodes();
+    // Installed before the restore so the history shows what boot switched on
+    relayControl.setChangeHook(onRelayChange);
+    
+    // Restore saved settings, relay states and RF codes
+    storage.load(settings, relayControl, rfCodes);
+    metrics.markBootStage(BOOT_RELAYS);
+    {
+        GroupConfig groupConfig;
+        storage.loadGroupConfig(groupConfig);
+        mqttBridge.setGroupConfig(groupConfig, false);
+    }
+#if UDP_CONTROL
+    {
+        uint8_t key[UDP_KEY_BYTES];
+        if (storage.loadUdpKey(key)) {
+            udpControl.setKey(key, sizeof(key));
+        }
+    }
+#endif
+    
+    // Counters start after the restore - restoring the saved states isn't a switch
+    relayStats.begin(relayControl.getMask(), millis());
+    
+    // Rolls back right away if a new firmware already used up its trial boots
+    otaUpdate.checkBoot();
+    
+    // Setup RF Receiver
+    setupRFReceiver();
+    metrics.markBootStage(BOOT_RF);
     
     // Initialize LittleFS for web files
     if (!LittleFS.begin(true)) {
         Serial.println("LittleFS Mount Failed");
+    } else {
+        restoreRelayHistory();
+        loadMqttCa();
     }
     
     // Setup WiFi event handlers FIRST (before connecting)
     setupWiFiEvents();
     
-    // Setup WiFi with captive portal
-    setupWiFi();
-    
-    // Setup mDNS
-    setupMDNS();
-    
-    // Setup MQTT
+    // Setup MQTT - connects from loop() once WiFi is up
     setupMQTT();
     
-    // Setup Web Server
-    setupWebServer();
-    
-    // Setup RF Receiver
-    setupRFReceiver();
+    // Start connecting, or open the captive portal - both non-blocking.
+    // mDNS and the web server follow from loop() (processWiFiBoot).
+    setupWiFi();
     
     Serial.println("\n=== Setup Complete ===");
     Serial.printf("Device Name: %s\n", DEVICE_NAME);
-    Serial.printf("WiFi SSID: %s\n", WiFi.SSID().c_str());
-    Serial.printf("IP Address: %s\n", WiFi.localIP().toString().c_str());
     Serial.printf("mDNS URL: http://%s.local\n", MDNS_HOSTNAME);
     Serial.printf("Admin Page: http://%s.local/solaceadmin\n", MDNS_HOSTNAME);
-    Serial.printf("MQTT Server: %s:%s\n", mqtt_server, mqtt_port);
-    Serial.printf("Active Relays: %d\n", activeRelayCount);
+    Serial.printf("MQTT Server: %s:%s\n", settings.mqtt_server, settings.mqtt_port);
+    Serial.printf("Active Relays: %d\n", settings.activeRelayCount);
     Serial.println("======================\n");
 }
 
 void loop() {
-    // Check WiFi connection status
-    checkWiFiConnection();
+#if METRICS_ENABLED
+    metrics.beginLoop();
+#endif
+    
+    // Check WiFi connection status (boot-time connect / portal until that is done)
+    {
+        SubsystemTimer timer(SUBSYS_WIFI);
+        if (wifiBootState != WIFI_BOOT_DONE) {
+            processWiFiBoot();
+        } else {
+            checkWiFiConnection();
+        }
+        processWiFiRecovery();
+    }
     
     // Reconnect to MQTT if needed (only if WiFi is connected)
     if (WiFi.status() == WL_CONNECTED) {
         if (!mqttClient.connected()) {
+            SubsystemTimer timer(SUBSYS_MQTT_RECONNECT);
             reconnectMQTT();
         }
-        mqttClient.loop();
+        {
+            SubsystemTimer timer(SUBSYS_MQTT_LOOP);
+            mqttClient.loop();
+        }
+    
+        // New broker / credentials / hostname from the admin page
+        if (mqttSwitchStatus == MQTT_SWITCH_PENDING) {
+            String clientId = String(DEVICE_NAME) + "-" + String(ESP.getEfuseMac(), HEX);
+            bool applied = mqttBridge.switchBroker(pendingMqttSettings, clientId.c_str());
+            mqttSwitchStatus = applied ? MQTT_SWITCH_APPLIED : MQTT_SWITCH_ROLLED_BACK;
+            reconnectPolicy.mqttAttempted(millis());
+        }
+    
+        // Discovery republish requested from the web server (e.g. mode change)
+        if (discoveryPending && mqttClient.connected()) {
+            discoveryPending = false;
+            mqttBridge.publishDiscovery();
+            mqttBridge.publishAllStates();  // The state topic may have changed with the mode
+        }
+    
+        // Group acknowledgements whose random delay is up
+        mqttBridge.publishGroupAcks();
+        mqttBridge.publishRelayStats(false);
+    }
+    
+    // Relay count changed from the admin page - applied here so MQTT stays on one task
+    if (pendingRelayCount > 0) {
+        int newCount = pendingRelayCount;
+        pendingRelayCount = 0;
+        mqttBridge.applyRelayCount(newCount);
+    }
+    if (groupConfigPending) {
+        groupConfigPending = false;
+        mqttBridge.setGroupConfig(pendingGroupConfig, true);
+    }
+    processUdpControl();
+    processPendingTraces();
+    
+    // Relay counters are only written to flash this often
+    if (relayStats.checkpointDue(millis())) {
+        storage.saveRelayStats();
+        relayHistory.clock(millis());  // Sees every millis() wrap, even with no switching in 49 days
     }
     
     // Check RF signals
-    checkRFSignal();
+    {
+        SubsystemTimer timer(SUBSYS_RF);
+        checkRFSignal();
+    }
+    
+    // A new firmware is accepted once it is back on the network
+    otaUpdate.loop(WiFi.status() == WL_CONNECTED && (strlen(settings.mqtt_server) == 0 || mqttClient.connected()));
+    if (filesystemUnmounted && !otaUpdate.isRunning()) {
+        filesystemUnmounted = false;
+        LittleFS.begin();
+    }
+    if (otaRestartAt != 0 && millis() - otaRestartAt > 1000) {
+        Serial.println("[OTA] Restarting into the new firmware");
+        storage.saveRelayStats();
+        saveRelayHistory();
+        ESP.restart();
+    }
+    
+#if METRICS_ENABLED
+    metrics.endLoop();
+#endif
     
     // Small delay to prevent watchdog resets and allow background tasks
     delay(10);
 }
 
-// WiFi event handlers - called automatically by ESP32
+// WiFi event handlers - run on the WiFi event task, so they only post to
+// wifiRecovery; processWiFiRecovery() does the work from loop()
 void onWiFiConnect(WiFiEvent_t event, WiFiEventInfo_t info) {
-    Serial.println("[WiFi] Event: Connected!");
-    Serial.printf("[WiFi] IP: %s\n", WiFi.localIP().toString().c_str());
+    LOGI("[WiFi] Event: Connected, IP: %s", WiFi.localIP().toString().c_str());
     wifiConnected = true;
-    wifiReconnecting = false;
+    metrics.markBootStage(BOOT_WIFI);
+    wifiRecovery.postConnected(millis());
+}
+
+void onWiFiDisconnect(WiFiEvent_t event, WiFiEventInfo_t info) {
+    LOGI("[WiFi] Event: Disconnected");
+    wifiConnected = false;
+    wifiRecovery.postDisconnected(millis());
+    // Reconnecting is up to checkWiFiConnection()
+}
+
+// Carries out what the WiFi events and the mDNS restart API asked for
+void processWiFiRecovery() {
+    uint32_t actions = wifiRecovery.poll(millis());
     
-    // If we were in AP mode, we can disable it now
-    if (apModeActive) {
+    if ((actions & RECOVERY_LEAVE_AP) && reconnectPolicy.stationConnected()) {
         Serial.println("[WiFi] Disabling AP mode - connected to network");
-        apModeActive = false;
         WiFi.mode(WIFI_STA);  // Switch back to station-only mode
     }
-    
-    // ONLY restart mDNS if it was already initialized (reconnection scenario)
-    // Don't interfere with initial setup in setup()
-    if (mdnsInitialized) {
-        Serial.println("[WiFi] Reconnection detected - restarting mDNS...");
-        
-        // Give WiFi a moment to fully stabilize
-        delay(100);
-        
-        // Restart mDNS for new IP
-        MDNS.end();
-        delay(50);
-        
-        if (MDNS.begin(MDNS_HOSTNAME)) {
-            Serial.printf("[mDNS] Responder restarted: http://%s.local\n", MDNS_HOSTNAME);
-            MDNS.addService("http", "tcp", 80);
-            delay(100);
-            Serial.println("[mDNS] Service re-announced");
-        } else {
-            Serial.println("[mDNS] ERROR: Failed to restart mDNS responder!");
-        }
-    } else {
-        Serial.println("[WiFi] Initial connection - mDNS will be set up in setup()");
+    // Debounced - one restart for a burst of reconnects, no settle delays
+    if (actions & RECOVERY_MDNS) {
+        setupMDNS();
     }
 }
 
-void onWiFiDisconnect(WiFiEvent_t event, WiFiEventInfo_t info) {
-    Serial.println("[WiFi] Event: Disconnected!");
-    wifiConnected = false;
-    // Don't take action here - let checkWiFiConnection() handle it
-}
-
 void setupWiFiEvents() {
     Serial.println("[WiFi] Registering event handlers...");
     // Register event handlers for automatic WiFi status updates
@@ -211,69 +367,24 @@ void setupWiFiEvents() {
 }
 
 void checkWiFiConnection() {
-    unsigned long currentMillis = millis();
+    bool connected = WiFi.status() == WL_CONNECTED;
+    int apClients = reconnectPolicy.isApMode() ? WiFi.softAPgetStationNum() : 0;
+    uint32_t actions = reconnectPolicy.checkWiFi(millis(), connected, apClients);
     
-    // Check connection status every 5 seconds (fast detection with event-driven approach)
-    if (currentMillis - lastWiFiCheck < WIFI_CHECK_INTERVAL) {
-        return;
-    }
-    lastWiFiCheck = currentMillis;
-    
-    // If connected, nothing to do (events handle status changes)
-    if (WiFi.status() == WL_CONNECTED) {
-        return;
+    // NON-BLOCKING: each action only initiates, the IP event tells when it worked
+    if (actions & RECONNECT_WIFI_BEGIN) {
+        Serial.println("[WiFi] WiFi disconnected - starting reconnect attempt...");
+        WiFi.begin();
     }
-    
-    // If currently reconnecting, check timeout
-    if (wifiReconnecting) {
-        if (currentMillis - reconnectStartTime > RECONNECT_TIMEOUT) {
-            Serial.println("[WiFi] Reconnect timeout (15s) - entering AP mode");
-            wifiReconnecting = false;
-            startAPMode();
-        }
-        // Still waiting for connection - event will notify us
-        return;
+    if (actions & RECONNECT_START_AP) {
+        Serial.printf("[WiFi] Reconnect timeout (%us) - entering AP mode\n", (unsigned)(WIFI_RECONNECT_TIMEOUT / 1000));
+        startAPMode();
     }
-    
-    // If in AP mode
-    if (apModeActive) {
-        int clientCount = WiFi.softAPgetStationNum();
-        
-        if (clientCount > 0) {
-            // Don't try to reconnect while clients are connected
-            lastReconnectAttempt = currentMillis;
-            return;
-        }
-        
-        // Try to reconnect every 30 seconds (faster recovery)
-        if (currentMillis - lastReconnectAttempt < RECONNECT_INTERVAL) {
-            return;
-        }
-        
+    if (actions & RECONNECT_AP_RETRY) {
         Serial.println("[WiFi] No AP clients - attempting reconnect (non-blocking)...");
-        lastReconnectAttempt = currentMillis;
-        wifiReconnecting = true;
-        reconnectStartTime = currentMillis;
-        
-        // NON-BLOCKING: Just initiate connection, event will notify when ready
         WiFi.mode(WIFI_AP_STA);
         WiFi.begin();
-        return;
     }
-    
-    // Not in AP mode, not reconnecting - start reconnection attempt
-    Serial.println("[WiFi] WiFi disconnected - starting reconnect attempt...");
-    wifiReconnecting = true;
-    reconnectStartTime = currentMillis;
-    
-    // NON-BLOCKING: Just initiate, event will fire when connected
-    WiFi.begin();
-    
-    // Give it a brief moment to see if connection is immediate
-    delay(100);
-    
-    // If still not connected after brief check, we'll wait for event
-    // Set a timeout check for next iteration
 }
 
 void startAPMode() {
@@ -283,9 +394,6 @@ void startAPMode() {
     WiFi.mode(WIFI_AP_STA);
     WiFi.softAP(AP_NAME, AP_PASSWORD);
     
-    apModeActive = true;
-    lastReconnectAttempt = millis();
-    
     IPAddress apIP = WiFi.softAPIP();
     Serial.println("[WiFi] AP Mode Started");
     Serial.printf("[WiFi] AP SSID: %s\n", AP_NAME);
@@ -295,20 +403,21 @@ void startAPMode() {
     
     // Restart mDNS to work with AP IP
     MDNS.end();
-    if (MDNS.begin(MDNS_HOSTNAME)) {
+    bool started = MDNS.begin(MDNS_HOSTNAME);
+    if (started) {
         Serial.printf("[mDNS] Responder started in AP mode: http://%s.local\n", MDNS_HOSTNAME);
         MDNS.addService("http", "tcp", 80);
     }
+    wifiRecovery.mdnsStarted(started);
 }
 
+// Non-blocking: starts the connection or the config portal, processWiFiBoot() finishes it
 void setupWiFi() {
-    WiFiManager wifiManager;
-    
-    // Create custom parameters for MQTT configuration
-    WiFiManagerParameter custom_mqtt_server("server", "MQTT Server IP", mqtt_server, 40);
-    WiFiManagerParameter custom_mqtt_port("port", "MQTT Port", mqtt_port, 6);
-    WiFiManagerParameter custom_mqtt_user("user", "MQTT Username", mqtt_user, 40);
-    WiFiManagerParameter custom_mqtt_password("password", "MQTT Password", mqtt_password, 40);
+    // Portal fields show the settings loaded from storage
+    custom_mqtt_server.setValue(settings.mqtt_server, 40);
+    custom_mqtt_port.setValue(settings.mqtt_port, 6);
+    custom_mqtt_user.setValue(settings.mqtt_user, 40);
+    custom_mqtt_password.setValue(settings.mqtt_password, 40);
     
     // Add all custom parameters to WiFiManager
     wifiManager.addParameter(&custom_mqtt_server);
@@ -316,56 +425,111 @@ void setupWiFi() {
     wifiManager.addParameter(&custom_mqtt_user);
     wifiManager.addParameter(&custom_mqtt_password);
     
-    // Set timeout
+    // Portal is serviced by wifiManager.process() from loop()
+    wifiManager.setConfigPortalBlocking(false);
     wifiManager.setConfigPortalTimeout(PORTAL_TIMEOUT);
+    wifiManager.setConnectTimeout(10);  // Bounds the one blocking step: trying credentials entered in the portal
     
-    // Try to connect to saved WiFi or start captive portal
-    if (!wifiManager.autoConnect(AP_NAME, AP_PASSWORD)) {
-        Serial.println("Failed to connect and hit timeout");
-        delay(3000);
-        ESP.restart();
+    wifiBootStart = millis();
+    if (wifiManager.getWiFiIsSaved()) {
+        Serial.println("[WiFi] Connecting to saved network (non-blocking)...");
+        WiFi.mode(WIFI_STA);
+        WiFi.begin();
+        wifiBootState = WIFI_BOOT_CONNECTING;
+    } else {
+        Serial.println("[WiFi] No saved network");
+        startConfigPortal();
+    }
+}
+
+void startConfigPortal() {
+    Serial.printf("[WiFi] Config portal open: connect to '%s' to configure WiFi and MQTT\n", AP_NAME);
+    wifiManager.startConfigPortal(AP_NAME, AP_PASSWORD);
+    wifiBootState = WIFI_BOOT_PORTAL;
+}
+
+// Boot-time WiFi state machine, called from loop() until the portal is closed for good
+void processWiFiBoot() {
+    if (wifiBootState == WIFI_BOOT_CONNECTING) {
+        if (WiFi.status() == WL_CONNECTED) {
+            finishWiFiBoot();
+        } else if (millis() - wifiBootStart > WIFI_BOOT_CONNECT_TIMEOUT * 1000UL) {
+            Serial.println("[WiFi] Saved network not reachable");
+            startConfigPortal();
+        }
+        return;
     }
     
-    // Connected!
-    Serial.println("WiFi connected!");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-    
-    wifiConnected = true;  // Mark WiFi as connected
-    apModeActive = false;
-    
-    // Read MQTT parameters from WiFiManager
-    String new_server = custom_mqtt_server.getValue();
-    String new_port = custom_mqtt_port.getValue();
-    String new_user = custom_mqtt_user.getValue();
-    String new_password = custom_mqtt_password.getValue();
-    
-    // If MQTT parameters were provided, save them
-    if (new_server.length() > 0) {
-        // Save to preferences
-        preferences.begin("relay-states", false);
-        preferences.putString("mqtt_server", new_server);
-        preferences.putString("mqtt_port", new_port);
-        preferences.putString("mqtt_user", new_user);
-        preferences.putString("mqtt_pass", new_password);
-        preferences.end();
-        
-        // Update current variables
-        new_server.toCharArray(mqtt_server, 40);
-        new_port.toCharArray(mqtt_port, 6);
-        new_user.toCharArray(mqtt_user, 40);
-        new_password.toCharArray(mqtt_password, 40);
-        
-        Serial.println("[WiFiManager] MQTT settings saved");
-        Serial.printf("  Server: %s:%s\n", mqtt_server, mqtt_port);
-        Serial.printf("  User: %s\n", mqtt_user);
-    } else {
-        Serial.println("[WiFiManager] Using existing MQTT settings:");
-        Serial.printf("  Server: %s:%s\n", mqtt_server, mqtt_port);
-        Serial.printf("  User: %s\n", mqtt_user);
+    if (wifiManager.process()) {
+        // Credentials entered in the portal and connected
+        Serial.println("WiFi connected!");
+        Serial.print("IP address: ");
+        Serial.println(WiFi.localIP());
+    
+        // Read MQTT parameters from WiFiManager
+        String new_server = custom_mqtt_server.getValue();
+        String new_port = custom_mqtt_port.getValue();
+        String new_user = custom_mqtt_user.getValue();
+        String new_password = custom_mqtt_password.getValue();
+    
+        // If MQTT parameters were provided, save them
+        if (new_server.length() > 0) {
+            // Update current variables
+            new_server.toCharArray(settings.mqtt_server, 40);
+            new_port.toCharArray(settings.mqtt_port, 6);
+            new_user.toCharArray(settings.mqtt_user, 40);
+            new_password.toCharArray(settings.mqtt_password, 40);
+    
+            // Save to preferences
+            storage.saveMqttSettings(settings, true);
+            mqttClient.setServer(settings.mqtt_server, atoi(settings.mqtt_port));
+    
+            Serial.println("[WiFiManager] MQTT settings saved");
+            Serial.printf("  Server: %s:%s\n", settings.mqtt_server, settings.mqtt_port);
+            Serial.printf("  User: %s\n", settings.mqtt_user);
+        } else {
+            Serial.println("[WiFiManager] Using existing MQTT settings:");
+            Serial.printf("  Server: %s:%s\n", settings.mqtt_server, settings.mqtt_port);
+            Serial.printf("  User: %s\n", settings.mqtt_user);
+        }
+        finishWiFiBoot();
+    } else if (WiFi.status() == WL_CONNECTED) {
+        // Saved network came back while the portal was open
+        Serial.println("[WiFi] Saved network reachable again - closing config portal");
+        wifiManager.stopConfigPortal();
+        WiFi.mode(WIFI_STA);
+        finishWiFiBoot();
+    } else if (!wifiManager.getConfigPortalActive()) {
+        if (!wifiManager.getWiFiIsSaved()) {
+            // Nothing to fall back to - keep the portal available (used to restart here)
+            startConfigPortal();
+        } else {
+            // Same as losing WiFi later on: checkWiFiConnection() retries and falls back to AP mode
+            Serial.println("[WiFi] Config portal timed out - continuing offline");
+            finishWiFiBoot();
+        }
     }
 }
 
+// Port 80 is free from here on
+void finishWiFiBoot() {
+    wifiBootState = WIFI_BOOT_DONE;
+    wifiConnected = WiFi.status() == WL_CONNECTED;
+    reconnectPolicy.begin(millis());
+    
+    // Setup Web Server
+    setupWebServer();
+    metrics.markBootStage(BOOT_WEB);
+    setupUdpControl();
+    
+    // AsyncTCP task exists now - register it for memory diagnostics
+    memDebug.attachTasks();
+    
+    Serial.printf("[WiFi] Boot network setup done (%s), IP: %s\n",
+                  wifiConnected ? "connected" : "offline", WiFi.localIP().toString().c_str());
+}
+
+// Starts the responder, or restarts it for a new IP - from processWiFiRecovery()
 void setupMDNS() {
     // Ensure WiFi is ready before starting mDNS
     if (WiFi.status() != WL_CONNECTED) {
@@ -373,259 +537,406 @@ void setupMDNS() {
         return;
     }
     
-    Serial.println("[mDNS] Starting mDNS responder...");
+    if (wifiRecovery.isMdnsRunning()) {
+        Serial.println("[mDNS] Restarting mDNS responder...");
+        MDNS.end();
+    } else {
+        Serial.println("[mDNS] Starting mDNS responder...");
+    }
     
     if (MDNS.begin(MDNS_HOSTNAME)) {
         Serial.printf("[mDNS] Responder started: http://%s.local\n", MDNS_HOSTNAME);
         Serial.printf("[mDNS] IP Address: %s\n", WiFi.localIP().toString().c_str());
-        
+    
         // Add HTTP service
         MDNS.addService("http", "tcp", 80);
-        
+#if UDP_CONTROL
+        if (udpControl.isEnabled()) {
+            MDNS.addService("relayctl", "udp", UDP_CONTROL_PORT);
+        }
+#endif
+    
         Serial.println("[mDNS] HTTP service registered");
         Serial.println("[mDNS] Device should now be discoverable at esp32-relay.local");
-        
-        // Mark as initialized so event handler can restart it on reconnection
-        mdnsInitialized = true;
+    
+        // Later reconnects restart it (debounced)
+        wifiRecovery.mdnsStarted(true);
+        metrics.markBootStage(BOOT_MDNS);
     } else {
         Serial.println("[mDNS] ERROR: Failed to start mDNS responder!");
         Serial.println("[mDNS] .local URL will not work - use IP address instead");
-        mdnsInitialized = false;
+        wifiRecovery.mdnsStarted(false);
     }
 }
 
 void setupMQTT() {
-    if (strlen(mqtt_server) > 0) {
-        mqttClient.setServer(mqtt_server, atoi(mqtt_port));
-        mqttClient.setCallback(mqttCallback);
-        mqttClient.setBufferSize(1024);  // Buffer for discovery messages (max ~500 bytes each)
+    // Callback and buffer are set even without a server - one can be added at runtime
+    mqttClient.setCallback(mqttCallback);
+    mqttClient.setBufferSize(1024);  // State, stats and trace messages - discovery is streamed past it
+    
+    if (strlen(settings.mqtt_server) > 0) {
+        mqttClient.setServer(settings.mqtt_server, atoi(settings.mqtt_port));
         // Keep-alive (60s) and socket timeout (30s) set via build flags in platformio.ini
-        reconnectMQTT();
+        // First attempt as soon as WiFi is up, not MQTT_RETRY_INTERVAL after boot
+        reconnectPolicy.mqttRetryNow(millis());
     } else {
         Serial.println("MQTT server not configured");
     }
 }
 
-/*
- * Optimized MQTT Reconnection
- * 
- * Strategy:
- * - Publishes discovery ONCE per boot (on first connection)
- * - Subsequent reconnections only publish states (fast, non-blocking)
- * - Manual republish available via /api/mqtt/rediscover
- * - Longer retry interval (10s) to prevent connection storms
- * 
- * This prevents blocking delays while maintaining reliability.
- */
+// Longer retry interval (10s) prevents connection storms - see MqttBridge::connect()
 void reconnectMQTT() {
-    // Use the global lastMQTTAttempt to prevent rapid reconnection attempts
-    if (millis() - lastMQTTAttempt < MQTT_RETRY_INTERVAL) {
+    if (!reconnectPolicy.mqttAttemptDue(millis())) {
         return;
     }
-    lastMQTTAttempt = millis();
     
-    if (strlen(mqtt_server) == 0) {
+    if (strlen(settings.mqtt_server) == 0) {
         return;
     }
     
-    Serial.print("Attempting MQTT connection...");
+    LOGI("[MQTT] Connecting to %s", settings.mqtt_server);
+    metrics.mqttReconnectAttempts++;
     
     String clientId = String(DEVICE_NAME) + "-" + String(ESP.getEfuseMac(), HEX);
-    String availTopic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/availability";
     
-    bool connected;
-    if (strlen(mqtt_user) > 0) {
-        connected = mqttClient.connect(clientId.c_str(), mqtt_user, mqtt_password, 
-                                       availTopic.c_str(), 0, true, "offline");
+    if (!mqttBridge.connect(clientId.c_str())) {
+        LOGW("[MQTT] Connection failed, rc=%d", mqttClient.state());
     } else {
-        connected = mqttClient.connect(clientId.c_str(), 
-                                       availTopic.c_str(), 0, true, "offline");
+        metrics.markBootStage(BOOT_MQTT);
+    }
+}
+
+// RelayControl change hook - every switch from any source, on the task that made it
+void onRelayChange(const RelayControl::Mask& changed, const RelayControl::Mask& states, RelaySource source) {
+    uint32_t now = millis();
+    relayHistory.record(changed, states, source, now);
+    if (source != RELAY_SOURCE_BOOT) {
+        relayStats.record(changed, states, now);
     }
+}
+
+// Runs verified UDP commands on the AsyncUDP task. Relays switch right away,
+// like /api/relay, under RelayControl's lock; the MQTT publish and the NVS
+// save wait for loop().
+void onUdpCommand(const UdpCommand& command, UdpReply& reply) {
+#if UDP_CONTROL
+    RelayControl::Mask active;
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        active.set(i);
+    }
+    RelayControl::Mask onMask;
+    RelayControl::Mask changeMask;
     
-    if (connected) {
-        Serial.println("connected");
-        
-        // Publish availability as online
-        mqttClient.publish(availTopic.c_str(), "online", true);
-        
-        // Subscribe to command topics for each relay
-        for (int i = 0; i < NUM_RELAYS; i++) {
-            String topic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/relay" + String(i + 1) + "/set";
-            mqttClient.subscribe(topic.c_str());
+    if (command.op == UDP_OP_SET) {
+        if ((command.select & ~udpMaskOf(active)).any()) {
+            reply.status = UDP_STATUS_BAD_RELAY;
+        } else {
+            changeMask = relayMaskOf<RelayControl::Mask::BITS>(command.select);
+            onMask = relayMaskOf<RelayControl::Mask::BITS>(command.value) & changeMask;
         }
-        Serial.println("Subscribed to command topics");
-        
-        // Only publish discovery on FIRST connection after boot
-        if (!discoveryPublished) {
-            Serial.println("[MQTT] First connection - publishing discovery...");
-            publishDiscovery();
-            discoveryPublished = true;
-            
-            // Publish initial states (with yield to prevent blocking)
-            for (int i = 0; i < activeRelayCount; i++) {
-                publishState(i);
-                yield();  // Allow other tasks to run
-            }
-            Serial.println("[MQTT] Discovery and states published");
+    } else if (command.op == UDP_OP_SCENE) {
+        const GroupConfig& config = mqttBridge.getGroupConfig();
+        const RelayScene* scene = command.scene < MQTT_SCENE_MAX ? &config.scenes[command.scene] : nullptr;
+        if (scene == nullptr || !scene->name[0]) {
+            reply.status = UDP_STATUS_BAD_SCENE;
         } else {
-            // On reconnection, just republish current states quickly
-            Serial.println("[MQTT] Reconnected - republishing states only");
-            for (int i = 0; i < activeRelayCount; i++) {
-                publishState(i);
-                yield();
-            }
+            onMask = relayMaskOf<RelayControl::Mask::BITS>(scene->on) & active;
+            changeMask = (onMask | relayMaskOf<RelayControl::Mask::BITS>(scene->off)) & active;
         }
-    } else {
-        Serial.print("failed, rc=");
-        Serial.println(mqttClient.state());
     }
+    
+    // RelayControl's lock covers the switch and the history / stats hook
+    RelayControl::Mask changed = relayControl.setMask(onMask, changeMask, RELAY_SOURCE_UDP);
+    if (changed.any()) {
+        std::lock_guard<std::mutex> guard(udpChangedLock);
+        udpChanged = udpChanged | changed;
+    }
+    reply.state = udpMaskOf(relayControl.getMask() & active);
+    reply.relayCount = settings.activeRelayCount;
+#endif
 }
 
-void mqttCallback(char* topic, byte* payload, unsigned int length) {
-    String message;
-    for (unsigned int i = 0; i < length; i++) {
-        message += (char)payload[i];
+// Listens once the network stack is up - frames are dropped until a key is set
+void setupUdpControl() {
+#if UDP_CONTROL
+    udpControl.setHandler(onUdpCommand);
+    if (!udpServer.listen(UDP_CONTROL_PORT)) {
+        LOGE("[UDP] Listen on port %u failed", (unsigned)UDP_CONTROL_PORT);
+        return;
+    }
+    udpServer.onPacket([](AsyncUDPPacket& packet) {
+        uint8_t reply[UDP_REPLY_BYTES];
+        size_t length = udpControl.handle(packet.data(), packet.length(), millis(), reply);
+        if (length) {
+            packet.write(reply, length);
+        }
+    });
+    Serial.printf("[UDP] Control protocol on port %d (%s)\n", UDP_CONTROL_PORT,
+                  udpControl.isEnabled() ? "enabled" : "no key set");
+#endif
+}
+
+// From loop(): state publishes and the relay save for UDP commands, key changes
+void processUdpControl() {
+#if UDP_CONTROL
+    RelayControl::Mask changed;
+    {
+        std::lock_guard<std::mutex> guard(udpChangedLock);
+        changed = udpChanged;
+        udpChanged = RelayControl::Mask();
+    }
+    if (changed.any()) {
+        // One publish per relay and one save for a whole burst of commands
+        mqttBridge.publishStates(changed);
+        storage.saveRelayStates(relayControl);
     }
     
-    Serial.printf("Message arrived [%s]: %s\n", topic, message.c_str());
-    
-    // Parse topic to get relay number
-    String topicStr = String(topic);
-    for (int i = 0; i < NUM_RELAYS; i++) {
-        String expectedTopic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/relay" + String(i + 1) + "/set";
-        if (topicStr == expectedTopic) {
-            bool newState = (message == "ON");
-            relayControl.setState(i, newState);
-            publishState(i);
-            saveRelayStates();  // Save state to persistent storage
-            break;
+    if (udpKeyPending != 0) {
+        bool enable = udpKeyPending > 0;
+        udpKeyPending = 0;
+        storage.saveUdpKey(enable ? pendingUdpKey : nullptr);
+        udpControl.setKey(enable ? pendingUdpKey : nullptr, UDP_KEY_BYTES);
+        memset(pendingUdpKey, 0, sizeof(pendingUdpKey));
+        wifiRecovery.requestMdnsRestart();  // Service record follows the enabled state
+        Serial.printf("[UDP] Control protocol %s\n", enable ? "enabled" : "disabled");
+    }
+#endif
+}
+
+// From the web task: a full queue drops the trace, the command itself has run
+void queueTrace(CommandTrace* trace) {
+    if (!trace || !trace->correlationId[0]) return;
+    std::lock_guard<std::mutex> guard(pendingTraceLock);
+    if (pendingTraceCount < HTTP_TRACE_QUEUE) {
+        pendingTraces[pendingTraceCount++] = {trace, trace->id};
+    }
+}
+
+void processPendingTraces() {
+    PendingTrace traces[HTTP_TRACE_QUEUE];
+    int count;
+    {
+        std::lock_guard<std::mutex> guard(pendingTraceLock);
+        count = pendingTraceCount;
+        memcpy(traces, pendingTraces, count * sizeof(PendingTrace));
+        pendingTraceCount = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        if (traces[i].trace->id == traces[i].id) {
+            mqttBridge.publishTrace(traces[i].trace);
         }
     }
 }
 
-void publishState(int relayIndex) {
-    if (!mqttClient.connected()) return;
-    
-    String topic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/relay" + String(relayIndex + 1) + "/state";
-    String state = relayControl.getState(relayIndex) ? "ON" : "OFF";
-    mqttClient.publish(topic.c_str(), state.c_str(), true);
+// Planned restart: the transition history goes to LittleFS for the next boot
+void saveRelayHistory() {
+#if RELAY_HISTORY_SNAPSHOT
+    File file = LittleFS.open(RELAY_HISTORY_FILE, "w");
+    if (!file) {
+        return;
+    }
+    size_t written = relayHistory.writeSnapshot(file, millis());
+    file.close();
+    Serial.printf("[History] Saved %u entries (%u bytes)\n", (unsigned)relayHistory.getCount(), (unsigned)written);
+#endif
 }
 
-void publishDiscovery() {
-    if (!mqttClient.connected()) return;
-    
-    String availTopic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/availability";
-    
-    Serial.printf("[MQTT] Publishing discovery for %d relays\n", activeRelayCount);
-    
-    for (int i = 0; i < activeRelayCount; i++) {
-        StaticJsonDocument<1024> doc;
-        
-        String uniqueId = String(mqtt_hostname) + "_relay" + String(i + 1);
-        String name = String(RELAY_NAMES[i]);
-        String stateTopic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/relay" + String(i + 1) + "/state";
-        String commandTopic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/relay" + String(i + 1) + "/set";
-        String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/switch/" + mqtt_hostname + "_relay" + String(i + 1) + "/config";
-        
-        doc["name"] = name;
-        doc["unique_id"] = uniqueId;
-        doc["state_topic"] = stateTopic;
-        doc["command_topic"] = commandTopic;
-        doc["availability_topic"] = availTopic;
-        doc["payload_on"] = "ON";
-        doc["payload_off"] = "OFF";
-        doc["state_on"] = "ON";
-        doc["state_off"] = "OFF";
-        doc["optimistic"] = false;
-        doc["icon"] = "mdi:electric-switch";
-        
-        JsonObject device = doc["device"].to<JsonObject>();
-        device["identifiers"][0] = mqtt_hostname;
-        device["name"] = DEVICE_NAME;
-        device["manufacturer"] = "ESP32";
-        device["model"] = "16-Channel Relay Controller";
-        device["sw_version"] = "1.2.0";
-        
-        String output;
-        serializeJson(doc, output);
-        
-        mqttClient.publish(configTopic.c_str(), output.c_str(), true);
-        
-        // Keep connection alive during discovery
-        yield();
-        mqttClient.loop();
-        delay(50);  // Small delay to prevent broker overflow
+// Boot: puts the saved history in front of the boot restore, then removes
+// the file so an unplanned reset later doesn't restore it twice
+void restoreRelayHistory() {
+#if RELAY_HISTORY_SNAPSHOT
+    if (!LittleFS.exists(RELAY_HISTORY_FILE)) {
+        return;
     }
-    
-    // Publish RF Trigger discovery for each learned code (binary sensors that auto-reset)
-    for (int i = 0; i < MAX_RF_CODES; i++) {
-        if (rfCodes[i].active && rfCodes[i].code != 0) {
-            StaticJsonDocument<1024> doc;
-            
-            // Create safe entity ID from name (lowercase, no spaces)
-            String entityId = String(rfCodes[i].name);
-            entityId.toLowerCase();
-            entityId.replace(" ", "_");
-            entityId.replace("-", "_");
-            
-            String uniqueId = String(mqtt_hostname) + "_rf_" + entityId;
-            String stateTopic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/rf_" + String(i) + "/state";
-            String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/binary_sensor/" + mqtt_hostname + "_rf_" + String(i) + "/config";
-            
-            doc["name"] = String("RF ") + rfCodes[i].name;
-            doc["unique_id"] = uniqueId;
-            doc["state_topic"] = stateTopic;
-            doc["availability_topic"] = availTopic;
-            doc["payload_on"] = "ON";
-            doc["payload_off"] = "OFF";
-            doc["device_class"] = "motion";
-            doc["icon"] = "mdi:remote";
-            doc["off_delay"] = 2;  // Auto-off after 2 seconds
-            
-            JsonObject device = doc["device"].to<JsonObject>();
-            device["identifiers"][0] = mqtt_hostname;
-            device["name"] = DEVICE_NAME;
-            device["manufacturer"] = "ESP32";
-            device["model"] = "16-Channel Relay Controller";
-            device["sw_version"] = "1.2.0";
-            
-            String output;
-            serializeJson(doc, output);
-            
-            mqttClient.publish(configTopic.c_str(), output.c_str(), true);
-            
-            // Keep connection alive during discovery
-            yield();
-            mqttClient.loop();
-            delay(50);
-            
-            Serial.printf("[MQTT] RF '%s' discovery published (slot %d)\n", rfCodes[i].name, i);
+    File file = LittleFS.open(RELAY_HISTORY_FILE, "r");
+    size_t size = file.size();
+    if (size <= sizeof(RelayHistorySnapshot) + RELAY_HISTORY_BYTES) {
+        uint8_t* data = new uint8_t[size];
+        if (file.read(data, size) == size && relayHistory.restoreSnapshot(data, size)) {
+            Serial.printf("[History] Restored %u entries\n", (unsigned)relayHistory.getCount());
+        }
+        delete[] data;
+    }
+    file.close();
+    LittleFS.remove(RELAY_HISTORY_FILE);
+#endif
+}
+
+// CA chain for the broker's certificate - parsed once, every TLS connect reuses it
+void loadMqttCa() {
+#if MQTT_TLS
+    File file = LittleFS.open(MQTT_TLS_CA_FILE, "r");
+    if (!file) {
+        Serial.printf("[TLS] %s missing - MQTT stays disconnected\n", MQTT_TLS_CA_FILE);
+        return;
+    }
+    size_t size = file.size();
+    uint8_t* pem = new uint8_t[size];
+    if (file.read(pem, size) == size) {
+        mqttTls.begin(pem, size);
+    }
+    delete[] pem;
+    file.close();
+#endif
+}
+
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+    if (mqttBridge.handleMessage(topic, payload, length)) {
+        storage.saveRelayStates(relayControl);  // Save state to persistent storage
+    }
+}
+
+// Every admitted request ends here, whatever happened to it. The request has
+// a single disconnect callback, so this releases everything it may hold.
+void finishRequest(AsyncWebServerRequest *request) {
+    httpAdmission.finish(request);
+    requestBodies.release(request);
+    otaUpdate.abort(request);  // Upload cut off mid-image
+}
+
+// Registered ahead of every route: sees each request once its headers are
+// in. Admitted requests fall through to their route. Shed ones are answered
+// right here, before the server parses any of their body; the response
+// closes the connection, and body bytes that still arrive are discarded
+// (this handler is trivial, so nothing buffers or parses them).
+class AdmissionHandler : public AsyncWebHandler {
+public:
+    bool canHandle(AsyncWebServerRequest *request) override {
+        RequestClass requestClass = (request->method() == HTTP_GET || request->method() == HTTP_HEAD)
+                                        ? REQUEST_READ : REQUEST_CONTROL;
+        uint32_t address = request->client()->remoteIP();
+        uint32_t retryAfter;
+        Admission result = httpAdmission.admit(request, address, requestClass, ESP.getFreeHeap(), retryAfter);
+        if (result == ADMIT_OK) {
+            request->onDisconnect([request]() { finishRequest(request); });
+            return false;
         }
+    
+        AsyncWebServerResponse *response = result == ADMIT_RATE_LIMITED
+            ? request->beginResponse(429, "application/json", "{\"error\":\"Too many requests\"}")
+            : request->beginResponse(503, "application/json", "{\"error\":\"Server busy\"}");
+        response->addHeader("Retry-After", String(retryAfter));
+        request->send(response);
+        return true;
     }
     
-    if (rfCodeCount > 0) {
-        Serial.printf("[MQTT] Published %d RF trigger entities\n", rfCodeCount);
+    // Already answered in canHandle()
+    void handleRequest(AsyncWebServerRequest *request) override {}
+};
+
+// Assembles a POST body from its chunks and parses it once complete.
+// Returns true with doc filled on the last chunk; otherwise false, with the
+// error response already sent if the body was rejected.
+bool receiveJsonBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total,
+                     JsonDocument& doc) {
+    char* body;
+    size_t length;
+    BodyStatus status = requestBodies.append(request, data, len, index, total, body, length);
+    
+    switch (status) {
+        case BODY_COMPLETE:
+            break;
+        case BODY_TOO_LARGE:
+            request->send(413, "application/json", "{\"error\":\"Body too large\"}");
+            return false;
+        case BODY_BUSY:
+            request->send(503, "application/json", "{\"error\":\"Too many requests in progress\"}");
+            return false;
+        case BODY_EVICTED:
+            request->send(408, "application/json", "{\"error\":\"Body timed out\"}");
+            return false;
+        case BODY_OUT_OF_ORDER:
+            request->send(400, "application/json", "{\"error\":\"Body chunks out of order\"}");
+            return false;
+        default:
+            return false;
     }
     
-    Serial.printf("[MQTT] Discovery complete for %d relays\n", activeRelayCount);
+    // Parsed in place - strings in doc point into the body, which stays valid until the request ends
+    if (deserializeJson(doc, body, length)) {
+        request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+        return false;
+    }
+    return true;
 }
 
 void setupWebServer() {
+    // Load shedding first - it decides before any route sees the request
+    server.addHandler(new AdmissionHandler());
+    
     // API routes MUST be defined BEFORE static file serving
     
+    // API: Switch counts, on-time and duty cycle per active relay
+    // Registered before /api/relays, which would also match its sub-paths
+    server.on("/api/relays/stats", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        relayStats.writeJson(*response, settings.activeRelayCount, millis());
+        request->send(response);
+    });
+    
+    // API: Relay transitions, oldest first - streamed, the ring can hold thousands
+    // since / until = history clock ms, last = seconds before now, relay = id
+    server.on("/api/relays/history", HTTP_GET, [](AsyncWebServerRequest *request) {
+        uint64_t now = relayHistory.clock(millis());
+        uint64_t since = 0;
+        uint64_t until = now;
+        int relay = -1;
+        if (request->hasParam("since")) {
+            since = strtoull(request->getParam("since")->value().c_str(), nullptr, 10);
+        }
+        if (request->hasParam("until")) {
+            until = strtoull(request->getParam("until")->value().c_str(), nullptr, 10);
+        }
+        if (request->hasParam("last")) {
+            uint64_t last = strtoull(request->getParam("last")->value().c_str(), nullptr, 10) * 1000;
+            since = last < now ? now - last : 0;
+        }
+        if (request->hasParam("relay")) {
+            relay = request->getParam("relay")->value().toInt() - 1;
+            if (relay < 0 || relay >= NUM_RELAYS) {
+                request->send(400, "application/json", "{\"error\":\"Invalid relay ID\"}");
+                return;
+            }
+        }
+    
+        // Owned by the response filler, freed with the request
+        std::shared_ptr<RelayHistoryQuery> query = std::make_shared<RelayHistoryQuery>(relayHistory, now, since,
+                                                                                       until, relay);
+        request->send(request->beginChunkedResponse("application/json",
+            [query](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+                return query->read(buffer, maxLen);
+            }));
+    });
+    
+    // API: Zero the relay counters (e.g. after replacing the relays)
+    server.on("/api/admin/relays/stats/reset", HTTP_POST, [](AsyncWebServerRequest *request) {
+        if (!request->authenticate("admin", ADMIN_PASSWORD)) {
+            return request->requestAuthentication();
+        }
+        relayStats.reset(millis());
+        storage.saveRelayStats();
+        Serial.println("[Admin] Relay counters reset");
+        request->send(200, "application/json", "{\"success\":true}");
+    });
+    
     // API: Get relay states
     server.on("/api/relays", HTTP_GET, [](AsyncWebServerRequest *request) {
-        StaticJsonDocument<2048> doc;
+        // Sized for the board (up to 128 relays) - on the heap, not the AsyncTCP stack
+        DynamicJsonDocument doc(JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(NUM_RELAYS) + NUM_RELAYS * JSON_OBJECT_SIZE(5));
+        doc["active_relays"] = settings.activeRelayCount;
         JsonArray relays = doc["relays"].to<JsonArray>();
-        
+    
         for (int i = 0; i < NUM_RELAYS; i++) {
             JsonObject relay = relays.createNestedObject();
             relay["id"] = i + 1;
             relay["name"] = RELAY_NAMES[i];
             relay["state"] = relayControl.getState(i);
-            relay["pin"] = RELAY_PINS[i];
+            relay["active"] = i < settings.activeRelayCount;
+            if (RelayControl::pin(i) >= 0) {
+                relay["pin"] = RelayControl::pin(i);
+            }
         }
-        
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
@@ -634,27 +945,31 @@ void setupWebServer() {
     // API: Control relay
     server.on("/api/relay", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
         [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            uint32_t received = micros();
             StaticJsonDocument<256> doc;
-            DeserializationError error = deserializeJson(doc, (char*)data);
-            
-            if (error) {
-                request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
                 return;
             }
-            
+    
             int relayId = doc["relay"];
             bool state = doc["state"];
-            
-            if (relayId >= 1 && relayId <= NUM_RELAYS) {
-                relayControl.setState(relayId - 1, state);
-                publishState(relayId - 1);
-                saveRelayStates();  // Save state to persistent storage
-                
+    
+            // Relays above the active count are hidden and have no discovery - MQTT and UDP refuse them too
+            if (relayId >= 1 && relayId <= settings.activeRelayCount) {
+                CommandTrace* trace = commandTrace.begin(TRACE_HTTP, relayId - 1, state, received, doc["cid"].as<const char*>());
+                CommandTracer::mark(trace, TRACE_DISPATCHED);
+                relayControl.setState(relayId - 1, state, RELAY_SOURCE_HTTP);
+                CommandTracer::mark(trace, TRACE_GPIO);
+                mqttBridge.publishState(relayId - 1);
+                CommandTracer::finish(trace);
+                queueTrace(trace);
+                storage.saveRelayStates(relayControl);  // Save state to persistent storage
+    
                 StaticJsonDocument<256> response;
                 response["success"] = true;
                 response["relay"] = relayId;
                 response["state"] = state;
-                
+    
                 String output;
                 serializeJson(response, output);
                 request->send(200, "application/json", output);
@@ -671,7 +986,7 @@ void setupWebServer() {
         doc["ip"] = WiFi.localIP().toString();
         doc["rssi"] = WiFi.RSSI();
         doc["hostname"] = String(MDNS_HOSTNAME) + ".local";
-        
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
@@ -679,11 +994,23 @@ void setupWebServer() {
     
     // API: Get MQTT info
     server.on("/api/mqtt", HTTP_GET, [](AsyncWebServerRequest *request) {
-        StaticJsonDocument<256> doc;
-        doc["server"] = mqtt_server;
-        doc["port"] = atoi(mqtt_port);
+        StaticJsonDocument<384> doc;
+        doc["server"] = settings.mqtt_server;
+        doc["port"] = atoi(settings.mqtt_port);
         doc["connected"] = mqttClient.connected();
-        
+        doc["tls"] = (bool)MQTT_TLS;
+#if MQTT_TLS
+        JsonObject tls = doc.createNestedObject("handshakes");
+        tls["full"] = mqttTls.handshakes[TLS_HANDSHAKE_FULL];
+        tls["resumed"] = mqttTls.handshakes[TLS_HANDSHAKE_RESUMED];
+        tls["resume_hit_rate"] = mqttTls.hitRate();
+        tls["last_ms"] = mqttTls.lastHandshakeMillis;
+        tls["last_resumed"] = mqttTls.lastResumed;
+#endif
+    
+        static const char* const SWITCH_STATUS[] = {"idle", "applying", "applied", "rolled_back"};
+        doc["switchover"] = SWITCH_STATUS[mqttSwitchStatus];
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
@@ -692,19 +1019,19 @@ void setupWebServer() {
     // API: Get WiFi status
     server.on("/api/wifi/status", HTTP_GET, [](AsyncWebServerRequest *request) {
         StaticJsonDocument<512> doc;
-        
+    
         doc["connected"] = (WiFi.status() == WL_CONNECTED);
-        doc["ap_mode"] = apModeActive;
+        doc["ap_mode"] = reconnectPolicy.isApMode();
         doc["ssid"] = WiFi.SSID();
         doc["ip"] = WiFi.localIP().toString();
         doc["rssi"] = WiFi.RSSI();
-        
-        if (apModeActive) {
+    
+        if (reconnectPolicy.isApMode()) {
             doc["ap_ssid"] = AP_NAME;
             doc["ap_ip"] = WiFi.softAPIP().toString();
             doc["ap_clients"] = WiFi.softAPgetStationNum();
         }
-        
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
@@ -714,26 +1041,23 @@ void setupWebServer() {
     server.on("/api/wifi/reconfigure", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
         [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
             StaticJsonDocument<512> doc;
-            DeserializationError error = deserializeJson(doc, (char*)data);
-            
-            if (error) {
-                request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
                 return;
             }
-            
+    
             String new_ssid = doc["ssid"].as<String>();
             String new_password = doc["password"].as<String>();
-            
+    
             if (new_ssid.length() == 0) {
                 request->send(400, "application/json", "{\"error\":\"SSID required\"}");
                 return;
             }
-            
+    
             request->send(200, "application/json", "{\"success\":true,\"message\":\"Connecting to new WiFi...\"}");
-            
+    
             // Save new credentials and reconnect
             WiFi.begin(new_ssid.c_str(), new_password.c_str());
-            
+    
             Serial.printf("[WiFi] Attempting to connect to: %s\n", new_ssid.c_str());
         }
     );
@@ -742,8 +1066,9 @@ void setupWebServer() {
     server.on("/api/reset", HTTP_POST, [](AsyncWebServerRequest *request) {
         request->send(200, "application/json", "{\"success\":true,\"message\":\"Resetting WiFi settings...\"}");
         delay(1000);
-        WiFiManager wifiManager;
         wifiManager.resetSettings();
+        storage.saveRelayStats();
+        saveRelayHistory();
         ESP.restart();
     });
     
@@ -757,6 +1082,8 @@ void setupWebServer() {
         request->send(200, "application/json", "{\"success\":true,\"message\":\"Restarting ESP32...\"}");
         Serial.println("[System] Restart requested via web interface");
         delay(1000);
+        storage.saveRelayStats();
+        saveRelayHistory();
         ESP.restart();
     });
     
@@ -773,17 +1100,18 @@ void setupWebServer() {
         if (!request->authenticate("admin", ADMIN_PASSWORD)) {
             return request->requestAuthentication();
         }
-        
+    
         StaticJsonDocument<512> doc;
-        doc["active_relays"] = activeRelayCount;
+        doc["active_relays"] = settings.activeRelayCount;
         doc["total_relays"] = NUM_RELAYS;
-        doc["mqtt_server"] = mqtt_server;
-        doc["mqtt_port"] = atoi(mqtt_port);
-        doc["mqtt_user"] = mqtt_user;
-        doc["mqtt_hostname"] = mqtt_hostname;
+        doc["mqtt_server"] = settings.mqtt_server;
+        doc["mqtt_port"] = atoi(settings.mqtt_port);
+        doc["mqtt_user"] = settings.mqtt_user;
+        doc["mqtt_hostname"] = settings.mqtt_hostname;
+        doc["discovery_mode"] = settings.deviceDiscovery ? "device" : "entity";
         // Don't send password for security
         doc["mqtt_password"] = "••••••••";
-        
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
@@ -792,107 +1120,337 @@ void setupWebServer() {
     // API: Save admin configuration
     server.on("/api/admin/config", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
         [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-            if (!request->authenticate("admin", ADMIN_PASSWORD)) {
+            // Checked on the first chunk - a rejected body gets no slot, so its later chunks are ignored
+            if (index == 0 && !request->authenticate("admin", ADMIN_PASSWORD)) {
                 return request->requestAuthentication();
             }
-            
+    
             StaticJsonDocument<256> doc;
-            DeserializationError error = deserializeJson(doc, (char*)data);
-            
-            if (error) {
-                request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
                 return;
             }
-            
+    
             int newRelayCount = doc["active_relays"];
-            
-            if (newRelayCount != 8 && newRelayCount != 12 && newRelayCount != 16) {
-                request->send(400, "application/json", "{\"error\":\"Invalid relay count. Must be 8, 12, or 16\"}");
+    
+            if (newRelayCount < 1 || newRelayCount > NUM_RELAYS) {
+                request->send(400, "application/json", "{\"error\":\"Invalid relay count. Must be between 1 and the number of relays on the board\"}");
                 return;
             }
-            
-            // Save to preferences
-            preferences.begin("relay-states", false);
-            preferences.putInt("active_count", newRelayCount);
-            preferences.end();
-            
-            activeRelayCount = newRelayCount;
-            
-            Serial.printf("[Admin] Relay count changed to: %d\n", activeRelayCount);
-            
-            request->send(200, "application/json", "{\"success\":true}");
-            
-            // Restart ESP32 to apply changes and republish discovery
-            delay(1000);
-            ESP.restart();
+    
+            // Saved and announced to Home Assistant by loop() - no restart needed
+            pendingRelayCount = newRelayCount;
+    
+            Serial.printf("[Admin] Relay count changed to: %d\n", newRelayCount);
+    
+            char response[48];
+            snprintf(response, sizeof(response), "{\"success\":true,\"active_relays\":%d}", newRelayCount);
+            request->send(200, "application/json", response);
         }
     );
     
     // API: Save MQTT configuration
     server.on("/api/admin/mqtt", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
         [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
-            if (!request->authenticate("admin", ADMIN_PASSWORD)) {
+            if (index == 0 && !request->authenticate("admin", ADMIN_PASSWORD)) {
                 return request->requestAuthentication();
             }
-            
+    
             StaticJsonDocument<512> doc;
-            DeserializationError error = deserializeJson(doc, (char*)data);
-            
-            if (error) {
-                request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
                 return;
             }
-            
+    
             String new_server = doc["mqtt_server"].as<String>();
             int new_port = doc["mqtt_port"];
             String new_user = doc["mqtt_user"].as<String>();
             String new_password = doc["mqtt_password"].as<String>();
             String new_hostname = doc["mqtt_hostname"].as<String>();
-            
+    
             // Validate inputs
             if (new_server.length() == 0 || new_port < 1 || new_port > 65535) {
                 request->send(400, "application/json", "{\"error\":\"Invalid MQTT settings\"}");
                 return;
             }
-            
+    
             // Validate hostname - use default if empty or too long
             if (new_hostname.length() == 0 || new_hostname.length() > 39) {
                 new_hostname = "esp32-relay";
             }
-            
-            // Save to preferences
-            preferences.begin("relay-states", false);
-            preferences.putString("mqtt_server", new_server);
-            preferences.putString("mqtt_port", String(new_port));
-            preferences.putString("mqtt_user", new_user);
-            preferences.putString("mqtt_hostname", new_hostname);
-            
-            // Only save password if it's not the placeholder
-            if (new_password != "••••••••") {
-                preferences.putString("mqtt_pass", new_password);
+    
+            if (mqttSwitchStatus == MQTT_SWITCH_PENDING) {
+                request->send(409, "application/json", "{\"error\":\"MQTT switchover already in progress\"}");
+                return;
             }
-            
-            preferences.end();
-            
-            // Update current variables
-            new_server.toCharArray(mqtt_server, 40);
-            String(new_port).toCharArray(mqtt_port, 6);
-            new_user.toCharArray(mqtt_user, 40);
-            new_hostname.toCharArray(mqtt_hostname, 40);
+    
+            // Candidate settings - only committed by loop() once the new broker accepts them
+            pendingMqttSettings = settings;
+            new_server.toCharArray(pendingMqttSettings.mqtt_server, 40);
+            String(new_port).toCharArray(pendingMqttSettings.mqtt_port, 6);
+            new_user.toCharArray(pendingMqttSettings.mqtt_user, 40);
+            new_hostname.toCharArray(pendingMqttSettings.mqtt_hostname, 40);
+    
+            // Keep the current password if the placeholder came back
             if (new_password != "••••••••") {
-                new_password.toCharArray(mqtt_password, 40);
+                new_password.toCharArray(pendingMqttSettings.mqtt_password, 40);
+            }
+            mqttSwitchStatus = MQTT_SWITCH_PENDING;
+    
+            Serial.println("[Admin] MQTT settings submitted");
+            Serial.printf("  Server: %s:%d\n", pendingMqttSettings.mqtt_server, new_port);
+            Serial.printf("  User: %s\n", pendingMqttSettings.mqtt_user);
+            Serial.printf("  Hostname: %s\n", pendingMqttSettings.mqtt_hostname);
+    
+            // Outcome is reported as "switchover" on GET /api/mqtt
+            request->send(202, "application/json", "{\"success\":true,\"status\":\"applying\"}");
+        }
+    );
+    
+    // API: Switch Home Assistant discovery mode (entity / device)
+    server.on("/api/admin/discovery", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
+        [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            if (index == 0 && !request->authenticate("admin", ADMIN_PASSWORD)) {
+                return request->requestAuthentication();
+            }
+    
+            StaticJsonDocument<128> doc;
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
+                return;
+            }
+    
+            String mode = doc["mode"].as<String>();
+            if (mode != "entity" && mode != "device") {
+                request->send(400, "application/json", "{\"error\":\"Mode must be entity or device\"}");
+                return;
+            }
+    
+            settings.deviceDiscovery = (mode == "device");
+            // Optional - keeps the current setting when left out
+            settings.aggregateState = doc["aggregate_state"] | settings.aggregateState;
+            storage.saveDiscoveryMode(settings.deviceDiscovery, settings.aggregateState);
+    
+            // Republish (and clean up the old mode) from loop() on the MQTT task
+            discoveryPending = true;
+    
+            Serial.printf("[Admin] Discovery mode changed to: %s, %s state topic\n", mode.c_str(),
+                          settings.aggregateState ? "aggregate" : "per-relay");
+            request->send(200, "application/json", "{\"success\":true}");
+        }
+    );
+    
+    // API: Group memberships and scenes
+    server.on("/api/admin/groups", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!request->authenticate("admin", ADMIN_PASSWORD)) {
+            return request->requestAuthentication();
+        }
+    
+        const GroupConfig& config = mqttBridge.getGroupConfig();
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->printf("{\"prefix\":\"%s\",\"ack_window_ms\":%u,\"groups\":[", MQTT_GROUP_PREFIX,
+                         (unsigned)MQTT_GROUP_ACK_WINDOW_MS);
+        bool first = true;
+        for (int i = 0; i < MQTT_GROUP_MAX; i++) {
+            if (config.groups[i][0]) {
+                response->printf("%s\"%s\"", first ? "" : ",", config.groups[i]);
+                first = false;
+            }
+        }
+        response->print("],\"scenes\":{");
+        first = true;
+        for (const RelayScene& scene : config.scenes) {
+            if (scene.name[0]) {
+                char pattern[NUM_RELAYS + 1];
+                formatRelayPattern(scene, NUM_RELAYS, pattern, sizeof(pattern));
+                response->printf("%s\"%s\":\"%s\"", first ? "" : ",", scene.name, pattern);
+                first = false;
+            }
+        }
+        response->print("}}");
+        request->send(response);
+    });
+    
+    // API: Set group memberships and / or scenes
+    // {"groups":["site-a","floor-2"],"scenes":{"night":"0000xx11"}} - each key given replaces that list
+    server.on("/api/admin/groups", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
+        [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            if (index == 0 && !request->authenticate("admin", ADMIN_PASSWORD)) {
+                return request->requestAuthentication();
+            }
+    
+            StaticJsonDocument<512> doc;
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
+                return;
+            }
+    
+            GroupConfig config = mqttBridge.getGroupConfig();
+            if (doc.containsKey("groups")) {
+                JsonArray groups = doc["groups"];
+                if (groups.isNull()) {
+                    request->send(400, "application/json", "{\"error\":\"groups must be a list of names\"}");
+                    return;
+                }
+                if (groups.size() > MQTT_GROUP_MAX) {
+                    request->send(400, "application/json", "{\"error\":\"Too many groups\"}");
+                    return;
+                }
+                memset(config.groups, 0, sizeof(config.groups));
+                int count = 0;
+                for (const char* name : groups) {
+                    if (name == nullptr || !isValidGroupName(name, MQTT_GROUP_NAME_LEN)) {
+                        request->send(400, "application/json", "{\"error\":\"Invalid group name\"}");
+                        return;
+                    }
+                    strcpy(config.groups[count++], name);
+                }
             }
-            
-            Serial.println("[Admin] MQTT settings updated");
-            Serial.printf("  Server: %s:%d\n", mqtt_server, new_port);
-            Serial.printf("  User: %s\n", mqtt_user);
-            Serial.printf("  Hostname: %s\n", mqtt_hostname);
-            
+            if (doc.containsKey("scenes")) {
+                JsonObject scenes = doc["scenes"];
+                if (scenes.isNull()) {
+                    request->send(400, "application/json", "{\"error\":\"scenes must map names to relay patterns\"}");
+                    return;
+                }
+                if (scenes.size() > MQTT_SCENE_MAX) {
+                    request->send(400, "application/json", "{\"error\":\"Too many scenes\"}");
+                    return;
+                }
+                memset((void*)config.scenes, 0, sizeof(config.scenes));
+                int count = 0;
+                for (JsonPair scene : scenes) {
+                    RelayScene& entry = config.scenes[count++];
+                    const char* pattern = scene.value();
+                    if (!isValidGroupName(scene.key().c_str(), MQTT_SCENE_NAME_LEN) || pattern == nullptr ||
+                        !parseRelayPattern(pattern, NUM_RELAYS, entry.on, entry.off)) {
+                        request->send(400, "application/json", "{\"error\":\"Invalid scene name or relay pattern\"}");
+                        return;
+                    }
+                    strcpy(entry.name, scene.key().c_str());
+                }
+            }
+    
+            // Saved and resubscribed by loop() on the MQTT task
+            pendingGroupConfig = config;
+            groupConfigPending = true;
+    
+            Serial.printf("[Admin] Groups updated: %d groups, %d scenes\n", config.groupCount(), config.sceneCount());
             request->send(200, "application/json", "{\"success\":true}");
-            
-            // Restart ESP32 to apply MQTT changes
-            delay(1000);
-            ESP.restart();
+        }
+    );
+    
+#if UDP_CONTROL
+    // API: UDP control protocol status and counters - the key is never shown
+    server.on("/api/admin/udp", HTTP_GET, [](AsyncWebServerRequest *request) {
+        if (!request->authenticate("admin", ADMIN_PASSWORD)) {
+            return request->requestAuthentication();
+        }
+    
+        UdpCounters counters = udpControl.getCounters();
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        response->printf("{\"enabled\":%s,\"port\":%u,\"clients\":%d,\"frames\":{",
+                         udpControl.isEnabled() ? "true" : "false", (unsigned)UDP_CONTROL_PORT, udpControl.clientCount());
+        for (int r = 0; r < UDP_RESULT_COUNT; r++) {
+            response->printf("%s\"%s\":%u", r ? "," : "", UdpControl::resultName(r), (unsigned)counters.frames[r]);
+        }
+        response->print("},\"commands\":{");
+        for (int op = 0; op < UDP_OP_COUNT; op++) {
+            response->printf("%s\"%s\":%u", op ? "," : "", UdpControl::opName(op), (unsigned)counters.commands[op]);
+        }
+        response->print("}}");
+        request->send(response);
+    });
+    
+    // API: Set the shared key {"key":"<64 hex digits>"} or turn the protocol off {"enabled":false}
+    server.on("/api/admin/udp", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
+        [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            if (index == 0 && !request->authenticate("admin", ADMIN_PASSWORD)) {
+                return request->requestAuthentication();
+            }
+    
+            StaticJsonDocument<256> doc;
+            if (!receiveJsonBody(request, data, len, index, total, doc)) {
+                return;
+            }
+    
+            if (doc["enabled"].is<bool>() && !doc["enabled"].as<bool>()) {
+                udpKeyPending = -1;
+            } else {
+                const char* key = doc["key"];
+                if (key == nullptr || !udpParseKey(key, pendingUdpKey)) {
+                    request->send(400, "application/json", "{\"error\":\"key must be 64 hex digits\"}");
+                    return;
+                }
+                udpKeyPending = 1;
+            }
+    
+            // Saved and applied by loop()
+            request->send(200, "application/json", "{\"success\":true}");
+        }
+    );
+#endif
+    
+    // API: Update status (running partition, trial, upload progress)
+    server.on("/api/ota", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        otaUpdate.writeJson(*response);
+        request->send(response);
+    });
+    
+    // API: Firmware / filesystem update - the raw image is the body, streamed to flash
+    // POST /api/ota?target=firmware|filesystem&crc32=<hex>
+    server.on("/api/ota", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL,
+        [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total) {
+            char response[128];
+    
+            if (index == 0) {
+                if (!request->authenticate("admin", ADMIN_PASSWORD)) {
+                    return request->requestAuthentication();
+                }
+                if (!request->hasParam("crc32")) {
+                    request->send(400, "application/json", "{\"error\":\"crc32 of the image required\"}");
+                    return;
+                }
+                String targetName = request->hasParam("target") ? request->getParam("target")->value() : "firmware";
+                if (targetName != "firmware" && targetName != "filesystem") {
+                    request->send(400, "application/json", "{\"error\":\"Target must be firmware or filesystem\"}");
+                    return;
+                }
+                if (otaUpdate.isRunning()) {
+                    request->send(409, "application/json", "{\"error\":\"Another update is in progress\"}");
+                    return;
+                }
+    
+                OtaTarget target = targetName == "filesystem" ? OTA_FILESYSTEM : OTA_FIRMWARE;
+                uint32_t crc = strtoul(request->getParam("crc32")->value().c_str(), nullptr, 16);
+                if (target == OTA_FILESYSTEM) {
+                    // Nothing may read the partition while it is rewritten; remounted from loop()
+                    LittleFS.end();
+                    filesystemUnmounted = true;
+                }
+                if (!otaUpdate.begin(request, target, total, crc)) {
+                    snprintf(response, sizeof(response), "{\"error\":\"%s\"}", otaUpdate.getError());
+                    request->send(400, "application/json", response);
+                    return;
+                }
+                // A disconnect mid-upload aborts it (finishRequest)
+            }
+    
+            // Chunks of a rejected upload are dropped
+            if (!otaUpdate.isOwner(request)) {
+                return;
+            }
+            if (!otaUpdate.write(request, data, len, index) ||
+                (index + len == total && !otaUpdate.end(request))) {
+                snprintf(response, sizeof(response), "{\"error\":\"%s\"}", otaUpdate.getError());
+                request->send(400, "application/json", response);
+                return;
+            }
+    
+            if (index + len == total) {
+                bool firmware = otaUpdate.getTarget() == OTA_FIRMWARE;
+                snprintf(response, sizeof(response), "{\"success\":true,\"restarting\":%s}", firmware ? "true" : "false");
+                request->send(200, "application/json", response);
+                if (firmware) {
+                    otaRestartAt = millis() | 1;  // Never 0, which means no restart
+                }
+            }
         }
     );
     
@@ -900,22 +1458,23 @@ void setupWebServer() {
     server.on("/api/rf/codes", HTTP_GET, [](AsyncWebServerRequest *request) {
         StaticJsonDocument<2048> doc;
         doc["learning_mode"] = rfLearningMode;
-        doc["count"] = rfCodeCount;
+        doc["count"] = rfCodes.count();
         doc["max_codes"] = MAX_RF_CODES;
-        
+    
         JsonArray codes = doc["codes"].to<JsonArray>();
         for (int i = 0; i < MAX_RF_CODES; i++) {
-            if (rfCodes[i].active) {
+            const RFCode& rfCode = rfCodes.get(i);
+            if (rfCode.active) {
                 JsonObject code = codes.createNestedObject();
                 code["slot"] = i;
-                code["name"] = rfCodes[i].name;
-                code["code"] = String(rfCodes[i].code);
-                code["bit_length"] = rfCodes[i].bitLength;
-                code["protocol"] = rfCodes[i].protocol;
-                code["last_trigger"] = rfCodes[i].lastTrigger;
+                code["name"] = rfCode.name;
+                code["code"] = String(rfCode.code);
+                code["bit_length"] = rfCode.bitLength;
+                code["protocol"] = rfCode.protocol;
+                code["last_trigger"] = rfCode.lastTrigger;
             }
         }
-        
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
@@ -925,37 +1484,46 @@ void setupWebServer() {
     server.on("/api/rf/status", HTTP_GET, [](AsyncWebServerRequest *request) {
         StaticJsonDocument<256> doc;
         doc["learning_mode"] = rfLearningMode;
-        doc["code_count"] = rfCodeCount;
+        doc["code_count"] = rfCodes.count();
         doc["max_codes"] = MAX_RF_CODES;
-        
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
     });
     
+#if RF_DECODER_RMT
+    // API: Most recent raw RF capture, replayable with native/rfreplay
+    server.on("/api/rf/trace", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
+        rfReceiver.writeTrace(*response);
+        request->send(response);
+    });
+#endif
+    
     // API: Start RF learning mode with name
     server.on("/api/rf/learn", HTTP_POST, [](AsyncWebServerRequest *request) {
-        if (rfCodeCount >= MAX_RF_CODES) {
+        if (rfCodes.count() >= MAX_RF_CODES) {
             request->send(400, "application/json", "{\"error\":\"Maximum codes reached\"}");
             return;
         }
-        
+    
         // Get name parameter (required)
         if (!request->hasParam("name", true)) {
             request->send(400, "application/json", "{\"error\":\"Name parameter required\"}");
             return;
         }
-        
+    
         String name = request->getParam("name", true)->value();
         if (name.length() == 0 || name.length() >= 32) {
             request->send(400, "application/json", "{\"error\":\"Name must be 1-31 characters\"}");
             return;
         }
-        
+    
         // Store name for when code is learned
         strncpy(pendingRFName, name.c_str(), sizeof(pendingRFName) - 1);
         pendingRFName[sizeof(pendingRFName) - 1] = '\0';
-        
+    
         rfLearningMode = true;
         Serial.printf("[RF] Learning mode activated for '%s' - press transmitter button\n", pendingRFName);
         request->send(200, "application/json", "{\"success\":true,\"message\":\"Learning mode activated\"}");
@@ -976,30 +1544,27 @@ void setupWebServer() {
             request->send(400, "application/json", "{\"error\":\"Slot parameter required\"}");
             return;
         }
-        
+    
         int slot = request->getParam("slot", true)->value().toInt();
         if (slot < 0 || slot >= MAX_RF_CODES) {
             request->send(400, "application/json", "{\"error\":\"Invalid slot\"}");
             return;
         }
-        
-        if (!rfCodes[slot].active) {
+    
+        if (!rfCodes.remove(slot)) {
             request->send(404, "application/json", "{\"error\":\"Slot is empty\"}");
             return;
         }
-        
-        deleteRFCode(slot);
+    
+        storage.saveRFCodes(rfCodes);
+        Serial.printf("[RF] Deleted code from slot %d\n", slot);
         request->send(200, "application/json", "{\"success\":true,\"message\":\"RF code deleted\"}");
     });
     
     // API: Clear all RF codes
     server.on("/api/rf/clear", HTTP_POST, [](AsyncWebServerRequest *request) {
-        for (int i = 0; i < MAX_RF_CODES; i++) {
-            rfCodes[i].active = false;
-            rfCodes[i].code = 0;
-        }
-        rfCodeCount = 0;
-        saveRFCodes();
+        rfCodes.clear();
+        storage.saveRFCodes(rfCodes);
         Serial.println("[RF] All codes cleared");
         request->send(200, "application/json", "{\"success\":true,\"message\":\"All RF codes cleared\"}");
     });
@@ -1008,37 +1573,22 @@ void setupWebServer() {
     server.on("/api/mqtt/rediscover", HTTP_POST, [](AsyncWebServerRequest *request) {
         if (mqttClient.connected()) {
             Serial.println("[API] Manual discovery republish requested...");
-            publishDiscovery();
-            
+            mqttBridge.publishDiscovery();
+    
             // Republish all states
-            for (int i = 0; i < activeRelayCount; i++) {
-                publishState(i);
-                yield();
-            }
-            
+            mqttBridge.publishAllStates();
+    
             request->send(200, "application/json", "{\"success\":true,\"message\":\"Discovery republished\"}");
         } else {
             request->send(503, "application/json", "{\"error\":\"MQTT not connected\"}");
         }
     });
     
-    // API: Restart mDNS service (troubleshooting)
+    // API: Restart mDNS service (troubleshooting) - done from loop(), see /api/mdns/status
     server.on("/api/mdns/restart", HTTP_POST, [](AsyncWebServerRequest *request) {
-        Serial.println("[API] Restarting mDNS service...");
-        MDNS.end();
-        delay(100);
-        
-        if (MDNS.begin(MDNS_HOSTNAME)) {
-            MDNS.addService("http", "tcp", 80);
-            delay(100);
-            mdnsInitialized = true;  // Mark as initialized
-            Serial.printf("[mDNS] Service restarted: http://%s.local\n", MDNS_HOSTNAME);
-            request->send(200, "application/json", "{\"success\":true,\"message\":\"mDNS restarted\"}");
-        } else {
-            mdnsInitialized = false;
-            Serial.println("[mDNS] ERROR: Failed to restart mDNS");
-            request->send(500, "application/json", "{\"error\":\"Failed to restart mDNS\"}");
-        }
+        Serial.println("[API] mDNS restart requested");
+        wifiRecovery.requestMdnsRestart();
+        request->send(202, "application/json", "{\"success\":true,\"message\":\"mDNS restart scheduled\"}");
     });
     
     // API: Get mDNS status
@@ -1048,12 +1598,60 @@ void setupWebServer() {
         doc["url"] = "http://" + String(MDNS_HOSTNAME) + ".local";
         doc["ip"] = WiFi.localIP().toString();
         doc["wifi_connected"] = WiFi.status() == WL_CONNECTED;
-        
+        doc["running"] = wifiRecovery.isMdnsRunning();
+        doc["restart_pending"] = wifiRecovery.isMdnsScheduled();
+    
         String output;
         serializeJson(doc, output);
         request->send(200, "application/json", output);
     });
     
+    // Prometheus metrics: loop latency histograms, stalls and event counters
+    server.on("/metrics", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("text/plain; version=0.0.4");
+        metrics.writePrometheus(*response);
+        relayStats.writePrometheus(*response, settings.activeRelayCount, millis());
+        wifiRecovery.writePrometheus(*response, millis());
+        httpAdmission.writePrometheus(*response);
+#if UDP_CONTROL
+        udpControl.writePrometheus(*response);
+#endif
+#if MQTT_TLS
+        mqttTls.writePrometheus(*response);
+#endif
+        request->send(response);
+    });
+    
+    // Debug: heap, fragmentation, task stacks and per-subsystem allocations
+    server.on("/api/debug/memory", HTTP_GET, [](AsyncWebServerRequest *request) {
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        memDebug.writeJson(*response);
+        request->send(response);
+    });
+    
+    // Debug: most recent log lines (?lines=N, default 50)
+    server.on("/api/debug/log", HTTP_GET, [](AsyncWebServerRequest *request) {
+        size_t lines = 50;
+        if (request->hasParam("lines")) {
+            lines = request->getParam("lines")->value().toInt();
+        }
+        AsyncResponseStream *response = request->beginResponseStream("text/plain");
+        response->printf("# dropped: %u\n", (unsigned)logBuffer.droppedCount());
+        logBuffer.writeRecent(*response, lines);
+        request->send(response);
+    });
+    
+    // Debug: command latency percentiles per source and stage, plus the latest traces (?recent=N, default 10)
+    server.on("/api/debug/trace", HTTP_GET, [](AsyncWebServerRequest *request) {
+        int recent = 10;
+        if (request->hasParam("recent")) {
+            recent = request->getParam("recent")->value().toInt();
+        }
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        commandTrace.writeJson(*response, recent);
+        request->send(response);
+    });
+    
     // Handle favicon.ico requests to prevent error messages
     server.on("/favicon.ico", HTTP_GET, [](AsyncWebServerRequest *request) {
         request->send(204);  // 204 No Content - silences browser requests
@@ -1071,65 +1669,28 @@ void saveConfigCallback() {
     shouldSaveConfig = true;
 }
 
-void saveRelayStates() {
-    preferences.begin("relay-states", false);
-    
-    for (int i = 0; i < NUM_RELAYS; i++) {
-        String key = "relay" + String(i);
-        bool state = relayControl.getState(i);
-        preferences.putBool(key.c_str(), state);
-    }
-    
-    preferences.end();
-    Serial.println("[Storage] Relay states saved");
-}
-
-void restoreRelayStates() {
-    preferences.begin("relay-states", true);  // Read-only mode
-    
-    Serial.println("[Storage] Restoring relay states...");
-    
-    // Restore active relay count
-    activeRelayCount = preferences.getInt("active_count", 16);
-    Serial.printf("[Storage] Active relay count: %d\n", activeRelayCount);
-    
-    // Restore MQTT settings if they exist (override hardcoded defaults)
-    String saved_server = preferences.getString("mqtt_server", "");
-    if (saved_server.length() > 0) {
-        saved_server.toCharArray(mqtt_server, 40);
-        String saved_port = preferences.getString("mqtt_port", "1883");
-        saved_port.toCharArray(mqtt_port, 6);
-        String saved_user = preferences.getString("mqtt_user", "");
-        saved_user.toCharArray(mqtt_user, 40);
-        String saved_pass = preferences.getString("mqtt_pass", "");
-        saved_pass.toCharArray(mqtt_password, 40);
-        String saved_hostname = preferences.getString("mqtt_hostname", "esp32-relay");
-        saved_hostname.toCharArray(mqtt_hostname, 40);
-        Serial.println("[Storage] MQTT settings loaded from preferences");
-        Serial.printf("[Storage] MQTT hostname: %s\n", mqtt_hostname);
-    } else {
-        Serial.println("[Storage] Using hardcoded MQTT settings");
-    }
-    
-    for (int i = 0; i < NUM_RELAYS; i++) {
-        String key = "relay" + String(i);
-        bool state = preferences.getBool(key.c_str(), false);  // Default to OFF if not found
-        relayControl.setState(i, state);
-        Serial.printf("  Relay %d: %s\n", i + 1, state ? "ON" : "OFF");
-    }
-    
-    preferences.end();
-    Serial.println("[Storage] Relay states restored");
-}
-
 // RF Receiver Functions
 
 void setupRFReceiver() {
+#if RF_DECODER_RMT
+#ifdef RF_USER_PROFILES
+    static const PulseProfile userProfiles[] = RF_USER_PROFILES;
+    for (const PulseProfile& profile : userProfiles) {
+        if (!rfReceiver.getDecoder().addProfile(profile)) {
+            Serial.printf("[RF] Profile %u not added (limit %d)\n", (unsigned)profile.protocol, RF_MAX_PROFILES);
+        }
+    }
+#endif
+    rfReceiver.begin(RF_RECEIVER_PIN);
+    Serial.printf("[RF] RMT receiver initialized on GPIO %d (%d timing profiles)\n",
+                  RF_RECEIVER_PIN, rfReceiver.getDecoder().getProfileCount());
+#else
     rfReceiver.enableReceive(digitalPinToInterrupt(RF_RECEIVER_PIN));
     Serial.printf("[RF] Receiver initialized on GPIO %d\n", RF_RECEIVER_PIN);
+#endif
     
-    if (rfCodeCount > 0) {
-        Serial.printf("[RF] %d code(s) loaded\n", rfCodeCount);
+    if (rfCodes.count() > 0) {
+        Serial.printf("[RF] %d code(s) loaded\n", rfCodes.count());
     } else {
         Serial.println("[RF] No codes learned yet");
     }
@@ -1137,62 +1698,59 @@ void setupRFReceiver() {
 
 void checkRFSignal() {
     if (rfReceiver.available()) {
+        uint32_t received = micros();  // RMT capture just decoded by available(), after the RF_RMT_IDLE_US gap
         unsigned long receivedCode = rfReceiver.getReceivedValue();
         unsigned int bitLength = rfReceiver.getReceivedBitlength();
         unsigned int protocol = rfReceiver.getReceivedProtocol();
-        
+    
         if (receivedCode != 0) {
+            metrics.rfFrames++;
+    
             // Learning mode - capture the signal and add to array
             if (rfLearningMode) {
-                int newSlot = addRFCode(pendingRFName, receivedCode, bitLength, protocol);
+                int newSlot = rfCodes.add(pendingRFName, receivedCode, bitLength, protocol);
                 rfLearningMode = false;
-                
+    
                 if (newSlot >= 0) {
-                    Serial.printf("[RF] Code learned '%s': %lu (bit: %d, protocol: %d) in slot %d\n", 
-                                 pendingRFName, receivedCode, bitLength, protocol, newSlot);
-                    Serial.println("[RF] Use /api/mqtt/rediscover to update HA entities, or reboot.");
+                    storage.saveRFCodes(rfCodes);
+                    LOGI("[RF] Code learned '%s': %lu in slot %d", pendingRFName, receivedCode, newSlot);
+                    LOGI("[RF] (bit: %u, protocol: %u) Use /api/mqtt/rediscover to update HA entities, or reboot.",
+                         bitLength, protocol);
                 } else {
-                    Serial.println("[RF] ERROR: Failed to add code (array full)");
+                    LOGE("[RF] ERROR: Failed to add code (array full)");
                 }
-                
+    
                 pendingRFName[0] = '\0';  // Clear pending name
             }
             // Normal mode - check if it matches any learned code
             else {
-                for (int i = 0; i < MAX_RF_CODES; i++) {
-                    if (rfCodes[i].active && 
-                        rfCodes[i].code == receivedCode && 
-                        rfCodes[i].bitLength == bitLength && 
-                        rfCodes[i].protocol == protocol) {
-                        
-                        Serial.printf("[RF] Trigger detected '%s': %lu (slot %d)\n", 
-                                     rfCodes[i].name, receivedCode, i);
-                        
-                        // Update last trigger time
-                        rfCodes[i].lastTrigger = millis();
-                        
-                        // Publish state to MQTT
-                        publishRFTriggerState(i);
-                        
-                        break;  // Only trigger first match
-                    }
+                int slot = rfCodes.match(receivedCode, bitLength, protocol);  // Only trigger first match
+                if (slot >= 0) {
+                    metrics.rfMatches++;
+                    CommandTrace* trace = commandTrace.begin(TRACE_RF, slot, true, received);
+                    CommandTracer::mark(trace, TRACE_DISPATCHED);
+                    LOGI("[RF] Trigger detected '%s': %lu (slot %d)",
+                         rfCodes.get(slot).name, receivedCode, slot);
+    
+                    // Update last trigger time
+                    rfCodes.get(slot).lastTrigger = millis();
+    
+                    // Publish state to MQTT
+                    publishRFTriggerState(slot, trace);
                 }
             }
         }
-        
+    
         rfReceiver.resetAvailable();
     }
 }
 
-void publishRFTriggerState(int slot) {
+void publishRFTriggerState(int slot, CommandTrace* trace) {
     if (!mqttClient.connected()) return;
-    if (slot < 0 || slot >= MAX_RF_CODES || !rfCodes[slot].active) return;
-    
-    String topic = String(MQTT_TOPIC_PREFIX) + mqtt_hostname + "/rf_" + String(slot) + "/state";
     
     // Publish ON
-    mqttClient.publish(topic.c_str(), "ON", true);
-    Serial.printf("[MQTT] RF '%s' (slot %d): ON\n", rfCodes[slot].name, slot);
+    mqttBridge.publishRFTrigger(slot, true);
+    CommandTracer::finish(trace);
     
     // Non-blocking delay - call loop during wait to maintain MQTT connection
     unsigned long start = millis();
@@ -1202,97 +1760,5 @@ void publishRFTriggerState(int slot) {
         delay(10);
     }
     
-    mqttClient.publish(topic.c_str(), "OFF", true);
-    Serial.printf("[MQTT] RF '%s' (slot %d): OFF\n", rfCodes[slot].name, slot);
-}
-
-void saveRFCodes() {
-    preferences.begin("relay-states", false);
-    preferences.putBytes("rf_codes", rfCodes, sizeof(rfCodes));
-    preferences.putInt("rf_count", rfCodeCount);
-    preferences.end();
-    
-    Serial.printf("[RF] %d codes saved to preferences\n", rfCodeCount);
-}
-
-void restoreRFCodes() {
-    preferences.begin("relay-states", true);
-    
-    // Initialize array
-    memset(rfCodes, 0, sizeof(rfCodes));
-    rfCodeCount = 0;
-    
-    // Try to restore new multi-code format
-    size_t len = preferences.getBytesLength("rf_codes");
-    if (len == sizeof(rfCodes)) {
-        preferences.getBytes("rf_codes", rfCodes, sizeof(rfCodes));
-        rfCodeCount = preferences.getInt("rf_count", 0);
-        
-        if (rfCodeCount > 0) {
-            Serial.printf("[RF] Restored %d codes from preferences\n", rfCodeCount);
-            for (int i = 0; i < MAX_RF_CODES; i++) {
-                if (rfCodes[i].active) {
-                    Serial.printf("  [%d] '%s': %lu\n", i, rfCodes[i].name, rfCodes[i].code);
-                }
-            }
-        }
-    } else {
-        // Migration: Try to restore old single code format
-        unsigned long oldCode = preferences.getULong("rf_code", 0);
-        if (oldCode != 0) {
-            unsigned int oldBits = preferences.getUInt("rf_bits", 0);
-            unsigned int oldProto = preferences.getUInt("rf_proto", 0);
-            
-            // Migrate to new format
-            rfCodes[0].active = true;
-            strncpy(rfCodes[0].name, "RF Signal 1", sizeof(rfCodes[0].name) - 1);
-            rfCodes[0].code = oldCode;
-            rfCodes[0].bitLength = oldBits;
-            rfCodes[0].protocol = oldProto;
-            rfCodes[0].lastTrigger = 0;
-            rfCodeCount = 1;
-            
-            Serial.println("[RF] Migrated old single code to slot 0");
-            saveRFCodes();  // Save in new format
-        }
-    }
-    
-    preferences.end();
+    mqttBridge.publishRFTrigger(slot, false);
 }
-
-int addRFCode(const char* name, unsigned long code, unsigned int bitLength, unsigned int protocol) {
-    if (rfCodeCount >= MAX_RF_CODES) {
-        return -1;  // Array full
-    }
-    
-    // Find first empty slot
-    for (int i = 0; i < MAX_RF_CODES; i++) {
-        if (!rfCodes[i].active) {
-            rfCodes[i].active = true;
-            strncpy(rfCodes[i].name, name, sizeof(rfCodes[i].name) - 1);
-            rfCodes[i].name[sizeof(rfCodes[i].name) - 1] = '\0';
-            rfCodes[i].code = code;
-            rfCodes[i].bitLength = bitLength;
-            rfCodes[i].protocol = protocol;
-            rfCodes[i].lastTrigger = 0;
-            rfCodeCount++;
-            
-            saveRFCodes();
-            return i;
-        }
-    }
-    
-    return -1;  // Should never reach here
-}
-
-void deleteRFCode(int slot) {
-    if (slot >= 0 && slot < MAX_RF_CODES && rfCodes[slot].active) {
-        rfCodes[slot].active = false;
-        rfCodes[slot].code = 0;
-        rfCodeCount--;
-        
-        saveRFCodes();
-        Serial.printf("[RF] Deleted code from slot %d\n", slot);
-    }
-}
-
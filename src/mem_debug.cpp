@@ -0,0 +1,123 @@
+#include "mem_debug.h"
+
+MemDebug memDebug;
+
+// Tasks reported on /api/debug/memory (missing ones are skipped)
+static const char* const TASK_NAMES[] = {
+    "loopTask",        // setup()/loop()
+    "async_tcp",       // ESPAsyncWebServer handlers
+    "wifi",            // ESP-IDF WiFi driver
+    "arduino_events",  // WiFi event callbacks (Arduino-ESP32 2.x)
+    "sys_evt",         // WiFi event callbacks (Arduino-ESP32 1.x)
+    "tiT",             // lwIP TCP/IP
+    "log_drain"        // Deferred Serial logging
+};
+
+void MemDebug::begin() {
+    loopTask = xTaskGetCurrentTaskHandle();
+}
+
+void MemDebug::attachTasks() {
+    // async_tcp is created by server.begin(), the event task by the first WiFi.onEvent()
+    webTask = xTaskGetHandle("async_tcp");
+    eventTask = xTaskGetHandle("arduino_events");
+    if (eventTask == nullptr) {
+        eventTask = xTaskGetHandle("sys_evt");
+    }
+}
+
+int MemDebug::currentTag() {
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    if (task == nullptr) return ALLOC_SYSTEM;  // Before the scheduler starts
+    if (task == loopTask) return activeSubsystem >= 0 ? activeSubsystem : ALLOC_LOOP_OTHER;
+    if (task == webTask) return ALLOC_WEB;
+    if (task == eventTask) return ALLOC_EVENTS;
+    return ALLOC_SYSTEM;
+}
+
+void MemDebug::recordAlloc(size_t size, bool ok) {
+    if (!ok) {
+        failures++;
+        lastFailureSize = size;
+        return;
+    }
+    int tag = currentTag();
+    allocs[tag]++;
+    allocBytes[tag] += size;
+}
+
+const char* MemDebug::tagName(int tag) {
+    if (tag < SUBSYS_COUNT) return Metrics::subsystemName(tag);
+    switch (tag) {
+        case ALLOC_LOOP_OTHER: return "loop_other";
+        case ALLOC_WEB:        return "web";
+        case ALLOC_EVENTS:     return "wifi_events";
+        case ALLOC_SYSTEM:     return "system";
+        default:               return "unknown";
+    }
+}
+
+// Written straight to the response stream - no JsonDocument on the AsyncTCP stack
+void MemDebug::writeJson(Print& out) {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t largestBlock = ESP.getMaxAllocHeap();
+    // 0% = all free memory in one block, 100% = completely fragmented
+    unsigned fragmentation = freeHeap > 0 ? 100 - (unsigned)((uint64_t)largestBlock * 100 / freeHeap) : 0;
+    
+    out.printf("{\"uptime_ms\":%lu,\"heap\":{\"size\":%u,\"free\":%u,\"min_free\":%u,"
+               "\"largest_free_block\":%u,\"fragmentation_pct\":%u},",
+               (unsigned long)millis(), (unsigned)ESP.getHeapSize(), (unsigned)freeHeap,
+               (unsigned)ESP.getMinFreeHeap(), (unsigned)largestBlock, fragmentation);
+    
+    // High-water mark = least free stack ever seen (bytes on ESP32)
+    out.print("\"stack_free_min\":{");
+    bool first = true;
+    for (const char* name : TASK_NAMES) {
+        TaskHandle_t task = xTaskGetHandle(name);
+        if (task == nullptr) continue;
+        out.printf("%s\"%s\":%u", first ? "" : ",", name, (unsigned)uxTaskGetStackHighWaterMark(task));
+        first = false;
+    }
+    out.print("},");
+    
+#if ALLOC_TRACKING
+    out.print("\"alloc_tracking\":true,\"allocations\":{");
+    for (int i = 0; i < ALLOC_TAG_COUNT; i++) {
+        out.printf("%s\"%s\":{\"count\":%u,\"bytes\":%u}", i ? "," : "", tagName(i),
+                   (unsigned)allocs[i].load(), (unsigned)allocBytes[i].load());
+    }
+    out.printf("},\"alloc_failures\":%u,\"last_failure_size\":%u}",
+               (unsigned)failures.load(), (unsigned)lastFailureSize.load());
+#else
+    out.print("\"alloc_tracking\":false}");
+#endif
+}
+
+#if ALLOC_TRACKING && !defined(NATIVE_BUILD)
+// Link-time wrappers, enabled with -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc
+extern "C" {
+    void* __real_malloc(size_t size);
+    void* __real_calloc(size_t n, size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+
+    void* __wrap_malloc(size_t size) {
+        void* p = __real_malloc(size);
+        memDebug.recordAlloc(size, p != nullptr);
+        return p;
+    }
+
+    void* __wrap_calloc(size_t n, size_t size) {
+        void* p = __real_calloc(n, size);
+        memDebug.recordAlloc(n * size, p != nullptr);
+        return p;
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size) {
+        void* p = __real_realloc(ptr, size);
+        if (size > 0) {  // realloc(ptr, 0) is a free
+            memDebug.recordAlloc(size, p != nullptr);
+        }
+        return p;
+    }
+}
+#endif
@@ -0,0 +1,197 @@
+#include "metrics.h"
+#include "log_buffer.h"
+#include "request_body.h"
+
+Metrics metrics;
+volatile int activeSubsystem = -1;
+
+const uint32_t LatencyHistogram::BOUNDS_US[LATENCY_BUCKET_COUNT] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 500000, 2000000
+};
+
+LatencyHistogram::LatencyHistogram() : sumMicros(0) {
+    memset(buckets, 0, sizeof(buckets));
+}
+
+void LatencyHistogram::record(uint32_t value) {
+    int i = 0;
+    while (i < LATENCY_BUCKET_COUNT && value > BOUNDS_US[i]) {
+        i++;
+    }
+    buckets[i]++;
+    sumMicros += value;
+}
+
+uint32_t LatencyHistogram::count() const {
+    uint32_t total = 0;
+    for (int i = 0; i <= LATENCY_BUCKET_COUNT; i++) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+// Prometheus buckets are cumulative and in seconds
+void LatencyHistogram::writePrometheus(Print& out, const char* name, const char* labels) const {
+    const char* sep = labels[0] ? "," : "";
+    uint32_t cumulative = 0;
+    for (int i = 0; i < LATENCY_BUCKET_COUNT; i++) {
+        cumulative += buckets[i];
+        out.printf("%s_bucket{%s%sle=\"%g\"} %u\n", name, labels, sep, BOUNDS_US[i] / 1e6, (unsigned)cumulative);
+    }
+    cumulative += buckets[LATENCY_BUCKET_COUNT];
+    out.printf("%s_bucket{%s%sle=\"+Inf\"} %u\n", name, labels, sep, (unsigned)cumulative);
+    if (labels[0]) {
+        out.printf("%s_sum{%s} %.6f\n", name, labels, sumMicros / 1e6);
+        out.printf("%s_count{%s} %u\n", name, labels, (unsigned)cumulative);
+    } else {
+        out.printf("%s_sum %.6f\n", name, sumMicros / 1e6);
+        out.printf("%s_count %u\n", name, (unsigned)cumulative);
+    }
+}
+
+Metrics::Metrics()
+    : loopStartCycles(0), subsystemStartCycles(0), cyclesPerMicro(240),
+      lastStallMicros(0), lastStallUptime(0), lastStallSubsystem(-1),
+      mqttPublishes(0), mqttPublishFailures(0), mqttReconnectAttempts(0), mqttConnects(0),
+      mqttGroupCommands(0), mqttGroupAcks(0),
+      rfFrames(0), rfMatches(0), nvsCommits(0) {
+    memset(iterationMicros, 0, sizeof(iterationMicros));
+    memset(stalls, 0, sizeof(stalls));
+    memset(bootStageMicros, 0, sizeof(bootStageMicros));
+}
+
+void Metrics::begin() {
+    cyclesPerMicro = ESP.getCpuFreqMHz();
+    if (cyclesPerMicro == 0) {
+        cyclesPerMicro = 240;
+    }
+}
+
+void Metrics::beginLoop() {
+    memset(iterationMicros, 0, sizeof(iterationMicros));
+    loopStartCycles = ESP.getCycleCount();
+}
+
+void Metrics::endLoop() {
+    // Unsigned subtraction handles counter wrap (every ~17 s at 240 MHz)
+    uint32_t elapsed = (ESP.getCycleCount() - loopStartCycles) / cyclesPerMicro;
+    loopHistogram.record(elapsed);
+    
+    if (elapsed >= LOOP_STALL_THRESHOLD_US) {
+        // Blame the subsystem that used most of this iteration
+        int culprit = 0;
+        for (int i = 1; i < SUBSYS_COUNT; i++) {
+            if (iterationMicros[i] > iterationMicros[culprit]) {
+                culprit = i;
+            }
+        }
+        stalls[culprit]++;
+        lastStallSubsystem = culprit;
+        lastStallMicros = elapsed;
+        lastStallUptime = millis();
+    }
+}
+
+void Metrics::beginSubsystem(Subsystem subsystem) {
+    (void)subsystem;
+    subsystemStartCycles = ESP.getCycleCount();
+}
+
+void Metrics::endSubsystem(Subsystem subsystem) {
+    uint32_t elapsed = (ESP.getCycleCount() - subsystemStartCycles) / cyclesPerMicro;
+    subsystemHistograms[subsystem].record(elapsed);
+    iterationMicros[subsystem] += elapsed;
+}
+
+const char* Metrics::subsystemName(int subsystem) {
+    switch (subsystem) {
+        case SUBSYS_WIFI:           return "wifi";
+        case SUBSYS_MQTT_RECONNECT: return "mqtt_reconnect";
+        case SUBSYS_MQTT_LOOP:      return "mqtt_loop";
+        case SUBSYS_RF:             return "rf";
+        default:                    return "unknown";
+    }
+}
+
+void Metrics::markBootStage(BootStage stage) {
+    if (bootStageMicros[stage] != 0) return;
+    bootStageMicros[stage] = max((uint32_t)micros(), (uint32_t)1);
+    LOGI("[Boot] %s ready after %u ms", bootStageName(stage), (unsigned)(bootStageMicros[stage] / 1000));
+}
+
+const char* Metrics::bootStageName(int stage) {
+    switch (stage) {
+        case BOOT_RELAYS: return "relays";
+        case BOOT_RF:     return "rf";
+        case BOOT_WIFI:   return "wifi";
+        case BOOT_WEB:    return "web";
+        case BOOT_MDNS:   return "mdns";
+        case BOOT_MQTT:   return "mqtt";
+        default:          return "unknown";
+    }
+}
+
+void Metrics::writePrometheus(Print& out) const {
+    out.print("# HELP relay_loop_duration_seconds Duration of one loop() iteration (excluding idle delay)\n");
+    out.print("# TYPE relay_loop_duration_seconds histogram\n");
+    loopHistogram.writePrometheus(out, "relay_loop_duration_seconds", "");
+    
+    out.print("# HELP relay_subsystem_duration_seconds Time spent in each loop() subsystem per call\n");
+    out.print("# TYPE relay_subsystem_duration_seconds histogram\n");
+    for (int i = 0; i < SUBSYS_COUNT; i++) {
+        char labels[40];
+        snprintf(labels, sizeof(labels), "subsystem=\"%s\"", subsystemName(i));
+        subsystemHistograms[i].writePrometheus(out, "relay_subsystem_duration_seconds", labels);
+    }
+    
+    out.printf("# HELP relay_loop_stalls_total Loop iterations longer than %u us, by slowest subsystem\n",
+               (unsigned)LOOP_STALL_THRESHOLD_US);
+    out.print("# TYPE relay_loop_stalls_total counter\n");
+    for (int i = 0; i < SUBSYS_COUNT; i++) {
+        out.printf("relay_loop_stalls_total{subsystem=\"%s\"} %u\n", subsystemName(i), (unsigned)stalls[i]);
+    }
+    
+    if (lastStallSubsystem >= 0) {
+        out.print("# HELP relay_loop_last_stall_seconds Duration of the most recent stall\n");
+        out.print("# TYPE relay_loop_last_stall_seconds gauge\n");
+        out.printf("relay_loop_last_stall_seconds{subsystem=\"%s\"} %.6f\n",
+                   subsystemName(lastStallSubsystem), lastStallMicros / 1e6);
+        out.print("# HELP relay_loop_last_stall_uptime_seconds Uptime when the most recent stall ended\n");
+        out.print("# TYPE relay_loop_last_stall_uptime_seconds gauge\n");
+        out.printf("relay_loop_last_stall_uptime_seconds %.3f\n", lastStallUptime / 1e3);
+    }
+    
+    out.print("# TYPE relay_mqtt_publishes_total counter\n");
+    out.printf("relay_mqtt_publishes_total %u\n", (unsigned)mqttPublishes.load());
+    out.print("# TYPE relay_mqtt_publish_failures_total counter\n");
+    out.printf("relay_mqtt_publish_failures_total %u\n", (unsigned)mqttPublishFailures.load());
+    out.print("# TYPE relay_mqtt_reconnect_attempts_total counter\n");
+    out.printf("relay_mqtt_reconnect_attempts_total %u\n", (unsigned)mqttReconnectAttempts.load());
+    out.print("# TYPE relay_mqtt_connects_total counter\n");
+    out.printf("relay_mqtt_connects_total %u\n", (unsigned)mqttConnects.load());
+    out.print("# TYPE relay_mqtt_group_commands_total counter\n");
+    out.printf("relay_mqtt_group_commands_total %u\n", (unsigned)mqttGroupCommands.load());
+    out.print("# TYPE relay_mqtt_group_acks_total counter\n");
+    out.printf("relay_mqtt_group_acks_total %u\n", (unsigned)mqttGroupAcks.load());
+    out.print("# TYPE relay_rf_frames_total counter\n");
+    out.printf("relay_rf_frames_total %u\n", (unsigned)rfFrames.load());
+    out.print("# TYPE relay_rf_matches_total counter\n");
+    out.printf("relay_rf_matches_total %u\n", (unsigned)rfMatches.load());
+    out.print("# TYPE relay_nvs_commits_total counter\n");
+    out.printf("relay_nvs_commits_total %u\n", (unsigned)nvsCommits.load());
+    out.print("# HELP relay_http_body_rejected_total POST bodies rejected before parsing\n");
+    out.print("# TYPE relay_http_body_rejected_total counter\n");
+    out.printf("relay_http_body_rejected_total{reason=\"too_large\"} %u\n", (unsigned)requestBodies.tooLarge);
+    out.printf("relay_http_body_rejected_total{reason=\"busy\"} %u\n", (unsigned)requestBodies.busy);
+    out.printf("relay_http_body_rejected_total{reason=\"timeout\"} %u\n", (unsigned)requestBodies.timedOut);
+    out.printf("relay_http_body_rejected_total{reason=\"out_of_order\"} %u\n", (unsigned)requestBodies.outOfOrder);
+    out.print("# HELP relay_boot_stage_seconds Time from power-on until each boot stage first completed\n");
+    out.print("# TYPE relay_boot_stage_seconds gauge\n");
+    for (int i = 0; i < BOOT_STAGE_COUNT; i++) {
+        if (bootStageMicros[i] != 0) {
+            out.printf("relay_boot_stage_seconds{stage=\"%s\"} %.6f\n", bootStageName(i), bootStageMicros[i] / 1e6);
+        }
+    }
+    out.print("# TYPE relay_uptime_seconds gauge\n");
+    out.printf("relay_uptime_seconds %.3f\n", millis() / 1e3);
+}
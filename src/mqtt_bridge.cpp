@@ -0,0 +1,992 @@
+#include "mqtt_bridge.h"
+#include <ArduinoJson.h>
+#include <WiFi.h>
+#include "log_buffer.h"
+#include "mqtt_tls.h"
+
+MqttBridge::MqttBridge(PubSubClient& client, RelayControl& relays, RFCodeStore& rfCodes,
+                       Settings& settings, Storage& storage)
+    : client(client), relays(relays), rfCodes(rfCodes), settings(settings), storage(storage),
+      discoveryPublished(false), staleRelayCount(0), aggregateRetained(false), groupConfig(),
+      lastStatsPublish(0) {
+    memset(publishedSwitches, 0, sizeof(publishedSwitches));
+}
+
+/*
+ * Optimized MQTT Reconnection
+ * 
+ * Strategy:
+ * - Publishes discovery ONCE per boot (on first connection)
+ * - Subsequent reconnections only publish states (fast, non-blocking)
+ * - Manual republish available via /api/mqtt/rediscover
+ * 
+ * This prevents blocking delays while maintaining reliability.
+ */
+bool MqttBridge::connect(const char* clientId) {
+    String availTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    
+    bool connected;
+    if (strlen(settings.mqtt_user) > 0) {
+        connected = client.connect(clientId, settings.mqtt_user, settings.mqtt_password, 
+                                   availTopic.c_str(), 0, true, "offline");
+    } else {
+        connected = client.connect(clientId, 
+                                   availTopic.c_str(), 0, true, "offline");
+    }
+    
+    if (!connected) {
+        return false;
+    }
+    
+    LOGI("[MQTT] Connected");
+    metrics.mqttConnects++;
+    
+    // Publish availability as online
+    publish(availTopic.c_str(), "online", true);
+    
+    // One wildcard subscription covers every relay's command topic, whatever the board size
+    String commandTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/+/set";
+    client.subscribe(commandTopic.c_str());
+    subscribeGroups(true);
+    LOGI("[MQTT] Subscribed to command topics");
+    
+    // Only publish discovery on FIRST connection after boot
+    if (!discoveryPublished) {
+        LOGI("[MQTT] First connection - publishing discovery");
+        publishDiscovery();
+        discoveryPublished = true;
+    
+        // Publish initial states (with yield to prevent blocking)
+        publishAllStates();
+        publishRelayStats(true);
+        LOGI("[MQTT] Discovery and states published");
+    } else {
+        // On reconnection, just republish current states quickly
+        LOGI("[MQTT] Reconnected - republishing states only");
+        publishAllStates();
+    }
+    return true;
+}
+
+/*
+ * Broker Switchover
+ * 
+ * Applies new server / credentials / hostname without a restart:
+ * 1. The candidate is checked with a throwaway session - the live
+ *    connection keeps running, so a typo costs nothing
+ * 2. If the broker or hostname changes, the old identity's retained
+ *    discovery, state and availability topics are cleared on the old broker
+ * 3. The client reconnects with the new settings, which rebuilds every topic
+ *    (availability, command subscription, discovery, states)
+ * 4. If that connection fails anyway, the previous settings are restored and
+ *    reconnected; only a successful switch is written to NVS
+ */
+bool MqttBridge::switchBroker(const Settings& candidate, const char* clientId) {
+    bool identityChanged = strcmp(candidate.mqtt_server, settings.mqtt_server) != 0 ||
+                           strcmp(candidate.mqtt_port, settings.mqtt_port) != 0 ||
+                           strcmp(candidate.mqtt_hostname, settings.mqtt_hostname) != 0;
+    
+    if (!probe(candidate, clientId)) {
+        return false;
+    }
+    
+    String availTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    if (client.connected()) {
+        if (identityChanged) {
+            clearRetainedTopics();
+        } else {
+            publish(availTopic.c_str(), "offline", true);
+        }
+    }
+    client.disconnect();
+    
+    Settings previous = settings;
+    copyMqttSettings(settings, candidate);
+    client.setServer(settings.mqtt_server, atoi(settings.mqtt_port));
+    if (identityChanged) {
+        discoveryPublished = false;
+    }
+    
+    // One string argument per entry - only the first is copied into the log
+    LOGI("[MQTT] Switching to %s:%d", settings.mqtt_server, atoi(settings.mqtt_port));
+    LOGI("[MQTT] Switch: hostname %s", settings.mqtt_hostname);
+    if (connect(clientId)) {
+        storage.saveMqttSettings(settings, strcmp(previous.mqtt_password, settings.mqtt_password) != 0);
+        return true;
+    }
+    
+    // Roll back - the old topics were cleared, so publish everything again
+    LOGW("[MQTT] Switch failed, rc=%d - restoring %s:%d", client.state(), previous.mqtt_server, atoi(previous.mqtt_port));
+    copyMqttSettings(settings, previous);
+    client.setServer(settings.mqtt_server, atoi(settings.mqtt_port));
+    discoveryPublished = false;
+    connect(clientId);  // If this fails too, reconnectMQTT() keeps retrying
+    return false;
+}
+
+// Opens and closes a session on the candidate broker; the live client is not
+// touched. Runs on loop(), so every step is bounded by MQTT_PROBE_TIMEOUT
+// instead of the live link's longer connect and handshake timeouts.
+bool MqttBridge::probe(const Settings& candidate, const char* clientId) {
+#if MQTT_TLS
+    TlsClient probeSocket;  // Own session cache - the live link keeps its own
+    probeSocket.setHandshakeTimeout(MQTT_PROBE_TIMEOUT * 1000);
+#else
+    WiFiClient probeSocket;
+    probeSocket.setTimeout(MQTT_PROBE_TIMEOUT);  // TCP connect (default 3 s)
+#endif
+    PubSubClient probeClient(probeSocket);
+    probeClient.setServer(candidate.mqtt_server, atoi(candidate.mqtt_port));
+    probeClient.setSocketTimeout(MQTT_PROBE_TIMEOUT);
+    
+    // Distinct client id so the broker doesn't kick the live session
+    String probeId = String(clientId) + "-probe";
+    bool ok;
+    if (strlen(candidate.mqtt_user) > 0) {
+        ok = probeClient.connect(probeId.c_str(), candidate.mqtt_user, candidate.mqtt_password);
+    } else {
+        ok = probeClient.connect(probeId.c_str());
+    }
+    
+    if (!ok) {
+        LOGW("[MQTT] Candidate broker %s:%d rejected, rc=%d",
+             candidate.mqtt_server, atoi(candidate.mqtt_port), probeClient.state());
+    }
+    probeClient.disconnect();
+    return ok;
+}
+
+// Empty retained payloads for everything published under the current hostname
+void MqttBridge::clearRetainedTopics() {
+    LOGI("[MQTT] Clearing retained topics of %s", settings.mqtt_hostname);
+    clearEntityDiscovery();
+    clearDeviceDiscovery();
+    
+    for (int i = 0; i < max(settings.activeRelayCount, staleRelayCount); i++) {
+        String topic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/relay" + String(i + 1) + "/state";
+        publish(topic.c_str(), "", true);
+        if (RELAY_STATS_SENSORS) {
+            String statsTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/relay" + String(i + 1) + "/stats";
+            publish(statsTopic.c_str(), "", true);
+        }
+        yield();
+        client.loop();
+    }
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        String topic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/rf_" + String(i) + "/state";
+        publish(topic.c_str(), "", true);
+    }
+    
+    String stateTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/state";
+    publish(stateTopic.c_str(), "", true);
+    aggregateRetained = false;
+    
+    String availTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    publish(availTopic.c_str(), "", true);
+    staleRelayCount = 0;
+}
+
+// Only the connection fields - relay count and discovery mode are left alone
+void MqttBridge::copyMqttSettings(Settings& to, const Settings& from) {
+    memcpy(to.mqtt_server, from.mqtt_server, sizeof(to.mqtt_server));
+    memcpy(to.mqtt_port, from.mqtt_port, sizeof(to.mqtt_port));
+    memcpy(to.mqtt_user, from.mqtt_user, sizeof(to.mqtt_user));
+    memcpy(to.mqtt_password, from.mqtt_password, sizeof(to.mqtt_password));
+    memcpy(to.mqtt_hostname, from.mqtt_hostname, sizeof(to.mqtt_hostname));
+}
+
+// All publishes go through here so they are counted in /metrics
+bool MqttBridge::publish(const char* topic, const char* payload, bool retained) {
+    return publish(topic, (const uint8_t*)payload, strlen(payload), retained);
+}
+
+bool MqttBridge::publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    bool ok = client.publish(topic, payload, length, retained);
+    if (ok) {
+        metrics.mqttPublishes++;
+    } else {
+        metrics.mqttPublishFailures++;
+    }
+    return ok;
+}
+
+/*
+ * serializeJson() writes a byte or a few at a time, and PubSubClient hands
+ * every write() of a streamed publish to the socket - gathered into
+ * MQTT_STREAM_CHUNK byte writes instead.
+ */
+class ChunkedWriter : public Print {
+private:
+    Print& out;
+    uint8_t chunk[MQTT_STREAM_CHUNK];
+    size_t used;
+    size_t sent;
+    
+public:
+    explicit ChunkedWriter(Print& target) : out(target), used(0), sent(0) {}
+    
+    size_t write(uint8_t c) override {
+        if (used == sizeof(chunk)) finish();
+        chunk[used++] = c;
+        return 1;
+    }
+    
+    size_t write(const uint8_t* buffer, size_t size) override {
+        for (size_t i = 0; i < size; i++) {
+            write(buffer[i]);
+        }
+        return size;
+    }
+    
+    // Sends what is left - returns the bytes that made it out in total
+    size_t finish() {
+        if (used > 0) {
+            sent += out.write(chunk, used);
+            used = 0;
+        }
+        return sent;
+    }
+};
+
+/*
+ * JSON publishes stream the document into the connection: its length is
+ * measured for the MQTT header, then it is serialized straight out. Neither
+ * a serialized copy nor an MQTT buffer the size of the message is needed -
+ * discovery payloads run to tens of KB, next to a 1 KB buffer.
+ */
+bool MqttBridge::publishJson(const char* topic, const JsonDocument& doc, bool retained) {
+    size_t length = measureJson(doc);
+    bool ok = client.beginPublish(topic, length, retained);
+    if (ok) {
+        ChunkedWriter writer(client);
+        serializeJson(doc, writer);
+        ok = writer.finish() == length;
+        ok = client.endPublish() && ok;
+    }
+    if (ok) {
+        metrics.mqttPublishes++;
+    } else {
+        metrics.mqttPublishFailures++;
+    }
+    return ok;
+}
+
+// Relay index from "<prefix><hostname>/relay<N>/set", or -1
+int MqttBridge::parseCommandTopic(const char* topic) const {
+    size_t prefixLength = strlen(MQTT_TOPIC_PREFIX);
+    size_t hostLength = strlen(settings.mqtt_hostname);
+    if (strncmp(topic, MQTT_TOPIC_PREFIX, prefixLength) != 0) return -1;
+    topic += prefixLength;
+    if (strncmp(topic, settings.mqtt_hostname, hostLength) != 0) return -1;
+    topic += hostLength;
+    if (strncmp(topic, "/relay", 6) != 0) return -1;
+    topic += 6;
+    
+    char* end;
+    long relayNumber = strtol(topic, &end, 10);
+    if (end == topic || strcmp(end, "/set") != 0) return -1;
+    if (relayNumber < 1 || relayNumber > NUM_RELAYS) return -1;
+    return (int)relayNumber - 1;
+}
+
+// Applies a relay or group command; returns true if relays were switched (states need saving)
+// Relay payload is ON / OFF, or {"state":"ON","cid":"<id>"} to trace the command end to end
+bool MqttBridge::handleMessage(const char* topic, const byte* payload, unsigned int length) {
+    uint32_t received = micros();
+    int group = parseGroupTopic(topic);
+    if (group >= 0) {
+        return handleGroupCommand(group, payload, length);
+    }
+    
+    int relayIndex = parseCommandTopic(topic);
+    if (relayIndex < 0 || relayIndex >= settings.activeRelayCount) {
+        LOGD("[MQTT] Ignored message on %s", topic);
+        return false;
+    }
+    
+    bool newState;
+    char correlationId[TRACE_ID_LEN] = "";
+    if (length > 0 && payload[0] == '{') {
+        StaticJsonDocument<128> doc;
+        if (deserializeJson(doc, (const char*)payload, length)) {
+            LOGW("[MQTT] relay%d/set: invalid JSON", relayIndex + 1);
+            return false;
+        }
+        newState = strcmp(doc["state"] | "", "ON") == 0;
+        snprintf(correlationId, sizeof(correlationId), "%s", doc["cid"] | "");
+    } else {
+        newState = (length == 2 && memcmp(payload, "ON", 2) == 0);
+    }
+    
+    CommandTrace* trace = commandTrace.begin(TRACE_MQTT, relayIndex, newState, received, correlationId);
+    CommandTracer::mark(trace, TRACE_DISPATCHED);
+    LOGI("[MQTT] relay%d/set: %s", relayIndex + 1, newState ? "ON" : "OFF");
+    relays.setState(relayIndex, newState, RELAY_SOURCE_MQTT);
+    CommandTracer::mark(trace, TRACE_GPIO);
+    publishState(relayIndex);
+    CommandTracer::finish(trace);
+    publishTrace(trace);
+    return true;
+}
+
+// Group index from "<group prefix><group>/set", or -1 if this device isn't in the group
+int MqttBridge::parseGroupTopic(const char* topic) const {
+    size_t prefixLength = strlen(MQTT_GROUP_PREFIX);
+    if (strncmp(topic, MQTT_GROUP_PREFIX, prefixLength) != 0) return -1;
+    topic += prefixLength;
+    
+    const char* end = strchr(topic, '/');
+    if (end == nullptr || strcmp(end, "/set") != 0) return -1;
+    return groupConfig.findGroup(topic, end - topic);
+}
+
+// Applies a group command (see group_commands.h) and queues its acknowledgement
+bool MqttBridge::handleGroupCommand(int group, const byte* payload, unsigned int length) {
+    const char* groupName = groupConfig.groups[group];
+    StaticJsonDocument<256> doc;
+    if (deserializeJson(doc, (const char*)payload, length)) {
+        LOGW("[MQTT] Group %s: invalid JSON", groupName);
+        return false;
+    }
+    
+    SceneMask on;
+    SceneMask off;
+    const char* pattern = doc["relays"];
+    const char* all = doc["all"];
+    const char* sceneName = doc["scene"];
+    if (pattern) {
+        if (!parseRelayPattern(pattern, NUM_RELAYS, on, off)) {
+            LOGW("[MQTT] Group %s: invalid relay pattern", groupName);
+            return false;
+        }
+    } else if (all) {
+        if (strcmp(all, "ON") == 0) {
+            on = SceneMask::all();
+        } else if (strcmp(all, "OFF") == 0) {
+            off = SceneMask::all();
+        } else {
+            LOGW("[MQTT] Group %s: \"all\" must be ON or OFF", groupName);
+            return false;
+        }
+    } else if (sceneName) {
+        const RelayScene* scene = groupConfig.findScene(sceneName);
+        if (scene == nullptr) {
+            // Only the first string argument is copied, and sceneName lives in doc
+            char names[LOG_TEXT_LEN];
+            snprintf(names, sizeof(names), "'%s' in group %s", sceneName, groupName);
+            LOGW("[MQTT] Unknown scene %s", names);
+            return false;
+        }
+        on = scene->on;
+        off = scene->off;
+    } else {
+        LOGW("[MQTT] Group %s: no relays, all or scene", groupName);
+        return false;
+    }
+    
+    // Relays above activeRelayCount aren't exposed, so a group can't switch them either
+    RelayControl::Mask active;
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        active.set(i);
+    }
+    RelayControl::Mask onMask = relayMaskOf<RelayControl::Mask::BITS>(on) & active;
+    RelayControl::Mask changeMask = (onMask | relayMaskOf<RelayControl::Mask::BITS>(off)) & active;
+    
+    // One backend update for the whole bank, then one publish per relay that actually changed
+    RelayControl::Mask changed = relays.setMask(onMask, changeMask, RELAY_SOURCE_GROUP);
+    if (changed.any()) {
+        publishStates(changed);
+    }
+    LOGI("[MQTT] Group %s: %d relays switched", groupName, changed.count());
+    
+    metrics.mqttGroupCommands++;
+    groupAck.add(group, doc["cid"] | "", millis(), random(MQTT_GROUP_ACK_WINDOW_MS + 1));
+    return changed.any();
+}
+
+void MqttBridge::subscribeGroups(bool subscribe) {
+    for (int i = 0; i < MQTT_GROUP_MAX; i++) {
+        if (!groupConfig.groups[i][0]) continue;
+    
+        char topic[96];
+        snprintf(topic, sizeof(topic), "%s%s/set", MQTT_GROUP_PREFIX, groupConfig.groups[i]);
+        if (subscribe) {
+            client.subscribe(topic);
+        } else {
+            client.unsubscribe(topic);
+        }
+    }
+}
+
+// Replaces group memberships and scenes, moving the subscriptions if connected.
+// Acks still waiting for their window are dropped - they may be for a group that's gone.
+void MqttBridge::setGroupConfig(const GroupConfig& config, bool save) {
+    bool connected = client.connected();
+    if (connected) {
+        subscribeGroups(false);
+    }
+    groupConfig = config;
+    groupAck.clear();
+    if (connected) {
+        subscribeGroups(true);
+    }
+    
+    if (save) {
+        storage.saveGroupConfig(groupConfig);
+    }
+    LOGI("[MQTT] %d groups, %d scenes", groupConfig.groupCount(), groupConfig.sceneCount());
+}
+
+// Sends one acknowledgement whose delay has run out - called from loop()
+void MqttBridge::publishGroupAcks() {
+    if (!client.connected()) return;
+    int group = groupAck.due(millis());
+    if (group < 0) return;
+    
+    char topic[96];
+    char states[NUM_RELAYS + 1];
+    char payload[NUM_RELAYS + 256];
+    snprintf(topic, sizeof(topic), "%s%s/ack", MQTT_GROUP_PREFIX, groupConfig.groups[group]);
+    states[formatRelayStates(states)] = '\0';
+    size_t length = groupAck.take(group, settings.mqtt_hostname, states, payload, sizeof(payload));
+    if (publish(topic, (const uint8_t*)payload, length, false)) {
+        metrics.mqttGroupAcks++;
+    }
+}
+
+// Echoes a traced command's correlation id and stage timings on relay<N>/trace
+void MqttBridge::publishTrace(const CommandTrace* trace) {
+    if (!trace || !trace->correlationId[0] || !client.connected()) return;
+    
+    char topic[96];
+    char payload[160];
+    snprintf(topic, sizeof(topic), "%s%s/relay%u/trace", MQTT_TOPIC_PREFIX, settings.mqtt_hostname, (unsigned)trace->target + 1);
+    snprintf(payload, sizeof(payload),
+             "{\"cid\":\"%s\",\"state\":\"%s\",\"source\":\"%s\",\"dispatch_us\":%ld,\"gpio_us\":%ld,\"publish_us\":%ld}",
+             trace->correlationId, trace->state ? "ON" : "OFF", CommandTracer::sourceName(trace->source),
+             trace->offset(TRACE_DISPATCHED), trace->offset(TRACE_GPIO), trace->offset(TRACE_PUBLISHED));
+    publish(topic, payload, false);
+}
+
+void MqttBridge::publishState(int relayIndex) {
+    if (!client.connected()) return;
+    
+    publishRelayState(relayIndex);
+    
+    // Home Assistant reads the aggregate topic - the per-relay one stays for other clients
+    if (settings.aggregateState) {
+        publishAggregateState();
+    }
+}
+
+// Several relays at once - the aggregate topic only once
+void MqttBridge::publishStates(const RelayControl::Mask& changed) {
+    if (!client.connected()) return;
+    
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        if (changed.test(i)) {
+            publishRelayState(i);
+        }
+    }
+    if (settings.aggregateState) {
+        publishAggregateState();
+    }
+}
+
+// No String temporaries - a group command can publish this for every relay in one go
+void MqttBridge::publishRelayState(int relayIndex) {
+    char topic[96];
+    snprintf(topic, sizeof(topic), "%s%s/relay%d/state", MQTT_TOPIC_PREFIX, settings.mqtt_hostname, relayIndex + 1);
+    publish(topic, relays.getState(relayIndex) ? "ON" : "OFF", true);
+}
+
+// One '1' / '0' per active relay, relay 1 first; returns the length (not terminated)
+int MqttBridge::formatRelayStates(char* out) const {
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        out[i] = relays.getState(i) ? '1' : '0';
+    }
+    return settings.activeRelayCount;
+}
+
+/*
+ * Aggregate Relay State
+ * 
+ * The whole bank as one retained message on <prefix><hostname>/state:
+ *   {"relays":"1001"}   - one character per active relay, relay 1 first
+ * Discovery points every switch at this topic with a value_template that
+ * picks its character, so a reconnect is one publish instead of one per
+ * relay (and one retained-store update on the broker).
+ */
+void MqttBridge::publishAggregateState() {
+    if (!client.connected()) return;
+    
+    char topic[96];
+    char payload[NUM_RELAYS + 16];
+    snprintf(topic, sizeof(topic), "%s%s/state", MQTT_TOPIC_PREFIX, settings.mqtt_hostname);
+    int length = snprintf(payload, sizeof(payload), "{\"relays\":\"");
+    length += formatRelayStates(payload + length);
+    length += snprintf(payload + length, sizeof(payload) - length, "\"}");
+    if (publish(topic, (const uint8_t*)payload, length, true)) {
+        aggregateRetained = true;
+    }
+}
+
+void MqttBridge::publishAllStates() {
+    if (settings.aggregateState) {
+        publishAggregateState();
+        return;
+    }
+    
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        publishState(i);
+        yield();  // Allow other tasks to run
+    }
+    
+    // Switched back to per-relay topics - don't leave a stale bank behind
+    if (aggregateRetained) {
+        String topic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/state";
+        publish(topic.c_str(), "", true);
+        aggregateRetained = false;
+    }
+}
+
+/*
+ * Relay Statistics Sensors (RELAY_STATS_SENSORS)
+ * 
+ * Retained on <prefix><hostname>/relay<N>/stats:
+ *   {"switches":1204,"on_s":86400,"duty":0.1250}
+ * Home Assistant shows the switch count as a sensor with on-time and duty
+ * cycle as attributes. Sent every RELAY_STATS_PUBLISH_MS, and only for
+ * relays that switched since the last update or are on (on-time grows).
+ */
+void MqttBridge::publishRelayStats(bool force) {
+    if (!RELAY_STATS_SENSORS || !client.connected()) return;
+    uint32_t now = millis();
+    if (!force && now - lastStatsPublish < RELAY_STATS_PUBLISH_MS) return;
+    lastStatsPublish = now;
+    
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        uint32_t switches = relayStats.getSwitches(i);
+        if (!force && switches == publishedSwitches[i] && !relays.getState(i)) continue;
+    
+        char topic[96];
+        char payload[96];
+        snprintf(topic, sizeof(topic), "%s%s/relay%d/stats", MQTT_TOPIC_PREFIX, settings.mqtt_hostname, i + 1);
+        snprintf(payload, sizeof(payload), "{\"switches\":%u,\"on_s\":%u,\"duty\":%.4f}", (unsigned)switches,
+                 (unsigned)relayStats.getOnSeconds(i, now), relayStats.getDutyCycle(i, now));
+        if (publish(topic, payload, true)) {
+            publishedSwitches[i] = switches;
+        }
+        yield();
+    }
+}
+
+// value_template that picks relay i's character out of the aggregate payload
+static String aggregateTemplate(int relayIndex) {
+    return "{{ 'ON' if value_json.relays[" + String(relayIndex) + "] == '1' else 'OFF' }}";
+}
+
+void MqttBridge::publishRFTrigger(int slot, bool on) {
+    if (!client.connected()) return;
+    if (slot < 0 || slot >= MAX_RF_CODES || !rfCodes.get(slot).active) return;
+    
+    String topic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/rf_" + String(slot) + "/state";
+    publish(topic.c_str(), on ? "ON" : "OFF", true);
+    LOGI("[MQTT] RF '%s' (slot %d): %s", rfCodes.get(slot).name, slot, on ? "ON" : "OFF");
+}
+
+/*
+ * Home Assistant Discovery
+ * 
+ * Two modes are supported:
+ * - Entity mode: one retained config per relay and per RF code. Every message
+ *   repeats the same device block (up to 26 publishes).
+ * - Device mode: one retained config on homeassistant/device/<hostname>/config
+ *   listing all components, so the device block is only sent once.
+ * 
+ * When the mode changes, the configs of the previous mode are cleared with
+ * empty retained payloads so Home Assistant doesn't keep duplicate entities.
+ */
+void MqttBridge::publishDiscovery() {
+    if (!client.connected()) return;
+    
+    bool device = useDeviceDiscovery();
+    int mode = device ? 1 : 0;
+    
+    // Migration: remove stale configs left over from the other mode
+    if (settings.lastDiscoveryMode != mode) {
+        if (device) {
+            clearEntityDiscovery();
+        } else {
+            clearDeviceDiscovery();
+        }
+    }
+    
+    if (device && !publishDeviceDiscovery()) {
+        // Out of heap - entities instead, without a stale device config
+        clearDeviceDiscovery();
+        mode = 0;
+        device = false;
+    }
+    if (!device) {
+        publishEntityDiscovery();
+    }
+    for (int i = settings.activeRelayCount; i < staleRelayCount; i++) {
+        clearRelayEntity(i);
+    }
+    staleRelayCount = 0;
+    
+    if (settings.lastDiscoveryMode != mode) {
+        settings.lastDiscoveryMode = mode;
+        storage.saveLastDiscoveryMode(settings.lastDiscoveryMode);
+    }
+}
+
+void MqttBridge::publishRelayEntityConfig(int i) {
+    StaticJsonDocument<1024> doc;
+    
+    String availTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    String uniqueId = String(settings.mqtt_hostname) + "_relay" + String(i + 1);
+    String name = String(RELAY_NAMES[i]);
+    String stateTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/relay" + String(i + 1) + "/state";
+    String commandTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/relay" + String(i + 1) + "/set";
+    String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/switch/" + settings.mqtt_hostname + "_relay" + String(i + 1) + "/config";
+    
+    doc["name"] = name;
+    doc["unique_id"] = uniqueId;
+    if (settings.aggregateState) {
+        doc["state_topic"] = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/state";
+        doc["value_template"] = aggregateTemplate(i);
+    } else {
+        doc["state_topic"] = stateTopic;
+    }
+    doc["command_topic"] = commandTopic;
+    doc["availability_topic"] = availTopic;
+    doc["payload_on"] = "ON";
+    doc["payload_off"] = "OFF";
+    doc["state_on"] = "ON";
+    doc["state_off"] = "OFF";
+    doc["optimistic"] = false;
+    doc["icon"] = "mdi:electric-switch";
+    
+    JsonObject device = doc["device"].to<JsonObject>();
+    device["identifiers"][0] = settings.mqtt_hostname;
+    device["name"] = DEVICE_NAME;
+    device["manufacturer"] = DEVICE_MANUFACTURER;
+    device["model"] = DEVICE_MODEL;
+    device["sw_version"] = FIRMWARE_VERSION;
+    
+    publishJson(configTopic.c_str(), doc, true);
+    
+    if (RELAY_STATS_SENSORS) {
+        publishRelayStatsConfig(i);
+    }
+}
+
+// Switch count sensor with on-time and duty cycle as attributes
+void MqttBridge::publishRelayStatsConfig(int i) {
+    StaticJsonDocument<1024> doc;
+    
+    String relayId = "relay" + String(i + 1);
+    String statsTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/" + relayId + "/stats";
+    String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/sensor/" + settings.mqtt_hostname + "_" + relayId + "_switches/config";
+    
+    doc["name"] = String(RELAY_NAMES[i]) + " switches";
+    doc["unique_id"] = String(settings.mqtt_hostname) + "_" + relayId + "_switches";
+    doc["state_topic"] = statsTopic;
+    doc["value_template"] = "{{ value_json.switches }}";
+    doc["json_attributes_topic"] = statsTopic;
+    doc["state_class"] = "total_increasing";
+    doc["entity_category"] = "diagnostic";
+    doc["availability_topic"] = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    doc["icon"] = "mdi:counter";
+    
+    JsonObject device = doc["device"].to<JsonObject>();
+    device["identifiers"][0] = settings.mqtt_hostname;
+    device["name"] = DEVICE_NAME;
+    device["manufacturer"] = DEVICE_MANUFACTURER;
+    device["model"] = DEVICE_MODEL;
+    device["sw_version"] = FIRMWARE_VERSION;
+    
+    publishJson(configTopic.c_str(), doc, true);
+}
+
+// Removes a relay's entity config and its retained state
+void MqttBridge::clearRelayEntity(int i) {
+    String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/switch/" + settings.mqtt_hostname + "_relay" + String(i + 1) + "/config";
+    String stateTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/relay" + String(i + 1) + "/state";
+    publish(configTopic.c_str(), "", true);
+    publish(stateTopic.c_str(), "", true);
+    
+    if (RELAY_STATS_SENSORS) {
+        String sensorTopic = String(MQTT_DISCOVERY_PREFIX) + "/sensor/" + settings.mqtt_hostname + "_relay" + String(i + 1) + "_switches/config";
+        String statsTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/relay" + String(i + 1) + "/stats";
+        publish(sensorTopic.c_str(), "", true);
+        publish(statsTopic.c_str(), "", true);
+    }
+}
+
+void MqttBridge::publishEntityDiscovery() {
+    String availTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/availability";
+    
+    LOGI("[MQTT] Publishing discovery for %d relays", settings.activeRelayCount);
+    
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        publishRelayEntityConfig(i);
+    
+        // Keep connection alive during discovery
+        yield();
+        client.loop();
+        delay(50);  // Small delay to prevent broker overflow
+    }
+    
+    // Publish RF Trigger discovery for each learned code (binary sensors that auto-reset)
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        if (rfCodes.get(i).active && rfCodes.get(i).code != 0) {
+            StaticJsonDocument<1024> doc;
+    
+            // Create safe entity ID from name (lowercase, no spaces)
+            String entityId = String(rfCodes.get(i).name);
+            entityId.toLowerCase();
+            entityId.replace(" ", "_");
+            entityId.replace("-", "_");
+    
+            String uniqueId = String(settings.mqtt_hostname) + "_rf_" + entityId;
+            String stateTopic = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname + "/rf_" + String(i) + "/state";
+            String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/binary_sensor/" + settings.mqtt_hostname + "_rf_" + String(i) + "/config";
+    
+            doc["name"] = String("RF ") + rfCodes.get(i).name;
+            doc["unique_id"] = uniqueId;
+            doc["state_topic"] = stateTopic;
+            doc["availability_topic"] = availTopic;
+            doc["payload_on"] = "ON";
+            doc["payload_off"] = "OFF";
+            doc["device_class"] = "motion";
+            doc["icon"] = "mdi:remote";
+            doc["off_delay"] = 2;  // Auto-off after 2 seconds
+    
+            JsonObject device = doc["device"].to<JsonObject>();
+            device["identifiers"][0] = settings.mqtt_hostname;
+            device["name"] = DEVICE_NAME;
+            device["manufacturer"] = DEVICE_MANUFACTURER;
+            device["model"] = DEVICE_MODEL;
+            device["sw_version"] = FIRMWARE_VERSION;
+    
+            publishJson(configTopic.c_str(), doc, true);
+    
+            // Keep connection alive during discovery
+            yield();
+            client.loop();
+            delay(50);
+    
+            LOGI("[MQTT] RF '%s' discovery published (slot %d)", rfCodes.get(i).name, i);
+        }
+    }
+    
+    if (rfCodes.count() > 0) {
+        LOGI("[MQTT] Published %d RF trigger entities", rfCodes.count());
+    }
+    
+    LOGI("[MQTT] Discovery complete for %d relays", settings.activeRelayCount);
+}
+
+// JSON pool the device document needs
+size_t MqttBridge::deviceDiscoveryCapacity() const {
+    // ~320 bytes of pool per component (members plus copied strings), ~80 more for a value_template
+    size_t componentSize = settings.aggregateState ? 400 : 320;
+    if (RELAY_STATS_SENSORS) {
+        componentSize += 360;  // Switch count sensor per relay
+    }
+    return 1024 + (max(settings.activeRelayCount, staleRelayCount) + rfCodes.count()) * componentSize;
+}
+
+// Device mode selected and its document small enough to build in one piece
+bool MqttBridge::useDeviceDiscovery() const {
+    if (!settings.deviceDiscovery) return false;
+    size_t capacity = deviceDiscoveryCapacity();
+    if (capacity > MQTT_DEVICE_DISCOVERY_MAX_BYTES) {
+        LOGW("[MQTT] Device discovery needs %u bytes - publishing entities instead", (unsigned)capacity);
+        return false;
+    }
+    return true;
+}
+
+// false if nothing was published (no heap for the document, or the publish failed)
+bool MqttBridge::publishDeviceDiscovery() {
+    String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/device/" + settings.mqtt_hostname + "/config";
+    
+    // Abbreviated keys and the "~" base topic keep the payload compact
+    DynamicJsonDocument doc(deviceDiscoveryCapacity());
+    if (doc.capacity() == 0) {
+        LOGE("[MQTT] No heap for the %u byte device discovery document", (unsigned)deviceDiscoveryCapacity());
+        return false;
+    }
+    doc["~"] = String(MQTT_TOPIC_PREFIX) + settings.mqtt_hostname;
+    
+    JsonObject device = doc.createNestedObject("dev");
+    device["ids"] = settings.mqtt_hostname;
+    device["name"] = DEVICE_NAME;
+    device["mf"] = DEVICE_MANUFACTURER;
+    device["mdl"] = DEVICE_MODEL;
+    device["sw"] = FIRMWARE_VERSION;
+    
+    JsonObject origin = doc.createNestedObject("o");
+    origin["name"] = DEVICE_NAME;
+    origin["sw"] = FIRMWARE_VERSION;
+    
+    doc["avty_t"] = "~/availability";
+    
+    JsonObject components = doc.createNestedObject("cmps");
+    
+    for (int i = 0; i < settings.activeRelayCount; i++) {
+        String relayId = "relay" + String(i + 1);
+        JsonObject cmp = components.createNestedObject(String(settings.mqtt_hostname) + "_" + relayId);
+        cmp["p"] = "switch";
+        cmp["name"] = RELAY_NAMES[i];
+        cmp["uniq_id"] = String(settings.mqtt_hostname) + "_" + relayId;
+        if (settings.aggregateState) {
+            cmp["stat_t"] = "~/state";
+            cmp["val_tpl"] = aggregateTemplate(i);
+        } else {
+            cmp["stat_t"] = "~/" + relayId + "/state";
+        }
+        cmp["cmd_t"] = "~/" + relayId + "/set";
+        cmp["ic"] = "mdi:electric-switch";
+    
+        if (RELAY_STATS_SENSORS) {
+            JsonObject sensor = components.createNestedObject(String(settings.mqtt_hostname) + "_" + relayId + "_switches");
+            sensor["p"] = "sensor";
+            sensor["name"] = String(RELAY_NAMES[i]) + " switches";
+            sensor["uniq_id"] = String(settings.mqtt_hostname) + "_" + relayId + "_switches";
+            sensor["stat_t"] = "~/" + relayId + "/stats";
+            sensor["val_tpl"] = "{{ value_json.switches }}";
+            sensor["json_attr_t"] = "~/" + relayId + "/stats";
+            sensor["stat_cla"] = "total_increasing";
+            sensor["ent_cat"] = "diagnostic";
+            sensor["ic"] = "mdi:counter";
+        }
+    }
+    
+    // Relays dropped by a count change: a platform-only entry removes the entity
+    for (int i = settings.activeRelayCount; i < staleRelayCount; i++) {
+        JsonObject cmp = components.createNestedObject(String(settings.mqtt_hostname) + "_relay" + String(i + 1));
+        cmp["p"] = "switch";
+        if (RELAY_STATS_SENSORS) {
+            components.createNestedObject(String(settings.mqtt_hostname) + "_relay" + String(i + 1) + "_switches")["p"] = "sensor";
+        }
+    }
+    
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        if (rfCodes.get(i).active && rfCodes.get(i).code != 0) {
+            String entityId = String(rfCodes.get(i).name);
+            entityId.toLowerCase();
+            entityId.replace(" ", "_");
+            entityId.replace("-", "_");
+    
+            JsonObject cmp = components.createNestedObject(String(settings.mqtt_hostname) + "_rf_" + String(i));
+            cmp["p"] = "binary_sensor";
+            cmp["name"] = String("RF ") + rfCodes.get(i).name;
+            cmp["uniq_id"] = String(settings.mqtt_hostname) + "_rf_" + entityId;
+            cmp["stat_t"] = "~/rf_" + String(i) + "/state";
+            cmp["dev_cla"] = "motion";
+            cmp["ic"] = "mdi:remote";
+            cmp["off_dly"] = 2;  // Auto-off after 2 seconds
+        }
+    }
+    
+    if (doc.overflowed()) {
+        LOGE("[MQTT] Device discovery document overflowed");
+        return false;
+    }
+    
+    size_t payloadLength = measureJson(doc);
+    if (!publishJson(configTopic.c_str(), doc, true)) {
+        LOGE("[MQTT] Device discovery publish failed (%u bytes)", (unsigned)payloadLength);
+        return false;
+    }
+    
+    LOGI("[MQTT] Device discovery published (%u bytes, %d relays, %d RF codes)",
+         (unsigned)payloadLength, settings.activeRelayCount, rfCodes.count());
+    return true;
+}
+
+/*
+ * Runtime Relay Count Change
+ * 
+ * Only the difference is published: entity mode adds or removes one config
+ * per affected relay, device mode republishes the single device config with
+ * removal entries for dropped relays. A count that makes the device config
+ * too large switches to entity mode (and back) through publishDiscovery(). Relay outputs are not touched. If MQTT
+ * is down, the change is applied by the discovery publish on reconnect.
+ */
+void MqttBridge::applyRelayCount(int newCount) {
+    int oldCount = settings.activeRelayCount;
+    if (newCount == oldCount) return;
+    
+    settings.activeRelayCount = newCount;
+    storage.saveActiveRelayCount(newCount);
+    if (newCount < oldCount) {
+        staleRelayCount = max(staleRelayCount, oldCount);
+    }
+    LOGI("[MQTT] Active relays %d -> %d", oldCount, newCount);
+    
+    if (!client.connected()) {
+        discoveryPublished = false;  // connect() publishes discovery, including removals
+        return;
+    }
+    
+    // The count can move the device document across MQTT_DEVICE_DISCOVERY_MAX_BYTES, and its
+    // publish can run out of heap - either way the mode changes, which needs the full migration
+    bool device = useDeviceDiscovery();
+    if (device != (settings.lastDiscoveryMode == 1) || (device && !publishDeviceDiscovery())) {
+        publishDiscovery();
+    } else {
+        for (int i = newCount; i < staleRelayCount; i++) {
+            clearRelayEntity(i);
+            yield();
+            client.loop();
+        }
+        staleRelayCount = 0;
+        if (!device) {
+            for (int i = oldCount; i < newCount; i++) {
+                publishRelayEntityConfig(i);
+                yield();
+                client.loop();
+            }
+        }
+    }
+    
+    // New relays need their current state
+    for (int i = oldCount; i < newCount; i++) {
+        publishState(i);
+    }
+}
+
+// Remove every per-entity config this device may have published
+void MqttBridge::clearEntityDiscovery() {
+    LOGI("[MQTT] Clearing per-entity discovery configs");
+    
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/switch/" + settings.mqtt_hostname + "_relay" + String(i + 1) + "/config";
+        publish(configTopic.c_str(), "", true);
+        if (RELAY_STATS_SENSORS) {
+            String sensorTopic = String(MQTT_DISCOVERY_PREFIX) + "/sensor/" + settings.mqtt_hostname + "_relay" + String(i + 1) + "_switches/config";
+            publish(sensorTopic.c_str(), "", true);
+        }
+        yield();
+        client.loop();
+    }
+    
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/binary_sensor/" + settings.mqtt_hostname + "_rf_" + String(i) + "/config";
+        publish(configTopic.c_str(), "", true);
+        yield();
+        client.loop();
+    }
+}
+
+// Remove the device-based config this device may have published
+void MqttBridge::clearDeviceDiscovery() {
+    String configTopic = String(MQTT_DISCOVERY_PREFIX) + "/device/" + settings.mqtt_hostname + "/config";
+    publish(configTopic.c_str(), "", true);
+}
@@ -0,0 +1,410 @@
+#include "mqtt_tls.h"
+
+#if MQTT_TLS
+
+#include <WiFi.h>
+#include <errno.h>
+#include <esp_attr.h>
+#include <lwip/sockets.h>
+#include <unistd.h>
+#include "crc32.h"
+#include "log_buffer.h"
+
+MqttTls mqttTls;
+
+#if MQTT_TLS_SESSION_RTC
+// Kept across software restarts and deep sleep, garbage after power-on - hence the magic and CRC
+struct RtcSession {
+    uint32_t magic;
+    uint32_t crc;               // Over everything after it
+    uint16_t port;
+    uint16_t length;
+    char host[40];
+    uint8_t data[MQTT_TLS_RTC_BYTES];
+};
+static RTC_NOINIT_ATTR RtcSession rtcSession;
+static const uint32_t RTC_SESSION_MAGIC = 0x544C5331;  // "TLS1"
+
+static uint32_t rtcSessionCrc() {
+    const uint8_t* start = (const uint8_t*)&rtcSession.port;
+    return crc32Update(0, start, offsetof(RtcSession, data) - offsetof(RtcSession, port) + rtcSession.length);
+}
+#endif
+
+MqttTls::MqttTls() : ready(false), offered(0), failures(0), lastHandshakeMillis(0), lastResumed(false) {
+    memset(handshakes, 0, sizeof(handshakes));
+    memset(handshakeMillis, 0, sizeof(handshakeMillis));
+}
+
+bool MqttTls::begin(const uint8_t* pem, size_t length) {
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    mbedtls_x509_crt_init(&ca);
+    mbedtls_ssl_config_init(&conf);
+    
+    // The PEM parser wants the terminating NUL counted in the length
+    uint8_t* text = (uint8_t*)malloc(length + 1);
+    if (!text) {
+        return false;
+    }
+    memcpy(text, pem, length);
+    text[length] = '\0';
+    int ret = mbedtls_x509_crt_parse(&ca, text, length + 1);
+    free(text);
+    if (ret != 0) {
+        LOGE("[TLS] CA certificate parse failed: -0x%04x", (unsigned)-ret);
+        return false;
+    }
+    
+    ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy, (const unsigned char*)DEVICE_NAME,
+                                strlen(DEVICE_NAME));
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(&conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                          MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret != 0) {
+        LOGE("[TLS] Setup failed: -0x%04x", (unsigned)-ret);
+        return false;
+    }
+    mbedtls_ssl_conf_authmode(&conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    mbedtls_ssl_conf_ca_chain(&conf, &ca, nullptr);
+    mbedtls_ssl_conf_rng(&conf, mbedtls_ctr_drbg_random, &drbg);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+    
+    ready = true;
+    LOGI("[TLS] CA chain loaded (%u bytes)", (unsigned)length);
+    return true;
+}
+
+void MqttTls::recordHandshake(bool resumed, bool offeredSession, uint32_t elapsed) {
+    int kind = resumed ? TLS_HANDSHAKE_RESUMED : TLS_HANDSHAKE_FULL;
+    handshakes[kind]++;
+    handshakeMillis[kind] += elapsed;
+    if (offeredSession) {
+        offered++;
+    }
+    lastHandshakeMillis = elapsed;
+    lastResumed = resumed;
+}
+
+float MqttTls::hitRate() const {
+    return offered ? (float)handshakes[TLS_HANDSHAKE_RESUMED] / offered : 0.0f;
+}
+
+void MqttTls::writePrometheus(Print& out) const {
+    static const char* const KINDS[TLS_HANDSHAKE_KIND_COUNT] = {"full", "resumed"};
+    out.print("# HELP relay_mqtt_tls_handshake_seconds Broker TLS handshakes, full or resumed session\n");
+    out.print("# TYPE relay_mqtt_tls_handshake_seconds summary\n");
+    for (int kind = 0; kind < TLS_HANDSHAKE_KIND_COUNT; kind++) {
+        out.printf("relay_mqtt_tls_handshake_seconds_sum{kind=\"%s\"} %.3f\n", KINDS[kind],
+                   handshakeMillis[kind] / 1e3);
+        out.printf("relay_mqtt_tls_handshake_seconds_count{kind=\"%s\"} %u\n", KINDS[kind],
+                   (unsigned)handshakes[kind]);
+    }
+    out.print("# HELP relay_mqtt_tls_sessions_offered_total Handshakes that offered a cached session\n");
+    out.print("# TYPE relay_mqtt_tls_sessions_offered_total counter\n");
+    out.printf("relay_mqtt_tls_sessions_offered_total %u\n", (unsigned)offered);
+    out.print("# TYPE relay_mqtt_tls_failures_total counter\n");
+    out.printf("relay_mqtt_tls_failures_total %u\n", (unsigned)failures);
+}
+
+// ---------------------------------------------------------------------------
+// TlsClient
+// ---------------------------------------------------------------------------
+TlsClient::TlsClient(bool persistent)
+    : fd(-1), peeked(-1), persistent(persistent), haveSession(false), sessionPort(0),
+      timeoutMs(MQTT_TLS_HANDSHAKE_TIMEOUT_MS) {
+    mbedtls_ssl_init(&ssl);
+    mbedtls_ssl_session_init(&session);
+    sessionHost[0] = '\0';
+    if (persistent) {
+        restoreSession();
+    }
+}
+
+TlsClient::~TlsClient() {
+    stop();
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_session_free(&session);
+}
+
+int TlsClient::sendCallback(void* context, const unsigned char* data, size_t length) {
+    int ret = send(((TlsClient*)context)->fd, data, length, 0);
+    if (ret >= 0) return ret;
+    return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_WRITE : MBEDTLS_ERR_NET_SEND_FAILED;
+}
+
+int TlsClient::recvCallback(void* context, unsigned char* data, size_t length) {
+    int ret = recv(((TlsClient*)context)->fd, data, length, 0);
+    if (ret >= 0) return ret;  // 0 = closed by the broker
+    return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_WANT_READ : MBEDTLS_ERR_NET_RECV_FAILED;
+}
+
+bool TlsClient::waitSocket(bool forWrite, uint32_t deadline) {
+    int32_t remaining = (int32_t)(deadline - millis());
+    if (remaining <= 0) {
+        return false;
+    }
+    fd_set set;
+    FD_ZERO(&set);
+    FD_SET(fd, &set);
+    struct timeval timeout = {remaining / 1000, (remaining % 1000) * 1000};
+    return select(fd + 1, forWrite ? nullptr : &set, forWrite ? &set : nullptr, nullptr, &timeout) > 0;
+}
+
+bool TlsClient::openSocket(const char* host, uint16_t port, uint32_t deadline) {
+    IPAddress address;
+    if (!WiFi.hostByName(host, address)) {
+        LOGW("[TLS] Cannot resolve %s", host);
+        return false;
+    }
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return false;
+    }
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = (uint32_t)address;
+    if (::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        return false;
+    }
+    int error = 0;
+    socklen_t size = sizeof(error);
+    if (!waitSocket(true, deadline) || getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) < 0 || error != 0) {
+        LOGW("[TLS] TCP connect to %s failed", host);
+        return false;
+    }
+    return true;
+}
+
+bool TlsClient::handshake(uint32_t deadline, bool& resumed) {
+    // Stepped by hand to see where the server hello leads: straight to its
+    // ChangeCipherSpec means it took our session, the certificate means it didn't
+    resumed = false;
+    while (ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER) {
+        int before = ssl.state;
+        int ret = mbedtls_ssl_handshake_step(&ssl);
+        if (before == MBEDTLS_SSL_SERVER_HELLO && ssl.state != MBEDTLS_SSL_SERVER_HELLO) {
+            resumed = ssl.state == MBEDTLS_SSL_SERVER_CHANGE_CIPHER_SPEC;
+        }
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            if (!waitSocket(ret == MBEDTLS_ERR_SSL_WANT_WRITE, deadline)) {
+                LOGW("[TLS] Handshake timed out");
+                return false;
+            }
+        } else if (ret != 0) {
+            uint32_t flags = mbedtls_ssl_get_verify_result(&ssl);
+            LOGW("[TLS] Handshake failed: -0x%04x (verify flags 0x%x)", (unsigned)-ret, (unsigned)flags);
+            return false;
+        }
+    }
+    return true;
+}
+
+int TlsClient::connect(IPAddress ip, uint16_t port) {
+    return connect(ip.toString().c_str(), port);
+}
+
+int TlsClient::connect(const char* host, uint16_t port) {
+    stop();
+    if (!mqttTls.isReady()) {
+        LOGW("[TLS] No CA certificate - not connecting");
+        return 0;
+    }
+    uint32_t deadline = millis() + timeoutMs;
+    if (!openSocket(host, port, deadline)) {
+        mqttTls.failures++;
+        stop();
+        return 0;
+    }
+    
+    int ret = mbedtls_ssl_setup(&ssl, mqttTls.config());
+    if (ret == 0) {
+        ret = mbedtls_ssl_set_hostname(&ssl, host);  // SNI, and the name the certificate must carry
+    }
+    bool offer = haveSession && port == sessionPort && strcmp(host, sessionHost) == 0;
+    if (ret == 0 && offer && mbedtls_ssl_set_session(&ssl, &session) != 0) {
+        offer = false;
+        dropSession();
+    }
+    mbedtls_ssl_set_bio(&ssl, this, sendCallback, recvCallback, nullptr);
+    
+    uint32_t start = millis();
+    bool resumed = false;
+    if (ret != 0 || !handshake(deadline, resumed)) {
+        mqttTls.failures++;
+        // An offered session may be what the broker choked on - the next attempt goes without it
+        if (offer) {
+            dropSession();
+        }
+        stop();
+        return 0;
+    }
+    uint32_t elapsed = millis() - start;
+    mqttTls.recordHandshake(resumed, offer, elapsed);
+    LOGI("[TLS] %s handshake in %u ms", resumed ? "Resumed" : "Full", (unsigned)elapsed);
+    
+    // A resumed session may come with a fresh ticket - keep whatever is current
+    keepSession(host, port);
+    return 1;
+}
+
+size_t TlsClient::write(uint8_t b) {
+    return write(&b, 1);
+}
+
+size_t TlsClient::write(const uint8_t* data, size_t length) {
+    if (fd < 0) {
+        return 0;
+    }
+    uint32_t deadline = millis() + timeoutMs;
+    size_t written = 0;
+    while (written < length) {
+        int ret = mbedtls_ssl_write(&ssl, data + written, length - written);
+        if (ret > 0) {
+            written += ret;
+        } else if ((ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) &&
+                   waitSocket(ret == MBEDTLS_ERR_SSL_WANT_WRITE, deadline)) {
+            continue;
+        } else {
+            stop();
+            break;
+        }
+    }
+    return written;
+}
+
+int TlsClient::available() {
+    if (fd < 0) {
+        return 0;
+    }
+    // A zero-length read processes a waiting record without consuming data
+    int ret = mbedtls_ssl_read(&ssl, nullptr, 0);
+    if (ret < 0 && ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        stop();
+        return peeked >= 0 ? 1 : 0;
+    }
+    return mbedtls_ssl_get_bytes_avail(&ssl) + (peeked >= 0 ? 1 : 0);
+}
+
+int TlsClient::read() {
+    uint8_t b;
+    return read(&b, 1) == 1 ? b : -1;
+}
+
+int TlsClient::read(uint8_t* data, size_t length) {
+    if (length == 0) {
+        return 0;
+    }
+    size_t count = 0;
+    if (peeked >= 0) {
+        data[count++] = (uint8_t)peeked;
+        peeked = -1;
+    }
+    if (fd < 0 || count == length) {
+        return count ? (int)count : -1;
+    }
+    int ret = mbedtls_ssl_read(&ssl, data + count, length - count);
+    if (ret > 0) {
+        count += ret;
+    } else if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+        stop();  // Closed (0 / close notify) or broken
+    }
+    return count ? (int)count : -1;
+}
+
+int TlsClient::peek() {
+    if (peeked < 0 && available() > 0) {
+        uint8_t b;
+        if (mbedtls_ssl_read(&ssl, &b, 1) == 1) {
+            peeked = b;
+        }
+    }
+    return peeked;
+}
+
+void TlsClient::stop() {
+    if (fd >= 0) {
+        if (ssl.state == MBEDTLS_SSL_HANDSHAKE_OVER) {
+            mbedtls_ssl_close_notify(&ssl);
+        }
+        close(fd);
+        fd = -1;
+    }
+    peeked = -1;
+    
+    // Frees the 2 x 16 KB record buffers between connections
+    mbedtls_ssl_free(&ssl);
+    mbedtls_ssl_init(&ssl);
+}
+
+uint8_t TlsClient::connected() {
+    if (fd >= 0) {
+        available();  // Notices a close or reset
+    }
+    return fd >= 0 || peeked >= 0;
+}
+
+void TlsClient::keepSession(const char* host, uint16_t port) {
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    haveSession = mbedtls_ssl_get_session(&ssl, &session) == 0;
+    if (!haveSession) {
+        return;
+    }
+    snprintf(sessionHost, sizeof(sessionHost), "%s", host);
+    sessionPort = port;
+    
+#if MQTT_TLS_SESSION_RTC
+    if (persistent) {
+        size_t length = 0;
+        rtcSession.magic = 0;
+        if (mbedtls_ssl_session_save(&session, rtcSession.data, sizeof(rtcSession.data), &length) != 0) {
+            LOGW("[TLS] Session doesn't fit MQTT_TLS_RTC_BYTES - kept in RAM only");
+            return;
+        }
+        rtcSession.port = port;
+        rtcSession.length = length;
+        snprintf(rtcSession.host, sizeof(rtcSession.host), "%s", host);
+        rtcSession.crc = rtcSessionCrc();
+        rtcSession.magic = RTC_SESSION_MAGIC;
+    }
+#endif
+}
+
+void TlsClient::dropSession() {
+    mbedtls_ssl_session_free(&session);
+    mbedtls_ssl_session_init(&session);
+    haveSession = false;
+#if MQTT_TLS_SESSION_RTC
+    if (persistent) {
+        rtcSession.magic = 0;
+    }
+#endif
+}
+
+void TlsClient::restoreSession() {
+#if MQTT_TLS_SESSION_RTC
+    if (rtcSession.magic != RTC_SESSION_MAGIC || rtcSession.length > sizeof(rtcSession.data) ||
+        rtcSession.crc != rtcSessionCrc()) {
+        return;
+    }
+    if (mbedtls_ssl_session_load(&session, rtcSession.data, rtcSession.length) != 0) {
+        dropSession();
+        return;
+    }
+    haveSession = true;
+    snprintf(sessionHost, sizeof(sessionHost), "%s", rtcSession.host);
+    sessionPort = rtcSession.port;
+#endif
+}
+
+#endif
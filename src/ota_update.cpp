@@ -0,0 +1,172 @@
+#include "ota_update.h"
+#include <Update.h>
+#include "crc32.h"
+#include "log_buffer.h"
+
+#ifndef NATIVE_BUILD
+#include <esp_ota_ops.h>
+#endif
+
+OtaUpdate::OtaUpdate(Storage& storage)
+    : storage(storage), owner(nullptr), target(OTA_FIRMWARE), total(0), received(0), crc(0), expectedCrc(0),
+      onTrial(false), trialStartMillis(0), completed(0), failed(0) {
+    lastError[0] = '\0';
+}
+
+const char* OtaUpdate::targetName(int target) {
+    return target == OTA_FILESYSTEM ? "filesystem" : "firmware";
+}
+
+bool OtaUpdate::fail(const char* message, const char* detail) {
+    snprintf(lastError, sizeof(lastError), "%s%s%s", message, detail[0] ? ": " : "", detail);
+    // lastError is rewritten by the next update - it has to be the copied (first) string
+    LOGE("[OTA] Update failed: %s (%s)", lastError, targetName(target));
+    if (Update.isRunning()) {
+        Update.abort();
+    }
+    owner = nullptr;
+    failed++;
+    return false;
+}
+
+bool OtaUpdate::begin(const void* request, OtaTarget updateTarget, size_t size, uint32_t checksum) {
+    if (owner != nullptr) {
+        snprintf(lastError, sizeof(lastError), "Another update is in progress");
+        return false;
+    }
+    
+    target = updateTarget;
+    if (!Update.begin(size, target == OTA_FILESYSTEM ? U_SPIFFS : U_FLASH)) {
+        return fail("Cannot start", Update.errorString());
+    }
+    
+    owner = request;
+    total = size;
+    received = 0;
+    crc = 0;
+    expectedCrc = checksum;
+    lastError[0] = '\0';
+    LOGI("[OTA] %s update started (%u bytes)", targetName(target), (unsigned)size);
+    return true;
+}
+
+bool OtaUpdate::write(const void* request, const uint8_t* data, size_t len, size_t index) {
+    if (!isOwner(request)) {
+        return false;
+    }
+    if (index != received || received + len > total) {
+        return fail("Chunk out of order");
+    }
+    
+    // Update::write() takes a non-const buffer but only copies from it
+    if (Update.write((uint8_t*)data, len) != len) {
+        return fail("Flash write", Update.errorString());
+    }
+    crc = crc32Update(crc, data, len);
+    received += len;
+    return true;
+}
+
+bool OtaUpdate::end(const void* request) {
+    if (!isOwner(request)) {
+        return false;
+    }
+    if (received != total) {
+        return fail("Upload incomplete");
+    }
+    if (crc != expectedCrc) {
+        char detail[32];
+        snprintf(detail, sizeof(detail), "got %08x", (unsigned)crc);
+        return fail("CRC mismatch", detail);
+    }
+    // For firmware this also validates the image and selects it for the next boot
+    if (!Update.end()) {
+        return fail("Cannot commit", Update.errorString());
+    }
+    
+    if (target == OTA_FIRMWARE) {
+        storage.saveOtaTrial(true, 0);
+    }
+    owner = nullptr;
+    completed++;
+    LOGI("[OTA] %s update complete (%u bytes, crc %08x)", targetName(target), (unsigned)total, (unsigned)crc);
+    return true;
+}
+
+// Upload dropped (client disconnected) - the partition written so far is never used
+void OtaUpdate::abort(const void* request) {
+    if (isOwner(request)) {
+        fail("Upload aborted");
+    }
+}
+
+void OtaUpdate::checkBoot() {
+    if (!storage.isOtaTrial()) {
+        return;
+    }
+    
+    int boots = storage.getOtaTrialBoots();
+    if (boots >= OTA_TRIAL_BOOTS) {
+        LOGE("[OTA] New firmware failed to come up in %d boots", boots);
+        rollBack();
+        return;
+    }
+    storage.saveOtaTrial(true, boots + 1);
+    onTrial = true;
+    trialStartMillis = millis();
+    LOGW("[OTA] Running new firmware on trial (boot %d of %d)", boots + 1, OTA_TRIAL_BOOTS);
+}
+
+void OtaUpdate::loop(bool healthy) {
+    if (!onTrial) {
+        return;
+    }
+    
+    if (healthy) {
+        onTrial = false;
+        storage.saveOtaTrial(false, 0);
+#ifndef NATIVE_BUILD
+        esp_ota_mark_app_valid_cancel_rollback();
+#endif
+        LOGI("[OTA] New firmware passed its health check after %u ms", (unsigned)(millis() - trialStartMillis));
+    } else if (millis() - trialStartMillis > OTA_HEALTH_TIMEOUT_MS) {
+        LOGE("[OTA] New firmware not healthy after %u s", (unsigned)(OTA_HEALTH_TIMEOUT_MS / 1000));
+        rollBack();
+    }
+}
+
+// Boots the other app partition - the firmware that was running before the update
+void OtaUpdate::rollBack() {
+    onTrial = false;
+    storage.saveOtaTrial(false, 0);
+#ifndef NATIVE_BUILD
+    esp_ota_img_states_t state;
+    if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) == ESP_OK &&
+        state == ESP_OTA_IMG_PENDING_VERIFY) {
+        esp_ota_mark_app_invalid_rollback_and_reboot();  // Doesn't return on success
+    }
+    const esp_partition_t* previous = esp_ota_get_next_update_partition(NULL);
+    if (previous == nullptr || esp_ota_set_boot_partition(previous) != ESP_OK) {
+        LOGE("[OTA] No previous firmware to roll back to - keeping this one");
+        return;
+    }
+    LOGW("[OTA] Rolling back to %s", previous->label);
+#endif
+    delay(100);  // Let the log drain
+    ESP.restart();
+}
+
+void OtaUpdate::writeJson(Print& out) const {
+#ifndef NATIVE_BUILD
+    const char* partition = esp_ota_get_running_partition()->label;
+#else
+    const char* partition = "native";
+#endif
+    out.printf("{\"partition\":\"%s\",\"trial\":%s,\"updating\":%s", partition, onTrial ? "true" : "false",
+               owner ? "true" : "false");
+    if (owner) {
+        out.printf(",\"target\":\"%s\",\"received\":%u,\"total\":%u", targetName(target),
+                   (unsigned)received, (unsigned)total);
+    }
+    out.printf(",\"completed\":%u,\"failed\":%u,\"last_error\":\"%s\"}", (unsigned)completed, (unsigned)failed, lastError);
+}
@@ -0,0 +1,141 @@
+#include "pulse_decoder.h"
+
+// rc-switch 2.6.4 protocol table, in the same order so protocol numbers match
+const PulseProfile PulseDecoder::BUILTIN_PROFILES[] = {
+    {  1, 350, {  1,  31 }, {  1,  3 }, {  3,  1 }, false },
+    {  2, 650, {  1,  10 }, {  1,  2 }, {  2,  1 }, false },
+    {  3, 100, { 30,  71 }, {  4, 11 }, {  9,  6 }, false },
+    {  4, 380, {  1,   6 }, {  1,  3 }, {  3,  1 }, false },
+    {  5, 500, {  6,  14 }, {  1,  2 }, {  2,  1 }, false },
+    {  6, 450, { 23,   1 }, {  1,  2 }, {  2,  1 }, true  },  // HT6P20B
+    {  7, 150, {  2,  62 }, {  1,  6 }, {  6,  1 }, false },  // HS2303-PT
+    {  8, 200, {  3, 130 }, {  7, 16 }, {  3, 16 }, false },  // Conrad RS-200 RX
+    {  9, 200, { 130,  7 }, { 16,  7 }, { 16,  3 }, true  },  // Conrad RS-200 TX
+    { 10, 365, { 18,   1 }, {  3,  1 }, {  1,  3 }, true  },  // 1ByOne doorbell
+    { 11, 270, { 36,   1 }, {  1,  2 }, {  2,  1 }, true  },  // HT12E
+    { 12, 320, { 36,   1 }, {  1,  2 }, {  2,  1 }, true  },  // SM5212
+};
+const int PulseDecoder::BUILTIN_PROFILE_COUNT = sizeof(BUILTIN_PROFILES) / sizeof(BUILTIN_PROFILES[0]);
+
+static inline uint32_t diff(uint32_t a, uint32_t b) {
+    return a > b ? a - b : b - a;
+}
+
+PulseDecoder::PulseDecoder()
+    : profileCount(0), minPulseUs(RF_MIN_PULSE_US), changeCount(0), repeatCount(0), pending(0), mergeNext(false),
+      receivedValue(0), receivedBitlength(0), receivedDelay(0), receivedProtocol(0),
+      pulses(0), glitches(0), frames(0) {
+    for (int i = 0; i < BUILTIN_PROFILE_COUNT; i++) {
+        addProfile(BUILTIN_PROFILES[i]);
+    }
+}
+
+bool PulseDecoder::addProfile(const PulseProfile& profile) {
+    if (profileCount >= RF_MAX_PROFILES || max(profile.sync[0], profile.sync[1]) == 0) {
+        return false;
+    }
+    profiles[profileCount++] = profile;
+    return true;
+}
+
+void PulseDecoder::reset() {
+    changeCount = 0;
+    repeatCount = 0;
+    pending = 0;
+    mergeNext = false;
+}
+
+void PulseDecoder::feed(uint32_t durationUs) {
+    pulses++;
+    
+    if (durationUs < minPulseUs) {
+        // Spike of the other level: it and the pulse after it belong to the held-back pulse
+        glitches++;
+        pending += durationUs;
+        mergeNext = true;
+        return;
+    }
+    if (mergeNext) {
+        pending += durationUs;
+        mergeNext = false;
+        return;
+    }
+    
+    if (pending != 0) {
+        processPulse(pending);
+    }
+    pending = durationUs;
+}
+
+void PulseDecoder::feed(const uint16_t* durations, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        feed(durations[i]);
+    }
+}
+
+void PulseDecoder::flush() {
+    if (pending != 0) {
+        processPulse(pending);
+    }
+    pending = 0;
+    mergeNext = false;
+}
+
+// rc-switch's handleInterrupt(), with the duration handed in instead of measured
+void PulseDecoder::processPulse(uint32_t duration) {
+    if (duration > RF_SEPARATION_LIMIT_US) {
+        // A gap - decode once the same gap shows up again (senders repeat with a fixed gap)
+        if (repeatCount == 0 || diff(duration, timings[0]) < 200) {
+            repeatCount++;
+            if (repeatCount == 2) {
+                for (int i = 0; i < profileCount; i++) {
+                    if (decodeFrame(profiles[i])) {
+                        frames++;
+                        break;
+                    }
+                }
+                repeatCount = 0;
+            }
+        }
+        changeCount = 0;
+    }
+    
+    if (changeCount >= RF_MAX_CHANGES) {
+        changeCount = 0;
+        repeatCount = 0;
+    }
+    
+    timings[changeCount++] = duration;
+}
+
+bool PulseDecoder::decodeFrame(const PulseProfile& profile) {
+    // Shorter frames than 4 bits are noise - no remote sends them
+    if (changeCount <= 7) {
+        return false;
+    }
+    
+    const unsigned int syncLength = max(profile.sync[0], profile.sync[1]);
+    const uint32_t delay = timings[0] / syncLength;
+    const uint32_t tolerance = delay * RF_PULSE_TOLERANCE / 100;
+    const unsigned int firstData = profile.inverted ? 2 : 1;
+    
+    unsigned long code = 0;
+    for (unsigned int i = firstData; i < changeCount - 1; i += 2) {
+        code <<= 1;
+        if (diff(timings[i], delay * profile.zero[0]) < tolerance &&
+            diff(timings[i + 1], delay * profile.zero[1]) < tolerance) {
+            // Zero
+        } else if (diff(timings[i], delay * profile.one[0]) < tolerance &&
+                   diff(timings[i + 1], delay * profile.one[1]) < tolerance) {
+            code |= 1;
+        } else {
+            return false;
+        }
+    }
+    
+    receivedValue = code;
+    receivedBitlength = (changeCount - 1) / 2;
+    receivedDelay = delay;
+    receivedProtocol = profile.protocol;
+    return true;
+}
@@ -0,0 +1,71 @@
+#include "reconnect_policy.h"
+
+ReconnectPolicy reconnectPolicy;
+
+ReconnectPolicy::ReconnectPolicy(const ReconnectTiming& timing)
+    : timing(timing), lastCheck(0), reconnecting(false), reconnectStart(0), apMode(false), lastApRetry(0),
+      lastMqttAttempt(0) {
+}
+
+void ReconnectPolicy::begin(uint32_t now) {
+    lastCheck = now;
+    reconnecting = false;
+    apMode = false;
+}
+
+uint32_t ReconnectPolicy::checkWiFi(uint32_t now, bool stationConnected, int apClients) {
+    if (now - lastCheck < timing.checkInterval) {
+        return RECONNECT_NONE;
+    }
+    lastCheck = now;
+    
+    // Connected: the IP event ends a reconnect / AP mode
+    if (stationConnected) {
+        return RECONNECT_NONE;
+    }
+    
+    // Still waiting for the IP event, up to the timeout
+    if (reconnecting) {
+        if (now - reconnectStart <= timing.reconnectTimeout) {
+            return RECONNECT_NONE;
+        }
+        reconnecting = false;
+        apMode = true;
+        lastApRetry = now;
+        return RECONNECT_START_AP;
+    }
+    
+    if (apMode) {
+        // Someone is on the AP (setting up WiFi?) - the interval starts once they leave
+        if (apClients > 0) {
+            lastApRetry = now;
+            return RECONNECT_NONE;
+        }
+        if (now - lastApRetry < timing.reconnectInterval) {
+            return RECONNECT_NONE;
+        }
+        lastApRetry = now;
+        reconnecting = true;
+        reconnectStart = now;
+        return RECONNECT_AP_RETRY;
+    }
+    
+    reconnecting = true;
+    reconnectStart = now;
+    return RECONNECT_WIFI_BEGIN;
+}
+
+bool ReconnectPolicy::stationConnected() {
+    reconnecting = false;
+    bool leaveAp = apMode;
+    apMode = false;
+    return leaveAp;
+}
+
+bool ReconnectPolicy::mqttAttemptDue(uint32_t now) {
+    if (now - lastMqttAttempt < timing.mqttRetryInterval) {
+        return false;
+    }
+    lastMqttAttempt = now;
+    return true;
+}
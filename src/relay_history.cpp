@@ -0,0 +1,285 @@
+#include "relay_history.h"
+
+RelayHistory relayHistory;
+
+static const uint32_t SNAPSHOT_MAGIC = 0x52484953;  // "RHIS"
+static const uint16_t SNAPSHOT_VERSION = 1;
+static const int MAX_ENTRY_BYTES = 11;              // 10 byte varint + relay/state
+
+const char* relaySourceName(uint8_t source) {
+    static const char* const names[RELAY_SOURCE_COUNT] = {
+        "other", "mqtt", "http", "rf", "schedule", "boot", "group", "udp"
+    };
+    return source < RELAY_SOURCE_COUNT ? names[source] : "other";
+}
+
+RelayHistory::RelayHistory()
+    : head(0), used(0), firstSeq(0), nextSeq(0), headTime(0), tailTime(0), clockOffset(0),
+      uptimeHigh(0), lastMillis(0), dropped(0) {
+}
+
+uint64_t RelayHistory::clockLocked(uint32_t now) {
+    // Another task may pass a millis() read just before ours - only a big step back is a wrap
+    if (now < lastMillis) {
+        if (lastMillis - now < 0x80000000UL) {
+            now = lastMillis;
+        } else {
+            uptimeHigh += 0x100000000ULL;
+        }
+    }
+    lastMillis = now;
+    return clockOffset + uptimeHigh + now;
+}
+
+uint64_t RelayHistory::clock(uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    return clockLocked(now);
+}
+
+uint32_t RelayHistory::decode(uint32_t offset, uint64_t& delta, uint8_t& source, uint8_t& relayState) const {
+    uint64_t value = 0;
+    uint32_t length = 0;
+    uint8_t b;
+    do {
+        b = byteAt(offset + length);
+        value |= (uint64_t)(b & 0x7F) << (7 * length);
+        length++;
+    } while ((b & 0x80) && length < MAX_ENTRY_BYTES - 1);
+    
+    source = value & 0x07;
+    delta = value >> 3;
+    relayState = byteAt(offset + length);
+    return length + 1;
+}
+
+void RelayHistory::dropOldest() {
+    uint64_t delta;
+    uint8_t source, relayState;
+    uint32_t length = decode(head, delta, source, relayState);
+    head = (head + length) % RELAY_HISTORY_BYTES;
+    used -= length;
+    firstSeq++;
+    dropped++;
+    
+    // The new oldest entry's delta is relative to the one just dropped
+    if (used > 0) {
+        decode(head, delta, source, relayState);
+        headTime += delta;
+    }
+}
+
+void RelayHistory::append(uint64_t time, uint8_t relay, bool state, uint8_t source) {
+    if (used > 0 && time < tailTime) {
+        time = tailTime;
+    }
+    
+    uint8_t entry[MAX_ENTRY_BYTES];
+    uint64_t value = ((used > 0 ? time - tailTime : 0) << 3) | (source & 0x07);
+    uint32_t length = 0;
+    while (value >= 0x80) {
+        entry[length++] = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    entry[length++] = (uint8_t)value;
+    entry[length++] = (state ? 0x80 : 0) | relay;
+    
+    while (used + length > RELAY_HISTORY_BYTES) {
+        dropOldest();
+    }
+    if (used == 0) {
+        headTime = time;
+    }
+    for (uint32_t i = 0; i < length; i++) {
+        ring[(head + used + i) % RELAY_HISTORY_BYTES] = entry[i];
+    }
+    used += length;
+    tailTime = time;
+    nextSeq++;
+}
+
+void RelayHistory::record(const RelayControl::Mask& changed, const RelayControl::Mask& states, RelaySource source,
+                          uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    uint64_t time = clockLocked(now);
+    for (int w = 0; w < RelayControl::Mask::WORDS; w++) {
+        for (uint32_t bits = changed.words[w]; bits; bits &= bits - 1) {
+            int i = w * 32 + __builtin_ctz(bits);
+            append(time, i, states.test(i), source);
+        }
+    }
+}
+
+RelayHistory::Cursor RelayHistory::begin() const {
+    Cursor cursor;
+    cursor.seq = 0;
+    cursor.offset = 0;
+    cursor.time = 0;
+    cursor.started = false;
+    return cursor;
+}
+
+bool RelayHistory::next(Cursor& cursor, uint64_t since, uint64_t until, int relay, RelayHistoryEntry& entry) const {
+    std::lock_guard<std::mutex> guard(lock);
+    
+    // Not started yet, or the entries it pointed at were dropped meanwhile
+    if (!cursor.started || (int32_t)(cursor.seq - firstSeq) < 0) {
+        cursor.seq = firstSeq;
+        cursor.offset = head;
+        cursor.started = true;
+    }
+    
+    while (cursor.seq != nextSeq) {
+        uint64_t delta;
+        uint8_t source, relayState;
+        uint32_t length = decode(cursor.offset, delta, source, relayState);
+        uint64_t time = cursor.seq == firstSeq ? headTime : cursor.time + delta;
+        cursor.time = time;
+        cursor.offset = (cursor.offset + length) % RELAY_HISTORY_BYTES;
+        cursor.seq++;
+    
+        if (time > until) {
+            cursor.seq = nextSeq;  // Entries are in time order - nothing later matches
+            return false;
+        }
+        if (time < since || (relay >= 0 && (relayState & 0x7F) != relay)) {
+            continue;
+        }
+        entry.time = time;
+        entry.relay = relayState & 0x7F;
+        entry.state = (relayState & 0x80) != 0;
+        entry.source = source;
+        return true;
+    }
+    return false;
+}
+
+uint32_t RelayHistory::getCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return nextSeq - firstSeq;
+}
+
+uint32_t RelayHistory::getUsedBytes() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return used;
+}
+
+size_t RelayHistory::snapshotSize() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return sizeof(RelayHistorySnapshot) + used;
+}
+
+size_t RelayHistory::writeSnapshot(Print& out, uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    
+    RelayHistorySnapshot header;
+    memset(&header, 0, sizeof(header));
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.relayCount = NUM_RELAYS;
+    header.used = used;
+    header.count = nextSeq - firstSeq;
+    header.headTime = headTime;
+    header.tailTime = tailTime;
+    header.savedTime = max(tailTime, clockLocked(now));
+    
+    size_t written = out.write((const uint8_t*)&header, sizeof(header));
+    uint32_t first = min(used, RELAY_HISTORY_BYTES - head);
+    written += out.write(ring + head, first);
+    written += out.write(ring, used - first);
+    return written;
+}
+
+bool RelayHistory::restoreSnapshot(const uint8_t* data, size_t length) {
+    RelayHistorySnapshot header;
+    if (length < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION || header.relayCount != NUM_RELAYS ||
+        header.used > RELAY_HISTORY_BYTES || length < sizeof(header) + header.used) {
+        return false;
+    }
+    
+    std::lock_guard<std::mutex> guard(lock);
+    
+    // Entries recorded since boot (the relay state restore) move behind the saved ones
+    uint32_t liveUsed = used;
+    uint32_t liveCount = nextSeq - firstSeq;
+    uint64_t liveTime = headTime;
+    uint8_t* live = new uint8_t[liveUsed + 1];
+    for (uint32_t i = 0; i < liveUsed; i++) {
+        live[i] = byteAt(head + i);
+    }
+    uint64_t liveOffset = clockOffset;
+    
+    memcpy(ring, data + sizeof(header), header.used);
+    head = 0;
+    used = header.used;
+    firstSeq = 0;
+    nextSeq = header.count;
+    headTime = header.headTime;
+    tailTime = header.tailTime;
+    clockOffset = header.savedTime;
+    
+    // Re-append through the live copy - it decodes like the ring, just never wraps
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < liveCount; i++) {
+        uint64_t value = 0;
+        uint32_t n = 0;
+        uint8_t b;
+        do {
+            b = live[offset + n];
+            value |= (uint64_t)(b & 0x7F) << (7 * n);
+            n++;
+        } while (b & 0x80);
+        uint8_t relayState = live[offset + n];
+        offset += n + 1;
+    
+        if (i > 0) {
+            liveTime += value >> 3;
+        }
+        append(liveTime - liveOffset + clockOffset, relayState & 0x7F, relayState & 0x80, value & 0x07);
+    }
+    delete[] live;
+    return true;
+}
+
+RelayHistoryQuery::RelayHistoryQuery(const RelayHistory& history, uint64_t now, uint64_t since, uint64_t until,
+                                     int relay)
+    : history(history), cursor(history.begin()), now(now), since(since), until(until), relay(relay), stage(0),
+      first(true), lineLength(0), linePosition(0) {
+}
+
+size_t RelayHistoryQuery::read(uint8_t* buffer, size_t maxLength) {
+    size_t length = 0;
+    while (length < maxLength) {
+        if (linePosition < lineLength) {
+            size_t n = min((size_t)(lineLength - linePosition), maxLength - length);
+            memcpy(buffer + length, line + linePosition, n);
+            linePosition += n;
+            length += n;
+            continue;
+        }
+    
+        int n = 0;
+        RelayHistoryEntry entry;
+        if (stage == 0) {
+            n = snprintf(line, sizeof(line), "{\"now\":%llu,\"count\":%u,\"dropped\":%u,\"entries\":[",
+                         (unsigned long long)now, (unsigned)history.getCount(), (unsigned)history.getDropped());
+            stage = 1;
+        } else if (stage == 1 && history.next(cursor, since, until, relay, entry)) {
+            n = snprintf(line, sizeof(line), "%s{\"t\":%llu,\"relay\":%u,\"state\":%u,\"source\":\"%s\"}",
+                         first ? "" : ",", (unsigned long long)entry.time, (unsigned)entry.relay + 1,
+                         (unsigned)entry.state, relaySourceName(entry.source));
+            first = false;
+        } else if (stage == 1) {
+            n = snprintf(line, sizeof(line), "]}");
+            stage = 2;
+        } else {
+            break;
+        }
+        lineLength = n;
+        linePosition = 0;
+    }
+    return length;
+}
@@ -0,0 +1,162 @@
+#include "relay_stats.h"
+
+RelayStats relayStats;
+
+RelayStats::RelayStats() : trackedMillis(0), foldMillis(0), lastCheckpointMillis(0) {
+    memset(switches, 0, sizeof(switches));
+    memset(onMillis, 0, sizeof(onMillis));
+    memset(onSinceMillis, 0, sizeof(onSinceMillis));
+    memset(lastChangeMillis, 0, sizeof(lastChangeMillis));
+}
+
+void RelayStats::restore(const RelayStatsRecord& saved) {
+    std::lock_guard<std::mutex> guard(lock);
+    trackedMillis = (uint64_t)saved.trackedSeconds * 1000;
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        switches[i] = saved.switches[i];
+        onMillis[i] = (uint64_t)saved.onSeconds[i] * 1000;
+    }
+}
+
+void RelayStats::begin(const RelayControl::Mask& states, uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    onMask = states;
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        onSinceMillis[i] = now;
+    }
+    foldMillis = now;
+    lastCheckpointMillis = now;
+}
+
+void RelayStats::record(const RelayControl::Mask& changed, const RelayControl::Mask& states, uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    for (int w = 0; w < RelayControl::Mask::WORDS; w++) {
+        for (uint32_t bits = changed.words[w]; bits; bits &= bits - 1) {
+            int i = w * 32 + __builtin_ctz(bits);
+            switches[i]++;
+            lastChangeMillis[i] = now ? now : 1;
+            if (states.test(i)) {
+                onSinceMillis[i] = now;
+            } else if (onMask.test(i)) {
+                onMillis[i] += now - onSinceMillis[i];
+            }
+        }
+    }
+    onMask = states;
+}
+
+// Moves everything up to now into the totals (lock held)
+void RelayStats::fold(uint32_t now) {
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        if (onMask.test(i)) {
+            onMillis[i] += now - onSinceMillis[i];
+            onSinceMillis[i] = now;
+        }
+    }
+    trackedMillis += now - foldMillis;
+    foldMillis = now;
+}
+
+void RelayStats::snapshot(RelayStatsRecord& out, uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    fold(now);
+    lastCheckpointMillis = now;
+    
+    out.count = NUM_RELAYS;
+    out.reserved = 0;
+    out.trackedSeconds = trackedMillis / 1000;
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        out.switches[i] = switches[i];
+        out.onSeconds[i] = onMillis[i] / 1000;
+    }
+}
+
+void RelayStats::reset(uint32_t now) {
+    std::lock_guard<std::mutex> guard(lock);
+    memset(switches, 0, sizeof(switches));
+    memset(onMillis, 0, sizeof(onMillis));
+    memset(lastChangeMillis, 0, sizeof(lastChangeMillis));
+    for (int i = 0; i < NUM_RELAYS; i++) {
+        onSinceMillis[i] = now;
+    }
+    trackedMillis = 0;
+    foldMillis = now;
+}
+
+uint32_t RelayStats::onSecondsLocked(int relayIndex, uint32_t now) const {
+    uint64_t total = onMillis[relayIndex];
+    if (onMask.test(relayIndex)) {
+        total += now - onSinceMillis[relayIndex];
+    }
+    return total / 1000;
+}
+
+uint32_t RelayStats::trackedSecondsLocked(uint32_t now) const {
+    return (trackedMillis + (now - foldMillis)) / 1000;
+}
+
+float RelayStats::dutyCycleLocked(int relayIndex, uint32_t now) const {
+    uint32_t tracked = trackedSecondsLocked(now);
+    return tracked ? (float)onSecondsLocked(relayIndex, now) / tracked : 0.0f;
+}
+
+bool RelayStats::checkpointDue(uint32_t now) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return now - lastCheckpointMillis >= RELAY_STATS_CHECKPOINT_MS;
+}
+
+uint32_t RelayStats::getSwitches(int relayIndex) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return switches[relayIndex];
+}
+
+uint32_t RelayStats::getOnSeconds(int relayIndex, uint32_t now) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return onSecondsLocked(relayIndex, now);
+}
+
+uint32_t RelayStats::getTrackedSeconds(uint32_t now) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return trackedSecondsLocked(now);
+}
+
+float RelayStats::getDutyCycle(int relayIndex, uint32_t now) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return dutyCycleLocked(relayIndex, now);
+}
+
+uint32_t RelayStats::getLastChange(int relayIndex) const {
+    std::lock_guard<std::mutex> guard(lock);
+    return lastChangeMillis[relayIndex];
+}
+
+void RelayStats::writeJson(Print& out, int count, uint32_t now) const {
+    std::lock_guard<std::mutex> guard(lock);
+    out.printf("{\"tracked_s\":%u,\"relays\":[", (unsigned)trackedSecondsLocked(now));
+    for (int i = 0; i < count; i++) {
+        out.printf("%s{\"id\":%d,\"switches\":%u,\"on_s\":%u,\"duty\":%.4f,\"last_change_s\":", i ? "," : "", i + 1,
+                   (unsigned)switches[i], (unsigned)onSecondsLocked(i, now), dutyCycleLocked(i, now));
+        // Seconds ago; null if it hasn't switched since boot
+        if (lastChangeMillis[i]) {
+            out.printf("%u}", (unsigned)((now - lastChangeMillis[i]) / 1000));
+        } else {
+            out.print("null}");
+        }
+    }
+    out.print("]}");
+}
+
+void RelayStats::writePrometheus(Print& out, int count, uint32_t now) const {
+    std::lock_guard<std::mutex> guard(lock);
+    out.print("# TYPE relay_switches_total counter\n");
+    for (int i = 0; i < count; i++) {
+        out.printf("relay_switches_total{relay=\"%d\"} %u\n", i + 1, (unsigned)switches[i]);
+    }
+    out.print("# TYPE relay_on_seconds_total counter\n");
+    for (int i = 0; i < count; i++) {
+        out.printf("relay_on_seconds_total{relay=\"%d\"} %u\n", i + 1, (unsigned)onSecondsLocked(i, now));
+    }
+    out.print("# HELP relay_stats_tracked_seconds Time the relay counters have been running\n");
+    out.print("# TYPE relay_stats_tracked_seconds counter\n");
+    out.printf("relay_stats_tracked_seconds %u\n", (unsigned)trackedSecondsLocked(now));
+}
@@ -0,0 +1,115 @@
+#include "request_body.h"
+
+RequestBodyPool requestBodies;
+
+RequestBodyPool::RequestBodyPool() : nextEvicted(0), tooLarge(0), busy(0), timedOut(0), outOfOrder(0) {
+    for (Slot& slot : slots) {
+        slot.owner = nullptr;
+    }
+    for (const void*& owner : evicted) {
+        owner = nullptr;
+    }
+}
+
+int RequestBodyPool::find(const void* owner) const {
+    for (int i = 0; i < HTTP_BODY_SLOTS; i++) {
+        if (slots[i].owner == owner) return i;
+    }
+    return -1;
+}
+
+int RequestBodyPool::acquire(const void* owner, size_t total) {
+    int free = find(nullptr);
+    if (free < 0) {
+        // A client that stopped sending mid-body shouldn't hold a slot forever
+        uint32_t now = millis();
+        for (int i = 0; i < HTTP_BODY_SLOTS; i++) {
+            if (now - slots[i].lastChunkMillis > HTTP_BODY_TIMEOUT_MS) {
+                free = i;
+                break;
+            }
+        }
+        if (free < 0) return -1;
+        // Told on its next chunk, if one ever comes
+        evicted[nextEvicted] = slots[free].owner;
+        nextEvicted = (nextEvicted + 1) % HTTP_BODY_SLOTS;
+        timedOut++;
+    }
+    
+    Slot& slot = slots[free];
+    slot.owner = owner;
+    slot.total = total;
+    slot.received = 0;
+    slot.lastChunkMillis = millis();
+    return free;
+}
+
+BodyStatus RequestBodyPool::append(const void* owner, const uint8_t* data, size_t len, size_t index, size_t total,
+                                   char*& body, size_t& length) {
+    if (index == 0) {
+        if (total > HTTP_BODY_MAX_BYTES) {
+            tooLarge++;
+            return BODY_TOO_LARGE;
+        }
+        if (len == total) {
+            // Whole body in one segment - the common case, no copy
+            body = (char*)data;
+            length = len;
+            return BODY_COMPLETE;
+        }
+        if (acquire(owner, total) < 0) {
+            busy++;
+            return BODY_BUSY;
+        }
+    }
+    
+    int found = find(owner);
+    if (found < 0) {
+        for (const void*& entry : evicted) {
+            if (entry == owner) {
+                entry = nullptr;
+                return BODY_EVICTED;
+            }
+        }
+        return BODY_IGNORED;
+    }
+    
+    Slot& slot = slots[found];
+    if (index != slot.received || index + len > slot.total) {
+        release(owner);
+        outOfOrder++;
+        return BODY_OUT_OF_ORDER;
+    }
+    memcpy(slot.data + index, data, len);
+    slot.received += len;
+    slot.lastChunkMillis = millis();
+    
+    if (slot.received < slot.total) {
+        return BODY_PARTIAL;
+    }
+    slot.data[slot.total] = '\0';
+    body = slot.data;
+    length = slot.total;
+    return BODY_COMPLETE;
+}
+
+void RequestBodyPool::release(const void* owner) {
+    int found = find(owner);
+    if (found >= 0) {
+        slots[found].owner = nullptr;
+    }
+    // The request is gone - its address may come back as a new request
+    for (const void*& entry : evicted) {
+        if (entry == owner) {
+            entry = nullptr;
+        }
+    }
+}
+
+int RequestBodyPool::slotsInUse() const {
+    int count = 0;
+    for (const Slot& slot : slots) {
+        if (slot.owner != nullptr) count++;
+    }
+    return count;
+}
@@ -0,0 +1,56 @@
+#include "rf_codes.h"
+
+RFCodeStore::RFCodeStore() {
+    clear();
+}
+
+void RFCodeStore::clear() {
+    memset(codes, 0, sizeof(codes));
+    codeCount = 0;
+}
+
+int RFCodeStore::add(const char* name, unsigned long code, unsigned int bitLength, unsigned int protocol) {
+    if (codeCount >= MAX_RF_CODES) {
+        return -1;  // Array full
+    }
+    
+    // Find first empty slot
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        if (!codes[i].active) {
+            codes[i].active = true;
+            strncpy(codes[i].name, name, sizeof(codes[i].name) - 1);
+            codes[i].name[sizeof(codes[i].name) - 1] = '\0';
+            codes[i].code = code;
+            codes[i].bitLength = bitLength;
+            codes[i].protocol = protocol;
+            codes[i].lastTrigger = 0;
+            codeCount++;
+            return i;
+        }
+    }
+    
+    return -1;  // Should never reach here
+}
+
+bool RFCodeStore::remove(int slot) {
+    if (slot >= 0 && slot < MAX_RF_CODES && codes[slot].active) {
+        codes[slot].active = false;
+        codes[slot].code = 0;
+        codeCount--;
+        return true;
+    }
+    return false;
+}
+
+// Returns the first slot matching the received frame, or -1
+int RFCodeStore::match(unsigned long code, unsigned int bitLength, unsigned int protocol) const {
+    for (int i = 0; i < MAX_RF_CODES; i++) {
+        if (codes[i].active && 
+            codes[i].code == code && 
+            codes[i].bitLength == bitLength && 
+            codes[i].protocol == protocol) {
+            return i;
+        }
+    }
+    return -1;
+}
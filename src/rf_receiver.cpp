@@ -0,0 +1,78 @@
+#include "rf_receiver.h"
+#include "log_buffer.h"
+
+#ifndef NATIVE_BUILD
+#include <driver/rmt.h>
+#endif
+
+RmtRFReceiver::RmtRFReceiver() : started(false), lastCaptureLength(0), lastCaptureMillis(0) {
+#ifndef NATIVE_BUILD
+    ringbuf = nullptr;
+#endif
+}
+
+bool RmtRFReceiver::begin(int pin) {
+#ifndef NATIVE_BUILD
+    rmt_config_t config = RMT_DEFAULT_CONFIG_RX((gpio_num_t)pin, (rmt_channel_t)RF_RMT_CHANNEL);
+    config.clk_div = 80;  // 80 MHz APB -> 1 us ticks
+    config.mem_block_num = RF_RMT_MEM_BLOCKS;
+    config.rx_config.filter_en = true;
+    config.rx_config.filter_ticks_thresh = 255;  // Hardware glitch filter, in APB ticks (~3 us)
+    config.rx_config.idle_threshold = RF_RMT_IDLE_US;
+    
+    if (rmt_config(&config) != ESP_OK ||
+        rmt_driver_install(config.channel, RF_RMT_RINGBUF_BYTES, 0) != ESP_OK ||
+        rmt_get_ringbuf_handle(config.channel, &ringbuf) != ESP_OK) {
+        LOGE("[RF] RMT receiver setup failed on GPIO %d", pin);
+        return false;
+    }
+    rmt_rx_start(config.channel, true);
+    started = true;
+#endif
+    return started;
+}
+
+// Drains finished captures - never waits
+void RmtRFReceiver::poll() {
+#ifndef NATIVE_BUILD
+    if (!started) return;
+    
+    size_t length = 0;
+    rmt_item32_t* items;
+    while ((items = (rmt_item32_t*)xRingbufferReceive(ringbuf, &length, 0)) != nullptr) {
+        uint16_t durations[RF_TRACE_MAX_PULSES];
+        size_t count = 0;
+        for (size_t i = 0; i < length / sizeof(rmt_item32_t) && count + 2 <= RF_TRACE_MAX_PULSES; i++) {
+            // duration1 == 0 marks the end of the capture
+            durations[count++] = items[i].duration0;
+            if (items[i].duration1 == 0) break;
+            durations[count++] = items[i].duration1;
+        }
+        vRingbufferReturnItem(ringbuf, items);
+        feedCapture(durations, count);
+    }
+#endif
+}
+
+void RmtRFReceiver::feedCapture(const uint16_t* durations, size_t count) {
+    decoder.feed(durations, count);
+    // The line went idle for longer than any gap - that ends the last pulse
+    decoder.feed(RF_RMT_IDLE_US);
+    decoder.flush();
+    
+    // Anything shorter can't hold a frame plus its confirming repeat
+    if (count >= 16) {
+        lastCaptureLength = min(count, (size_t)RF_TRACE_MAX_PULSES);
+        memcpy(lastCapture, durations, lastCaptureLength * sizeof(uint16_t));
+        lastCaptureMillis = millis();
+    }
+}
+
+void RmtRFReceiver::writeTrace(Print& out) const {
+    out.printf("# RF capture, %u pulses, %u ms ago\n", (unsigned)lastCaptureLength,
+               (unsigned)(lastCaptureLength ? millis() - lastCaptureMillis : 0));
+    out.print("# Alternating-level pulse durations in us\n");
+    for (size_t i = 0; i < lastCaptureLength; i++) {
+        out.printf("%u%c", (unsigned)lastCapture[i], (i % 16 == 15 || i + 1 == lastCaptureLength) ? '\n' : ' ');
+    }
+}
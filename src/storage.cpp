@@ -0,0 +1,349 @@
+#include "storage.h"
+#include <stddef.h>
+#include "metrics.h"
+#include "log_buffer.h"
+#include "crc32.h"
+#include "relay_stats.h"
+
+static const char* const RECORD_KEYS[2] = {"cfg_a", "cfg_b"};
+static const size_t PAYLOAD_OFFSET = offsetof(ConfigRecord, mqttConfigured);
+
+static_assert(sizeof(ConfigRecord) <= 0xFFFF, "ConfigRecord length must fit its 16-bit header field");
+
+static uint32_t recordCrc(const ConfigRecord& record) {
+    return crc32Update(0, (const uint8_t*)&record + PAYLOAD_OFFSET, record.length - PAYLOAD_OFFSET);
+}
+
+// Defaults for a fresh device, and for fields an older record doesn't cover
+static void defaultRecord(ConfigRecord& record) {
+    memset((void*)&record, 0, sizeof(record));  // Padding too - the CRC covers it
+    record.magic = CONFIG_RECORD_MAGIC;
+    record.version = CONFIG_RECORD_VERSION;
+    record.length = sizeof(ConfigRecord);
+    record.deviceDiscovery = MQTT_DEVICE_DISCOVERY;
+    record.lastDiscoveryMode = -1;
+    record.aggregateState = MQTT_AGGREGATE_STATE;
+    record.activeRelayCount = NUM_RELAYS;
+    strcpy(record.mqtt_port, "1883");
+    strcpy(record.mqtt_hostname, "esp32-relay");
+}
+
+Storage::Storage(Preferences& prefs) : preferences(prefs), liveSlot(-1) {
+    defaultRecord(record);
+}
+
+// Record written by newer firmware (after a downgrade): longer than ours, so
+// it is checked as a whole and the leading fields this firmware knows are kept
+bool Storage::readNewerRecord(int slot, size_t length, ConfigRecord& out) {
+    uint8_t* blob = new uint8_t[length];
+    bool valid = preferences.getBytes(RECORD_KEYS[slot], blob, length) == length;
+    if (valid) {
+        memcpy((void*)&out, blob, sizeof(out));
+        valid = out.magic == CONFIG_RECORD_MAGIC && out.length == length && out.version > CONFIG_RECORD_VERSION &&
+                out.crc == crc32Update(0, blob + PAYLOAD_OFFSET, length - PAYLOAD_OFFSET);
+    }
+    delete[] blob;
+    if (!valid) {
+        LOGW("[Storage] Config record %s rejected (%u bytes)", RECORD_KEYS[slot], (unsigned)length);
+        return false;
+    }
+    LOGW("[Storage] Config record %s is v%u from newer firmware - its newer fields are dropped on the next save",
+         RECORD_KEYS[slot], (unsigned)out.version);
+    return true;
+}
+
+// Expects the namespace to be open; out holds defaults beyond the stored length
+bool Storage::readRecord(int slot, ConfigRecord& out) {
+    defaultRecord(out);
+    size_t length = preferences.getBytes(RECORD_KEYS[slot], &out, sizeof(out));
+    size_t newer = length ? 0 : preferences.getBytesLength(RECORD_KEYS[slot]);  // 0 if it didn't fit
+    if (newer > sizeof(out)) {
+        if (!readNewerRecord(slot, newer, out)) return false;
+    } else {
+        if (length < PAYLOAD_OFFSET || out.magic != CONFIG_RECORD_MAGIC || out.length != length) {
+            return false;
+        }
+        // A newer version that didn't grow the record would break the append-only rule
+        if (out.version > CONFIG_RECORD_VERSION || out.crc != recordCrc(out)) {
+            LOGW("[Storage] Config record %s rejected (version %u, %u bytes)",
+                 RECORD_KEYS[slot], (unsigned)out.version, (unsigned)length);
+            return false;
+        }
+    }
+    
+    // Upgraded in memory, written back in the current layout on the next save
+    out.version = CONFIG_RECORD_VERSION;
+    out.length = sizeof(ConfigRecord);
+    return true;
+}
+
+// Lock held
+void Storage::writeRecord() {
+    int slot = liveSlot == 0 ? 1 : 0;
+    record.sequence++;
+    record.crc = recordCrc(record);
+    
+    preferences.begin(PREFS_NAMESPACE, false);
+    size_t written = preferences.putBytes(RECORD_KEYS[slot], &record, sizeof(record));
+    preferences.end();
+    metrics.nvsCommits++;
+    
+    if (written == sizeof(record)) {
+        liveSlot = slot;
+    } else {
+        // The other slot still holds the previous copy
+        LOGE("[Storage] Config record write to %s failed", RECORD_KEYS[slot]);
+    }
+}
+
+// Expects the namespace to be open; fills record from the pre-record keys
+void Storage::migrateLegacyKeys() {
+    record.activeRelayCount = preferences.getInt("active_count", NUM_RELAYS);
+    record.deviceDiscovery = preferences.getBool("disc_mode", MQTT_DEVICE_DISCOVERY);
+    record.lastDiscoveryMode = preferences.getInt("disc_last", -1);
+    
+    String saved_server = preferences.getString("mqtt_server", "");
+    if (saved_server.length() > 0) {
+        record.mqttConfigured = 1;
+        saved_server.toCharArray(record.mqtt_server, 40);
+        preferences.getString("mqtt_port", "1883").toCharArray(record.mqtt_port, 6);
+        preferences.getString("mqtt_user", "").toCharArray(record.mqtt_user, 40);
+        preferences.getString("mqtt_pass", "").toCharArray(record.mqtt_password, 40);
+        preferences.getString("mqtt_hostname", "esp32-relay").toCharArray(record.mqtt_hostname, 40);
+    }
+    
+    if (preferences.getBytesLength("rf_codes") == sizeof(record.rfCodes)) {
+        preferences.getBytes("rf_codes", record.rfCodes, sizeof(record.rfCodes));
+        record.rfCount = preferences.getInt("rf_count", 0);
+    } else {
+        // Oldest format: a single code in three keys
+        unsigned long oldCode = preferences.getULong("rf_code", 0);
+        if (oldCode != 0) {
+            RFCode& slot = record.rfCodes[0];
+            strcpy(slot.name, "RF Signal 1");
+            slot.code = oldCode;
+            slot.bitLength = preferences.getUInt("rf_bits", 0);
+            slot.protocol = preferences.getUInt("rf_proto", 0);
+            slot.active = true;
+            record.rfCount = 1;
+            LOGI("[RF] Migrated old single code to slot 0");
+        }
+    }
+}
+
+void Storage::applySettings(Settings& settings) const {
+    // Clamped in case the firmware was built for a smaller board since it was saved
+    settings.activeRelayCount = constrain((int)record.activeRelayCount, 1, NUM_RELAYS);
+    settings.deviceDiscovery = record.deviceDiscovery != 0;
+    settings.lastDiscoveryMode = record.lastDiscoveryMode;
+    settings.aggregateState = record.aggregateState != 0;
+    LOGI("[Storage] Active relay count: %d", settings.activeRelayCount);
+    
+    // Saved MQTT settings override the hardcoded defaults
+    if (record.mqttConfigured) {
+        memcpy(settings.mqtt_server, record.mqtt_server, sizeof(settings.mqtt_server));
+        memcpy(settings.mqtt_port, record.mqtt_port, sizeof(settings.mqtt_port));
+        memcpy(settings.mqtt_user, record.mqtt_user, sizeof(settings.mqtt_user));
+        memcpy(settings.mqtt_password, record.mqtt_password, sizeof(settings.mqtt_password));
+        memcpy(settings.mqtt_hostname, record.mqtt_hostname, sizeof(settings.mqtt_hostname));
+        LOGI("[Storage] MQTT settings loaded from preferences");
+        LOGI("[Storage] MQTT hostname: %s", settings.mqtt_hostname);
+    } else {
+        LOGI("[Storage] Using hardcoded MQTT settings");
+    }
+}
+
+void Storage::load(Settings& settings, RelayControl& relays, RFCodeStore& rfCodes) {
+    static_assert(sizeof(record.rfCodes) == sizeof(RFCode) * MAX_RF_CODES, "RF table layout mismatch");
+    
+    preferences.begin(PREFS_NAMESPACE, true);  // Read-only mode
+    
+    // Newest valid copy wins (sequence compared modulo 2^32)
+    ConfigRecord candidate;
+    liveSlot = -1;
+    for (int slot = 0; slot < 2; slot++) {
+        if (readRecord(slot, candidate) &&
+            (liveSlot < 0 || (int32_t)(candidate.sequence - record.sequence) > 0)) {
+            record = candidate;
+            liveSlot = slot;
+        }
+    }
+    
+    bool migrate = liveSlot < 0;
+    if (migrate) {
+        defaultRecord(record);
+        migrateLegacyKeys();
+    }
+    
+    RelayControl::Mask states;
+    bool legacyStates = preferences.getBytes("relay_mask", states.words, RelayControl::Mask::BYTES) != RelayControl::Mask::BYTES;
+    if (legacyStates) {
+        // Older firmware stored one bool per relay ("relay0".."relay15")
+        states = RelayControl::Mask();
+        for (int i = 0; i < NUM_RELAYS && i < 16; i++) {
+            String key = "relay" + String(i);
+            states.set(i, preferences.getBool(key.c_str(), false));  // Default to OFF if not found
+        }
+    }
+    
+    // Relay counters, kept out of the record like the states (relay_stats.h)
+    RelayStatsRecord stats;
+    if (preferences.getBytes("relay_stats", &stats, sizeof(stats)) == sizeof(stats) && stats.count == NUM_RELAYS) {
+        relayStats.restore(stats);
+    }
+    
+    preferences.end();
+    
+    relays.setMask(states, RelayControl::ALL_MASK, RELAY_SOURCE_BOOT);
+    LOGI("[Storage] Relay states restored (%d of %d ON)", states.count(), NUM_RELAYS);
+    if (legacyStates) {
+        saveRelayStates(relays);  // So later boots find the mask
+    }
+    
+    applySettings(settings);
+    
+    memcpy(rfCodes.table(), record.rfCodes, rfCodes.tableSize());
+    rfCodes.setCount(record.rfCount);
+    if (rfCodes.count() > 0) {
+        LOGI("[RF] Restored %d codes from preferences", rfCodes.count());
+        for (int i = 0; i < MAX_RF_CODES; i++) {
+            if (rfCodes.get(i).active) {
+                LOGI("[RF]   %d '%s': %u", i, rfCodes.get(i).name, (unsigned)rfCodes.get(i).code);
+            }
+        }
+    }
+    
+    if (migrate) {
+        // One-time conversion; the old keys go once the record is safely written
+        writeRecord();
+        if (liveSlot >= 0) {
+            static const char* const legacyKeys[] = {
+                "active_count", "disc_mode", "disc_last", "mqtt_server", "mqtt_port", "mqtt_user",
+                "mqtt_pass", "mqtt_hostname", "rf_codes", "rf_count", "rf_code", "rf_bits", "rf_proto"
+            };
+            preferences.begin(PREFS_NAMESPACE, false);
+            for (const char* key : legacyKeys) {
+                if (preferences.isKey(key)) {
+                    preferences.remove(key);
+                }
+            }
+            preferences.end();
+            LOGI("[Storage] Settings migrated to config record v%d", CONFIG_RECORD_VERSION);
+        }
+    } else {
+        LOGI("[Storage] Config record v%u loaded from %s (sequence %u)",
+             (unsigned)CONFIG_RECORD_VERSION, RECORD_KEYS[liveSlot], (unsigned)record.sequence);
+    }
+}
+
+void Storage::saveMqttSettings(const Settings& settings, bool savePassword) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.mqttConfigured = 1;
+    memcpy(record.mqtt_server, settings.mqtt_server, sizeof(record.mqtt_server));
+    memcpy(record.mqtt_port, settings.mqtt_port, sizeof(record.mqtt_port));
+    memcpy(record.mqtt_user, settings.mqtt_user, sizeof(record.mqtt_user));
+    memcpy(record.mqtt_hostname, settings.mqtt_hostname, sizeof(record.mqtt_hostname));
+    if (savePassword) {
+        memcpy(record.mqtt_password, settings.mqtt_password, sizeof(record.mqtt_password));
+    }
+    writeRecord();
+}
+
+void Storage::saveActiveRelayCount(int count) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.activeRelayCount = count;
+    writeRecord();
+}
+
+void Storage::saveDiscoveryMode(bool deviceDiscovery, bool aggregateState) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.deviceDiscovery = deviceDiscovery;
+    record.aggregateState = aggregateState;
+    writeRecord();
+}
+
+void Storage::saveLastDiscoveryMode(int mode) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.lastDiscoveryMode = mode;
+    writeRecord();
+}
+
+// All relay states as one bitmask blob - a single NVS write for any board size
+void Storage::saveRelayStates(RelayControl& relays) {
+    RelayControl::Mask states = relays.getMask();
+    std::lock_guard<std::mutex> guard(lock);
+    preferences.begin(PREFS_NAMESPACE, false);
+    preferences.putBytes("relay_mask", states.words, RelayControl::Mask::BYTES);
+    preferences.end();
+    metrics.nvsCommits++;
+    LOGI("[Storage] Relay states saved");
+}
+
+// Called every RELAY_STATS_CHECKPOINT_MS and before a planned restart, not per toggle
+void Storage::saveRelayStats() {
+    RelayStatsRecord stats;
+    relayStats.snapshot(stats, millis());
+    std::lock_guard<std::mutex> guard(lock);
+    preferences.begin(PREFS_NAMESPACE, false);
+    preferences.putBytes("relay_stats", &stats, sizeof(stats));
+    preferences.end();
+    metrics.nvsCommits++;
+    LOGD("[Storage] Relay counters saved");
+}
+
+void Storage::saveRFCodes(RFCodeStore& rfCodes) {
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        memcpy(record.rfCodes, rfCodes.table(), sizeof(record.rfCodes));
+        record.rfCount = rfCodes.count();
+        writeRecord();
+    }
+    
+    LOGI("[RF] %d codes saved to preferences", rfCodes.count());
+}
+
+void Storage::saveOtaTrial(bool trial, int boots) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.otaTrial = trial;
+    record.otaTrialBoots = boots;
+    writeRecord();
+}
+
+void Storage::saveGroupConfig(const GroupConfig& config) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.groupConfig = config;
+    writeRecord();
+}
+
+bool Storage::isOtaTrial() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return record.otaTrial != 0;
+}
+
+int Storage::getOtaTrialBoots() const {
+    std::lock_guard<std::mutex> guard(lock);
+    return record.otaTrialBoots;
+}
+
+void Storage::loadGroupConfig(GroupConfig& config) const {
+    std::lock_guard<std::mutex> guard(lock);
+    config = record.groupConfig;
+}
+
+bool Storage::loadUdpKey(uint8_t key[UDP_KEY_BYTES]) const {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!record.udpKeySet) return false;
+    memcpy(key, record.udpKey, UDP_KEY_BYTES);
+    return true;
+}
+
+void Storage::saveUdpKey(const uint8_t* key) {
+    std::lock_guard<std::mutex> guard(lock);
+    record.udpKeySet = key != nullptr;
+    if (key) {
+        memcpy(record.udpKey, key, UDP_KEY_BYTES);
+    } else {
+        memset(record.udpKey, 0, UDP_KEY_BYTES);
+    }
+    writeRecord();
+}
@@ -0,0 +1,309 @@
+#include "udp_control.h"
+
+UdpControl udpControl;
+
+static const size_t REQUEST_SIGNED = UDP_REQUEST_BYTES - UDP_TAG_BYTES;
+static const size_t REPLY_SIGNED = UDP_REPLY_BYTES - UDP_TAG_BYTES;
+
+static void putU16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void putU32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint16_t getU16(const uint8_t* p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t getU32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void putMask(uint8_t* p, const UdpMask& mask) {
+    for (int b = 0; b < UDP_MASK_BYTES; b++) {
+        p[b] = mask.byteAt(b);
+    }
+}
+
+static void getMask(const uint8_t* p, UdpMask& mask) {
+    for (int b = 0; b < UDP_MASK_BYTES; b++) {
+        mask.setByte(b, p[b]);
+    }
+}
+
+static void putHeader(uint8_t* p, uint8_t code, uint16_t client, uint32_t sequence, uint32_t session) {
+    p[0] = UDP_MAGIC_0;
+    p[1] = UDP_MAGIC_1;
+    p[2] = UDP_VERSION;
+    p[3] = code;
+    putU16(p + 4, client);
+    putU32(p + 8, sequence);
+    putU32(p + 12, session);
+}
+
+static void sign(const HmacSha256& key, uint8_t* frame, size_t signedBytes) {
+    uint8_t tag[SHA256_DIGEST_BYTES];
+    key.compute(frame, signedBytes, tag);
+    memcpy(frame + signedBytes, tag, UDP_TAG_BYTES);
+}
+
+static bool verify(const HmacSha256& key, const uint8_t* frame, size_t signedBytes) {
+    uint8_t tag[SHA256_DIGEST_BYTES];
+    key.compute(frame, signedBytes, tag);
+    return HmacSha256::equal(tag, frame + signedBytes, UDP_TAG_BYTES);
+}
+
+static bool validHeader(const uint8_t* frame, size_t size, size_t expected) {
+    return size == expected && frame[0] == UDP_MAGIC_0 && frame[1] == UDP_MAGIC_1 && frame[2] == UDP_VERSION;
+}
+
+void udpEncodeRequest(const HmacSha256& key, const UdpCommand& command, uint8_t frame[UDP_REQUEST_BYTES]) {
+    putHeader(frame, command.op, command.client, command.sequence, command.session);
+    frame[6] = command.scene;
+    frame[7] = 0;
+    putMask(frame + 16, command.select);
+    putMask(frame + 32, command.value);
+    sign(key, frame, REQUEST_SIGNED);
+}
+
+void udpEncodeReply(const HmacSha256& key, const UdpReply& reply, uint8_t frame[UDP_REPLY_BYTES]) {
+    putHeader(frame, reply.status, reply.client, reply.sequence, reply.session);
+    frame[6] = reply.relayCount;
+    frame[7] = 0;
+    putMask(frame + 16, reply.state);
+    sign(key, frame, REPLY_SIGNED);
+}
+
+bool udpDecodeRequest(const HmacSha256& key, const uint8_t* frame, size_t size, UdpCommand& command) {
+    if (!validHeader(frame, size, UDP_REQUEST_BYTES) || !verify(key, frame, REQUEST_SIGNED)) {
+        return false;
+    }
+    command.op = frame[3];
+    command.client = getU16(frame + 4);
+    command.scene = frame[6];
+    command.sequence = getU32(frame + 8);
+    command.session = getU32(frame + 12);
+    getMask(frame + 16, command.select);
+    getMask(frame + 32, command.value);
+    return true;
+}
+
+bool udpDecodeReply(const HmacSha256& key, const uint8_t* frame, size_t size, UdpReply& reply) {
+    if (!validHeader(frame, size, UDP_REPLY_BYTES) || !verify(key, frame, REPLY_SIGNED)) {
+        return false;
+    }
+    reply.status = frame[3];
+    reply.client = getU16(frame + 4);
+    reply.relayCount = frame[6];
+    reply.sequence = getU32(frame + 8);
+    reply.session = getU32(frame + 12);
+    getMask(frame + 16, reply.state);
+    return true;
+}
+
+bool udpParseKey(const char* hex, uint8_t key[UDP_KEY_BYTES]) {
+    if (strlen(hex) != 2 * UDP_KEY_BYTES) return false;
+    for (int i = 0; i < 2 * UDP_KEY_BYTES; i++) {
+        char c = hex[i];
+        int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 :
+                    c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+        if (digit < 0) return false;
+        key[i / 2] = (uint8_t)((i & 1) ? key[i / 2] | digit : digit << 4);
+    }
+    return true;
+}
+
+UdpControl::UdpControl() : enabled(false), session(0), handler(nullptr) {
+    for (Client& c : clients) {
+        c.used = false;
+    }
+    memset(counts, 0, sizeof(counts));
+    memset(ops, 0, sizeof(ops));
+}
+
+void UdpControl::setKey(const uint8_t* keyBytes, size_t size) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (keyBytes) {
+        key.setKey(keyBytes, size);
+    }
+    enabled = keyBytes != nullptr;
+    // Cached replies are signed with the old key, and a client may restart its count
+    for (Client& c : clients) {
+        c.used = false;
+    }
+    session = 0;
+}
+
+// Lock held. Frames signed in the previous session get UDP_STATUS_SESSION from now on
+void UdpControl::newSession() {
+    do {
+        session = esp_random();
+    } while (session == 0);
+}
+
+UdpControl::Client* UdpControl::findClient(uint16_t id) {
+    for (Client& c : clients) {
+        if (c.used && c.id == id) {
+            return &c;
+        }
+    }
+    return nullptr;
+}
+
+UdpControl::Client& UdpControl::addClient(uint16_t id, uint32_t now) {
+    // A free entry, else the one seen longest ago
+    Client* found = &clients[0];
+    uint32_t oldest = 0;
+    for (Client& c : clients) {
+        uint32_t age = c.used ? now - c.seenMillis : UINT32_MAX;
+        if (age > oldest) {
+            found = &c;
+            oldest = age;
+        }
+    }
+    if (found->used) {
+        // Its frames could run again once it is forgotten - unless the session moves on
+        newSession();
+    }
+    found->used = true;
+    found->id = id;
+    return *found;
+}
+
+// Lock held. Answers with the current state only - the command isn't run
+size_t UdpControl::answerState(const UdpCommand& command, UdpReply& result, uint8_t status,
+                               uint8_t reply[UDP_REPLY_BYTES]) {
+    UdpCommand get = command;
+    get.op = UDP_OP_GET;
+    handler(get, result);
+    result.status = status;
+    udpEncodeReply(key, result, reply);
+    return UDP_REPLY_BYTES;
+}
+
+size_t UdpControl::handle(const uint8_t* frame, size_t size, uint32_t now,
+                          uint8_t reply[UDP_REPLY_BYTES]) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (!enabled || handler == nullptr) {
+        counts[UDP_RESULT_DISABLED]++;
+        return 0;
+    }
+    if (!validHeader(frame, size, UDP_REQUEST_BYTES)) {
+        counts[UDP_RESULT_MALFORMED]++;
+        return 0;
+    }
+    UdpCommand command;
+    if (!udpDecodeRequest(key, frame, size, command)) {
+        counts[UDP_RESULT_BAD_TAG]++;
+        return 0;
+    }
+    if (session == 0) {
+        newSession();
+    }
+    
+    UdpReply result;
+    result.client = command.client;
+    result.sequence = command.sequence;
+    result.session = session;
+    result.status = UDP_STATUS_OK;
+    result.relayCount = 0;
+    
+    Client* client = findClient(command.client);
+    if (client && command.sequence == client->sequence) {
+        client->seenMillis = now;
+        counts[UDP_RESULT_RETRY]++;
+        memcpy(reply, client->reply, UDP_REPLY_BYTES);
+        return UDP_REPLY_BYTES;
+    }
+    if (command.session != session) {
+        // Nothing recorded either, so replayed frames can't push clients out of the table
+        counts[UDP_RESULT_SESSION]++;
+        return answerState(command, result, UDP_STATUS_SESSION, reply);
+    }
+    if (client) {
+        client->seenMillis = now;
+        if ((int32_t)(command.sequence - client->sequence) < 0) {
+            // Current state only - the command may be older than ones already run
+            counts[UDP_RESULT_STALE]++;
+            return answerState(command, result, UDP_STATUS_STALE, reply);
+        }
+    } else {
+        client = &addClient(command.client, now);
+        client->seenMillis = now;
+        result.session = session;  // addClient() starts a new one when it evicts
+    }
+    
+    if (command.op < UDP_OP_COUNT) {
+        ops[command.op]++;
+        handler(command, result);
+    } else {
+        // Still answered with the state, and cached like any other command
+        UdpCommand get = command;
+        get.op = UDP_OP_GET;
+        handler(get, result);
+        result.status = UDP_STATUS_BAD_OP;
+    }
+    counts[result.status == UDP_STATUS_OK ? UDP_RESULT_OK : UDP_RESULT_REFUSED]++;
+    
+    udpEncodeReply(key, result, reply);
+    client->sequence = command.sequence;
+    memcpy(client->reply, reply, UDP_REPLY_BYTES);
+    return UDP_REPLY_BYTES;
+}
+
+int UdpControl::clientCount() const {
+    std::lock_guard<std::mutex> guard(lock);
+    int n = 0;
+    for (const Client& c : clients) {
+        if (c.used) n++;
+    }
+    return n;
+}
+
+UdpCounters UdpControl::getCounters() const {
+    std::lock_guard<std::mutex> guard(lock);
+    UdpCounters c;
+    memcpy(c.frames, counts, sizeof(c.frames));
+    memcpy(c.commands, ops, sizeof(c.commands));
+    return c;
+}
+
+const char* UdpControl::opName(int op) {
+    static const char* const names[UDP_OP_COUNT] = {"get", "set", "scene"};
+    return op >= 0 && op < UDP_OP_COUNT ? names[op] : "unknown";
+}
+
+const char* UdpControl::statusName(int status) {
+    static const char* const names[UDP_STATUS_COUNT] = {
+        "ok", "stale", "bad_op", "bad_relay", "bad_scene", "session"
+    };
+    return status >= 0 && status < UDP_STATUS_COUNT ? names[status] : "unknown";
+}
+
+const char* UdpControl::resultName(int result) {
+    static const char* const names[UDP_RESULT_COUNT] = {
+        "ok", "refused", "retry", "stale", "session", "malformed", "bad_tag", "disabled"
+    };
+    return result >= 0 && result < UDP_RESULT_COUNT ? names[result] : "unknown";
+}
+
+void UdpControl::writePrometheus(Print& out) const {
+    UdpCounters c = getCounters();
+    out.print("# HELP relay_udp_frames_total Received UDP control frames by outcome\n");
+    out.print("# TYPE relay_udp_frames_total counter\n");
+    for (int r = 0; r < UDP_RESULT_COUNT; r++) {
+        out.printf("relay_udp_frames_total{result=\"%s\"} %u\n", resultName(r), (unsigned)c.frames[r]);
+    }
+    out.print("# HELP relay_udp_commands_total UDP control commands run, by op\n");
+    out.print("# TYPE relay_udp_commands_total counter\n");
+    for (int op = 0; op < UDP_OP_COUNT; op++) {
+        out.printf("relay_udp_commands_total{op=\"%s\"} %u\n", opName(op), (unsigned)c.commands[op]);
+    }
+    out.print("# TYPE relay_udp_clients gauge\n");
+    out.printf("relay_udp_clients %d\n", clientCount());
+}
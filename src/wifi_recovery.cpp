@@ -0,0 +1,119 @@
+#include "wifi_recovery.h"
+#include "log_buffer.h"
+
+WiFiRecovery wifiRecovery;
+
+WiFiRecovery::WiFiRecovery()
+    : events(0), connectMillis(0), disconnectMillis(0), connected(false), outageStartMillis(0),
+      mdnsRunning(false), mdnsScheduled(false), mdnsDueMillis(0), outages(0), recoveries(0),
+      lastRecoveryMillis(0), maxRecoveryMillis(0), totalRecoveryMillis(0), mdnsRestarts(0) {
+}
+
+void WiFiRecovery::postConnected(uint32_t now) {
+    connectMillis = now;
+    events.fetch_or(EVENT_CONNECTED);
+}
+
+void WiFiRecovery::postDisconnected(uint32_t now) {
+    // Only the first one counts - the station retries and reports each failure
+    if (!(events.load() & EVENT_DISCONNECTED)) {
+        disconnectMillis = now;
+    }
+    events.fetch_or(EVENT_DISCONNECTED);
+}
+
+void WiFiRecovery::requestMdnsRestart() {
+    events.fetch_or(EVENT_MDNS_RESTART);
+}
+
+void WiFiRecovery::scheduleMdns(uint32_t now, bool debounce) {
+    // Every new request pushes a pending restart out - one restart per burst
+    mdnsScheduled = true;
+    mdnsDueMillis = now + (debounce ? MDNS_RESTART_DEBOUNCE_MS : 0);
+}
+
+void WiFiRecovery::onConnected(uint32_t now) {
+    if (!connected && outageStartMillis != 0) {
+        uint32_t elapsed = now - outageStartMillis;
+        recoveries++;
+        lastRecoveryMillis = elapsed;
+        maxRecoveryMillis = max(maxRecoveryMillis, elapsed);
+        totalRecoveryMillis += elapsed;
+        outageStartMillis = 0;
+        LOGI("[WiFi] Recovered after %u ms", (unsigned)elapsed);
+    }
+    connected = true;
+    
+    // New IP: a running responder must re-announce, the first start doesn't wait
+    scheduleMdns(now, mdnsRunning);
+}
+
+void WiFiRecovery::onDisconnected(uint32_t now) {
+    if (connected) {
+        connected = false;
+        outageStartMillis = now ? now : 1;
+        outages++;
+    }
+}
+
+uint32_t WiFiRecovery::poll(uint32_t now) {
+    uint32_t posted = events.exchange(0);
+    uint32_t actions = RECOVERY_NONE;
+    
+    if (posted & (EVENT_CONNECTED | EVENT_DISCONNECTED)) {
+        uint32_t connectAt = connectMillis;
+        uint32_t disconnectAt = disconnectMillis;
+        bool connectedLast = (posted & EVENT_CONNECTED) &&
+                             (!(posted & EVENT_DISCONNECTED) || (int32_t)(connectAt - disconnectAt) >= 0);
+    
+        // Both since the last poll: replay them in the order they happened
+        if ((posted & EVENT_CONNECTED) && !connectedLast) {
+            onConnected(connectAt);
+        }
+        if (posted & EVENT_DISCONNECTED) {
+            onDisconnected(disconnectAt);
+        }
+        if (connectedLast) {
+            onConnected(connectAt);
+        }
+        if (connected) {
+            actions |= RECOVERY_LEAVE_AP;
+        }
+    }
+    if (posted & EVENT_MDNS_RESTART) {
+        scheduleMdns(now, true);
+    }
+    
+    // Waits for the station - the connect event schedules it again anyway
+    if (mdnsScheduled && connected && (int32_t)(now - mdnsDueMillis) >= 0) {
+        mdnsScheduled = false;
+        actions |= RECOVERY_MDNS;
+    }
+    return actions;
+}
+
+void WiFiRecovery::mdnsStarted(bool running) {
+    if (running && mdnsRunning) {
+        mdnsRestarts++;
+    }
+    mdnsRunning = running;
+}
+
+void WiFiRecovery::writePrometheus(Print& out, uint32_t now) const {
+    out.print("# HELP relay_wifi_outages_total Connections lost after having an IP address\n");
+    out.print("# TYPE relay_wifi_outages_total counter\n");
+    out.printf("relay_wifi_outages_total %u\n", (unsigned)outages);
+    out.print("# HELP relay_wifi_recovery_seconds Time from losing the connection to the next IP address\n");
+    out.print("# TYPE relay_wifi_recovery_seconds summary\n");
+    out.printf("relay_wifi_recovery_seconds_sum %.3f\n", totalRecoveryMillis / 1e3);
+    out.printf("relay_wifi_recovery_seconds_count %u\n", (unsigned)recoveries);
+    out.print("# TYPE relay_wifi_last_recovery_seconds gauge\n");
+    out.printf("relay_wifi_last_recovery_seconds %.3f\n", lastRecoveryMillis / 1e3);
+    out.print("# TYPE relay_wifi_max_recovery_seconds gauge\n");
+    out.printf("relay_wifi_max_recovery_seconds %.3f\n", maxRecoveryMillis / 1e3);
+    out.print("# HELP relay_wifi_outage_seconds Length of the current outage (0 = connected)\n");
+    out.print("# TYPE relay_wifi_outage_seconds gauge\n");
+    out.printf("relay_wifi_outage_seconds %.3f\n", outageStartMillis ? (now - outageStartMillis) / 1e3 : 0.0);
+    out.print("# TYPE relay_mdns_restarts_total counter\n");
+    out.printf("relay_mdns_restarts_total %u\n", (unsigned)mdnsRestarts);
+}